@@ -0,0 +1,168 @@
+/*
+ * KProcessHacker
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <kph.h>
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, KpiExecuteBatch)
+#endif
+
+/**
+ * Executes a batch of query operations.
+ *
+ * \param Operations An array of operations.
+ * \param OperationsLength The size of the array, in bytes.
+ * \param Output The output buffer. This begins with an array of KPH_BATCH_RESULT
+ * structures, one for each operation, followed by the data area.
+ * \param OutputLength The size of the output buffer, in bytes.
+ * \param AccessMode The mode in which to perform access checks.
+ *
+ * \remarks The status of each operation is written to its KPH_BATCH_RESULT. The
+ * function itself only fails if the batch is malformed or the output buffer is
+ * inaccessible.
+ */
+NTSTATUS KpiExecuteBatch(
+    __in_bcount(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    __in ULONG OperationsLength,
+    __out_bcount(OutputLength) PVOID Output,
+    __in ULONG OutputLength,
+    __in KPROCESSOR_MODE AccessMode
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG numberOfOperations;
+    PKPH_BATCH_OPERATION operations;
+    PKPH_BATCH_RESULT results;
+    PVOID data;
+    ULONG dataLength;
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (OperationsLength == 0 || OperationsLength % sizeof(KPH_BATCH_OPERATION) != 0)
+        return STATUS_INVALID_PARAMETER_2;
+
+    numberOfOperations = OperationsLength / sizeof(KPH_BATCH_OPERATION);
+
+    if (numberOfOperations > KPH_BATCH_MAXIMUM_OPERATIONS)
+        return STATUS_INVALID_PARAMETER_2;
+    if (OutputLength < numberOfOperations * sizeof(KPH_BATCH_RESULT))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    operations = ExAllocatePoolWithTag(PagedPool, OperationsLength, 'BhpK');
+
+    if (!operations)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    // Capture the operations so they cannot change while we validate and
+    // execute them.
+    __try
+    {
+        if (AccessMode != KernelMode)
+        {
+            ProbeForRead(Operations, OperationsLength, sizeof(ULONG));
+            ProbeForWrite(Output, OutputLength, sizeof(ULONG));
+        }
+
+        memcpy(operations, Operations, OperationsLength);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = GetExceptionCode();
+        goto CleanupExit;
+    }
+
+    results = Output;
+    data = (PCHAR)Output + numberOfOperations * sizeof(KPH_BATCH_RESULT);
+    dataLength = OutputLength - numberOfOperations * sizeof(KPH_BATCH_RESULT);
+
+    for (i = 0; i < numberOfOperations; i++)
+    {
+        PKPH_BATCH_OPERATION operation = &operations[i];
+        PVOID operationData;
+        NTSTATUS operationStatus;
+
+        if (
+            operation->DataOffset > dataLength ||
+            operation->DataLength > dataLength - operation->DataOffset ||
+            operation->DataOffset % KPH_BATCH_DATA_ALIGNMENT != 0
+            )
+        {
+            operationStatus = STATUS_INVALID_PARAMETER;
+            goto SetResult;
+        }
+
+        operationData = (PCHAR)data + operation->DataOffset;
+
+        // Each of these functions probes the output buffers itself.
+        switch (operation->Type)
+        {
+        case KphBatchQueryInformationProcess:
+            operationStatus = KpiQueryInformationProcess(
+                operation->u.QueryInformationProcess.ProcessHandle,
+                operation->u.QueryInformationProcess.ProcessInformationClass,
+                operationData,
+                operation->DataLength,
+                &results[i].ReturnLength,
+                AccessMode
+                );
+            break;
+        case KphBatchQueryInformationThread:
+            operationStatus = KpiQueryInformationThread(
+                operation->u.QueryInformationThread.ThreadHandle,
+                operation->u.QueryInformationThread.ThreadInformationClass,
+                operationData,
+                operation->DataLength,
+                &results[i].ReturnLength,
+                AccessMode
+                );
+            break;
+        case KphBatchQueryInformationObject:
+            operationStatus = KpiQueryInformationObject(
+                operation->u.QueryInformationObject.ProcessHandle,
+                operation->u.QueryInformationObject.Handle,
+                operation->u.QueryInformationObject.ObjectInformationClass,
+                operationData,
+                operation->DataLength,
+                &results[i].ReturnLength,
+                AccessMode
+                );
+            break;
+        default:
+            operationStatus = STATUS_INVALID_INFO_CLASS;
+            break;
+        }
+
+SetResult:
+        __try
+        {
+            results[i].Status = operationStatus;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+            goto CleanupExit;
+        }
+    }
+
+CleanupExit:
+    ExFreePoolWithTag(operations, 'BhpK');
+
+    return status;
+}
@@ -109,6 +109,27 @@ NTSTATUS KphDispatchDeviceControl(
                 );
         }
         break;
+    case KPH_EXECUTEBATCH:
+        {
+            struct
+            {
+                PKPH_BATCH_OPERATION Operations;
+                ULONG OperationsLength;
+                PVOID Output;
+                ULONG OutputLength;
+            } *input = capturedInputPointer;
+
+            VERIFY_INPUT_LENGTH;
+
+            status = KpiExecuteBatch(
+                input->Operations,
+                input->OperationsLength,
+                input->Output,
+                input->OutputLength,
+                accessMode
+                );
+        }
+        break;
     case KPH_OPENPROCESS:
         {
             struct
@@ -40,6 +40,16 @@ NTSTATUS KphValidateAddressForSystemModules(
     __in SIZE_T Length
     );
 
+// batch
+
+NTSTATUS KpiExecuteBatch(
+    __in_bcount(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    __in ULONG OperationsLength,
+    __out_bcount(OutputLength) PVOID Output,
+    __in ULONG OutputLength,
+    __in KPROCESSOR_MODE AccessMode
+    );
+
 // devctrl
 
 __drv_dispatchType(IRP_MJ_DEVICE_CONTROL) DRIVER_DISPATCH KphDispatchDeviceControl;
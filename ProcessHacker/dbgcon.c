@@ -29,6 +29,7 @@
 #include <phapp.h>
 #include <phintrnl.h>
 #include <refp.h>
+#include "mxml/mxml.h"
 
 typedef struct _STRING_TABLE_ENTRY
 {
@@ -149,6 +150,14 @@ static PWSTR PhpGetSymbolForAddress(
         )))->Buffer;
 }
 
+static PPH_STRING NTAPI PhpTraceResolveCallback(
+    _In_ PVOID Address,
+    _In_opt_ PVOID Context
+    )
+{
+    return PhGetSymbolFromAddress(DebugConsoleSymbolProvider, (ULONG64)Address, NULL, NULL, NULL, NULL);
+}
+
 static VOID PhpPrintObjectInfo(
     _In_ PPH_OBJECT_HEADER ObjectHeader,
     _In_ LONG RefToSubtract
@@ -175,7 +184,7 @@ static VOID PhpPrintObjectInfo(
     {
         wprintf(L"\t%.32s", ((PPH_OBJECT_TYPE)PhObjectHeaderToObject(ObjectHeader))->Name);
     }
-    else if (ObjectHeader->Type == PhStringType)
+    else if (ObjectHeader->Type == PhStringType || ObjectHeader->Type == PhInternedStringType)
     {
         wprintf(L"\t%.32s", ((PPH_STRING)PhObjectHeaderToObject(ObjectHeader))->Buffer);
     }
@@ -233,7 +242,7 @@ static VOID PhpDumpObjectInfo(
             wprintf(L"Number of objects: %u\n", ((PPH_OBJECT_TYPE)PhObjectHeaderToObject(ObjectHeader))->NumberOfObjects);
             wprintf(L"Free list count: %u\n", ((PPH_OBJECT_TYPE)PhObjectHeaderToObject(ObjectHeader))->FreeList.Count);
         }
-        else if (ObjectHeader->Type == PhStringType)
+        else if (ObjectHeader->Type == PhStringType || ObjectHeader->Type == PhInternedStringType)
         {
             wprintf(L"%s\n", ((PPH_STRING)PhObjectHeaderToObject(ObjectHeader))->Buffer);
         }
@@ -320,6 +329,24 @@ static VOID PhpPrintHashtableStatistics(
     wprintf(L"\nExpected lookup misses: %u\n", expectedLookupMisses);
 }
 
+static VOID PhpPrintStatisticsHistogram(
+    _In_ PWSTR Name,
+    _In_ PPH_STATISTICS_HISTOGRAM Histogram
+    )
+{
+    ULONG i;
+
+    wprintf(L"%s:", Name);
+
+    for (i = 0; i < PH_STATISTICS_HISTOGRAM_BUCKETS; i++)
+    {
+        if (Histogram->Buckets[i] != 0)
+            wprintf(L" 2^%u: %u", i, Histogram->Buckets[i]);
+    }
+
+    wprintf(L"\n");
+}
+
 #ifdef DEBUG
 static VOID PhpDebugCreateObjectHook(
     _In_ PVOID Object,
@@ -642,6 +669,285 @@ VOID FASTCALL PhfReleaseQueuedLockExclusiveUsingInline(
     PhReleaseQueuedLockExclusive(QueuedLock);
 }
 
+static mxml_type_t PhpTestXmlLoadCallback(
+    _In_ mxml_node_t *node
+    )
+{
+    return MXML_OPAQUE;
+}
+
+static int PhpTestXmlStreamCallback(
+    _In_ mxml_stream_event_t Event,
+    _In_ mxml_stream_node_t *Node,
+    _In_ PVOID Context
+    )
+{
+    if (Event == MXML_STREAM_DATA && Node->depth == 2)
+    {
+        PPH_STRING value;
+
+        // Do the same work as the settings loader.
+        value = PhCreateStringEx((PWSTR)Node->text, Node->length * sizeof(WCHAR));
+        PhDereferenceObject(value);
+        (*(PULONG)Context)++;
+    }
+
+    return 0;
+}
+
+static HANDLE PhpTestXmlOpenFile(
+    _In_ PWSTR FileName,
+    _In_ BOOLEAN Write
+    )
+{
+    HANDLE fileHandle;
+
+    if (!NT_SUCCESS(PhCreateFileWin32(
+        &fileHandle,
+        FileName,
+        Write ? FILE_GENERIC_WRITE : FILE_GENERIC_READ,
+        0,
+        FILE_SHARE_READ,
+        Write ? FILE_OVERWRITE_IF : FILE_OPEN,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT
+        )))
+        return NULL;
+
+    return fileHandle;
+}
+
+/**
+ * Compares the tree-based and streaming XML loaders and writers on a
+ * synthetic settings file.
+ */
+static VOID PhpTestXml(
+    _In_ ULONG Count
+    )
+{
+    STOPWATCH stopwatch;
+    WCHAR tempPath[MAX_PATH];
+    PPH_STRING fileName;
+    HANDLE fileHandle;
+    mxml_stream_writer_t writer;
+    mxml_node_t *topNode;
+    mxml_node_t *currentNode;
+    ULONG numberOfValues;
+    ULONG i;
+
+    if (!GetTempPath(MAX_PATH, tempPath))
+        return;
+
+    fileName = PhConcatStrings2(tempPath, L"phxmltest.xml");
+
+    // Streaming writer
+
+    if (!(fileHandle = PhpTestXmlOpenFile(fileName->Buffer, TRUE)))
+        goto CleanupExit;
+
+    PhStartStopwatch(&stopwatch);
+
+    mxmlStreamWriterInit(&writer, fileHandle);
+    mxmlStreamWriteElementOpen(&writer, "settings");
+    mxmlStreamWriteRaw(&writer, "\r\n");
+
+    for (i = 0; i < Count; i++)
+    {
+        WCHAR name[32];
+        WCHAR value[64];
+
+        _snwprintf(name, 32, L"Test.Setting%u", i);
+        _snwprintf(value, 64, L"%u,%u|C:\\Program Files\\Test & <Values>", i, i * 7);
+        mxmlStreamWriteRaw(&writer, "  ");
+        mxmlStreamWriteElementOpen(&writer, "setting");
+        mxmlStreamWriteAttr(&writer, "name", name, (int)wcslen(name));
+        mxmlStreamWriteText(&writer, value, (int)wcslen(value));
+        mxmlStreamWriteElementClose(&writer, "setting");
+        mxmlStreamWriteRaw(&writer, "\r\n");
+    }
+
+    mxmlStreamWriteElementClose(&writer, "settings");
+    mxmlStreamWriterClose(&writer);
+
+    PhStopStopwatch(&stopwatch);
+    NtClose(fileHandle);
+
+    wprintf(L"Stream write: %ums\n", PhGetMillisecondsStopwatch(&stopwatch));
+
+    // Tree writer
+
+    if (!(fileHandle = PhpTestXmlOpenFile(fileName->Buffer, TRUE)))
+        goto CleanupExit;
+
+    PhStartStopwatch(&stopwatch);
+
+    topNode = mxmlNewElement(MXML_NO_PARENT, "settings");
+
+    for (i = 0; i < Count; i++)
+    {
+        CHAR name[32];
+        CHAR value[64];
+
+        _snprintf(name, 32, "Test.Setting%u", i);
+        _snprintf(value, 64, "%u,%u|C:\\Program Files\\Test & <Values>", i, i * 7);
+        currentNode = mxmlNewElement(topNode, "setting");
+        mxmlElementSetAttr(currentNode, "name", name);
+        mxmlNewOpaque(currentNode, value);
+    }
+
+    mxmlSaveFd(topNode, fileHandle, NULL);
+    mxmlDelete(topNode);
+
+    PhStopStopwatch(&stopwatch);
+    NtClose(fileHandle);
+
+    wprintf(L"Tree write: %ums\n", PhGetMillisecondsStopwatch(&stopwatch));
+
+    // Tree loader
+
+    if (!(fileHandle = PhpTestXmlOpenFile(fileName->Buffer, FALSE)))
+        goto CleanupExit;
+
+    numberOfValues = 0;
+    PhStartStopwatch(&stopwatch);
+
+    if (topNode = mxmlLoadFd(NULL, fileHandle, PhpTestXmlLoadCallback))
+    {
+        for (currentNode = topNode->child; currentNode; currentNode = currentNode->next)
+        {
+            PPH_STRING value;
+
+            value = PhGetOpaqueXmlNodeText(currentNode);
+            PhDereferenceObject(value);
+            numberOfValues++;
+        }
+
+        mxmlDelete(topNode);
+    }
+
+    PhStopStopwatch(&stopwatch);
+    NtClose(fileHandle);
+
+    wprintf(L"Tree load: %ums (%u values)\n", PhGetMillisecondsStopwatch(&stopwatch), numberOfValues);
+
+    // Streaming loader
+
+    if (!(fileHandle = PhpTestXmlOpenFile(fileName->Buffer, FALSE)))
+        goto CleanupExit;
+
+    numberOfValues = 0;
+    PhStartStopwatch(&stopwatch);
+    mxmlStreamLoadFd(fileHandle, PhpTestXmlStreamCallback, &numberOfValues);
+    PhStopStopwatch(&stopwatch);
+    NtClose(fileHandle);
+
+    wprintf(L"Stream load: %ums (%u values)\n", PhGetMillisecondsStopwatch(&stopwatch), numberOfValues);
+
+CleanupExit:
+    PhDeleteFileWin32(fileName->Buffer);
+    PhDereferenceObject(fileName);
+}
+
+/**
+ * Replays a synthetic thread list through a thread provider. One percent of the
+ * threads are replaced in each update. The dead thread search that was used before
+ * threads were reconciled by run ID is timed on the same lists for comparison.
+ */
+static VOID PhpTestThreadProvider(
+    _In_ ULONG Count
+    )
+{
+    // Nothing can have these IDs, so no handles are opened.
+    static HANDLE testProcessId = (HANDLE)0x7ffffff0;
+    static ULONG testThreadIdBase = 0x7f000000;
+
+    STOPWATCH stopwatch;
+    PSYSTEM_PROCESS_INFORMATION process;
+    PSYSTEM_THREAD_INFORMATION threads;
+    PHANDLE oldThreadIds;
+    PPH_THREAD_PROVIDER threadProvider;
+    ULONG nextThreadId;
+    ULONG updateTime;
+    ULONG numberOfDeadThreads;
+    ULONG run;
+    ULONG i;
+    ULONG j;
+
+    if (Count == 0)
+        return;
+
+    process = PhAllocate(sizeof(SYSTEM_PROCESS_INFORMATION) + Count * sizeof(SYSTEM_THREAD_INFORMATION));
+    memset(process, 0, sizeof(SYSTEM_PROCESS_INFORMATION) + Count * sizeof(SYSTEM_THREAD_INFORMATION));
+    process->UniqueProcessId = testProcessId;
+    process->NumberOfThreads = Count;
+    threads = process->Threads;
+    oldThreadIds = PhAllocate(Count * sizeof(HANDLE));
+    nextThreadId = testThreadIdBase;
+
+    for (i = 0; i < Count; i++)
+    {
+        threads[i].ClientId.UniqueProcess = testProcessId;
+        threads[i].ClientId.UniqueThread = (HANDLE)nextThreadId;
+        threads[i].WaitReason = Executive;
+        nextThreadId += 4;
+    }
+
+    threadProvider = PhCreateThreadProvider(testProcessId);
+
+    PhStartStopwatch(&stopwatch);
+    PhUpdateThreadProvider(threadProvider, process);
+    PhStopStopwatch(&stopwatch);
+
+    wprintf(L"Initial update: %ums (%u threads)\n", PhGetMillisecondsStopwatch(&stopwatch), Count);
+
+    updateTime = 0;
+
+    for (run = 0; run < 10; run++)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            oldThreadIds[i] = threads[i].ClientId.UniqueThread;
+            threads[i].ContextSwitches += i % 3;
+        }
+
+        for (i = run; i < Count; i += 100)
+        {
+            threads[i].ClientId.UniqueThread = (HANDLE)nextThreadId;
+            nextThreadId += 4;
+        }
+
+        PhStartStopwatch(&stopwatch);
+        PhUpdateThreadProvider(threadProvider, process);
+        PhStopStopwatch(&stopwatch);
+
+        updateTime += PhGetMillisecondsStopwatch(&stopwatch);
+    }
+
+    wprintf(L"Update: %ums per run\n", updateTime / 10);
+
+    numberOfDeadThreads = 0;
+    PhStartStopwatch(&stopwatch);
+
+    for (j = 0; j < Count; j++)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (oldThreadIds[j] == threads[i].ClientId.UniqueThread)
+                break;
+        }
+
+        if (i == Count)
+            numberOfDeadThreads++;
+    }
+
+    PhStopStopwatch(&stopwatch);
+
+    wprintf(L"Quadratic dead thread search: %ums (%u dead)\n", PhGetMillisecondsStopwatch(&stopwatch), numberOfDeadThreads);
+
+    PhDereferenceObject(threadProvider);
+    PhFree(oldThreadIds);
+    PhFree(process);
+}
+
 NTSTATUS PhpDebugConsoleThreadStart(
     _In_ PVOID Parameter
     )
@@ -715,7 +1021,13 @@ NTSTATUS PhpDebugConsoleThreadStart(
                 L"exit\n"
                 L"testperf\n"
                 L"testlocks\n"
+                L"testxml [count]\n"
+                L"testthrdprv [count]\n"
+                L"profile pid [seconds] [file-name]\n"
                 L"stats\n"
+                L"statsdump [file-name]\n"
+                L"lockprof [on|off|reset|count]\n"
+                L"trace on|off|dump [file-name]\n"
                 L"objects [type-name-filter]\n"
                 L"objtrace object-address\n"
                 L"objmksnap\n"
@@ -734,6 +1046,9 @@ NTSTATUS PhpDebugConsoleThreadStart(
                 L"enableleakdetect\n"
                 L"leakdetect\n"
                 L"mem\n"
+                L"hndlcache [flush]\n"
+                L"internstats\n"
+                L"srvstats\n"
                 );
         }
         else if (WSTR_IEQUAL(command, L"exit"))
@@ -865,12 +1180,137 @@ NTSTATUS PhpDebugConsoleThreadStart(
             PhInitializeQueuedLock(&queuedLock);
             PhpTestRwLock(&testContext);
         }
+        else if (WSTR_IEQUAL(command, L"testxml"))
+        {
+            PWSTR countString;
+            PH_STRINGREF countStringRef;
+            ULONG64 count = 100000;
+
+            countString = wcstok_s(NULL, delims, &context);
+
+            if (countString)
+            {
+                PhInitializeStringRef(&countStringRef, countString);
+                PhStringToInteger64(&countStringRef, 10, &count);
+            }
+
+            PhpTestXml((ULONG)count);
+        }
+        else if (WSTR_IEQUAL(command, L"testthrdprv"))
+        {
+            PWSTR countString;
+            PH_STRINGREF countStringRef;
+            ULONG64 count = 20000;
+
+            countString = wcstok_s(NULL, delims, &context);
+
+            if (countString)
+            {
+                PhInitializeStringRef(&countStringRef, countString);
+                PhStringToInteger64(&countStringRef, 10, &count);
+            }
+
+            PhpTestThreadProvider((ULONG)count);
+        }
+        else if (WSTR_IEQUAL(command, L"profile"))
+        {
+            PWSTR pidString;
+            PWSTR secondsString;
+            PWSTR fileNameString;
+            PH_STRINGREF stringRef;
+            ULONG64 pid;
+            ULONG64 seconds = 10;
+            PPH_PROFILER profiler;
+            PPH_STRING folded;
+            PPH_FILE_STREAM fileStream;
+            LARGE_INTEGER interval;
+            NTSTATUS status;
+
+            pidString = wcstok_s(NULL, delims, &context);
+
+            if (!pidString)
+            {
+                wprintf(L"Missing pid.\n");
+                continue;
+            }
+
+            PhInitializeStringRef(&stringRef, pidString);
+            PhStringToInteger64(&stringRef, 10, &pid);
+
+            secondsString = wcstok_s(NULL, delims, &context);
+
+            if (secondsString)
+            {
+                PhInitializeStringRef(&stringRef, secondsString);
+                PhStringToInteger64(&stringRef, 10, &seconds);
+            }
+
+            fileNameString = wcstok_s(NULL, delims, &context);
+
+            if (!(profiler = PhCreateProfiler((HANDLE)pid, 10, 8)))
+            {
+                wprintf(L"Unable to create the profiler.\n");
+                continue;
+            }
+
+            if (!NT_SUCCESS(status = PhStartProfiler(profiler)))
+            {
+                wprintf(L"Unable to start the profiler: 0x%x\n", status);
+                PhDereferenceObject(profiler);
+                continue;
+            }
+
+            wprintf(L"Profiling for %I64u seconds...\n", seconds);
+            NtDelayExecution(FALSE, PhTimeoutFromMilliseconds(&interval, (ULONG)seconds * 1000));
+            PhStopProfiler(profiler);
+
+            wprintf(
+                L"%u ticks, %u samples, %u failed captures, %u call tree nodes\n",
+                profiler->NumberOfTicks,
+                profiler->CallTree->NumberOfSamples,
+                profiler->NumberOfFailures,
+                profiler->CallTree->NumberOfNodes
+                );
+
+            folded = PhExportFoldedProfiler(profiler);
+
+            if (fileNameString)
+            {
+                if (NT_SUCCESS(status = PhCreateFileStream(
+                    &fileStream,
+                    fileNameString,
+                    FILE_GENERIC_WRITE,
+                    FILE_SHARE_READ,
+                    FILE_OVERWRITE_IF,
+                    0
+                    )))
+                {
+                    PhWriteStringAsAnsiFileStream(fileStream, &folded->sr);
+                    PhDereferenceObject(fileStream);
+                }
+                else
+                {
+                    wprintf(L"Unable to create the file: 0x%x\n", status);
+                }
+            }
+            else
+            {
+                wprintf(L"%s", folded->Buffer);
+            }
+
+            PhDereferenceObject(folded);
+            PhDereferenceObject(profiler);
+        }
         else if (WSTR_IEQUAL(command, L"stats"))
         {
-#ifdef DEBUG
+            PHLIB_STATISTICS_BLOCK statistics;
+
+            PhQueryLibStatistics(&statistics);
+
             wprintf(L"Object small free list count: %u\n", PhObjectSmallFreeList.Count);
             wprintf(L"Statistics:\n");
-#define PRINT_STATISTIC(Name) wprintf(L#Name L": %u\n", PhLibStatisticsBlock.Name);
+#define PRINT_STATISTIC(Name) wprintf(L#Name L": %u\n", statistics.Name);
+#define PRINT_HISTOGRAM(Name) PhpPrintStatisticsHistogram(L#Name, &statistics.Name);
 
             PRINT_STATISTIC(BaseThreadsCreated);
             PRINT_STATISTIC(BaseThreadsCreateFailed);
@@ -896,10 +1336,196 @@ NTSTATUS PhpDebugConsoleThreadStart(
             PRINT_STATISTIC(WqWorkQueueThreadsCreated);
             PRINT_STATISTIC(WqWorkQueueThreadsCreateFailed);
             PRINT_STATISTIC(WqWorkItemsQueued);
+            PRINT_STATISTIC(ProvProviderRuns);
+            PRINT_STATISTIC(ProvProviderBoostedRuns);
+            PRINT_STATISTIC(ProvProviderSkippedRuns);
+            PRINT_STATISTIC(ProvProviderLateRuns);
+
+            wprintf(L"Histograms (timestamp counter ticks, log2 buckets):\n");
+            PRINT_HISTOGRAM(RefDeleteProcedureTime);
+            PRINT_HISTOGRAM(QlBlockWaitTime);
+            PRINT_HISTOGRAM(WqWorkItemWaitTime);
+            PRINT_HISTOGRAM(WqWorkItemRunTime);
+            PRINT_HISTOGRAM(ProvProviderRunTime);
+        }
+        else if (WSTR_IEQUAL(command, L"statsdump"))
+        {
+            PWSTR fileNameString;
+            PPH_STRING text;
+            PPH_FILE_STREAM fileStream;
+            NTSTATUS status;
 
-#else
-            wprintf(commandDebugOnly);
-#endif
+            fileNameString = wcstok_s(NULL, delims, &context);
+            text = PhFormatLibStatistics();
+
+            if (fileNameString)
+            {
+                if (NT_SUCCESS(status = PhCreateFileStream(
+                    &fileStream,
+                    fileNameString,
+                    FILE_GENERIC_WRITE,
+                    FILE_SHARE_READ,
+                    FILE_OVERWRITE_IF,
+                    0
+                    )))
+                {
+                    PhWriteStringAsAnsiFileStream(fileStream, &text->sr);
+                    PhDereferenceObject(fileStream);
+                }
+                else
+                {
+                    wprintf(L"Unable to create the file: 0x%x\n", status);
+                }
+            }
+            else
+            {
+                wprintf(L"%s", text->Buffer);
+            }
+
+            PhDereferenceObject(text);
+        }
+        else if (WSTR_IEQUAL(command, L"lockprof"))
+        {
+            PWSTR argument;
+            ULONG64 count = 10;
+
+            argument = wcstok_s(NULL, delims, &context);
+
+            if (argument && WSTR_IEQUAL(argument, L"on"))
+            {
+                PhResetQueuedLockProfiles();
+                PhQueuedLockProfilingEnabled = TRUE;
+            }
+            else if (argument && WSTR_IEQUAL(argument, L"off"))
+            {
+                PhQueuedLockProfilingEnabled = FALSE;
+            }
+            else if (argument && WSTR_IEQUAL(argument, L"reset"))
+            {
+                PhResetQueuedLockProfiles();
+            }
+            else
+            {
+                PH_STRINGREF countStringRef;
+                PPH_QUEUED_LOCK_PROFILE profiles;
+                ULONG numberOfProfiles;
+                ULONG i;
+
+                if (argument)
+                {
+                    PhInitializeStringRef(&countStringRef, argument);
+                    PhStringToInteger64(&countStringRef, 10, &count);
+                }
+
+                profiles = PhAllocate(sizeof(PH_QUEUED_LOCK_PROFILE) * (ULONG)count);
+                numberOfProfiles = PhQueryQueuedLockProfiles(profiles, (ULONG)count);
+
+                wprintf(L"Profiling is %s. Times are in timestamp counter ticks.\n", PhQueuedLockProfilingEnabled ? L"on" : L"off");
+
+                for (i = 0; i < numberOfProfiles; i++)
+                {
+                    PPH_QUEUED_LOCK_PROFILE profile = &profiles[i];
+                    ULONG j;
+
+                    wprintf(
+                        L"%s (%Ix): %u exclusive, %u shared, %u contended, %u spins, %u waits, %I64u wait, %I64u hold\n",
+                        profile->Name,
+                        profile->Lock,
+                        profile->ExclusiveAcquireCount,
+                        profile->SharedAcquireCount,
+                        profile->ContendedCount,
+                        profile->SpinCount,
+                        profile->WaitCount,
+                        profile->WaitTime,
+                        profile->HoldTime
+                        );
+
+                    for (j = 0; j < PH_QUEUED_LOCK_PROFILE_CALL_SITES; j++)
+                    {
+                        PPH_QUEUED_LOCK_CALL_SITE callSite = &profile->CallSites[j];
+
+                        if (!callSite->Address)
+                            break;
+
+                        wprintf(
+                            L"    %s: %u acquires, %u contended, %I64u wait, %I64u hold\n",
+                            PhpGetSymbolForAddress(callSite->Address),
+                            callSite->AcquireCount,
+                            callSite->ContendedCount,
+                            callSite->WaitTime,
+                            callSite->HoldTime
+                            );
+                    }
+
+                    if (profile->OtherCallSites.AcquireCount != 0)
+                    {
+                        wprintf(
+                            L"    (other): %u acquires, %u contended, %I64u wait, %I64u hold\n",
+                            profile->OtherCallSites.AcquireCount,
+                            profile->OtherCallSites.ContendedCount,
+                            profile->OtherCallSites.WaitTime,
+                            profile->OtherCallSites.HoldTime
+                            );
+                    }
+                }
+
+                PhFree(profiles);
+            }
+        }
+        else if (WSTR_IEQUAL(command, L"trace"))
+        {
+            PWSTR argument;
+
+            argument = wcstok_s(NULL, delims, &context);
+
+            if (argument && WSTR_IEQUAL(argument, L"on"))
+            {
+                PhStartTrace();
+            }
+            else if (argument && WSTR_IEQUAL(argument, L"off"))
+            {
+                PhStopTrace();
+            }
+            else if (argument && WSTR_IEQUAL(argument, L"dump"))
+            {
+                PWSTR fileNameString;
+                PPH_STRING text;
+                PPH_FILE_STREAM fileStream;
+                NTSTATUS status;
+
+                fileNameString = wcstok_s(NULL, delims, &context);
+                text = PhExportTrace(PhpTraceResolveCallback, NULL);
+
+                if (fileNameString)
+                {
+                    if (NT_SUCCESS(status = PhCreateFileStream(
+                        &fileStream,
+                        fileNameString,
+                        FILE_GENERIC_WRITE,
+                        FILE_SHARE_READ,
+                        FILE_OVERWRITE_IF,
+                        0
+                        )))
+                    {
+                        PhWriteStringAsAnsiFileStream(fileStream, &text->sr);
+                        PhDereferenceObject(fileStream);
+                    }
+                    else
+                    {
+                        wprintf(L"Unable to create the file: 0x%x\n", status);
+                    }
+                }
+                else
+                {
+                    wprintf(L"%s", text->Buffer);
+                }
+
+                PhDereferenceObject(text);
+            }
+            else
+            {
+                wprintf(L"Tracing is %s.\n", PhTraceEnabled ? L"on" : L"off");
+            }
         }
         else if (WSTR_IEQUAL(command, L"objects"))
         {
@@ -1261,6 +1887,8 @@ NTSTATUS PhpDebugConsoleThreadStart(
                         wprintf(L"Thread not running\n");
                     }
 
+                    wprintf(L"Interval: %u ms, budget: %u us\n", providerThread->Interval, providerThread->Budget);
+
                     PhAcquireQueuedLockExclusive(&providerThread->Lock);
 
                     providerEntry = providerThread->ListHead.Flink;
@@ -1274,6 +1902,13 @@ NTSTATUS PhpDebugConsoleThreadStart(
                         wprintf(L"\tProvider registration at %Ix\n", registration);
                         wprintf(L"\t\tEnabled: %s\n", registration->Enabled ? L"Yes" : L"No");
                         wprintf(L"\t\tFunction: %s\n", PhpGetSymbolForAddress(registration->Function));
+                        wprintf(
+                            L"\t\tInterval: %u ms, deadline: %u ms, cost: %u us\n",
+                            registration->Interval,
+                            registration->Deadline,
+                            registration->Cost
+                            );
+                        wprintf(L"\t\tSkipped runs: %u, late runs: %u\n", registration->SkippedRuns, registration->LateRuns);
 
                         if (registration->Object)
                         {
@@ -1349,36 +1984,35 @@ NTSTATUS PhpDebugConsoleThreadStart(
         else if (WSTR_IEQUAL(command, L"procrecords"))
         {
             PPH_PROCESS_RECORD record;
-            ULONG i;
+            PPH_AVL_LINKS links;
             SYSTEMTIME systemTime;
-            PPH_PROCESS_RECORD startRecord;
-
-            PhAcquireQueuedLockShared(&PhProcessRecordListLock);
+            LARGE_INTEGER lastCreateTime;
 
-            for (i = 0; i < PhProcessRecordList->Count; i++)
-            {
-                record = (PPH_PROCESS_RECORD)PhProcessRecordList->Items[i];
+            lastCreateTime.QuadPart = -1;
 
-                PhLargeIntegerToLocalSystemTime(&systemTime, &record->CreateTime);
-                wprintf(L"Records for %s %s:\n",
-                    ((PPH_STRING)PHA_DEREFERENCE(PhFormatDate(&systemTime, NULL)))->Buffer,
-                    ((PPH_STRING)PHA_DEREFERENCE(PhFormatTime(&systemTime, NULL)))->Buffer
-                    );
+            PhAcquireQueuedLockShared(&PhProcessRecordSetLock);
 
-                startRecord = record;
+            for (links = PhMinimumElementAvlTree(&PhProcessRecordSet); links; links = PhSuccessorElementAvlTree(links))
+            {
+                record = CONTAINING_RECORD(links, PH_PROCESS_RECORD, Links);
 
-                do
+                if (record->CreateTime.QuadPart != lastCreateTime.QuadPart)
                 {
-                    wprintf(L"\tRecord at %Ix: %s (%u) (refs: %d)\n", record, record->ProcessName->Buffer, (ULONG)record->ProcessId, record->RefCount);
+                    PhLargeIntegerToLocalSystemTime(&systemTime, &record->CreateTime);
+                    wprintf(L"Records for %s %s:\n",
+                        ((PPH_STRING)PHA_DEREFERENCE(PhFormatDate(&systemTime, NULL)))->Buffer,
+                        ((PPH_STRING)PHA_DEREFERENCE(PhFormatTime(&systemTime, NULL)))->Buffer
+                        );
+                    lastCreateTime = record->CreateTime;
+                }
 
-                    if (record->FileName)
-                        wprintf(L"\t\t%s\n", record->FileName->Buffer);
+                wprintf(L"\tRecord at %Ix: %s (%u) (refs: %d)\n", record, record->ProcessName->Buffer, (ULONG)record->ProcessId, record->RefCount);
 
-                    record = CONTAINING_RECORD(record->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-                } while (record != startRecord);
+                if (record->FileName)
+                    wprintf(L"\t\t%s\n", record->FileName->Buffer);
             }
 
-            PhReleaseQueuedLockShared(&PhProcessRecordListLock);
+            PhReleaseQueuedLockShared(&PhProcessRecordSetLock);
         }
         else if (WSTR_IEQUAL(command, L"procitem"))
         {
@@ -1658,6 +2292,48 @@ PrintMemUsage:
             wprintf(L"Usage: mem address [numberOfBytes]\n");
             wprintf(L"Example: mem 12345678 16\n");
         }
+        else if (WSTR_IEQUAL(command, L"hndlcache"))
+        {
+            PWSTR part;
+            PH_HANDLE_NAME_CACHE_STATISTICS statistics;
+
+            part = wcstok_s(NULL, delims, &context);
+
+            if (part && WSTR_IEQUAL(part, L"flush"))
+                PhFlushHandleNameCache();
+
+            PhGetHandleNameCacheStatistics(&statistics);
+            wprintf(L"Entries: %u\n", statistics.Count);
+            wprintf(L"Generation: %u\n", statistics.Generation);
+            wprintf(L"Hits: %u\n", statistics.Hits);
+            wprintf(L"Misses: %u\n", statistics.Misses);
+        }
+        else if (WSTR_IEQUAL(command, L"internstats"))
+        {
+            PH_INTERNED_STRING_STATISTICS statistics;
+
+            PhGetInternedStringStatistics(&statistics);
+            wprintf(L"Strings: %u\n", statistics.NumberOfStrings);
+            wprintf(L"References: %u\n", statistics.NumberOfReferences);
+            wprintf(L"Lookups: %u (%u hits)\n", statistics.NumberOfLookups, statistics.NumberOfHits);
+            wprintf(L"Bytes: %Iu\n", statistics.NumberOfBytes);
+            wprintf(L"Bytes without interning: %Iu\n", statistics.NumberOfReferencedBytes);
+
+            if (statistics.NumberOfBytes != 0)
+                wprintf(L"Dedup ratio: %.2f\n", (DOUBLE)statistics.NumberOfReferencedBytes / statistics.NumberOfBytes);
+        }
+        else if (WSTR_IEQUAL(command, L"srvstats"))
+        {
+            PH_SERVICE_PROVIDER_STATISTICS statistics;
+
+            PhGetServiceProviderStatistics(&statistics);
+            wprintf(L"Non-polling: %s\n", PhEnableServiceNonPoll ? L"enabled" : L"disabled");
+            wprintf(L"Runs: %u\n", statistics.Runs);
+            wprintf(L"Full scans: %u (%u services enumerated)\n", statistics.FullScans, statistics.ServicesEnumerated);
+            wprintf(L"Incremental updates: %u (%u services queried)\n", statistics.IncrementalUpdates, statistics.ServicesQueried);
+            wprintf(L"Config queries: %u\n", statistics.ConfigQueries);
+            wprintf(L"Notifications: %u\n", statistics.Notifications);
+        }
         else
         {
             wprintf(L"Unrecognized command.\n");
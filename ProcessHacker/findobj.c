@@ -69,6 +69,7 @@ static RECT MinimumSize;
 static HANDLE SearchThreadHandle = NULL;
 static BOOLEAN SearchStop;
 static PPH_STRING SearchString;
+static PPH_REGEX SearchRegex;
 static PPH_LIST SearchResults = NULL;
 static ULONG SearchResultsAddIndex;
 static PH_QUEUED_LOCK SearchResultsLock = PH_QUEUED_LOCK_INIT;
@@ -206,6 +207,8 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
             PhInitializeLayoutManager(&WindowLayoutManager, hwndDlg);
             PhAddLayoutItem(&WindowLayoutManager, GetDlgItem(hwndDlg, IDC_FILTER),
                 NULL, PH_ANCHOR_LEFT | PH_ANCHOR_TOP | PH_ANCHOR_RIGHT);
+            PhAddLayoutItem(&WindowLayoutManager, GetDlgItem(hwndDlg, IDC_REGEX),
+                NULL, PH_ANCHOR_TOP | PH_ANCHOR_RIGHT);
             PhAddLayoutItem(&WindowLayoutManager, GetDlgItem(hwndDlg, IDOK),
                 NULL, PH_ANCHOR_TOP | PH_ANCHOR_RIGHT);
             PhAddLayoutItem(&WindowLayoutManager, lvHandle,
@@ -308,6 +311,25 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
                         // Start the search.
 
                         SearchString = PhGetWindowText(GetDlgItem(hwndDlg, IDC_FILTER));
+                        SearchRegex = NULL;
+
+                        if (Button_GetCheck(GetDlgItem(hwndDlg, IDC_REGEX)) == BST_CHECKED)
+                        {
+                            PPH_STRING errorMessage;
+
+                            SearchRegex = PhCreateRegex(&SearchString->sr, PH_REGEX_IGNORE_CASE, &errorMessage);
+
+                            if (!SearchRegex)
+                            {
+                                PhShowError(hwndDlg, L"Unable to compile the regular expression: %s.", errorMessage->Buffer);
+                                PhDereferenceObject(errorMessage);
+                                PhDereferenceObject(SearchString);
+                                SearchString = NULL;
+                                SearchResults = NULL;
+                                break;
+                            }
+                        }
+
                         SearchResults = PhCreateList(128);
                         SearchResultsAddIndex = 0;
 
@@ -317,6 +339,7 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
                         {
                             PhDereferenceObject(SearchString);
                             PhDereferenceObject(SearchResults);
+                            PhSwapReference(&SearchRegex, NULL);
                             SearchString = NULL;
                             SearchResults = NULL;
                             break;
@@ -645,6 +668,7 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
             SendMessage(hwndDlg, WM_PH_SEARCH_UPDATE, 0, 0);
 
             PhDereferenceObject(SearchString);
+            PhSwapReference(&SearchRegex, NULL);
 
             NtWaitForSingleObject(SearchThreadHandle, FALSE, NULL);
             NtClose(SearchThreadHandle);
@@ -664,18 +688,31 @@ static INT_PTR CALLBACK PhpFindObjectsDlgProc(
     return FALSE;
 }
 
+static BOOLEAN MatchSearchString(
+    _In_ PPH_STRING Text
+    )
+{
+    PPH_STRING upperText;
+    BOOLEAN result;
+
+    if (SearchRegex)
+        return PhMatchRegex(SearchRegex, &Text->sr);
+
+    upperText = PhDuplicateString(Text);
+    PhUpperString(upperText);
+    result = PhFindStringInString(upperText, 0, SearchString->Buffer) != -1;
+    PhDereferenceObject(upperText);
+
+    return result;
+}
+
 static BOOLEAN NTAPI EnumModulesCallback(
     _In_ PPH_MODULE_INFO Module,
     _In_opt_ PVOID Context
     )
 {
-    PPH_STRING upperFileName;
-
-    upperFileName = PhDuplicateString(Module->FileName);
-    PhUpperString(upperFileName);
-
     if (
-        PhFindStringInString(upperFileName, 0, SearchString->Buffer) != -1 ||
+        MatchSearchString(Module->FileName) ||
         (UseSearchPointer && Module->BaseAddress == (PVOID)SearchPointer)
         )
     {
@@ -716,8 +753,6 @@ static BOOLEAN NTAPI EnumModulesCallback(
         PhReleaseQueuedLockExclusive(&SearchResultsLock);
     }
 
-    PhDereferenceObject(upperFileName);
-
     return TRUE;
 }
 
@@ -738,7 +773,8 @@ static NTSTATUS PhpFindObjectsThreadStart(
     // Try to get a search pointer from the search string.
     UseSearchPointer = PhStringToInteger64(&SearchString->sr, 0, &SearchPointer);
 
-    PhUpperString(SearchString);
+    if (!SearchRegex)
+        PhUpperString(SearchString);
 
     if (NT_SUCCESS(PhEnumHandlesEx(&handles)))
     {
@@ -788,23 +824,22 @@ static NTSTATUS PhpFindObjectsThreadStart(
 
             // Get handle information.
 
-            if (NT_SUCCESS(PhGetHandleInformation(
+            typeName = NULL;
+            bestObjectName = NULL;
+
+            if (NT_SUCCESS(PhGetHandleInformationCached(
                 processHandle,
                 (HANDLE)handleInfo->HandleValue,
                 handleInfo->ObjectTypeIndex,
+                handleInfo->Object,
                 NULL,
                 &typeName,
                 NULL,
                 &bestObjectName
-                )))
+                )) && bestObjectName)
             {
-                PPH_STRING upperBestObjectName;
-
-                upperBestObjectName = PhDuplicateString(bestObjectName);
-                PhUpperString(upperBestObjectName);
-
                 if (
-                    PhFindStringInString(upperBestObjectName, 0, SearchString->Buffer) != -1 ||
+                    MatchSearchString(bestObjectName) ||
                     (UseSearchPointer && handleInfo->Object == (PVOID)SearchPointer)
                     )
                 {
@@ -834,8 +869,10 @@ static NTSTATUS PhpFindObjectsThreadStart(
                     PhDereferenceObject(typeName);
                     PhDereferenceObject(bestObjectName);
                 }
-
-                PhDereferenceObject(upperBestObjectName);
+            }
+            else if (typeName)
+            {
+                PhDereferenceObject(typeName);
             }
         }
 
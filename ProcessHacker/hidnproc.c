@@ -751,25 +751,25 @@ NTSTATUS PhpEnumHiddenProcessesBruteForce(
     )
 {
     NTSTATUS status;
-    PVOID processes;
+    PPH_PROCESS_SNAPSHOT snapshot;
     PSYSTEM_PROCESS_INFORMATION process;
     PPH_LIST pids;
     ULONG pid;
     BOOLEAN stop = FALSE;
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    if (!NT_SUCCESS(status = PhGetProcessSnapshot(0, &snapshot)))
         return status;
 
     pids = PhCreateList(40);
 
-    process = PH_FIRST_PROCESS(processes);
+    process = PH_FIRST_PROCESS(snapshot->Processes);
 
     do
     {
         PhAddItemList(pids, process->UniqueProcessId);
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhFree(processes);
+    PhDereferenceObject(snapshot);
 
     for (pid = 8; pid <= 65536; pid += 4)
     {
@@ -934,24 +934,24 @@ NTSTATUS PhpEnumHiddenProcessesCsrHandles(
     )
 {
     NTSTATUS status;
-    PVOID processes;
+    PPH_PROCESS_SNAPSHOT snapshot;
     PSYSTEM_PROCESS_INFORMATION process;
     PPH_LIST pids;
     CSR_HANDLES_CONTEXT context;
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    if (!NT_SUCCESS(status = PhGetProcessSnapshot(0, &snapshot)))
         return status;
 
     pids = PhCreateList(40);
 
-    process = PH_FIRST_PROCESS(processes);
+    process = PH_FIRST_PROCESS(snapshot->Processes);
 
     do
     {
         PhAddItemList(pids, process->UniqueProcessId);
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhFree(processes);
+    PhDereferenceObject(snapshot);
 
     context.Callback = Callback;
     context.Context = Context;
@@ -992,16 +992,16 @@ NTSTATUS PhpOpenCsrProcesses(
     )
 {
     NTSTATUS status;
-    PVOID processes;
+    PPH_PROCESS_SNAPSHOT snapshot;
     PSYSTEM_PROCESS_INFORMATION process;
     PPH_LIST processHandleList;
 
-    if (!NT_SUCCESS(status = PhEnumProcesses(&processes)))
+    if (!NT_SUCCESS(status = PhGetProcessSnapshot(0, &snapshot)))
         return status;
 
     processHandleList = PhCreateList(8);
 
-    process = PH_FIRST_PROCESS(processes);
+    process = PH_FIRST_PROCESS(snapshot->Processes);
 
     do
     {
@@ -1029,7 +1029,7 @@ NTSTATUS PhpOpenCsrProcesses(
         }
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhFree(processes);
+    PhDereferenceObject(snapshot);
 
     *ProcessHandles = PhAllocateCopy(processHandleList->Items, processHandleList->Count * sizeof(HANDLE));
     *NumberOfProcessHandles = processHandleList->Count;
@@ -559,17 +559,15 @@ VOID PhHandleProviderUpdate(
         {
             handleItem = PhCreateHandleItem(handle);
 
-            PhGetHandleInformationEx(
+            PhGetHandleInformationCached(
                 handleProvider->ProcessHandle,
                 handleItem->Handle,
                 handle->ObjectTypeIndex,
-                0,
-                NULL,
+                handle->Object,
                 NULL,
                 &handleItem->TypeName,
                 &handleItem->ObjectName,
-                &handleItem->BestObjectName,
-                NULL
+                &handleItem->BestObjectName
                 );
 
             // We need at least a type name to continue.
@@ -101,6 +101,36 @@ ULONG_PTR PhMwpOnUserMessage(
 
 // Callbacks
 
+typedef struct _PH_MWP_EVENT_QUEUE
+{
+    PH_QUEUED_LOCK Lock;
+    PPH_PROVIDER_EVENT Events;
+    ULONG Count;
+    ULONG AllocatedCount;
+
+    // Owned by the main thread.
+    PPH_PROVIDER_EVENT SpareEvents;
+    ULONG SpareAllocatedCount;
+} PH_MWP_EVENT_QUEUE, *PPH_MWP_EVENT_QUEUE;
+
+VOID PhMwpPushProviderEvent(
+    _Inout_ PPH_MWP_EVENT_QUEUE Queue,
+    _In_ ULONG Type,
+    _In_ ULONG RunId,
+    _In_ PVOID Object
+    );
+
+PPH_PROVIDER_EVENT PhMwpFlushProviderEvents(
+    _Inout_ PPH_MWP_EVENT_QUEUE Queue,
+    _Out_ PULONG NumberOfEvents
+    );
+
+VOID PhMwpInvokeProviderEventsCallback(
+    _In_ PH_GENERAL_CALLBACK Callback,
+    _In_ PPH_PROVIDER_EVENT Events,
+    _In_ ULONG NumberOfEvents
+    );
+
 VOID NTAPI PhMwpProcessAddedHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
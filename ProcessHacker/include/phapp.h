@@ -118,6 +118,12 @@ VOID PhUnregisterMessageLoopFilter(
     _In_ struct _PH_MESSAGE_LOOP_FILTER_ENTRY *FilterEntry
     );
 
+// The primary provider thread may spend half of each interval running providers (in
+// microseconds).
+#define PH_PROVIDER_BUDGET(Interval) ((Interval) * 500)
+// Providers which can be deferred may be deferred by up to this time (in milliseconds).
+#define PH_DEFERRED_PROVIDER_DEADLINE 1000
+
 VOID PhApplyUpdateInterval(
     _In_ ULONG Interval
     );
@@ -523,19 +529,11 @@ extern BOOLEAN PhMainWndExiting;
 #define WM_PH_ACTIVATE (WM_APP + 99)
 #define PH_ACTIVATE_REPLY 0x1119
 
-#define WM_PH_PROCESS_ADDED (WM_APP + 101)
-#define WM_PH_PROCESS_MODIFIED (WM_APP + 102)
-#define WM_PH_PROCESS_REMOVED (WM_APP + 103)
 #define WM_PH_PROCESSES_UPDATED (WM_APP + 104)
 
-#define WM_PH_SERVICE_ADDED (WM_APP + 105)
-#define WM_PH_SERVICE_MODIFIED (WM_APP + 106)
-#define WM_PH_SERVICE_REMOVED (WM_APP + 107)
+#define WM_PH_SERVICE_MODIFIED (WM_APP + 106) // used by service list controls
 #define WM_PH_SERVICES_UPDATED (WM_APP + 108)
 
-#define WM_PH_NETWORK_ITEM_ADDED (WM_APP + 109)
-#define WM_PH_NETWORK_ITEM_MODIFIED (WM_APP + 110)
-#define WM_PH_NETWORK_ITEM_REMOVED (WM_APP + 111)
 #define WM_PH_NETWORK_ITEMS_UPDATED (WM_APP + 112)
 
 #define WM_PH_SHOW_PROCESS_PROPERTIES (WM_APP + 120)
@@ -1658,6 +1656,90 @@ VOID PhShowProcessRecordDialog(
     _In_ PPH_PROCESS_RECORD Record
     );
 
+// profiler
+
+typedef struct _PH_PROFILER
+{
+    HANDLE ProcessId;
+    ULONG Interval;
+    ULONG MaximumThreads;
+    PPH_CALL_TREE CallTree;
+
+    HANDLE ProcessHandle;
+    PPH_UNWIND_CACHE UnwindCache;
+
+    HANDLE SamplerThreadHandle;
+    HANDLE StopEventHandle;
+    HANDLE CaptureEventHandle;
+    PH_WORK_QUEUE WorkQueue;
+
+    PPH_HASHTABLE ThreadHashtable;
+    ULONG RunId;
+
+    LONG NumberOfTicks;
+    LONG NumberOfFailures;
+} PH_PROFILER, *PPH_PROFILER;
+
+extern PPH_OBJECT_TYPE PhProfilerType;
+
+PHAPPAPI
+PPH_PROFILER PhCreateProfiler(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG Interval,
+    _In_ ULONG MaximumThreads
+    );
+
+PHAPPAPI
+NTSTATUS PhStartProfiler(
+    _Inout_ PPH_PROFILER Profiler
+    );
+
+PHAPPAPI
+VOID PhStopProfiler(
+    _Inout_ PPH_PROFILER Profiler
+    );
+
+PHAPPAPI
+PPH_STRING PhExportFoldedProfiler(
+    _In_ PPH_PROFILER Profiler
+    );
+
+// regex
+
+#define PH_REGEX_IGNORE_CASE 0x1
+#define PH_REGEX_DOT_ALL 0x2
+
+typedef struct _PH_REGEX *PPH_REGEX;
+
+typedef PPH_STRINGREF (NTAPI *PPH_REGEX_GET_TEXT)(
+    _In_ PVOID Item,
+    _In_opt_ PVOID Context
+    );
+
+extern PPH_OBJECT_TYPE PhRegexType;
+
+PHAPPAPI
+PPH_REGEX PhCreateRegex(
+    _In_ PPH_STRINGREF Pattern,
+    _In_ ULONG Flags,
+    _Out_opt_ PPH_STRING *ErrorMessage
+    );
+
+PHAPPAPI
+BOOLEAN PhMatchRegex(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_STRINGREF Text
+    );
+
+PHAPPAPI
+ULONG PhMatchRegexList(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_LIST Items,
+    _In_ PPH_REGEX_GET_TEXT GetText,
+    _In_opt_ PVOID Context,
+    _Out_writes_(Items->Count) PBOOLEAN Matches
+    );
+
 // runas
 
 typedef struct _PH_RUNAS_SERVICE_PARAMETERS
@@ -40,6 +40,9 @@ typedef enum _PH_GENERAL_CALLBACK
     GeneralCallbackThreadStackControl = 26, // PPH_PLUGIN_THREAD_STACK_CONTROL Data [properties thread]
     GeneralCallbackSystemInformationInitializing = 27, // PPH_PLUGIN_SYSINFO_POINTERS Data [system information thread]
     GeneralCallbackMainWindowTabChanged = 28, // INT NewIndex [main thread]
+    GeneralCallbackProcessProviderEvents = 29, // PPH_PLUGIN_PROVIDER_EVENTS Data [main thread]
+    GeneralCallbackServiceProviderEvents = 30, // PPH_PLUGIN_PROVIDER_EVENTS Data [main thread]
+    GeneralCallbackNetworkProviderEvents = 31, // PPH_PLUGIN_PROVIDER_EVENTS Data [main thread]
 
     GeneralCallbackMaximum
 } PH_GENERAL_CALLBACK, *PPH_GENERAL_CALLBACK;
@@ -81,6 +84,33 @@ typedef struct _PH_PLUGIN_NOTIFY_EVENT
     PVOID Parameter;
 } PH_PLUGIN_NOTIFY_EVENT, *PPH_PLUGIN_NOTIFY_EVENT;
 
+#define PH_PROVIDER_EVENT_ADDED 1
+#define PH_PROVIDER_EVENT_MODIFIED 2
+#define PH_PROVIDER_EVENT_REMOVED 3
+
+typedef struct _PH_PROVIDER_EVENT
+{
+    // Object is:
+    // PPH_PROCESS_ITEM for GeneralCallbackProcessProviderEvents
+    // PPH_SERVICE_ITEM for GeneralCallbackServiceProviderEvents, except
+    //   PPH_SERVICE_MODIFIED_DATA for Type = PH_PROVIDER_EVENT_MODIFIED
+    // PPH_NETWORK_ITEM for GeneralCallbackNetworkProviderEvents
+
+    ULONG Type;
+    ULONG RunId;
+    PVOID Object;
+} PH_PROVIDER_EVENT, *PPH_PROVIDER_EVENT;
+
+typedef struct _PH_PLUGIN_PROVIDER_EVENTS
+{
+    // The events from one or more provider runs, in the order in which they
+    // were raised. The callback is invoked before the events are applied to
+    // the tree list.
+
+    PPH_PROVIDER_EVENT Events;
+    ULONG NumberOfEvents;
+} PH_PLUGIN_PROVIDER_EVENTS, *PPH_PLUGIN_PROVIDER_EVENTS;
+
 typedef struct _PH_PLUGIN_OBJECT_PROPERTIES
 {
     // Parameter is:
@@ -211,8 +211,8 @@ typedef struct _PH_MEMORY_CONTEXT
 {
     PH_MEMORY_PROVIDER Provider;
 
-    PPH_LIST MemoryList;
     HWND ListViewHandle;
+    PPH_HASHTABLE ItemIdHashtable; // memory item to list view item ID
 } PH_MEMORY_CONTEXT, *PPH_MEMORY_CONTEXT;
 
 #define WM_PH_STATISTICS_UPDATE (WM_APP + 231)
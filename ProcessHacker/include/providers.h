@@ -14,8 +14,8 @@ PHAPPAPI extern PH_CALLBACK PhProcessModifiedEvent;
 PHAPPAPI extern PH_CALLBACK PhProcessRemovedEvent;
 PHAPPAPI extern PH_CALLBACK PhProcessesUpdatedEvent;
 
-extern PPH_LIST PhProcessRecordList;
-extern PH_QUEUED_LOCK PhProcessRecordListLock;
+extern PH_AVL_TREE PhProcessRecordSet;
+extern PH_QUEUED_LOCK PhProcessRecordSetLock;
 
 extern ULONG PhStatisticsSampleCount;
 extern BOOLEAN PhEnableProcessQueryStage2;
@@ -223,16 +223,20 @@ typedef struct _PH_PROCESS_ITEM
     // New fields
     PH_UINTPTR_DELTA PrivateBytesDelta;
     PPH_STRING PackageFullName;
+    struct _PH_IMAGE_METADATA *ImageMetadata;
 } PH_PROCESS_ITEM, *PPH_PROCESS_ITEM;
 
 // The process itself is dead.
 #define PH_PROCESS_RECORD_DEAD 0x1
 // An extra reference has been added to the process record for the statistics system.
 #define PH_PROCESS_RECORD_STAT_REF 0x2
+// The process record could not be added to the record set.
+#define PH_PROCESS_RECORD_NOT_INDEXED 0x4
 
 typedef struct _PH_PROCESS_RECORD
 {
-    LIST_ENTRY ListEntry;
+    PH_AVL_LINKS Links; // in PhProcessRecordSet, ordered by create time and process ID
+    PH_AVL_LINKS ProcessIdLinks; // ordered by process ID and create time
     LONG RefCount;
     ULONG Flags;
 
@@ -396,7 +400,7 @@ typedef struct _PH_SERVICE_ITEM
 typedef struct _PH_SERVICE_MODIFIED_DATA
 {
     PPH_SERVICE_ITEM Service;
-    PH_SERVICE_ITEM OldService;
+    PH_SERVICE_ITEM OldService; // DisplayName is only valid during the event; reference it to keep it
 } PH_SERVICE_MODIFIED_DATA, *PPH_SERVICE_MODIFIED_DATA;
 
 typedef enum _PH_SERVICE_CHANGE
@@ -407,6 +411,17 @@ typedef enum _PH_SERVICE_CHANGE
     ServiceStopped
 } PH_SERVICE_CHANGE, *PPH_SERVICE_CHANGE;
 
+typedef struct _PH_SERVICE_PROVIDER_STATISTICS
+{
+    ULONG Runs;
+    ULONG FullScans;
+    ULONG IncrementalUpdates;
+    ULONG ServicesEnumerated; // by full scans
+    ULONG ServicesQueried; // by incremental updates
+    ULONG ConfigQueries;
+    ULONG Notifications;
+} PH_SERVICE_PROVIDER_STATISTICS, *PPH_SERVICE_PROVIDER_STATISTICS;
+
 BOOLEAN PhServiceProviderInitialization(
     VOID
     );
@@ -437,6 +452,10 @@ VOID PhServiceProviderUpdate(
     _In_ PVOID Object
     );
 
+VOID PhGetServiceProviderStatistics(
+    _Out_ PPH_SERVICE_PROVIDER_STATISTICS Statistics
+    );
+
 // netprv
 
 #ifndef PH_NETPRV_PRIVATE
@@ -622,6 +641,8 @@ typedef struct _PH_THREAD_ITEM
     BOOLEAN JustResolved;
 
     WCHAR ThreadIdString[PH_INT32_STR_LEN_1];
+
+    ULONG SeenRunId; // run ID of the last update in which the thread existed
 } PH_THREAD_ITEM, *PPH_THREAD_ITEM;
 
 typedef enum _PH_KNOWN_PROCESS_TYPE PH_KNOWN_PROCESS_TYPE;
@@ -686,6 +707,11 @@ VOID PhThreadProviderInitialUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider
     );
 
+VOID PhUpdateThreadProvider(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ PVOID ProcessInformation
+    );
+
 // hndlprv
 
 #ifndef PH_HNDLPRV_PRIVATE
@@ -776,7 +802,11 @@ extern PPH_OBJECT_TYPE PhMemoryItemType;
 
 typedef struct _PH_MEMORY_ITEM
 {
+    PH_AVL_LINKS Links;
+    ULONG RunId;
+
     PVOID BaseAddress;
+    PVOID AllocationBase;
     ULONG_PTR Size;
     ULONG Flags;
     ULONG Protection;
@@ -785,11 +815,19 @@ typedef struct _PH_MEMORY_ITEM
     PPH_STRING Name;
 } PH_MEMORY_ITEM, *PPH_MEMORY_ITEM;
 
+typedef enum _PH_MEMORY_PROVIDER_ACTION
+{
+    MemoryItemAdded,
+    MemoryItemModified,
+    MemoryItemRemoved
+} PH_MEMORY_PROVIDER_ACTION;
+
 typedef struct _PH_MEMORY_PROVIDER *PPH_MEMORY_PROVIDER;
 
-typedef BOOLEAN (NTAPI *PPH_MEMORY_PROVIDER_CALLBACK)(
+typedef VOID (NTAPI *PPH_MEMORY_PROVIDER_CALLBACK)(
     _In_ PPH_MEMORY_PROVIDER Provider,
-    _In_ _Assume_refs_(1) PPH_MEMORY_ITEM MemoryItem
+    _In_ PH_MEMORY_PROVIDER_ACTION Action,
+    _In_ PPH_MEMORY_ITEM MemoryItem
     );
 
 typedef struct _PH_MEMORY_PROVIDER
@@ -801,6 +839,10 @@ typedef struct _PH_MEMORY_PROVIDER
     HANDLE ProcessHandle;
 
     BOOLEAN IgnoreFreeRegions;
+
+    PH_AVL_TREE RegionTree;
+    ULONG RunId;
+    PPH_HASHTABLE NameCacheHashtable;
 } PH_MEMORY_PROVIDER, *PPH_MEMORY_PROVIDER;
 
 BOOLEAN PhMemoryProviderInitialization(
@@ -842,4 +884,9 @@ VOID PhMemoryProviderUpdate(
     _In_ PPH_MEMORY_PROVIDER Provider
     );
 
+PPH_MEMORY_ITEM PhLookupMemoryItem(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PVOID Address
+    );
+
 #endif
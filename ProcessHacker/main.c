@@ -398,6 +398,7 @@ VOID PhApplyUpdateInterval(
 {
     PhSetIntervalProviderThread(&PhPrimaryProviderThread, Interval);
     PhSetIntervalProviderThread(&PhSecondaryProviderThread, Interval);
+    PhSetBudgetProviderThread(&PhPrimaryProviderThread, PH_PROVIDER_BUDGET(Interval));
 }
 
 VOID PhActivatePreviousInstance(
@@ -88,6 +88,7 @@ static PH_CALLBACK_REGISTRATION ProcessAddedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessModifiedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessRemovedRegistration;
 static PH_CALLBACK_REGISTRATION ProcessesUpdatedRegistration;
+static PH_MWP_EVENT_QUEUE ProcessEventQueue;
 static BOOLEAN ProcessesNeedsRedraw = FALSE;
 static PPH_PROCESS_NODE ProcessToScrollTo = NULL;
 
@@ -96,6 +97,7 @@ static PH_CALLBACK_REGISTRATION ServiceAddedRegistration;
 static PH_CALLBACK_REGISTRATION ServiceModifiedRegistration;
 static PH_CALLBACK_REGISTRATION ServiceRemovedRegistration;
 static PH_CALLBACK_REGISTRATION ServicesUpdatedRegistration;
+static PH_MWP_EVENT_QUEUE ServiceEventQueue;
 static PPH_POINTER_LIST ServicesPendingList;
 static BOOLEAN ServicesNeedsRedraw = FALSE;
 
@@ -104,6 +106,7 @@ static PH_CALLBACK_REGISTRATION NetworkItemAddedRegistration;
 static PH_CALLBACK_REGISTRATION NetworkItemModifiedRegistration;
 static PH_CALLBACK_REGISTRATION NetworkItemRemovedRegistration;
 static PH_CALLBACK_REGISTRATION NetworkItemsUpdatedRegistration;
+static PH_MWP_EVENT_QUEUE NetworkEventQueue;
 static BOOLEAN NetworkNeedsRedraw = FALSE;
 
 static ULONG SelectedRunAsMode;
@@ -390,6 +393,12 @@ VOID PhMwpInitializeProviders(
     PhRegisterProvider(&PhPrimaryProviderThread, PhServiceProviderUpdate, NULL, &ServiceProviderRegistration);
     PhSetEnabledProvider(&ServiceProviderRegistration, TRUE);
     PhRegisterProvider(&PhPrimaryProviderThread, PhNetworkProviderUpdate, NULL, &NetworkProviderRegistration);
+
+    // The process provider runs on every tick. The service and network providers can be
+    // moved to the next tick when a tick would take more than half of the interval.
+    PhSetBudgetProviderThread(&PhPrimaryProviderThread, PH_PROVIDER_BUDGET(interval));
+    PhSetScheduleProvider(&ServiceProviderRegistration, 0, PH_DEFERRED_PROVIDER_DEADLINE, 0);
+    PhSetScheduleProvider(&NetworkProviderRegistration, 0, PH_DEFERRED_PROVIDER_DEADLINE, 0);
 }
 
 VOID PhMwpInitializeControls(
@@ -2232,81 +2241,122 @@ ULONG_PTR PhMwpOnUserMessage(
             PhMwpActivateWindow(!!PhGetIntegerSetting(L"IconTogglesVisibility"));
         }
         break;
-    case WM_PH_PROCESS_ADDED:
-        {
-            ULONG runId = (ULONG)WParam;
-            PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)LParam;
-
-            PhMwpOnProcessAdded(processItem, runId);
-        }
-        break;
-    case WM_PH_PROCESS_MODIFIED:
-        {
-            PhMwpOnProcessModified((PPH_PROCESS_ITEM)LParam);
-        }
-        break;
-    case WM_PH_PROCESS_REMOVED:
-        {
-            PhMwpOnProcessRemoved((PPH_PROCESS_ITEM)LParam);
-        }
-        break;
     case WM_PH_PROCESSES_UPDATED:
         {
             PhMwpOnProcessesUpdated();
         }
         break;
-    case WM_PH_SERVICE_ADDED:
-        {
-            ULONG runId = (ULONG)WParam;
-            PPH_SERVICE_ITEM serviceItem = (PPH_SERVICE_ITEM)LParam;
-
-            PhMwpOnServiceAdded(serviceItem, runId);
-        }
-        break;
-    case WM_PH_SERVICE_MODIFIED:
-        {
-            PPH_SERVICE_MODIFIED_DATA serviceModifiedData = (PPH_SERVICE_MODIFIED_DATA)LParam;
-
-            PhMwpOnServiceModified(serviceModifiedData);
-            PhFree(serviceModifiedData);
-        }
-        break;
-    case WM_PH_SERVICE_REMOVED:
-        {
-            PhMwpOnServiceRemoved((PPH_SERVICE_ITEM)LParam);
-        }
-        break;
     case WM_PH_SERVICES_UPDATED:
         {
             PhMwpOnServicesUpdated();
         }
         break;
-    case WM_PH_NETWORK_ITEM_ADDED:
-        {
-            ULONG runId = (ULONG)WParam;
-            PPH_NETWORK_ITEM networkItem = (PPH_NETWORK_ITEM)LParam;
-
-            PhMwpOnNetworkItemAdded(runId, networkItem);
-        }
-        break;
-    case WM_PH_NETWORK_ITEM_MODIFIED:
+    case WM_PH_NETWORK_ITEMS_UPDATED:
         {
-            PhMwpOnNetworkItemModified((PPH_NETWORK_ITEM)LParam);
+            PhMwpOnNetworkItemsUpdated();
         }
         break;
-    case WM_PH_NETWORK_ITEM_REMOVED:
+    }
+
+    return 0;
+}
+
+/**
+ * Queues an event from a provider. The event is handled in the main thread
+ * when the provider has finished its run.
+ *
+ * \param Queue The event queue of the provider.
+ * \param Type The type of event.
+ * \param RunId The run ID of the provider.
+ * \param Object The object that the event applies to.
+ */
+VOID PhMwpPushProviderEvent(
+    _Inout_ PPH_MWP_EVENT_QUEUE Queue,
+    _In_ ULONG Type,
+    _In_ ULONG RunId,
+    _In_ PVOID Object
+    )
+{
+    PPH_PROVIDER_EVENT event;
+
+    PhAcquireQueuedLockExclusive(&Queue->Lock);
+
+    if (Queue->Count == Queue->AllocatedCount)
+    {
+        if (Queue->Events)
         {
-            PhMwpOnNetworkItemRemoved((PPH_NETWORK_ITEM)LParam);
+            Queue->AllocatedCount *= 2;
+            Queue->Events = PhReAllocate(Queue->Events, Queue->AllocatedCount * sizeof(PH_PROVIDER_EVENT));
         }
-        break;
-    case WM_PH_NETWORK_ITEMS_UPDATED:
+        else
         {
-            PhMwpOnNetworkItemsUpdated();
+            Queue->AllocatedCount = 64;
+            Queue->Events = PhAllocate(Queue->AllocatedCount * sizeof(PH_PROVIDER_EVENT));
         }
-        break;
     }
 
-    return 0;
+    event = &Queue->Events[Queue->Count++];
+    event->Type = Type;
+    event->RunId = RunId;
+    event->Object = Object;
+
+    PhReleaseQueuedLockExclusive(&Queue->Lock);
+}
+
+/**
+ * Takes all queued events from a provider.
+ *
+ * \param Queue The event queue of the provider.
+ * \param NumberOfEvents A variable which receives the number of events.
+ *
+ * \return An array of events. The array is valid until the next call to
+ * this function for the same queue.
+ *
+ * \remarks This function must only be called from the main thread.
+ */
+PPH_PROVIDER_EVENT PhMwpFlushProviderEvents(
+    _Inout_ PPH_MWP_EVENT_QUEUE Queue,
+    _Out_ PULONG NumberOfEvents
+    )
+{
+    PPH_PROVIDER_EVENT events;
+    ULONG allocatedCount;
+
+    // Swap the buffers so that the provider can keep adding events while we
+    // process these ones.
+
+    PhAcquireQueuedLockExclusive(&Queue->Lock);
+
+    events = Queue->Events;
+    allocatedCount = Queue->AllocatedCount;
+    *NumberOfEvents = Queue->Count;
+
+    Queue->Events = Queue->SpareEvents;
+    Queue->AllocatedCount = Queue->SpareAllocatedCount;
+    Queue->Count = 0;
+
+    PhReleaseQueuedLockExclusive(&Queue->Lock);
+
+    Queue->SpareEvents = events;
+    Queue->SpareAllocatedCount = allocatedCount;
+
+    return events;
+}
+
+VOID PhMwpInvokeProviderEventsCallback(
+    _In_ PH_GENERAL_CALLBACK Callback,
+    _In_ PPH_PROVIDER_EVENT Events,
+    _In_ ULONG NumberOfEvents
+    )
+{
+    PH_PLUGIN_PROVIDER_EVENTS providerEvents;
+
+    if (PhPluginsEnabled && NumberOfEvents != 0)
+    {
+        providerEvents.Events = Events;
+        providerEvents.NumberOfEvents = NumberOfEvents;
+        PhInvokeCallback(PhGetGeneralCallback(Callback), &providerEvents);
+    }
 }
 
 VOID NTAPI PhMwpProcessAddedHandler(
@@ -2319,11 +2369,11 @@ VOID NTAPI PhMwpProcessAddedHandler(
     // Reference the process item so it doesn't get deleted before
     // we handle the event in the main thread.
     PhReferenceObject(processItem);
-    PostMessage(
-        PhMainWndHandle,
-        WM_PH_PROCESS_ADDED,
-        (WPARAM)PhGetRunIdProvider(&ProcessProviderRegistration),
-        (LPARAM)processItem
+    PhMwpPushProviderEvent(
+        &ProcessEventQueue,
+        PH_PROVIDER_EVENT_ADDED,
+        PhGetRunIdProvider(&ProcessProviderRegistration),
+        processItem
         );
 }
 
@@ -2334,7 +2384,7 @@ VOID NTAPI PhMwpProcessModifiedHandler(
 {
     PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)Parameter;
 
-    PostMessage(PhMainWndHandle, WM_PH_PROCESS_MODIFIED, 0, (LPARAM)processItem);
+    PhMwpPushProviderEvent(&ProcessEventQueue, PH_PROVIDER_EVENT_MODIFIED, 0, processItem);
 }
 
 VOID NTAPI PhMwpProcessRemovedHandler(
@@ -2346,7 +2396,7 @@ VOID NTAPI PhMwpProcessRemovedHandler(
 
     // We already have a reference to the process item, so we don't need to
     // reference it here.
-    PostMessage(PhMainWndHandle, WM_PH_PROCESS_REMOVED, 0, (LPARAM)processItem);
+    PhMwpPushProviderEvent(&ProcessEventQueue, PH_PROVIDER_EVENT_REMOVED, 0, processItem);
 }
 
 VOID NTAPI PhMwpProcessesUpdatedHandler(
@@ -2365,11 +2415,11 @@ VOID NTAPI PhMwpServiceAddedHandler(
     PPH_SERVICE_ITEM serviceItem = (PPH_SERVICE_ITEM)Parameter;
 
     PhReferenceObject(serviceItem);
-    PostMessage(
-        PhMainWndHandle,
-        WM_PH_SERVICE_ADDED,
+    PhMwpPushProviderEvent(
+        &ServiceEventQueue,
+        PH_PROVIDER_EVENT_ADDED,
         PhGetRunIdProvider(&ServiceProviderRegistration),
-        (LPARAM)serviceItem
+        serviceItem
         );
 }
 
@@ -2383,7 +2433,11 @@ VOID NTAPI PhMwpServiceModifiedHandler(
 
     copy = PhAllocateCopy(serviceModifiedData, sizeof(PH_SERVICE_MODIFIED_DATA));
 
-    PostMessage(PhMainWndHandle, WM_PH_SERVICE_MODIFIED, 0, (LPARAM)copy);
+    // The service list may still be drawing the old display name until this event is processed.
+    if (copy->OldService.DisplayName)
+        PhReferenceObject(copy->OldService.DisplayName);
+
+    PhMwpPushProviderEvent(&ServiceEventQueue, PH_PROVIDER_EVENT_MODIFIED, 0, copy);
 }
 
 VOID NTAPI PhMwpServiceRemovedHandler(
@@ -2393,7 +2447,7 @@ VOID NTAPI PhMwpServiceRemovedHandler(
 {
     PPH_SERVICE_ITEM serviceItem = (PPH_SERVICE_ITEM)Parameter;
 
-    PostMessage(PhMainWndHandle, WM_PH_SERVICE_REMOVED, 0, (LPARAM)serviceItem);
+    PhMwpPushProviderEvent(&ServiceEventQueue, PH_PROVIDER_EVENT_REMOVED, 0, serviceItem);
 }
 
 VOID NTAPI PhMwpServicesUpdatedHandler(
@@ -2412,11 +2466,11 @@ VOID NTAPI PhMwpNetworkItemAddedHandler(
     PPH_NETWORK_ITEM networkItem = (PPH_NETWORK_ITEM)Parameter;
 
     PhReferenceObject(networkItem);
-    PostMessage(
-        PhMainWndHandle,
-        WM_PH_NETWORK_ITEM_ADDED,
+    PhMwpPushProviderEvent(
+        &NetworkEventQueue,
+        PH_PROVIDER_EVENT_ADDED,
         PhGetRunIdProvider(&NetworkProviderRegistration),
-        (LPARAM)networkItem
+        networkItem
         );
 }
 
@@ -2427,7 +2481,7 @@ VOID NTAPI PhMwpNetworkItemModifiedHandler(
 {
     PPH_NETWORK_ITEM networkItem = (PPH_NETWORK_ITEM)Parameter;
 
-    PostMessage(PhMainWndHandle, WM_PH_NETWORK_ITEM_MODIFIED, 0, (LPARAM)networkItem);
+    PhMwpPushProviderEvent(&NetworkEventQueue, PH_PROVIDER_EVENT_MODIFIED, 0, networkItem);
 }
 
 VOID NTAPI PhMwpNetworkItemRemovedHandler(
@@ -2437,7 +2491,7 @@ VOID NTAPI PhMwpNetworkItemRemovedHandler(
 {
     PPH_NETWORK_ITEM networkItem = (PPH_NETWORK_ITEM)Parameter;
 
-    PostMessage(PhMainWndHandle, WM_PH_NETWORK_ITEM_REMOVED, 0, (LPARAM)networkItem);
+    PhMwpPushProviderEvent(&NetworkEventQueue, PH_PROVIDER_EVENT_REMOVED, 0, networkItem);
 }
 
 VOID NTAPI PhMwpNetworkItemsUpdatedHandler(
@@ -4296,9 +4350,6 @@ VOID PhMwpOnProcessModified(
     )
 {
     PhUpdateProcessNode(PhFindProcessNode(ProcessItem->ProcessId));
-
-    if (SignedFilterEntry)
-        PhApplyTreeNewFilters(PhGetFilterSupportProcessTreeList());
 }
 
 VOID PhMwpOnProcessRemoved(
@@ -4338,6 +4389,37 @@ VOID PhMwpOnProcessesUpdated(
     VOID
     )
 {
+    PPH_PROVIDER_EVENT events;
+    ULONG numberOfEvents;
+    ULONG i;
+    BOOLEAN modified = FALSE;
+
+    // Apply all events from the provider at once. The tree list only restructures
+    // itself when redraw is enabled again below.
+
+    events = PhMwpFlushProviderEvents(&ProcessEventQueue, &numberOfEvents);
+    PhMwpInvokeProviderEventsCallback(GeneralCallbackProcessProviderEvents, events, numberOfEvents);
+
+    for (i = 0; i < numberOfEvents; i++)
+    {
+        switch (events[i].Type)
+        {
+        case PH_PROVIDER_EVENT_ADDED:
+            PhMwpOnProcessAdded(events[i].Object, events[i].RunId);
+            break;
+        case PH_PROVIDER_EVENT_MODIFIED:
+            PhMwpOnProcessModified(events[i].Object);
+            modified = TRUE;
+            break;
+        case PH_PROVIDER_EVENT_REMOVED:
+            PhMwpOnProcessRemoved(events[i].Object);
+            break;
+        }
+    }
+
+    if (modified && SignedFilterEntry)
+        PhApplyTreeNewFilters(PhGetFilterSupportProcessTreeList());
+
     // The modified notification is only sent for special cases.
     // We have to invalidate the text on each update.
     PhTickProcessNodes();
@@ -4618,9 +4700,6 @@ VOID PhMwpOnServiceModified(
         //}
 
         PhUpdateServiceNode(PhFindServiceNode(ServiceModifiedData->Service));
-
-        if (DriverFilterEntry)
-            PhApplyTreeNewFilters(PhGetFilterSupportServiceTreeList());
     }
 
     serviceChange = PhGetServiceChange(ServiceModifiedData);
@@ -4730,8 +4809,41 @@ VOID PhMwpOnServicesUpdated(
     VOID
     )
 {
+    PPH_PROVIDER_EVENT events;
+    ULONG numberOfEvents;
+    ULONG i;
+    BOOLEAN modified = FALSE;
+
+    events = PhMwpFlushProviderEvents(&ServiceEventQueue, &numberOfEvents);
+    PhMwpInvokeProviderEventsCallback(GeneralCallbackServiceProviderEvents, events, numberOfEvents);
+
+    for (i = 0; i < numberOfEvents; i++)
+    {
+        switch (events[i].Type)
+        {
+        case PH_PROVIDER_EVENT_ADDED:
+            PhMwpOnServiceAdded(events[i].Object, events[i].RunId);
+            break;
+        case PH_PROVIDER_EVENT_MODIFIED:
+            PhMwpOnServiceModified(events[i].Object);
+
+            if (((PPH_SERVICE_MODIFIED_DATA)events[i].Object)->OldService.DisplayName)
+                PhDereferenceObject(((PPH_SERVICE_MODIFIED_DATA)events[i].Object)->OldService.DisplayName);
+
+            PhFree(events[i].Object);
+            modified = TRUE;
+            break;
+        case PH_PROVIDER_EVENT_REMOVED:
+            PhMwpOnServiceRemoved(events[i].Object);
+            break;
+        }
+    }
+
     if (ServiceTreeListLoaded)
     {
+        if (modified && DriverFilterEntry)
+            PhApplyTreeNewFilters(PhGetFilterSupportServiceTreeList());
+
         PhTickServiceNodes();
 
         if (ServicesNeedsRedraw)
@@ -4941,6 +5053,29 @@ VOID PhMwpOnNetworkItemsUpdated(
     VOID
     )
 {
+    PPH_PROVIDER_EVENT events;
+    ULONG numberOfEvents;
+    ULONG i;
+
+    events = PhMwpFlushProviderEvents(&NetworkEventQueue, &numberOfEvents);
+    PhMwpInvokeProviderEventsCallback(GeneralCallbackNetworkProviderEvents, events, numberOfEvents);
+
+    for (i = 0; i < numberOfEvents; i++)
+    {
+        switch (events[i].Type)
+        {
+        case PH_PROVIDER_EVENT_ADDED:
+            PhMwpOnNetworkItemAdded(events[i].RunId, events[i].Object);
+            break;
+        case PH_PROVIDER_EVENT_MODIFIED:
+            PhMwpOnNetworkItemModified(events[i].Object);
+            break;
+        case PH_PROVIDER_EVENT_REMOVED:
+            PhMwpOnNetworkItemRemoved(events[i].Object);
+            break;
+        }
+    }
+
     PhTickNetworkNodes();
 
     if (NetworkNeedsRedraw)
@@ -20,14 +20,49 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * The memory provider keeps the regions of the last walk in an AVL tree ordered
+ * by base address. Since NtQueryVirtualMemory returns regions in ascending order,
+ * each refresh is a linear merge of the new walk against the tree: regions whose
+ * attributes have not changed keep their existing memory item and are not reported,
+ * and the callback only sees regions which were added, modified or removed.
+ *
+ * Mapped file names are cached per allocation base. An image or a mapped view
+ * usually spans many regions which share the same allocation base, so only one
+ * name query is needed per allocation. A cache entry is dropped when no region
+ * with its allocation base is seen during a walk, or when a new allocation appears
+ * at that base.
+ */
+
 #define PH_MEMPRV_PRIVATE
 #include <phapp.h>
 
+typedef struct _PH_MEMORY_NAME_CACHE_ENTRY
+{
+    PVOID AllocationBase;
+    ULONG RunId;
+    PPH_STRING Name;
+} PH_MEMORY_NAME_CACHE_ENTRY, *PPH_MEMORY_NAME_CACHE_ENTRY;
+
 VOID PhpMemoryItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
     );
 
+LONG NTAPI PhpMemoryItemCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    );
+
+BOOLEAN NTAPI PhpMemoryNameCacheCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpMemoryNameCacheHashFunction(
+    _In_ PVOID Entry
+    );
+
 PPH_OBJECT_TYPE PhMemoryItemType;
 
 BOOLEAN PhMemoryProviderInitialization(
@@ -58,6 +93,15 @@ VOID PhInitializeMemoryProvider(
     Provider->ProcessHandle = NULL;
     Provider->IgnoreFreeRegions = FALSE;
 
+    PhInitializeAvlTree(&Provider->RegionTree, PhpMemoryItemCompareFunction);
+    Provider->RunId = 0;
+    Provider->NameCacheHashtable = PhCreateHashtable(
+        sizeof(PH_MEMORY_NAME_CACHE_ENTRY),
+        PhpMemoryNameCacheCompareFunction,
+        PhpMemoryNameCacheHashFunction,
+        32
+        );
+
     if (!NT_SUCCESS(PhOpenProcess(
         &Provider->ProcessHandle,
         PROCESS_QUERY_INFORMATION | PROCESS_VM_READ,
@@ -76,6 +120,27 @@ VOID PhDeleteMemoryProvider(
     _Inout_ PPH_MEMORY_PROVIDER Provider
     )
 {
+    PPH_AVL_LINKS links;
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_MEMORY_NAME_CACHE_ENTRY entry;
+
+    // Dereference all memory items (we referenced them when we added them to the tree).
+    while (links = PhMinimumElementAvlTree(&Provider->RegionTree))
+    {
+        PhRemoveElementAvlTree(&Provider->RegionTree, links);
+        PhDereferenceObject(CONTAINING_RECORD(links, PH_MEMORY_ITEM, Links));
+    }
+
+    PhBeginEnumHashtable(Provider->NameCacheHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        if (entry->Name)
+            PhDereferenceObject(entry->Name);
+    }
+
+    PhDereferenceObject(Provider->NameCacheHashtable);
+
     if (Provider->ProcessHandle)
         NtClose(Provider->ProcessHandle);
 }
@@ -110,6 +175,40 @@ VOID PhpMemoryItemDeleteProcedure(
         PhDereferenceObject(memoryItem->Name);
 }
 
+LONG NTAPI PhpMemoryItemCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    PPH_MEMORY_ITEM memoryItem1 = CONTAINING_RECORD(Links1, PH_MEMORY_ITEM, Links);
+    PPH_MEMORY_ITEM memoryItem2 = CONTAINING_RECORD(Links2, PH_MEMORY_ITEM, Links);
+
+    return uintptrcmp((ULONG_PTR)memoryItem1->BaseAddress, (ULONG_PTR)memoryItem2->BaseAddress);
+}
+
+BOOLEAN NTAPI PhpMemoryNameCacheCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return
+        ((PPH_MEMORY_NAME_CACHE_ENTRY)Entry1)->AllocationBase ==
+        ((PPH_MEMORY_NAME_CACHE_ENTRY)Entry2)->AllocationBase;
+}
+
+ULONG NTAPI PhpMemoryNameCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PVOID allocationBase = ((PPH_MEMORY_NAME_CACHE_ENTRY)Entry)->AllocationBase;
+
+#ifdef _M_IX86
+    return PhHashInt32((ULONG)allocationBase);
+#else
+    return PhHashInt64((ULONGLONG)allocationBase);
+#endif
+}
+
 VOID PhGetMemoryProtectionString(
     _In_ ULONG Protection,
     _Out_writes_(17) PWSTR String
@@ -197,16 +296,163 @@ PWSTR PhGetMemoryTypeString(
         return L"Unknown";
 }
 
+/**
+ * Gets the mapped file name for a memory item, using the provider's name cache.
+ *
+ * \param Provider The memory provider.
+ * \param MemoryItem The memory item. The item must be a mapped or image region.
+ * \param NewAllocation TRUE if the allocation at the item's allocation base may have
+ * changed since the last walk, in which case any cached name is discarded.
+ *
+ * \return The base name of the mapped file, or NULL if the name could not be
+ * determined. You must dereference the string when you no longer need it.
+ */
+PPH_STRING PhpGetMemoryItemName(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PPH_MEMORY_ITEM MemoryItem,
+    _In_ BOOLEAN NewAllocation
+    )
+{
+    PH_MEMORY_NAME_CACHE_ENTRY lookupEntry;
+    PPH_MEMORY_NAME_CACHE_ENTRY entry;
+    BOOLEAN added;
+    PPH_STRING fileName;
+
+    lookupEntry.AllocationBase = MemoryItem->AllocationBase;
+    lookupEntry.RunId = Provider->RunId;
+    lookupEntry.Name = NULL;
+
+    entry = PhAddEntryHashtableEx(Provider->NameCacheHashtable, &lookupEntry, &added);
+
+    if (!added)
+    {
+        entry->RunId = Provider->RunId;
+
+        if (!NewAllocation)
+        {
+            if (entry->Name)
+                PhReferenceObject(entry->Name);
+
+            return entry->Name;
+        }
+
+        if (entry->Name)
+        {
+            PhDereferenceObject(entry->Name);
+            entry->Name = NULL;
+        }
+    }
+
+    if (NT_SUCCESS(PhGetProcessMappedFileName(
+        Provider->ProcessHandle,
+        MemoryItem->BaseAddress,
+        &fileName
+        )))
+    {
+        entry->Name = PhGetBaseName(fileName);
+        PhDereferenceObject(fileName);
+    }
+
+    if (entry->Name)
+        PhReferenceObject(entry->Name);
+
+    return entry->Name;
+}
+
+VOID PhpTouchMemoryNameCache(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PVOID AllocationBase
+    )
+{
+    PH_MEMORY_NAME_CACHE_ENTRY lookupEntry;
+    PPH_MEMORY_NAME_CACHE_ENTRY entry;
+
+    lookupEntry.AllocationBase = AllocationBase;
+    entry = PhFindEntryHashtable(Provider->NameCacheHashtable, &lookupEntry);
+
+    if (entry)
+        entry->RunId = Provider->RunId;
+}
+
+VOID PhpSweepMemoryNameCache(
+    _In_ PPH_MEMORY_PROVIDER Provider
+    )
+{
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_MEMORY_NAME_CACHE_ENTRY entry;
+    PPH_LIST staleEntries = NULL;
+    ULONG i;
+
+    PhBeginEnumHashtable(Provider->NameCacheHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
+    {
+        if (entry->RunId != Provider->RunId)
+        {
+            if (!staleEntries)
+                staleEntries = PhCreateList(16);
+
+            PhAddItemList(staleEntries, entry->AllocationBase);
+
+            if (entry->Name)
+            {
+                PhDereferenceObject(entry->Name);
+                entry->Name = NULL;
+            }
+        }
+    }
+
+    if (staleEntries)
+    {
+        for (i = 0; i < staleEntries->Count; i++)
+        {
+            PH_MEMORY_NAME_CACHE_ENTRY lookupEntry;
+
+            lookupEntry.AllocationBase = staleEntries->Items[i];
+            PhRemoveEntryHashtable(Provider->NameCacheHashtable, &lookupEntry);
+        }
+
+        PhDereferenceObject(staleEntries);
+    }
+}
+
+VOID PhpRemoveMemoryItem(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PPH_MEMORY_ITEM MemoryItem
+    )
+{
+    PhRemoveElementAvlTree(&Provider->RegionTree, &MemoryItem->Links);
+    Provider->Callback(Provider, MemoryItemRemoved, MemoryItem);
+    PhDereferenceObject(MemoryItem);
+}
+
+/**
+ * Walks the address space of the process and reports the differences from the
+ * previous walk.
+ *
+ * \param Provider The memory provider.
+ *
+ * \remarks The provider's callback is invoked for each region that was added,
+ * modified or removed since the previous call. Memory items for unchanged regions
+ * are kept and not reported.
+ */
 VOID PhMemoryProviderUpdate(
     _In_ PPH_MEMORY_PROVIDER Provider
     )
 {
     PVOID baseAddress;
     MEMORY_BASIC_INFORMATION basicInfo;
+    PPH_AVL_LINKS nextLinks;
 
     if (!Provider->ProcessHandle)
         return;
 
+    Provider->RunId++;
+
+    // Both the walk and the tree are in ascending order of base address, so we
+    // merge them using a cursor into the tree. Any tree elements that the walk
+    // skips over no longer exist.
+    nextLinks = PhMinimumElementAvlTree(&Provider->RegionTree);
     baseAddress = (PVOID)0;
 
     while (NT_SUCCESS(NtQueryVirtualMemory(
@@ -219,41 +465,156 @@ VOID PhMemoryProviderUpdate(
         )))
     {
         PPH_MEMORY_ITEM memoryItem;
-        BOOLEAN cont;
+        ULONG flags;
+        BOOLEAN added;
+        BOOLEAN newAllocation;
 
-        if (Provider->IgnoreFreeRegions && basicInfo.Type == MEM_FREE)
+        if (Provider->IgnoreFreeRegions && basicInfo.State == MEM_FREE)
             goto ContinueLoop;
 
-        memoryItem = PhCreateMemoryItem();
+        memoryItem = NULL;
+
+        while (nextLinks)
+        {
+            PPH_MEMORY_ITEM existingItem = CONTAINING_RECORD(nextLinks, PH_MEMORY_ITEM, Links);
+
+            if ((ULONG_PTR)existingItem->BaseAddress > (ULONG_PTR)basicInfo.BaseAddress)
+                break;
+
+            nextLinks = PhSuccessorElementAvlTree(nextLinks);
+
+            if (existingItem->BaseAddress == basicInfo.BaseAddress)
+            {
+                memoryItem = existingItem;
+                break;
+            }
+
+            PhpRemoveMemoryItem(Provider, existingItem);
+        }
+
+        flags = basicInfo.State | basicInfo.Type;
+
+        if (memoryItem)
+        {
+            memoryItem->RunId = Provider->RunId;
+
+            if (
+                memoryItem->Size == basicInfo.RegionSize &&
+                memoryItem->Flags == flags &&
+                memoryItem->Protection == basicInfo.Protect &&
+                memoryItem->AllocationBase == basicInfo.AllocationBase
+                )
+            {
+                // Keep the cached name for this allocation alive.
+                if (memoryItem->Flags & (MEM_MAPPED | MEM_IMAGE))
+                    PhpTouchMemoryNameCache(Provider, memoryItem->AllocationBase);
 
-        memoryItem->BaseAddress = basicInfo.BaseAddress;
-        PhPrintPointer(memoryItem->BaseAddressString, memoryItem->BaseAddress);
+                goto ContinueLoop;
+            }
+
+            newAllocation =
+                memoryItem->AllocationBase != basicInfo.AllocationBase ||
+                (memoryItem->Flags & (MEM_PRIVATE | MEM_MAPPED | MEM_IMAGE)) != basicInfo.Type;
+            added = FALSE;
+        }
+        else
+        {
+            memoryItem = PhCreateMemoryItem();
+            memoryItem->BaseAddress = basicInfo.BaseAddress;
+            PhPrintPointer(memoryItem->BaseAddressString, memoryItem->BaseAddress);
+            memoryItem->RunId = Provider->RunId;
+            newAllocation = TRUE;
+            added = TRUE;
+        }
+
+        memoryItem->AllocationBase = basicInfo.AllocationBase;
         memoryItem->Size = basicInfo.RegionSize;
-        memoryItem->Flags = basicInfo.State | basicInfo.Type;
+        memoryItem->Flags = flags;
         memoryItem->Protection = basicInfo.Protect;
 
-        // Get the mapped file name.
-        if (memoryItem->Flags & (MEM_MAPPED | MEM_IMAGE))
+        // Get the mapped file name. Only the first region of an allocation can tell
+        // us that the allocation itself has been replaced.
+        if (newAllocation || !memoryItem->Name)
         {
-            PPH_STRING fileName;
+            PhSwapReference2(&memoryItem->Name, NULL);
 
-            if (NT_SUCCESS(PhGetProcessMappedFileName(
-                Provider->ProcessHandle,
-                memoryItem->BaseAddress,
-                &fileName
-                )))
+            if (memoryItem->Flags & (MEM_MAPPED | MEM_IMAGE))
             {
-                memoryItem->Name = PhGetBaseName(fileName);
-                PhDereferenceObject(fileName);
+                memoryItem->Name = PhpGetMemoryItemName(
+                    Provider,
+                    memoryItem,
+                    newAllocation && memoryItem->BaseAddress == memoryItem->AllocationBase
+                    );
             }
         }
 
-        cont = Provider->Callback(Provider, memoryItem);
-
-        if (!cont)
-            break;
+        if (added)
+        {
+            PhAddElementAvlTree(&Provider->RegionTree, &memoryItem->Links);
+            Provider->Callback(Provider, MemoryItemAdded, memoryItem);
+        }
+        else
+        {
+            Provider->Callback(Provider, MemoryItemModified, memoryItem);
+        }
 
 ContinueLoop:
         baseAddress = PTR_ADD_OFFSET(baseAddress, basicInfo.RegionSize);
     }
+
+    // Remove any regions beyond the end of the walk.
+    while (nextLinks)
+    {
+        PPH_MEMORY_ITEM existingItem = CONTAINING_RECORD(nextLinks, PH_MEMORY_ITEM, Links);
+
+        nextLinks = PhSuccessorElementAvlTree(nextLinks);
+        PhpRemoveMemoryItem(Provider, existingItem);
+    }
+
+    PhpSweepMemoryNameCache(Provider);
+}
+
+/**
+ * Finds the memory item containing an address.
+ *
+ * \param Provider The memory provider.
+ * \param Address The address.
+ *
+ * \return The memory item containing the address, or NULL if no such
+ * item exists. The item is not referenced and is only valid until the
+ * next call to PhMemoryProviderUpdate().
+ */
+PPH_MEMORY_ITEM PhLookupMemoryItem(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PVOID Address
+    )
+{
+    PH_MEMORY_ITEM lookupMemoryItem;
+    PPH_AVL_LINKS links;
+    PPH_MEMORY_ITEM memoryItem;
+    LONG result;
+
+    // Do an approximate search to find the region with the largest base address
+    // that is not larger than the given address.
+    lookupMemoryItem.BaseAddress = Address;
+    links = PhFindElementAvlTree2(&Provider->RegionTree, &lookupMemoryItem.Links, &result);
+
+    if (!links)
+        return NULL;
+
+    if (result < 0)
+    {
+        links = PhPredecessorElementAvlTree(links);
+
+        if (!links)
+            return NULL;
+    }
+
+    memoryItem = CONTAINING_RECORD(links, PH_MEMORY_ITEM, Links);
+
+    if ((ULONG_PTR)Address >= (ULONG_PTR)memoryItem->BaseAddress &&
+        (ULONG_PTR)Address < (ULONG_PTR)memoryItem->BaseAddress + memoryItem->Size)
+        return memoryItem;
+
+    return NULL;
 }
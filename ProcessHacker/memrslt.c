@@ -23,7 +23,6 @@
 #include <phapp.h>
 #include <settings.h>
 #include <memsrch.h>
-#include "pcre/pcre.h"
 #include <windowsx.h>
 
 #define FILTER_CONTAINS 1
@@ -106,6 +105,14 @@ static PPH_STRING PhpGetStringForSelectedResults(
     return PhFinalStringBuilderString(&stringBuilder);
 }
 
+static PPH_STRINGREF NTAPI PhpGetMemoryResultText(
+    _In_ PVOID Item,
+    _In_opt_ PVOID Context
+    )
+{
+    return &((PPH_MEMORY_RESULT)Item)->Display;
+}
+
 static VOID FilterResults(
     _In_ HWND hwndDlg,
     _In_ PMEMORY_RESULTS_CONTEXT Context,
@@ -114,8 +121,6 @@ static VOID FilterResults(
 {
     PPH_STRING selectedChoice = NULL;
     PPH_LIST results;
-    pcre *expression;
-    pcre_extra *expression_extra;
 
     results = Context->Results;
 
@@ -183,90 +188,41 @@ static VOID FilterResults(
         }
         else if (Type == FILTER_REGEX || Type == FILTER_REGEX_IGNORECASE)
         {
-            PPH_ANSI_STRING patternString;
-            char *errorString;
-            int errorOffset;
-            PCHAR ansiBuffer;
-
-            patternString = PhCreateAnsiStringFromUnicodeEx(
-                selectedChoice->Buffer,
-                selectedChoice->Length
-                );
-            PhaDereferenceObject(patternString);
-
-            expression = pcre_compile2(
-                patternString->Buffer,
-                (Type == FILTER_REGEX_IGNORECASE ? PCRE_CASELESS : 0) | PCRE_DOTALL,
-                NULL,
-                &errorString,
-                &errorOffset,
-                NULL
+            PPH_REGEX regex;
+            PPH_STRING errorMessage;
+            PBOOLEAN matches;
+
+            regex = PhCreateRegex(
+                &selectedChoice->sr,
+                (Type == FILTER_REGEX_IGNORECASE ? PH_REGEX_IGNORE_CASE : 0) | PH_REGEX_DOT_ALL,
+                &errorMessage
                 );
 
-            if (!expression)
+            if (!regex)
             {
-                PhShowError(hwndDlg, L"Unable to compile the regular expression: \"%S\" at position %d.",
-                    errorString,
-                    errorOffset
-                    );
+                PhShowError(hwndDlg, L"Unable to compile the regular expression: %s.", errorMessage->Buffer);
+                PhDereferenceObject(errorMessage);
                 continue;
             }
 
-            expression_extra = pcre_study(expression, 0, &errorString);
-
-            ansiBuffer = PhAllocatePage(PH_DISPLAY_BUFFER_COUNT + 1, NULL);
-            newResults = PhCreateList(1024);
+            // The expression is matched against all results at once so that large
+            // result lists can be divided between threads.
+            matches = PhAllocate(results->Count * sizeof(BOOLEAN) + 1);
+            newResults = PhCreateList(PhMatchRegexList(regex, results, PhpGetMemoryResultText, NULL, matches) + 1);
 
             for (i = 0; i < results->Count; i++)
             {
-                PPH_MEMORY_RESULT result = results->Items[i];
-                ULONG ansiLength;
-                int r;
-
-                if (!NT_SUCCESS(RtlUnicodeToMultiByteN(
-                    ansiBuffer,
-                    PH_DISPLAY_BUFFER_COUNT,
-                    &ansiLength,
-                    result->Display.Buffer,
-                    (ULONG)result->Display.Length
-                    )))
-                    continue;
-
-                // Guard against stack overflows.
-                __try
+                if (matches[i])
                 {
-                    r = pcre_exec(
-                        expression,
-                        expression_extra,
-                        ansiBuffer,
-                        ansiLength,
-                        0,
-                        0,
-                        NULL,
-                        0
-                        );
-                }
-                __except (SIMPLE_EXCEPTION_FILTER(GetExceptionCode() == STATUS_STACK_OVERFLOW))
-                {
-                    r = -1;
-
-                    if (!_resetstkoflw())
-                    {
-                        PhRaiseStatus(STATUS_STACK_OVERFLOW);
-                    }
-                }
+                    PPH_MEMORY_RESULT result = results->Items[i];
 
-                if (r >= 0)
-                {
                     PhReferenceMemoryResult(result);
                     PhAddItemList(newResults, result);
                 }
             }
 
-            PhFreePage(ansiBuffer);
-
-            pcre_free(expression_extra);
-            pcre_free(expression);
+            PhFree(matches);
+            PhDereferenceObject(regex);
         }
 
         if (newResults)
@@ -472,10 +472,9 @@ VOID PhModuleProviderUpdate(
             moduleItem->Reserved = 0;
             moduleItem->LoadCount = module->LoadCount;
 
-            moduleItem->Name = module->Name;
-            PhReferenceObject(moduleItem->Name);
-            moduleItem->FileName = module->FileName;
-            PhReferenceObject(moduleItem->FileName);
+            // Most modules are loaded by many processes, so share the names between module items.
+            moduleItem->Name = PhInternString(module->Name);
+            moduleItem->FileName = PhInternString(module->FileName);
 
             PhInitializeImageVersionInfo(
                 &moduleItem->VersionInfo,
@@ -0,0 +1,1066 @@
+/*
+ * Streaming reader and writer for Mini-XML.
+ *
+ * Copyright 2003-2009 by Michael Sweet.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Contents:
+ *
+ *   mxmlStreamLoadFd()          - Read a file descriptor, reporting each
+ *                                 element and text run to a callback.
+ *   mxmlStreamWriterInit()      - Initialize a streaming writer.
+ *   mxmlStreamWriterClose()     - Flush and free a streaming writer.
+ *   mxmlStreamWriteRaw()        - Write unescaped markup or whitespace.
+ *   mxmlStreamWriteElementOpen() - Start an element.
+ *   mxmlStreamWriteAttr()       - Add an attribute to the current element.
+ *   mxmlStreamWriteText()       - Write text content.
+ *   mxmlStreamWriteElementClose() - End an element.
+ *   mxml_stream_grow()          - Grow a buffer.
+ *   mxml_stream_decode()        - Replace entities in place.
+ *   mxml_stream_widen()         - Convert text to UTF-16.
+ *   mxml_stream_data()          - Report a text run.
+ *   mxml_stream_markup()        - Report the contents of a tag.
+ *   mxml_stream_flush()         - Write buffered output.
+ *   mxml_stream_put()           - Write bytes.
+ *   mxml_stream_put_escaped()   - Write UTF-16 text as escaped UTF-8.
+ */
+
+/*
+ * Unlike mxmlSAXLoadFd(), the streaming reader does not create nodes and
+ * does not decode characters one at a time. It scans the raw bytes of each
+ * tag or text run, replaces entities in place and converts the result to
+ * UTF-16 with a single call. Memory use is bounded by the longest tag or
+ * text run in the file, not by the size of the file.
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <phbase.h>
+#include "mxml-private.h"
+
+
+/*
+ * Local types...
+ */
+
+typedef struct _mxml_stream_buf_s	/**** Growable buffer ****/
+{
+  char		*data;			/* Data */
+  int		length,			/* Bytes used */
+		size;			/* Bytes allocated */
+} _mxml_stream_buf_t;
+
+typedef struct _mxml_stream_reader_s	/**** Reader state ****/
+{
+  mxml_stream_cb_t	cb;		/* Callback function */
+  void			*cb_data;	/* Callback data */
+  int			depth;		/* Current element depth */
+  UINT			codepage;	/* Code page of the file */
+  _mxml_stream_buf_t	token;		/* Current tag or text run */
+  wchar_t		*wide;		/* Converted text */
+  int			widesize;	/* Characters allocated */
+  mxml_stream_attr_t	*attrs;		/* Attributes of the current tag */
+  int			attrsize;	/* Attributes allocated */
+  int			*attrlens;	/* Byte lengths of attribute values */
+} _mxml_stream_reader_t;
+
+
+/*
+ * Local functions...
+ */
+
+static int	mxml_stream_data(_mxml_stream_reader_t *r, int cdata);
+static int	mxml_stream_decode(char *s, int length);
+static int	mxml_stream_flush(mxml_stream_writer_t *w);
+static int	mxml_stream_grow(_mxml_stream_buf_t *buf, int size);
+static int	mxml_stream_markup(_mxml_stream_reader_t *r);
+static void	mxml_stream_put(mxml_stream_writer_t *w, const char *s,
+		                int length);
+static void	mxml_stream_put_escaped(mxml_stream_writer_t *w,
+		                        const wchar_t *s, int length,
+		                        int attr);
+static int	mxml_stream_widen(_mxml_stream_reader_t *r, const char *s,
+		                  int length, wchar_t *wide);
+
+#define mxml_stream_isspace(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\r' || (ch) == '\n')
+
+
+/*
+ * 'mxmlStreamLoadFd()' - Read a file descriptor, reporting each element
+ *                        and text run to a callback.
+ *
+ * The callback receives MXML_STREAM_ELEMENT_OPEN and
+ * MXML_STREAM_ELEMENT_CLOSE for each element and MXML_STREAM_DATA for each
+ * run of text or CDATA inside an element. Text may be reported in more than
+ * one piece if it is interrupted by comments or CDATA sections. Comments,
+ * processing directives and declarations are skipped.
+ *
+ * All strings passed to the callback are only valid for the duration of
+ * the call. The callback returns 0 to continue or any other value to stop.
+ *
+ * Files are read as UTF-8. If a file is not valid UTF-8, it is assumed to
+ * have been written in the ANSI code page by an older version.
+ */
+
+int					/* O - 0 on success, -1 on error, or the callback's return value */
+mxmlStreamLoadFd(HANDLE           fd,	/* I - File descriptor to read from */
+                 mxml_stream_cb_t cb,	/* I - Callback function */
+                 void             *cb_data)
+					/* I - Callback data */
+{
+  _mxml_stream_reader_t	r;		/* Reader state */
+  IO_STATUS_BLOCK	isb;		/* I/O status */
+  unsigned char		*buffer;	/* Read buffer */
+  unsigned char		*ptr,		/* Pointer into buffer */
+			*end,		/* End of data in buffer */
+			*start;		/* Start of unconsumed data */
+  int			markup,		/* Non-zero if inside a tag */
+			quote,		/* Quote character, if any */
+			first,		/* Non-zero for first read */
+			status;		/* Return status */
+  NTSTATUS		ntstatus;	/* Status of the read */
+
+
+  memset(&r, 0, sizeof(r));
+  r.cb       = cb;
+  r.cb_data  = cb_data;
+  r.codepage = CP_UTF8;
+
+  if ((buffer = PhAllocateSafe(65536)) == NULL)
+  {
+    mxml_error("Unable to allocate read buffer!");
+    return (-1);
+  }
+
+  markup = 0;
+  quote  = 0;
+  first  = 1;
+  status = 0;
+
+  for (;;)
+  {
+    ntstatus = NtReadFile(fd, NULL, NULL, NULL, &isb, buffer, 65536, NULL, NULL);
+
+    if (ntstatus == STATUS_END_OF_FILE || (NT_SUCCESS(ntstatus) && isb.Information == 0))
+      break;
+
+    if (!NT_SUCCESS(ntstatus))
+    {
+      status = -1;
+      break;
+    }
+
+    ptr = buffer;
+    end = buffer + isb.Information;
+
+    if (first)
+    {
+     /*
+      * Skip the UTF-8 byte order mark...
+      */
+
+      if (isb.Information >= 3 && ptr[0] == 0xef && ptr[1] == 0xbb && ptr[2] == 0xbf)
+        ptr += 3;
+
+      first = 0;
+    }
+
+    start = ptr;
+
+    while (ptr < end)
+    {
+      if (!markup)
+      {
+       /*
+        * Text runs are copied to the token in one piece...
+	*/
+
+        if ((ptr = memchr(ptr, '<', end - ptr)) == NULL)
+	  break;
+
+        if (mxml_stream_grow(&r.token, r.token.length + (int)(ptr - start)))
+	{
+	  status = -1;
+	  goto cleanup;
+	}
+
+        memcpy(r.token.data + r.token.length, start, ptr - start);
+	r.token.length += (int)(ptr - start);
+
+        if (r.token.length > 0 && (status = mxml_stream_data(&r, 0)) != 0)
+	  goto cleanup;
+
+        r.token.length = 0;
+	markup         = 1;
+	quote          = 0;
+	start          = ++ ptr;
+      }
+      else if (*ptr == '>' && !quote)
+      {
+        if (mxml_stream_grow(&r.token, r.token.length + (int)(ptr - start)))
+	{
+	  status = -1;
+	  goto cleanup;
+	}
+
+        memcpy(r.token.data + r.token.length, start, ptr - start);
+	r.token.length += (int)(ptr - start);
+	start = ++ ptr;
+
+       /*
+        * Comments and CDATA sections end with "-->" and "]]>"...
+	*/
+
+        if (r.token.length >= 3 && !memcmp(r.token.data, "!--", 3) &&
+	    (r.token.length < 5 || memcmp(r.token.data + r.token.length - 2, "--", 2)))
+	{
+	  r.token.data[r.token.length ++] = '>';
+	  continue;
+	}
+
+        if (r.token.length >= 8 && !memcmp(r.token.data, "![CDATA[", 8) &&
+	    (r.token.length < 10 || memcmp(r.token.data + r.token.length - 2, "]]", 2)))
+	{
+	  r.token.data[r.token.length ++] = '>';
+	  continue;
+	}
+
+        if ((status = mxml_stream_markup(&r)) != 0)
+	  goto cleanup;
+
+        r.token.length = 0;
+	markup         = 0;
+      }
+      else
+      {
+       /*
+        * Track quotes in element tags so that '>' can appear in
+	* attribute values...
+	*/
+
+        if (quote)
+	{
+	  if (*ptr == quote)
+	    quote = 0;
+	}
+	else if ((*ptr == '\"' || *ptr == '\'') &&
+	         (ptr > start || r.token.length > 0))
+	{
+	  char c = r.token.length > 0 ? r.token.data[0] : *start;
+
+	  if (c != '!' && c != '?')
+	    quote = *ptr;
+	}
+
+        ptr ++;
+      }
+    }
+
+   /*
+    * Save the remainder of the buffer...
+    */
+
+    if (end > start)
+    {
+      if (mxml_stream_grow(&r.token, r.token.length + (int)(end - start)))
+      {
+	status = -1;
+	goto cleanup;
+      }
+
+      memcpy(r.token.data + r.token.length, start, end - start);
+      r.token.length += (int)(end - start);
+    }
+  }
+
+  if (status == 0 && (markup || r.depth != 0))
+  {
+    mxml_error("Unexpected end of file!");
+    status = -1;
+  }
+
+cleanup:
+
+  PhFree(buffer);
+
+  if (r.token.data)
+    PhFree(r.token.data);
+  if (r.wide)
+    PhFree(r.wide);
+  if (r.attrs)
+    PhFree(r.attrs);
+  if (r.attrlens)
+    PhFree(r.attrlens);
+
+  return (status);
+}
+
+
+/*
+ * 'mxmlStreamWriterInit()' - Initialize a streaming writer.
+ */
+
+void
+mxmlStreamWriterInit(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    HANDLE               fd)		/* I - File descriptor to write to */
+{
+  w->fd       = fd;
+  w->error    = 0;
+  w->tag_open = 0;
+  w->current  = w->buffer;
+  w->end      = w->buffer + sizeof(w->buffer);
+  w->temp     = NULL;
+  w->tempsize = 0;
+}
+
+
+/*
+ * 'mxmlStreamWriterClose()' - Flush and free a streaming writer.
+ *
+ * The file descriptor is not closed.
+ */
+
+int					/* O - 0 on success, -1 on error */
+mxmlStreamWriterClose(
+    mxml_stream_writer_t *w)		/* I - Writer */
+{
+  if (!w->error)
+    mxml_stream_flush(w);
+
+  if (w->temp)
+  {
+    PhFree(w->temp);
+    w->temp = NULL;
+  }
+
+  return (w->error ? -1 : 0);
+}
+
+
+/*
+ * 'mxmlStreamWriteRaw()' - Write unescaped markup or whitespace.
+ */
+
+void
+mxmlStreamWriteRaw(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const char           *s)		/* I - String to write */
+{
+  if (w->tag_open)
+  {
+    mxml_stream_put(w, ">", 1);
+    w->tag_open = 0;
+  }
+
+  mxml_stream_put(w, s, (int)strlen(s));
+}
+
+
+/*
+ * 'mxmlStreamWriteElementOpen()' - Start an element.
+ *
+ * Attributes can be added with mxmlStreamWriteAttr() until text, raw data
+ * or another element is written.
+ */
+
+void
+mxmlStreamWriteElementOpen(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const char           *name)		/* I - Element name */
+{
+  if (w->tag_open)
+    mxml_stream_put(w, ">", 1);
+
+  mxml_stream_put(w, "<", 1);
+  mxml_stream_put(w, name, (int)strlen(name));
+  w->tag_open = 1;
+}
+
+
+/*
+ * 'mxmlStreamWriteAttr()' - Add an attribute to the current element.
+ */
+
+void
+mxmlStreamWriteAttr(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const char           *name,		/* I - Attribute name */
+    const wchar_t        *value,	/* I - Attribute value */
+    int                  length)	/* I - Length of value in characters */
+{
+  if (!w->tag_open)
+  {
+    mxml_error("Attribute \"%s\" written outside of a tag!", name);
+    w->error = 1;
+    return;
+  }
+
+  mxml_stream_put(w, " ", 1);
+  mxml_stream_put(w, name, (int)strlen(name));
+  mxml_stream_put(w, "=\"", 2);
+  mxml_stream_put_escaped(w, value, length, 1);
+  mxml_stream_put(w, "\"", 1);
+}
+
+
+/*
+ * 'mxmlStreamWriteText()' - Write text content.
+ */
+
+void
+mxmlStreamWriteText(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const wchar_t        *text,		/* I - Text */
+    int                  length)	/* I - Length of text in characters */
+{
+  if (w->tag_open)
+  {
+    mxml_stream_put(w, ">", 1);
+    w->tag_open = 0;
+  }
+
+  mxml_stream_put_escaped(w, text, length, 0);
+}
+
+
+/*
+ * 'mxmlStreamWriteElementClose()' - End an element.
+ */
+
+void
+mxmlStreamWriteElementClose(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const char           *name)		/* I - Element name */
+{
+  if (w->tag_open)
+  {
+    mxml_stream_put(w, " />", 3);
+    w->tag_open = 0;
+    return;
+  }
+
+  mxml_stream_put(w, "</", 2);
+  mxml_stream_put(w, name, (int)strlen(name));
+  mxml_stream_put(w, ">", 1);
+}
+
+
+/*
+ * 'mxml_stream_grow()' - Grow a buffer.
+ *
+ * One extra byte is always available after the requested size.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+mxml_stream_grow(_mxml_stream_buf_t *buf,/* I - Buffer */
+                 int                size)/* I - Bytes needed */
+{
+  char	*data;				/* New data */
+  int	newsize;			/* New size */
+
+
+  if (size < buf->size)
+    return (0);
+
+  newsize = buf->size ? buf->size : 256;
+
+  while (newsize <= size)
+  {
+    if (newsize > 0x3fffffff)
+    {
+      mxml_error("Unable to expand buffer!");
+      return (-1);
+    }
+
+    newsize *= 2;
+  }
+
+  if (buf->data)
+    data = PhReAllocateSafe(buf->data, newsize);
+  else
+    data = PhAllocateSafe(newsize);
+
+  if (!data)
+  {
+    mxml_error("Unable to expand buffer to %d bytes!", newsize);
+    return (-1);
+  }
+
+  buf->data = data;
+  buf->size = newsize;
+
+  return (0);
+}
+
+
+/*
+ * 'mxml_stream_decode()' - Replace entities in place.
+ *
+ * Entities are never shorter than their UTF-8 encoding, so the result
+ * always fits.
+ */
+
+static int				/* O - New length */
+mxml_stream_decode(char *s,		/* I - String */
+                   int  length)		/* I - Length in bytes */
+{
+  char	*src,				/* Source pointer */
+	*dst,				/* Destination pointer */
+	*end,				/* End of string */
+	*semi;				/* End of entity */
+  char	name[32];			/* Entity name */
+  int	ch;				/* Character value */
+
+
+  if ((src = memchr(s, '&', length)) == NULL)
+    return (length);
+
+  dst = src;
+  end = s + length;
+
+  while (src < end)
+  {
+    if (*src != '&')
+    {
+      *dst++ = *src++;
+      continue;
+    }
+
+    semi = memchr(src, ';', end - src);
+
+    if (!semi || semi - src - 1 >= (int)sizeof(name) || semi - src < 2)
+    {
+      *dst++ = *src++;
+      continue;
+    }
+
+    memcpy(name, src + 1, semi - src - 1);
+    name[semi - src - 1] = '\0';
+
+    if (name[0] == '#')
+    {
+      if (name[1] == 'x' || name[1] == 'X')
+        ch = strtol(name + 2, NULL, 16);
+      else
+        ch = strtol(name + 1, NULL, 10);
+    }
+    else
+      ch = mxmlEntityGetValue(name);
+
+    if (ch <= 0 || ch > 0x10ffff)
+    {
+     /*
+      * Keep unknown entities as they are...
+      */
+
+      *dst++ = *src++;
+      continue;
+    }
+
+    if (ch < 0x80)
+      *dst++ = ch;
+    else if (ch < 0x800)
+    {
+      *dst++ = 0xc0 | (ch >> 6);
+      *dst++ = 0x80 | (ch & 0x3f);
+    }
+    else if (ch < 0x10000)
+    {
+      *dst++ = 0xe0 | (ch >> 12);
+      *dst++ = 0x80 | ((ch >> 6) & 0x3f);
+      *dst++ = 0x80 | (ch & 0x3f);
+    }
+    else
+    {
+      *dst++ = 0xf0 | (ch >> 18);
+      *dst++ = 0x80 | ((ch >> 12) & 0x3f);
+      *dst++ = 0x80 | ((ch >> 6) & 0x3f);
+      *dst++ = 0x80 | (ch & 0x3f);
+    }
+
+    src = semi + 1;
+  }
+
+  return ((int)(dst - s));
+}
+
+
+/*
+ * 'mxml_stream_widen()' - Convert text to UTF-16.
+ *
+ * The destination must have room for length characters.
+ */
+
+static int				/* O - Number of characters or -1 on error */
+mxml_stream_widen(
+    _mxml_stream_reader_t *r,		/* I - Reader */
+    const char            *s,		/* I - Text */
+    int                   length,	/* I - Length in bytes */
+    wchar_t               *wide)	/* I - Destination */
+{
+  int	count;				/* Number of characters */
+
+
+  if (length == 0)
+    return (0);
+
+  count = MultiByteToWideChar(r->codepage, r->codepage == CP_UTF8 ? MB_ERR_INVALID_CHARS : 0,
+                              s, length, wide, length);
+
+  if (count == 0 && r->codepage == CP_UTF8)
+  {
+   /*
+    * Not UTF-8; older versions wrote files in the ANSI code page...
+    */
+
+    r->codepage = CP_ACP;
+    count = MultiByteToWideChar(r->codepage, 0, s, length, wide, length);
+  }
+
+  if (count == 0)
+  {
+    mxml_error("Unable to convert text!");
+    return (-1);
+  }
+
+  return (count);
+}
+
+
+/*
+ * 'mxml_stream_data()' - Report a text run.
+ */
+
+static int				/* O - 0 to continue, non-zero to stop */
+mxml_stream_data(_mxml_stream_reader_t *r,/* I - Reader */
+                 int                   cdata)
+					/* I - Non-zero if CDATA (no entities) */
+{
+  mxml_stream_node_t	node;		/* Node information */
+  char			*text;		/* Text */
+  int			length;		/* Length of text */
+
+
+ /*
+  * Text outside of the root element (normally whitespace) is ignored...
+  */
+
+  if (r->depth == 0)
+    return (0);
+
+  if (cdata)
+  {
+    text   = r->token.data + 8;
+    length = r->token.length - 10;
+  }
+  else
+  {
+    text   = r->token.data;
+    length = mxml_stream_decode(text, r->token.length);
+  }
+
+  if (length + 1 > r->widesize)
+  {
+    wchar_t *wide;
+
+    if (r->wide)
+      wide = PhReAllocateSafe(r->wide, (length + 1) * sizeof(wchar_t));
+    else
+      wide = PhAllocateSafe((length + 1) * sizeof(wchar_t));
+
+    if (!wide)
+    {
+      mxml_error("Unable to allocate text buffer!");
+      return (-1);
+    }
+
+    r->wide     = wide;
+    r->widesize = length + 1;
+  }
+
+  memset(&node, 0, sizeof(node));
+  node.depth = r->depth;
+
+  if ((node.length = mxml_stream_widen(r, text, length, r->wide)) < 0)
+    return (-1);
+
+  r->wide[node.length] = 0;
+  node.text = r->wide;
+
+  return ((*r->cb)(MXML_STREAM_DATA, &node, r->cb_data));
+}
+
+
+/*
+ * 'mxml_stream_markup()' - Report the contents of a tag.
+ */
+
+static int				/* O - 0 to continue, non-zero to stop */
+mxml_stream_markup(_mxml_stream_reader_t *r)
+					/* I - Reader */
+{
+  mxml_stream_node_t	node;		/* Node information */
+  char			*ptr,		/* Pointer into tag */
+			*end;		/* End of tag */
+  int			empty,		/* Non-zero for <element/> */
+			total,		/* Total bytes of attribute values */
+			offset,		/* Offset into converted values */
+			count,		/* Characters converted */
+			i,		/* Looping var */
+			status;		/* Callback status */
+  char			quote;		/* Quote character */
+
+
+  ptr = r->token.data;
+  end = ptr + r->token.length;
+
+  if (r->token.length == 0)
+  {
+    mxml_error("Empty tag!");
+    return (-1);
+  }
+
+  if (*ptr == '?' || (*ptr == '!' && (r->token.length < 8 || memcmp(ptr, "![CDATA[", 8))))
+  {
+   /*
+    * Skip comments, directives and declarations...
+    */
+
+    return (0);
+  }
+
+  if (*ptr == '!')
+    return (mxml_stream_data(r, 1));
+
+  memset(&node, 0, sizeof(node));
+
+  if (*ptr == '/')
+  {
+   /*
+    * Close tag...
+    */
+
+    for (ptr ++; end > ptr && mxml_stream_isspace(end[-1]); end --);
+
+    *end = '\0';
+
+    if (r->depth == 0)
+    {
+      mxml_error("Mismatched close tag <%s>!", r->token.data);
+      return (-1);
+    }
+
+    node.depth = r->depth --;
+    node.name  = ptr;
+
+    return ((*r->cb)(MXML_STREAM_ELEMENT_CLOSE, &node, r->cb_data));
+  }
+
+ /*
+  * Open tag...
+  */
+
+  for (; end > ptr && mxml_stream_isspace(end[-1]); end --);
+
+  if ((empty = (end > ptr && end[-1] == '/')) != 0)
+    end --;
+
+  node.name = ptr;
+
+  while (ptr < end && !mxml_stream_isspace(*ptr))
+    ptr ++;
+
+  if (ptr < end)
+    *ptr++ = '\0';
+  else
+    *end = '\0';
+
+  total = 0;
+
+  while (ptr < end)
+  {
+    while (ptr < end && mxml_stream_isspace(*ptr))
+      ptr ++;
+
+    if (ptr >= end)
+      break;
+
+    if (node.num_attrs >= r->attrsize)
+    {
+      mxml_stream_attr_t	*attrs;
+      int			*attrlens;
+      int			newsize = r->attrsize ? r->attrsize * 2 : 4;
+
+      attrs    = r->attrs ? PhReAllocateSafe(r->attrs, newsize * sizeof(mxml_stream_attr_t))
+                          : PhAllocateSafe(newsize * sizeof(mxml_stream_attr_t));
+
+      if (attrs)
+        r->attrs = attrs;
+
+      attrlens = r->attrlens ? PhReAllocateSafe(r->attrlens, newsize * sizeof(int))
+                             : PhAllocateSafe(newsize * sizeof(int));
+
+      if (attrlens)
+        r->attrlens = attrlens;
+
+      if (!attrs || !attrlens)
+      {
+        mxml_error("Unable to allocate attributes!");
+	return (-1);
+      }
+
+      r->attrsize = newsize;
+    }
+
+    r->attrs[node.num_attrs].name = ptr;
+
+    while (ptr < end && *ptr != '=' && !mxml_stream_isspace(*ptr))
+      ptr ++;
+
+    if (ptr < end && *ptr != '=')
+    {
+      *ptr++ = '\0';
+
+      while (ptr < end && mxml_stream_isspace(*ptr))
+        ptr ++;
+    }
+
+    if (ptr >= end || *ptr != '=')
+    {
+      mxml_error("Missing value for attribute in <%s>!", node.name);
+      return (-1);
+    }
+
+    *ptr++ = '\0';
+
+    while (ptr < end && mxml_stream_isspace(*ptr))
+      ptr ++;
+
+    if (ptr >= end || (*ptr != '\"' && *ptr != '\''))
+    {
+      mxml_error("Unquoted attribute value in <%s>!", node.name);
+      return (-1);
+    }
+
+    quote = *ptr++;
+
+   /*
+    * Values are converted after all attributes have been parsed, so store
+    * the byte offset for now...
+    */
+
+    r->attrs[node.num_attrs].value = (const wchar_t *)(ULONG_PTR)(ptr - r->token.data);
+
+    while (ptr < end && *ptr != quote)
+      ptr ++;
+
+    if (ptr >= end)
+    {
+      mxml_error("Unterminated attribute value in <%s>!", node.name);
+      return (-1);
+    }
+
+    *ptr = '\0';
+    r->attrlens[node.num_attrs] = mxml_stream_decode(
+        r->token.data + (ULONG_PTR)r->attrs[node.num_attrs].value,
+        (int)(ptr - r->token.data - (ULONG_PTR)r->attrs[node.num_attrs].value));
+    total += r->attrlens[node.num_attrs] + 1;
+    node.num_attrs ++;
+    ptr ++;
+  }
+
+ /*
+  * Convert all of the attribute values into one buffer...
+  */
+
+  if (total > r->widesize)
+  {
+    wchar_t *wide;
+
+    if (r->wide)
+      wide = PhReAllocateSafe(r->wide, total * sizeof(wchar_t));
+    else
+      wide = PhAllocateSafe(total * sizeof(wchar_t));
+
+    if (!wide)
+    {
+      mxml_error("Unable to allocate attribute buffer!");
+      return (-1);
+    }
+
+    r->wide     = wide;
+    r->widesize = total;
+  }
+
+  for (i = 0, offset = 0; i < node.num_attrs; i ++)
+  {
+    if ((count = mxml_stream_widen(r, r->token.data + (ULONG_PTR)r->attrs[i].value,
+                                   r->attrlens[i], r->wide + offset)) < 0)
+      return (-1);
+
+    r->wide[offset + count] = 0;
+    r->attrs[i].value  = r->wide + offset;
+    r->attrs[i].length = count;
+    offset += count + 1;
+  }
+
+  node.attrs = r->attrs;
+  node.depth = ++ r->depth;
+
+  if ((status = (*r->cb)(MXML_STREAM_ELEMENT_OPEN, &node, r->cb_data)) != 0)
+    return (status);
+
+  if (empty)
+  {
+    node.num_attrs = 0;
+    node.attrs     = NULL;
+    r->depth --;
+
+    return ((*r->cb)(MXML_STREAM_ELEMENT_CLOSE, &node, r->cb_data));
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'mxml_stream_flush()' - Write buffered output.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+mxml_stream_flush(mxml_stream_writer_t *w)/* I - Writer */
+{
+  IO_STATUS_BLOCK isb;
+
+
+  if (w->current == w->buffer)
+    return (0);
+
+  if (!NT_SUCCESS(NtWriteFile(w->fd, NULL, NULL, NULL, &isb, w->buffer,
+                              (ULONG)(w->current - w->buffer), NULL, NULL)))
+  {
+    w->error = 1;
+    return (-1);
+  }
+
+  w->current = w->buffer;
+
+  return (0);
+}
+
+
+/*
+ * 'mxml_stream_put()' - Write bytes.
+ */
+
+static void
+mxml_stream_put(mxml_stream_writer_t *w,/* I - Writer */
+                const char           *s,/* I - Bytes */
+                int                  length)
+					/* I - Number of bytes */
+{
+  int	count;				/* Bytes to copy */
+
+
+  while (length > 0 && !w->error)
+  {
+    if (w->current >= w->end && mxml_stream_flush(w))
+      return;
+
+    count = (int)(w->end - w->current);
+
+    if (count > length)
+      count = length;
+
+    memcpy(w->current, s, count);
+    w->current += count;
+    s          += count;
+    length     -= count;
+  }
+}
+
+
+/*
+ * 'mxml_stream_put_escaped()' - Write UTF-16 text as escaped UTF-8.
+ */
+
+static void
+mxml_stream_put_escaped(
+    mxml_stream_writer_t *w,		/* I - Writer */
+    const wchar_t        *s,		/* I - Text */
+    int                  length,	/* I - Length in characters */
+    int                  attr)		/* I - Non-zero for attribute values */
+{
+  int		count,			/* Bytes converted */
+		i,			/* Looping var */
+		start;			/* Start of unescaped run */
+  const char	*name;			/* Entity name */
+
+
+  if (length <= 0 || w->error)
+    return;
+
+ /*
+  * Convert the whole string at once; UTF-8 needs at most 3 bytes for each
+  * UTF-16 code unit...
+  */
+
+  if (length * 3 > w->tempsize)
+  {
+    char *temp;
+
+    if (w->temp)
+      temp = PhReAllocateSafe(w->temp, length * 3);
+    else
+      temp = PhAllocateSafe(length * 3);
+
+    if (!temp)
+    {
+      mxml_error("Unable to allocate conversion buffer!");
+      w->error = 1;
+      return;
+    }
+
+    w->temp     = temp;
+    w->tempsize = length * 3;
+  }
+
+  if ((count = WideCharToMultiByte(CP_UTF8, 0, s, length, w->temp, w->tempsize,
+                                   NULL, NULL)) == 0)
+  {
+    mxml_error("Unable to convert text!");
+    w->error = 1;
+    return;
+  }
+
+  for (i = 0, start = 0; i < count; i ++)
+  {
+    char ch = w->temp[i];
+
+    if (ch == '&' || ch == '<' || ch == '>' || (attr && ch == '\"'))
+    {
+      mxml_stream_put(w, w->temp + start, i - start);
+
+      name = mxmlEntityGetName(ch);
+      mxml_stream_put(w, "&", 1);
+      mxml_stream_put(w, name, (int)strlen(name));
+      mxml_stream_put(w, ";", 1);
+
+      start = i + 1;
+    }
+  }
+
+  mxml_stream_put(w, w->temp + start, count - start);
+}
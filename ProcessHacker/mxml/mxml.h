@@ -184,6 +184,45 @@ typedef const char *(*mxml_save_cb_t)(mxml_node_t *, int);
 typedef void (*mxml_sax_cb_t)(mxml_node_t *, mxml_sax_event_t, void *);  
 					/**** SAX callback function ****/
 
+typedef enum mxml_stream_event_e	/**** Streaming event type. ****/
+{
+  MXML_STREAM_ELEMENT_OPEN,		/* Element opened */
+  MXML_STREAM_ELEMENT_CLOSE,		/* Element closed */
+  MXML_STREAM_DATA			/* Text or CDATA */
+} mxml_stream_event_t;
+
+typedef struct mxml_stream_attr_s	/**** Streaming attribute. ****/
+{
+  const char		*name;		/* Attribute name */
+  const wchar_t		*value;		/* Attribute value */
+  int			length;		/* Length of value in characters */
+} mxml_stream_attr_t;
+
+typedef struct mxml_stream_node_s	/**** Streaming node information. ****/
+{
+  int			depth;		/* Element depth, 1 for the root */
+  const char		*name;		/* Element name */
+  int			num_attrs;	/* Number of attributes */
+  mxml_stream_attr_t	*attrs;		/* Attributes */
+  const wchar_t		*text;		/* Text */
+  int			length;		/* Length of text in characters */
+} mxml_stream_node_t;
+
+typedef int (*mxml_stream_cb_t)(mxml_stream_event_t, mxml_stream_node_t *, void *);
+					/**** Streaming callback function ****/
+
+typedef struct mxml_stream_writer_s	/**** Streaming writer. ****/
+{
+  HANDLE		fd;		/* File descriptor */
+  int			error;		/* Non-zero if an error occurred */
+  int			tag_open;	/* Non-zero if a start tag is open */
+  char			*current,	/* Current position in buffer */
+			*end;		/* End of buffer */
+  char			*temp;		/* Conversion buffer */
+  int			tempsize;	/* Size of conversion buffer */
+  char			buffer[8192];	/* Output buffer */
+} mxml_stream_writer_t;
+
 
 /*
  * C++ support...
@@ -268,6 +307,22 @@ extern mxml_node_t	*mxmlSAXLoadFile(mxml_node_t *top, FILE *fp,
 extern mxml_node_t	*mxmlSAXLoadString(mxml_node_t *top, const char *s,
 			                   mxml_type_t (*cb)(mxml_node_t *),
 			                   mxml_sax_cb_t sax, void *sax_data);
+PHMXMLAPI extern int		mxmlStreamLoadFd(HANDLE fd, mxml_stream_cb_t cb,
+			                 void *cb_data);
+PHMXMLAPI extern void		mxmlStreamWriteAttr(mxml_stream_writer_t *w,
+			                    const char *name,
+			                    const wchar_t *value, int length);
+PHMXMLAPI extern void		mxmlStreamWriteElementClose(mxml_stream_writer_t *w,
+			                            const char *name);
+PHMXMLAPI extern void		mxmlStreamWriteElementOpen(mxml_stream_writer_t *w,
+			                           const char *name);
+PHMXMLAPI extern void		mxmlStreamWriteRaw(mxml_stream_writer_t *w,
+			                   const char *s);
+PHMXMLAPI extern void		mxmlStreamWriteText(mxml_stream_writer_t *w,
+			                    const wchar_t *text, int length);
+PHMXMLAPI extern int		mxmlStreamWriterClose(mxml_stream_writer_t *w);
+PHMXMLAPI extern void		mxmlStreamWriterInit(mxml_stream_writer_t *w,
+			                     HANDLE fd);
 PHMXMLAPI extern int		mxmlSetCDATA(mxml_node_t *node, const char *data);
 PHMXMLAPI extern int		mxmlSetCustom(mxml_node_t *node, void *data,
 			              mxml_custom_destroy_cb_t destroy);
@@ -3700,30 +3700,23 @@ VOID PhpRefreshProcessMemoryList(
 
     ExtendedListView_SetRedraw(memoryContext->ListViewHandle, FALSE);
 
-    // Get rid of existing memory items.
-    PhDereferenceObjects(memoryContext->MemoryList->Items, memoryContext->MemoryList->Count);
-    PhClearList(memoryContext->MemoryList);
-    ListView_DeleteAllItems(memoryContext->ListViewHandle);
-
+    // The provider only reports regions which have changed since the last refresh.
     PhMemoryProviderUpdate(&memoryContext->Provider);
+
     ExtendedListView_SortItems(memoryContext->ListViewHandle);
     ExtendedListView_SetRedraw(memoryContext->ListViewHandle, TRUE);
 }
 
-BOOLEAN NTAPI PhpProcessMemoryCallback(
-    _In_ PPH_MEMORY_PROVIDER Provider,
-    _In_ _Assume_refs_(1) PPH_MEMORY_ITEM MemoryItem
+VOID PhpUpdateMemoryItemInListView(
+    _In_ HANDLE ListViewHandle,
+    _In_ INT ItemIndex,
+    _In_ PPH_MEMORY_ITEM MemoryItem
     )
 {
-    PPH_PROCESS_PROPPAGECONTEXT propPageContext = Provider->Context;
-    PPH_MEMORY_CONTEXT memoryContext = propPageContext->Context;
-    INT lvItemIndex;
     PPH_STRING string;
     PWSTR name;
     WCHAR protectionString[17];
 
-    PhAddItemList(memoryContext->MemoryList, MemoryItem);
-
     // Name
 
     string = NULL;
@@ -3757,41 +3750,83 @@ BOOLEAN NTAPI PhpProcessMemoryCallback(
         name = string->Buffer;
     }
 
-    lvItemIndex = PhAddListViewItem(memoryContext->ListViewHandle, MAXINT, name, MemoryItem);
+    PhSetListViewSubItem(ListViewHandle, ItemIndex, 0, name);
 
     if (string)
         PhDereferenceObject(string);
 
     // Base address
-    PhSetListViewSubItem(memoryContext->ListViewHandle, lvItemIndex, 1, MemoryItem->BaseAddressString);
+    PhSetListViewSubItem(ListViewHandle, ItemIndex, 1, MemoryItem->BaseAddressString);
 
     // Size
     string = PhFormatSize(MemoryItem->Size, -1);
-    PhSetListViewSubItem(memoryContext->ListViewHandle, lvItemIndex, 2, string->Buffer);
+    PhSetListViewSubItem(ListViewHandle, ItemIndex, 2, string->Buffer);
     PhDereferenceObject(string);
 
     // Protection
     PhGetMemoryProtectionString(MemoryItem->Protection, protectionString);
-    PhSetListViewSubItem(memoryContext->ListViewHandle, lvItemIndex, 3, protectionString);
+    PhSetListViewSubItem(ListViewHandle, ItemIndex, 3, protectionString);
+}
 
-    return TRUE;
+INT PhpFindMemoryItemInListView(
+    _In_ PPH_MEMORY_CONTEXT MemoryContext,
+    _In_ PPH_MEMORY_ITEM MemoryItem
+    )
+{
+    PVOID *id;
+
+    // List view item IDs do not change when items are sorted or deleted, so this avoids
+    // searching the list view for each region.
+    id = PhFindItemSimpleHashtable(MemoryContext->ItemIdHashtable, MemoryItem);
+
+    if (!id)
+        return -1;
+
+    return ListView_MapIDToIndex(MemoryContext->ListViewHandle, PtrToUlong(*id));
 }
 
-VOID PhpUpdateMemoryItemInListView(
-    _In_ HANDLE ListViewHandle,
+VOID NTAPI PhpProcessMemoryCallback(
+    _In_ PPH_MEMORY_PROVIDER Provider,
+    _In_ PH_MEMORY_PROVIDER_ACTION Action,
     _In_ PPH_MEMORY_ITEM MemoryItem
     )
 {
+    PPH_PROCESS_PROPPAGECONTEXT propPageContext = Provider->Context;
+    PPH_MEMORY_CONTEXT memoryContext = propPageContext->Context;
     INT lvItemIndex;
 
-    lvItemIndex = PhFindListViewItemByParam(ListViewHandle, -1, MemoryItem);
-
-    if (lvItemIndex != -1)
+    switch (Action)
     {
-        WCHAR protectionString[17];
+    case MemoryItemAdded:
+        {
+            // The provider holds a reference to each memory item until the item is removed.
+            lvItemIndex = PhAddListViewItem(memoryContext->ListViewHandle, MAXINT, L"", MemoryItem);
+            PhpUpdateMemoryItemInListView(memoryContext->ListViewHandle, lvItemIndex, MemoryItem);
+            PhAddItemSimpleHashtable(
+                memoryContext->ItemIdHashtable,
+                MemoryItem,
+                UlongToPtr(ListView_MapIndexToID(memoryContext->ListViewHandle, lvItemIndex))
+                );
+        }
+        break;
+    case MemoryItemModified:
+        {
+            lvItemIndex = PhpFindMemoryItemInListView(memoryContext, MemoryItem);
+
+            if (lvItemIndex != -1)
+                PhpUpdateMemoryItemInListView(memoryContext->ListViewHandle, lvItemIndex, MemoryItem);
+        }
+        break;
+    case MemoryItemRemoved:
+        {
+            lvItemIndex = PhpFindMemoryItemInListView(memoryContext, MemoryItem);
+
+            if (lvItemIndex != -1)
+                ListView_DeleteItem(memoryContext->ListViewHandle, lvItemIndex);
 
-        PhGetMemoryProtectionString(MemoryItem->Protection, protectionString);
-        PhSetListViewSubItem(ListViewHandle, lvItemIndex, 3, protectionString);
+            PhRemoveItemSimpleHashtable(memoryContext->ItemIdHashtable, MemoryItem);
+        }
+        break;
     }
 }
 
@@ -3885,8 +3920,8 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                 PhpProcessMemoryCallback,
                 propPageContext
                 );
-            memoryContext->MemoryList = PhCreateList(40);
             memoryContext->ListViewHandle = lvHandle;
+            memoryContext->ItemIdHashtable = PhCreateSimpleHashtable(512);
 
             PhSetListViewStyle(lvHandle, TRUE, TRUE);
             PhSetControlTheme(lvHandle, L"explorer");
@@ -3910,9 +3945,8 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
 
             memoryContext = propPageContext->Context;
 
-            PhDereferenceObjects(memoryContext->MemoryList->Items, memoryContext->MemoryList->Count);
-            PhDereferenceObject(memoryContext->MemoryList);
             PhDeleteMemoryProvider(&memoryContext->Provider);
+            PhDereferenceObject(memoryContext->ItemIdHashtable);
             PhFree(memoryContext);
 
             PhSaveListViewColumnsToSetting(L"MemoryListViewColumns", lvHandle);
@@ -4064,16 +4098,27 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                 break;
             case ID_MEMORY_CHANGEPROTECTION:
                 {
+                    PPH_MEMORY_CONTEXT memoryContext = propPageContext->Context;
                     PPH_MEMORY_ITEM memoryItem = PhGetSelectedListViewItemParam(lvHandle);
+                    INT lvItemIndex;
 
                     if (memoryItem)
                     {
                         PhReferenceObject(memoryItem);
 
                         PhShowMemoryProtectDialog(hwndDlg, processItem, memoryItem);
-                        PhpUpdateMemoryItemInListView(lvHandle, memoryItem);
+
+                        // The dialog updates the protection of the item directly, so the
+                        // provider will not report it as modified.
+                        lvItemIndex = PhpFindMemoryItemInListView(memoryContext, memoryItem);
+
+                        if (lvItemIndex != -1)
+                            PhpUpdateMemoryItemInListView(lvHandle, lvItemIndex, memoryItem);
 
                         PhDereferenceObject(memoryItem);
+
+                        // Changing the protection of part of a region splits it.
+                        PhpRefreshProcessMemoryList(hwndDlg, propPageContext);
                     }
                 }
                 break;
@@ -4086,7 +4131,8 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                         PhReferenceObject(memoryItem);
                         PhUiFreeMemory(hwndDlg, processItem->ProcessId, memoryItem, TRUE);
                         PhDereferenceObject(memoryItem);
-                        // TODO: somehow update the list
+
+                        PhpRefreshProcessMemoryList(hwndDlg, propPageContext);
                     }
                 }
                 break;
@@ -4099,6 +4145,8 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
                         PhReferenceObject(memoryItem);
                         PhUiFreeMemory(hwndDlg, processItem->ProcessId, memoryItem, FALSE);
                         PhDereferenceObject(memoryItem);
+
+                        PhpRefreshProcessMemoryList(hwndDlg, propPageContext);
                     }
                 }
                 break;
@@ -4128,28 +4176,12 @@ INT_PTR CALLBACK PhpProcessMemoryDlgProc(
 
                         if (PhStringToInteger64(&selectedChoice->sr, 0, &address64))
                         {
-                            ULONG i;
-                            PPH_MEMORY_ITEM memoryItem = NULL;
-                            BOOLEAN found = FALSE;
+                            PPH_MEMORY_ITEM memoryItem;
 
                             address = (ULONG_PTR)address64;
+                            memoryItem = PhLookupMemoryItem(&memoryContext->Provider, (PVOID)address);
 
-                            for (i = 0; i < memoryContext->MemoryList->Count; i++)
-                            {
-                                memoryItem = memoryContext->MemoryList->Items[i];
-
-                                // Dumb linear search.
-                                if (
-                                    address >= (ULONG_PTR)memoryItem->BaseAddress &&
-                                    address < (ULONG_PTR)memoryItem->BaseAddress + memoryItem->Size
-                                    )
-                                {
-                                    found = TRUE;
-                                    break;
-                                }
-                            }
-
-                            if (found)
+                            if (memoryItem)
                             {
                                 PPH_SHOWMEMORYEDITOR showMemoryEditor = PhAllocate(sizeof(PH_SHOWMEMORYEDITOR));
 
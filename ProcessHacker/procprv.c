@@ -66,6 +66,38 @@
 #define PROCESS_ID_BUCKETS 64
 #define PROCESS_ID_TO_BUCKET_INDEX(ProcessId) (((ULONG)(ProcessId) / 4) & (PROCESS_ID_BUCKETS - 1))
 
+// Existing process items are only updated in parallel when there are enough of them
+// to make up for the cost of waking the worker threads.
+#define PH_PROCESS_UPDATE_PARALLEL_THRESHOLD 256
+#define PH_PROCESS_UPDATE_MINIMUM_CHUNK_SIZE 64
+#define PH_PROCESS_UPDATE_MAXIMUM_CHUNKS 16
+
+// The maximum number of process records examined by each call to PhPurgeProcessRecords.
+#define PH_PROCESS_RECORD_PURGE_BATCH_SIZE 1024
+
+// Information about an image file which is shared between all processes
+// running that image. Entries are keyed on the file name and the file's
+// size and last write time, and are removed when the last process item
+// referencing them is deleted.
+typedef struct _PH_IMAGE_METADATA
+{
+    PPH_STRING FileName;
+    ULONG Hash;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER EndOfFile;
+
+    PH_INITONCE Stage1InitOnce;
+    HICON SmallIcon;
+    HICON LargeIcon;
+    PH_IMAGE_VERSION_INFO VersionInfo;
+
+    PH_INITONCE Stage2InitOnce;
+    NTSTATUS PackedStatus;
+    BOOLEAN IsPacked;
+    ULONG ImportFunctions;
+    ULONG ImportModules;
+} PH_IMAGE_METADATA, *PPH_IMAGE_METADATA;
+
 typedef struct _PH_PROCESS_QUERY_DATA
 {
     SLIST_ENTRY ListEntry;
@@ -79,9 +111,9 @@ typedef struct _PH_PROCESS_QUERY_S1_DATA
 
     PPH_STRING CommandLine;
 
+    PPH_IMAGE_METADATA ImageMetadata;
     HICON SmallIcon;
     HICON LargeIcon;
-    PH_IMAGE_VERSION_INFO VersionInfo;
 
     TOKEN_ELEVATION_TYPE ElevationType;
     BOOLEAN IsElevated;
@@ -105,6 +137,8 @@ typedef struct _PH_PROCESS_QUERY_S2_DATA
 {
     PH_PROCESS_QUERY_DATA Header;
 
+    PPH_IMAGE_METADATA ImageMetadata; // from stage 1
+
     VERIFY_RESULT VerifyResult;
     PPH_STRING VerifySignerName;
 
@@ -122,6 +156,33 @@ typedef struct _PH_VERIFY_CACHE_ENTRY
     PPH_STRING VerifySignerName;
 } PH_VERIFY_CACHE_ENTRY, *PPH_VERIFY_CACHE_ENTRY;
 
+typedef struct _PH_PROCESS_UPDATE_ENTRY
+{
+    PPH_PROCESS_ITEM ProcessItem;
+    PSYSTEM_PROCESS_INFORMATION Process;
+    BOOLEAN Modified;
+} PH_PROCESS_UPDATE_ENTRY, *PPH_PROCESS_UPDATE_ENTRY;
+
+typedef struct _PH_PROCESS_UPDATE_PARAMETERS
+{
+    BOOLEAN IsCycleCpuUsageEnabled;
+    ULONG64 SysTotalTime;
+    ULONG64 SysTotalCycleTime;
+    LONG PendingChunks;
+} PH_PROCESS_UPDATE_PARAMETERS, *PPH_PROCESS_UPDATE_PARAMETERS;
+
+typedef struct _PH_PROCESS_UPDATE_CHUNK
+{
+    PPH_PROCESS_UPDATE_PARAMETERS Parameters;
+    PPH_PROCESS_UPDATE_ENTRY Entries;
+    ULONG Count;
+
+    FLOAT MaxCpuValue;
+    PPH_PROCESS_ITEM MaxCpuProcessItem;
+    ULONG64 MaxIoValue;
+    PPH_PROCESS_ITEM MaxIoProcessItem;
+} PH_PROCESS_UPDATE_CHUNK, *PPH_PROCESS_UPDATE_CHUNK;
+
 VOID NTAPI PhpProcessItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -132,18 +193,43 @@ INT NTAPI PhpVerifyCacheCompareFunction(
     _In_ PPH_AVL_LINKS Links2
     );
 
+VOID NTAPI PhpImageMetadataDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+BOOLEAN NTAPI PhpImageMetadataCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpImageMetadataHashFunction(
+    _In_ PVOID Entry
+    );
+
 VOID PhpQueueProcessQueryStage1(
     _In_ PPH_PROCESS_ITEM ProcessItem
     );
 
 VOID PhpQueueProcessQueryStage2(
-    _In_ PPH_PROCESS_ITEM ProcessItem
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_opt_ PPH_IMAGE_METADATA ImageMetadata
     );
 
 PPH_PROCESS_RECORD PhpCreateProcessRecord(
     _In_ PPH_PROCESS_ITEM ProcessItem
     );
 
+LONG NTAPI PhpProcessRecordCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    );
+
+LONG NTAPI PhpProcessRecordProcessIdCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    );
+
 VOID PhpAddProcessRecord(
     _Inout_ PPH_PROCESS_RECORD ProcessRecord
     );
@@ -165,8 +251,12 @@ PHAPPAPI PH_CALLBACK_DECLARE(PhProcessModifiedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessRemovedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhProcessesUpdatedEvent);
 
-PPH_LIST PhProcessRecordList;
-PH_QUEUED_LOCK PhProcessRecordListLock = PH_QUEUED_LOCK_INIT;
+PH_AVL_TREE PhProcessRecordSet = PH_AVL_TREE_INIT(PhpProcessRecordCompareFunction);
+PH_QUEUED_LOCK PhProcessRecordSetLock = PH_QUEUED_LOCK_INIT;
+static PH_AVL_TREE PhpProcessRecordProcessIdSet = PH_AVL_TREE_INIT(PhpProcessRecordProcessIdCompareFunction);
+static LARGE_INTEGER PhpPurgeCursorCreateTime;
+static HANDLE PhpPurgeCursorProcessId;
+static BOOLEAN PhpPurgeCursorValid = FALSE;
 
 ULONG PhStatisticsSampleCount = 512;
 BOOLEAN PhEnableProcessQueryStage2 = FALSE;
@@ -174,6 +264,7 @@ BOOLEAN PhEnablePurgeProcessRecords = TRUE;
 BOOLEAN PhEnableCycleCpuUsage = TRUE;
 
 PVOID PhProcessInformation; // only can be used if running on same thread as process provider
+static PPH_PROCESS_SNAPSHOT PhpProcessSnapshot = NULL; // owns PhProcessInformation
 SYSTEM_PERFORMANCE_INFORMATION PhPerfInformation;
 PSYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuInformation;
 SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION PhCpuTotals;
@@ -243,6 +334,16 @@ static PH_AVL_TREE PhpVerifyCacheSet = PH_AVL_TREE_INIT(PhpVerifyCacheCompareFun
 static PH_QUEUED_LOCK PhpVerifyCacheLock = PH_QUEUED_LOCK_INIT;
 #endif
 
+static PPH_OBJECT_TYPE PhpImageMetadataType;
+static PPH_HASHTABLE PhpImageMetadataHashtable;
+static PH_QUEUED_LOCK PhpImageMetadataLock = PH_QUEUED_LOCK_INIT;
+
+static PPH_PROCESS_UPDATE_ENTRY PhpProcessUpdateEntries = NULL;
+static ULONG PhpProcessUpdateEntriesAllocated = 0;
+static BOOLEAN PhpProcessUpdateWorkQueueInitialized = FALSE;
+static PH_WORK_QUEUE PhpProcessUpdateWorkQueue;
+static HANDLE PhpProcessUpdateEventHandle = NULL;
+
 BOOLEAN PhProcessProviderInitialization(
     VOID
     )
@@ -259,9 +360,22 @@ BOOLEAN PhProcessProviderInitialization(
         )))
         return FALSE;
 
-    RtlInitializeSListHead(&PhProcessQueryDataListHead);
+    if (!NT_SUCCESS(PhCreateObjectType(
+        &PhpImageMetadataType,
+        L"ImageMetadata",
+        0,
+        PhpImageMetadataDeleteProcedure
+        )))
+        return FALSE;
+
+    PhpImageMetadataHashtable = PhCreateHashtable(
+        sizeof(PPH_IMAGE_METADATA),
+        PhpImageMetadataCompareFunction,
+        PhpImageMetadataHashFunction,
+        64
+        );
 
-    PhProcessRecordList = PhCreateList(40);
+    RtlInitializeSListHead(&PhProcessQueryDataListHead);
 
     RtlInitUnicodeString(
         &PhDpcsProcessInformation.ImageName,
@@ -320,6 +434,12 @@ BOOLEAN PhProcessProviderInitialization(
 
     memset(deltaBuffer, 0, sizeof(PH_UINT64_DELTA) * (ULONG)PhSystemBasicInformation.NumberOfProcessors);
 
+    PhRegisterQueuedLockProfile(&PhProcessHashSetLock, L"PhProcessHashSetLock");
+    PhRegisterQueuedLockProfile(&PhpImageMetadataLock, L"PhpImageMetadataLock");
+#ifdef PH_ENABLE_VERIFY_CACHE
+    PhRegisterQueuedLockProfile(&PhpVerifyCacheLock, L"PhpVerifyCacheLock");
+#endif
+
     return TRUE;
 }
 
@@ -495,8 +615,18 @@ VOID PhpProcessItemDeleteProcedure(
     if (processItem->ProcessName) PhDereferenceObject(processItem->ProcessName);
     if (processItem->FileName) PhDereferenceObject(processItem->FileName);
     if (processItem->CommandLine) PhDereferenceObject(processItem->CommandLine);
-    if (processItem->SmallIcon) DestroyIcon(processItem->SmallIcon);
-    if (processItem->LargeIcon) DestroyIcon(processItem->LargeIcon);
+
+    // Icons from the image metadata cache are owned by the cache entry.
+    if (processItem->ImageMetadata)
+    {
+        PhDereferenceObject(processItem->ImageMetadata);
+    }
+    else
+    {
+        if (processItem->SmallIcon) DestroyIcon(processItem->SmallIcon);
+        if (processItem->LargeIcon) DestroyIcon(processItem->LargeIcon);
+    }
+
     PhDeleteImageVersionInfo(&processItem->VersionInfo);
     if (processItem->UserName) PhDereferenceObject(processItem->UserName);
     if (processItem->JobName) PhDereferenceObject(processItem->JobName);
@@ -860,6 +990,221 @@ VERIFY_RESULT PhVerifyFileCached(
 #endif
 }
 
+VOID NTAPI PhpImageMetadataDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_IMAGE_METADATA metadata = (PPH_IMAGE_METADATA)Object;
+    PPH_IMAGE_METADATA *entry;
+
+    // The entry may already have been replaced by a newer one with the same key
+    // (see PhpReferenceImageMetadata), so make sure we only remove ourselves.
+    PhAcquireQueuedLockExclusive(&PhpImageMetadataLock);
+
+    entry = PhFindEntryHashtable(PhpImageMetadataHashtable, &metadata);
+
+    if (entry && *entry == metadata)
+        PhRemoveEntryHashtable(PhpImageMetadataHashtable, &metadata);
+
+    PhReleaseQueuedLockExclusive(&PhpImageMetadataLock);
+
+    if (metadata->SmallIcon) DestroyIcon(metadata->SmallIcon);
+    if (metadata->LargeIcon) DestroyIcon(metadata->LargeIcon);
+    PhDeleteImageVersionInfo(&metadata->VersionInfo);
+    PhDereferenceObject(metadata->FileName);
+}
+
+BOOLEAN NTAPI PhpImageMetadataCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_IMAGE_METADATA metadata1 = *(PPH_IMAGE_METADATA *)Entry1;
+    PPH_IMAGE_METADATA metadata2 = *(PPH_IMAGE_METADATA *)Entry2;
+
+    return
+        metadata1->Hash == metadata2->Hash &&
+        metadata1->LastWriteTime.QuadPart == metadata2->LastWriteTime.QuadPart &&
+        metadata1->EndOfFile.QuadPart == metadata2->EndOfFile.QuadPart &&
+        PhEqualString(metadata1->FileName, metadata2->FileName, TRUE);
+}
+
+ULONG NTAPI PhpImageMetadataHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return (*(PPH_IMAGE_METADATA *)Entry)->Hash;
+}
+
+/**
+ * Gets the shared metadata entry for an image file, creating one if
+ * necessary.
+ *
+ * \param FileName The file name of the image.
+ *
+ * \return The metadata entry. You must dereference it using
+ * PhDereferenceObject() when you no longer need it.
+ */
+PPH_IMAGE_METADATA PhpReferenceImageMetadata(
+    _In_ PPH_STRING FileName
+    )
+{
+    PH_IMAGE_METADATA lookupMetadata;
+    PPH_IMAGE_METADATA lookupMetadataPtr = &lookupMetadata;
+    PPH_IMAGE_METADATA metadata;
+    PPH_IMAGE_METADATA *entry;
+    FILE_NETWORK_OPEN_INFORMATION networkOpenInfo;
+    PPH_STRING upperFileName;
+
+    // The file's size and last write time distinguish between different
+    // versions of an image with the same name, e.g. after an update.
+    if (NT_SUCCESS(PhQueryFullAttributesFileWin32(FileName->Buffer, &networkOpenInfo)))
+    {
+        lookupMetadata.LastWriteTime = networkOpenInfo.LastWriteTime;
+        lookupMetadata.EndOfFile = networkOpenInfo.EndOfFile;
+    }
+    else
+    {
+        lookupMetadata.LastWriteTime.QuadPart = 0;
+        lookupMetadata.EndOfFile.QuadPart = 0;
+    }
+
+    upperFileName = PhDuplicateString(FileName);
+    PhUpperString(upperFileName);
+    lookupMetadata.FileName = FileName;
+    lookupMetadata.Hash = PhHashBytes((PUCHAR)upperFileName->Buffer, upperFileName->Length);
+    PhDereferenceObject(upperFileName);
+
+    PhAcquireQueuedLockShared(&PhpImageMetadataLock);
+
+    entry = PhFindEntryHashtable(PhpImageMetadataHashtable, &lookupMetadataPtr);
+
+    // The entry may be in the process of being deleted.
+    if (entry && PhReferenceObjectSafe(*entry))
+        metadata = *entry;
+    else
+        metadata = NULL;
+
+    PhReleaseQueuedLockShared(&PhpImageMetadataLock);
+
+    if (metadata)
+        return metadata;
+
+    if (!NT_SUCCESS(PhCreateObject(
+        &metadata,
+        sizeof(PH_IMAGE_METADATA),
+        0,
+        PhpImageMetadataType
+        )))
+        return NULL;
+
+    memset(metadata, 0, sizeof(PH_IMAGE_METADATA));
+    PhReferenceObject(FileName);
+    metadata->FileName = FileName;
+    metadata->Hash = lookupMetadata.Hash;
+    metadata->LastWriteTime = lookupMetadata.LastWriteTime;
+    metadata->EndOfFile = lookupMetadata.EndOfFile;
+    PhInitializeInitOnce(&metadata->Stage1InitOnce);
+    PhInitializeInitOnce(&metadata->Stage2InitOnce);
+
+    PhAcquireQueuedLockExclusive(&PhpImageMetadataLock);
+
+    entry = PhFindEntryHashtable(PhpImageMetadataHashtable, &lookupMetadataPtr);
+
+    if (entry && PhReferenceObjectSafe(*entry))
+    {
+        PPH_IMAGE_METADATA existingMetadata = *entry;
+
+        // Someone else added an entry while we weren't holding the lock.
+        PhReleaseQueuedLockExclusive(&PhpImageMetadataLock);
+        PhDereferenceObject(metadata);
+
+        return existingMetadata;
+    }
+
+    // Replace any entry which is being deleted. Its delete procedure will see that it
+    // is no longer in the hashtable.
+    if (entry)
+        PhRemoveEntryHashtable(PhpImageMetadataHashtable, &lookupMetadataPtr);
+
+    PhAddEntryHashtable(PhpImageMetadataHashtable, &metadata);
+
+    PhReleaseQueuedLockExclusive(&PhpImageMetadataLock);
+
+    return metadata;
+}
+
+/**
+ * Queries the icons and version information of an image. If another thread is
+ * already querying the same image, the function waits for it to finish.
+ */
+VOID PhpQueryImageMetadataStage1(
+    _Inout_ PPH_IMAGE_METADATA Metadata
+    )
+{
+    if (!PhBeginInitOnce(&Metadata->Stage1InitOnce))
+        return;
+
+    // Small icon, large icon.
+    if (ExtractIconEx(
+        Metadata->FileName->Buffer,
+        0,
+        &Metadata->LargeIcon,
+        &Metadata->SmallIcon,
+        1
+        ) == 0)
+    {
+        Metadata->LargeIcon = NULL;
+        Metadata->SmallIcon = NULL;
+    }
+
+    // Version info.
+    PhInitializeImageVersionInfo(&Metadata->VersionInfo, Metadata->FileName->Buffer);
+
+    // Use the default EXE icon if we didn't get the file's icon.
+    if (!Metadata->SmallIcon || !Metadata->LargeIcon)
+    {
+        if (Metadata->SmallIcon)
+        {
+            DestroyIcon(Metadata->SmallIcon);
+            Metadata->SmallIcon = NULL;
+        }
+        else if (Metadata->LargeIcon)
+        {
+            DestroyIcon(Metadata->LargeIcon);
+            Metadata->LargeIcon = NULL;
+        }
+
+        PhGetStockApplicationIcon(&Metadata->SmallIcon, &Metadata->LargeIcon);
+        Metadata->SmallIcon = DuplicateIcon(NULL, Metadata->SmallIcon);
+        Metadata->LargeIcon = DuplicateIcon(NULL, Metadata->LargeIcon);
+    }
+
+    PhEndInitOnce(&Metadata->Stage1InitOnce);
+}
+
+/**
+ * Checks whether an image is packed. If another thread is already checking the
+ * same image, the function waits for it to finish.
+ */
+VOID PhpQueryImageMetadataStage2(
+    _Inout_ PPH_IMAGE_METADATA Metadata
+    )
+{
+    if (!PhBeginInitOnce(&Metadata->Stage2InitOnce))
+        return;
+
+    Metadata->PackedStatus = PhIsExecutablePacked(
+        Metadata->FileName->Buffer,
+        &Metadata->IsPacked,
+        &Metadata->ImportModules,
+        &Metadata->ImportFunctions
+        );
+
+    PhEndInitOnce(&Metadata->Stage2InitOnce);
+}
+
 VOID PhpProcessQueryStage1(
     _Inout_ PPH_PROCESS_QUERY_S1_DATA Data
     )
@@ -871,44 +1216,19 @@ VOID PhpProcessQueryStage1(
 
     PhOpenProcess(&processHandleLimited, ProcessQueryAccess, processId);
 
+    // Icons and version info are shared between all processes running the same image.
     if (processItem->FileName)
     {
-        // Small icon, large icon.
-        if (ExtractIconEx(
-            processItem->FileName->Buffer,
-            0,
-            &Data->LargeIcon,
-            &Data->SmallIcon,
-            1
-            ) == 0)
-        {
-            Data->LargeIcon = NULL;
-            Data->SmallIcon = NULL;
-        }
-
-        // Version info.
-        PhInitializeImageVersionInfo(&Data->VersionInfo, processItem->FileName->Buffer);
+        if (Data->ImageMetadata = PhpReferenceImageMetadata(processItem->FileName))
+            PhpQueryImageMetadataStage1(Data->ImageMetadata);
     }
 
-    // Use the default EXE icon if we didn't get the file's icon.
+    // Use the default EXE icon if we don't have a file name.
+    if (!Data->ImageMetadata)
     {
-        if (!Data->SmallIcon || !Data->LargeIcon)
-        {
-            if (Data->SmallIcon)
-            {
-                DestroyIcon(Data->SmallIcon);
-                Data->SmallIcon = NULL;
-            }
-            else if (Data->LargeIcon)
-            {
-                DestroyIcon(Data->LargeIcon);
-                Data->LargeIcon = NULL;
-            }
-
-            PhGetStockApplicationIcon(&Data->SmallIcon, &Data->LargeIcon);
-            Data->SmallIcon = DuplicateIcon(NULL, Data->SmallIcon);
-            Data->LargeIcon = DuplicateIcon(NULL, Data->LargeIcon);
-        }
+        PhGetStockApplicationIcon(&Data->SmallIcon, &Data->LargeIcon);
+        Data->SmallIcon = DuplicateIcon(NULL, Data->SmallIcon);
+        Data->LargeIcon = DuplicateIcon(NULL, Data->LargeIcon);
     }
 
 #ifdef _M_X64
@@ -1103,7 +1423,7 @@ VOID PhpProcessQueryStage1(
     if (processHandleLimited)
         NtClose(processHandleLimited);
 
-    PhpQueueProcessQueryStage2(processItem);
+    PhpQueueProcessQueryStage2(processItem, Data->ImageMetadata);
 }
 
 VOID PhpProcessQueryStage2(
@@ -1117,6 +1437,7 @@ VOID PhpProcessQueryStage2(
     if (PhEnableProcessQueryStage2 && processItem->FileName)
     {
         PPH_STRING packageFullName = NULL;
+        PPH_IMAGE_METADATA metadata = Data->ImageMetadata;
 
         if (processItem->QueryHandle)
             packageFullName = PhGetProcessPackageFullName(processItem->QueryHandle);
@@ -1131,12 +1452,23 @@ VOID PhpProcessQueryStage2(
         if (packageFullName)
             PhDereferenceObject(packageFullName);
 
-        status = PhIsExecutablePacked(
-            processItem->FileName->Buffer,
-            &Data->IsPacked,
-            &Data->ImportModules,
-            &Data->ImportFunctions
-            );
+        if (metadata)
+        {
+            PhpQueryImageMetadataStage2(metadata);
+            status = metadata->PackedStatus;
+            Data->IsPacked = metadata->IsPacked;
+            Data->ImportModules = metadata->ImportModules;
+            Data->ImportFunctions = metadata->ImportFunctions;
+        }
+        else
+        {
+            status = PhIsExecutablePacked(
+                processItem->FileName->Buffer,
+                &Data->IsPacked,
+                &Data->ImportModules,
+                &Data->ImportFunctions
+                );
+        }
 
         // If we got an image-related error, the image is packed.
         if (
@@ -1150,6 +1482,12 @@ VOID PhpProcessQueryStage2(
             Data->ImportFunctions = -1;
         }
     }
+
+    if (Data->ImageMetadata)
+    {
+        PhDereferenceObject(Data->ImageMetadata);
+        Data->ImageMetadata = NULL;
+    }
 }
 
 NTSTATUS PhpProcessQueryStage1Worker(
@@ -1175,13 +1513,7 @@ NTSTATUS PhpProcessQueryStage2Worker(
     _In_ PVOID Parameter
     )
 {
-    PPH_PROCESS_QUERY_S2_DATA data;
-    PPH_PROCESS_ITEM processItem = (PPH_PROCESS_ITEM)Parameter;
-
-    data = PhAllocate(sizeof(PH_PROCESS_QUERY_S2_DATA));
-    memset(data, 0, sizeof(PH_PROCESS_QUERY_S2_DATA));
-    data->Header.Stage = 2;
-    data->Header.ProcessItem = processItem;
+    PPH_PROCESS_QUERY_S2_DATA data = (PPH_PROCESS_QUERY_S2_DATA)Parameter;
 
     PhpProcessQueryStage2(data);
 
@@ -1201,13 +1533,29 @@ VOID PhpQueueProcessQueryStage1(
 }
 
 VOID PhpQueueProcessQueryStage2(
-    _In_ PPH_PROCESS_ITEM ProcessItem
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_opt_ PPH_IMAGE_METADATA ImageMetadata
     )
 {
     if (PhEnableProcessQueryStage2)
     {
+        PPH_PROCESS_QUERY_S2_DATA data;
+
+        data = PhAllocate(sizeof(PH_PROCESS_QUERY_S2_DATA));
+        memset(data, 0, sizeof(PH_PROCESS_QUERY_S2_DATA));
+        data->Header.Stage = 2;
+        data->Header.ProcessItem = ProcessItem;
+
+        // Stage 2 reuses the metadata entry found by stage 1 instead of looking
+        // up the image again.
+        if (ImageMetadata)
+        {
+            PhReferenceObject(ImageMetadata);
+            data->ImageMetadata = ImageMetadata;
+        }
+
         PhReferenceObject(ProcessItem);
-        PhQueueItemGlobalWorkQueue(PhpProcessQueryStage2Worker, ProcessItem);
+        PhQueueItemGlobalWorkQueue(PhpProcessQueryStage2Worker, data);
     }
 }
 
@@ -1218,9 +1566,29 @@ VOID PhpFillProcessItemStage1(
     PPH_PROCESS_ITEM processItem = Data->Header.ProcessItem;
 
     processItem->CommandLine = Data->CommandLine;
-    processItem->SmallIcon = Data->SmallIcon;
-    processItem->LargeIcon = Data->LargeIcon;
-    memcpy(&processItem->VersionInfo, &Data->VersionInfo, sizeof(PH_IMAGE_VERSION_INFO));
+
+    if (Data->ImageMetadata)
+    {
+        PPH_IMAGE_METADATA metadata = Data->ImageMetadata;
+
+        // The process item takes the reference to the metadata entry, which owns the icons.
+        // The version info strings are shared.
+        processItem->ImageMetadata = metadata;
+        processItem->SmallIcon = metadata->SmallIcon;
+        processItem->LargeIcon = metadata->LargeIcon;
+        memcpy(&processItem->VersionInfo, &metadata->VersionInfo, sizeof(PH_IMAGE_VERSION_INFO));
+
+        if (processItem->VersionInfo.CompanyName) PhReferenceObject(processItem->VersionInfo.CompanyName);
+        if (processItem->VersionInfo.FileDescription) PhReferenceObject(processItem->VersionInfo.FileDescription);
+        if (processItem->VersionInfo.FileVersion) PhReferenceObject(processItem->VersionInfo.FileVersion);
+        if (processItem->VersionInfo.ProductName) PhReferenceObject(processItem->VersionInfo.ProductName);
+    }
+    else
+    {
+        processItem->SmallIcon = Data->SmallIcon;
+        processItem->LargeIcon = Data->LargeIcon;
+    }
+
     processItem->ElevationType = Data->ElevationType;
     processItem->IntegrityLevel = Data->IntegrityLevel;
     processItem->IntegrityString = Data->IntegrityString;
@@ -1265,7 +1633,10 @@ VOID PhpFillProcessItem(
 
     if (ProcessItem->ProcessId != SYSTEM_IDLE_PROCESS_ID)
     {
-        ProcessItem->ProcessName = PhCreateStringEx(Process->ImageName.Buffer, Process->ImageName.Length);
+        PH_STRINGREF processName;
+
+        PhUnicodeStringToStringRef(&Process->ImageName, &processName);
+        ProcessItem->ProcessName = PhInternStringRef(&processName);
     }
     else
     {
@@ -1298,8 +1669,9 @@ VOID PhpFillProcessItem(
                 PPH_STRING newFileName;
 
                 newFileName = PhGetFileName(fileName);
-                ProcessItem->FileName = newFileName;
+                ProcessItem->FileName = PhInternString(newFileName);
 
+                PhDereferenceObject(newFileName);
                 PhDereferenceObject(fileName);
             }
         }
@@ -1314,8 +1686,9 @@ VOID PhpFillProcessItem(
                 PPH_STRING newFileName;
 
                 newFileName = PhGetFileName(fileName);
-                ProcessItem->FileName = newFileName;
+                ProcessItem->FileName = PhInternString(newFileName);
 
+                PhDereferenceObject(newFileName);
                 PhDereferenceObject(fileName);
             }
         }
@@ -1341,7 +1714,14 @@ VOID PhpFillProcessItem(
 
                 if (NT_SUCCESS(status))
                 {
-                    ProcessItem->UserName = PhGetSidFullName(user->User.Sid, TRUE, NULL);
+                    PPH_STRING userName;
+
+                    if (userName = PhGetSidFullName(user->User.Sid, TRUE, NULL))
+                    {
+                        ProcessItem->UserName = PhInternString(userName);
+                        PhDereferenceObject(userName);
+                    }
+
                     PhFree(user);
                 }
             }
@@ -1811,79 +2191,390 @@ VOID PhpGetProcessThreadInformation(
         *ContextSwitches = contextSwitches;
 }
 
-VOID PhProcessProviderUpdate(
-    _In_ PVOID Object
+/**
+ * Updates an item for a process that was already present in the previous update.
+ *
+ * \param Entry The entry for the process item. The Modified field is set if the
+ * process modified event needs to be raised for the item.
+ * \param Chunk The chunk that contains the entry. The maximum CPU and I/O values
+ * of the chunk are updated.
+ *
+ * \remarks This function may be called from any thread. It only modifies the
+ * process item given by \a Entry and the chunk given by \a Chunk.
+ */
+VOID PhpUpdateExistingProcessItem(
+    _Inout_ PPH_PROCESS_UPDATE_ENTRY Entry,
+    _Inout_ PPH_PROCESS_UPDATE_CHUNK Chunk
     )
 {
-    static ULONG runCount = 0;
-    static PSYSTEM_PROCESS_INFORMATION pidBuckets[PROCESS_ID_BUCKETS];
-
-    // Note about locking:
-    // Since this is the only function that is allowed to
-    // modify the process hashtable, locking is not needed
-    // for shared accesses. However, exclusive accesses
-    // need locking.
+    PPH_PROCESS_ITEM processItem = Entry->ProcessItem;
+    PSYSTEM_PROCESS_INFORMATION process = Entry->Process;
+    BOOLEAN modified = FALSE;
+    BOOLEAN isSuspended;
+    ULONG contextSwitches;
+    FLOAT newCpuUsage;
+    FLOAT kernelCpuUsage;
+    FLOAT userCpuUsage;
 
-    PVOID processes;
-    PSYSTEM_PROCESS_INFORMATION process;
-    ULONG bucketIndex;
+    PhpGetProcessThreadInformation(process, &isSuspended, &contextSwitches);
+    PhpUpdateDynamicInfoProcessItem(processItem, process);
 
-    BOOLEAN isCycleCpuUsageEnabled = FALSE;
+    // Update the deltas.
+    PhUpdateDelta(&processItem->CpuKernelDelta, process->KernelTime.QuadPart);
+    PhUpdateDelta(&processItem->CpuUserDelta, process->UserTime.QuadPart);
+    PhUpdateDelta(&processItem->IoReadDelta, process->ReadTransferCount.QuadPart);
+    PhUpdateDelta(&processItem->IoWriteDelta, process->WriteTransferCount.QuadPart);
+    PhUpdateDelta(&processItem->IoOtherDelta, process->OtherTransferCount.QuadPart);
+    PhUpdateDelta(&processItem->IoReadCountDelta, process->ReadOperationCount.QuadPart);
+    PhUpdateDelta(&processItem->IoWriteCountDelta, process->WriteOperationCount.QuadPart);
+    PhUpdateDelta(&processItem->IoOtherCountDelta, process->OtherOperationCount.QuadPart);
+    PhUpdateDelta(&processItem->ContextSwitchesDelta, contextSwitches);
+    PhUpdateDelta(&processItem->PageFaultsDelta, process->PageFaultCount);
+    PhUpdateDelta(&processItem->CycleTimeDelta, process->CycleTime);
+    PhUpdateDelta(&processItem->PrivateBytesDelta, process->PagefileUsage);
 
-    ULONG64 sysTotalTime; // total time for this update period
-    ULONG64 sysTotalCycleTime = 0; // total cycle time for this update period
-    ULONG64 sysIdleCycleTime = 0; // total idle cycle time for this update period
-    FLOAT maxCpuValue = 0;
-    PPH_PROCESS_ITEM maxCpuProcessItem = NULL;
-    ULONG64 maxIoValue = 0;
-    PPH_PROCESS_ITEM maxIoProcessItem = NULL;
+    processItem->SequenceNumber++;
+    PhAddItemCircularBuffer_ULONG64(&processItem->IoReadHistory, processItem->IoReadDelta.Delta);
+    PhAddItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, processItem->IoWriteDelta.Delta);
+    PhAddItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, processItem->IoOtherDelta.Delta);
 
-    // Pre-update tasks
+    PhAddItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, processItem->VmCounters.PagefileUsage);
+    //PhAddItemCircularBuffer_SIZE_T(&processItem->WorkingSetHistory, processItem->VmCounters.WorkingSetSize);
 
-    if (runCount % 8 == 0)
+    if (processItem->JustProcessed)
     {
-        PhUpdateDosDevicePrefixes();
+        processItem->JustProcessed = FALSE;
+        modified = TRUE;
     }
 
-    if (runCount % 512 == 0) // yes, a very long time
+    if (Chunk->Parameters->IsCycleCpuUsageEnabled)
     {
-        if (PhEnablePurgeProcessRecords)
-            PhPurgeProcessRecords();
-    }
+        FLOAT totalDelta;
 
-    isCycleCpuUsageEnabled = WindowsVersion >= WINDOWS_7 && PhEnableCycleCpuUsage;
+        newCpuUsage = (FLOAT)processItem->CycleTimeDelta.Delta / Chunk->Parameters->SysTotalCycleTime;
 
-    if (!PhProcessStatisticsInitialized)
-    {
-        PhpInitializeProcessStatistics();
-        PhProcessStatisticsInitialized = TRUE;
-    }
+        // Calculate the kernel/user CPU usage based on the kernel/user time. If the kernel and
+        // user deltas are both zero, we'll just have to use an estimate. Currently, we split
+        // the CPU usage evenly across the kernel and user components, except when the total
+        // user time is zero, in which case we assign it all to the kernel component.
 
-    PhpUpdatePerfInformation();
+        totalDelta = (FLOAT)(processItem->CpuKernelDelta.Delta + processItem->CpuUserDelta.Delta);
 
-    if (isCycleCpuUsageEnabled)
-    {
-        PhpUpdateCpuInformation(FALSE, &sysTotalTime);
-        PhpUpdateCpuCycleInformation(&sysIdleCycleTime);
+        if (totalDelta != 0)
+        {
+            kernelCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuKernelDelta.Delta / totalDelta);
+            userCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuUserDelta.Delta / totalDelta);
+        }
+        else
+        {
+            if (processItem->UserTime.QuadPart != 0)
+            {
+                kernelCpuUsage = newCpuUsage / 2;
+                userCpuUsage = newCpuUsage / 2;
+            }
+            else
+            {
+                kernelCpuUsage = newCpuUsage;
+                userCpuUsage = 0;
+            }
+        }
     }
     else
     {
-        PhpUpdateCpuInformation(TRUE, &sysTotalTime);
+        kernelCpuUsage = (FLOAT)processItem->CpuKernelDelta.Delta / Chunk->Parameters->SysTotalTime;
+        userCpuUsage = (FLOAT)processItem->CpuUserDelta.Delta / Chunk->Parameters->SysTotalTime;
+        newCpuUsage = kernelCpuUsage + userCpuUsage;
     }
 
-    if (runCount != 0)
-    {
-        PhTimeSequenceNumber++;
-    }
+    processItem->CpuUsage = newCpuUsage;
+    processItem->CpuKernelUsage = kernelCpuUsage;
+    processItem->CpuUserUsage = userCpuUsage;
 
-    // Get the process list.
+    PhAddItemCircularBuffer_FLOAT(&processItem->CpuKernelHistory, kernelCpuUsage);
+    PhAddItemCircularBuffer_FLOAT(&processItem->CpuUserHistory, userCpuUsage);
 
-    PhTotalProcesses = 0;
-    PhTotalThreads = 0;
-    PhTotalHandles = 0;
+    // Max. values
 
-    if (!NT_SUCCESS(PhEnumProcesses(&processes)))
-        return;
+    if (processItem->ProcessId != NULL)
+    {
+        if (Chunk->MaxCpuValue < newCpuUsage)
+        {
+            Chunk->MaxCpuValue = newCpuUsage;
+            Chunk->MaxCpuProcessItem = processItem;
+        }
+
+        // I/O for Other is not included because it is too generic.
+        if (Chunk->MaxIoValue < processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta)
+        {
+            Chunk->MaxIoValue = processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta;
+            Chunk->MaxIoProcessItem = processItem;
+        }
+    }
+
+    // Debugged
+    if (processItem->QueryHandle)
+    {
+        BOOLEAN isBeingDebugged;
+
+        if (NT_SUCCESS(PhGetProcessIsBeingDebugged(
+            processItem->QueryHandle,
+            &isBeingDebugged
+            )) && processItem->IsBeingDebugged != isBeingDebugged)
+        {
+            processItem->IsBeingDebugged = isBeingDebugged;
+            modified = TRUE;
+        }
+    }
+
+    // Suspended
+    if (processItem->IsSuspended != isSuspended)
+    {
+        processItem->IsSuspended = isSuspended;
+        modified = TRUE;
+    }
+
+    // .NET
+    if (processItem->UpdateIsDotNet)
+    {
+        BOOLEAN isDotNet;
+
+        if (NT_SUCCESS(PhGetProcessIsDotNet(processItem->ProcessId, &isDotNet)))
+        {
+            processItem->IsDotNet = isDotNet;
+            modified = TRUE;
+        }
+
+        processItem->UpdateIsDotNet = FALSE;
+    }
+
+    // Immersive
+    if (processItem->QueryHandle && IsImmersiveProcess_I)
+    {
+        BOOLEAN isImmersive;
+
+        isImmersive = !!IsImmersiveProcess_I(processItem->QueryHandle);
+
+        if (processItem->IsImmersive != isImmersive)
+        {
+            processItem->IsImmersive = isImmersive;
+            modified = TRUE;
+        }
+    }
+
+    Entry->Modified = modified;
+}
+
+VOID PhpUpdateProcessItemChunk(
+    _Inout_ PPH_PROCESS_UPDATE_CHUNK Chunk
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Chunk->Count; i++)
+    {
+        PhpUpdateExistingProcessItem(&Chunk->Entries[i], Chunk);
+    }
+}
+
+NTSTATUS PhpProcessUpdateChunkWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_PROCESS_UPDATE_CHUNK chunk = Parameter;
+
+    PhpUpdateProcessItemChunk(chunk);
+
+    if (_InterlockedDecrement(&chunk->Parameters->PendingChunks) == 0)
+        NtSetEvent(PhpProcessUpdateEventHandle, NULL);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Updates the items for processes that were already present in the previous update.
+ *
+ * \param Parameters The parameters for this update period.
+ * \param Entries An array of entries, in process list order.
+ * \param Count The number of entries.
+ * \param Result A variable which receives the maximum CPU and I/O values.
+ *
+ * \remarks Large process lists are divided into chunks which are updated
+ * concurrently. The maximum values of the chunks are combined in order, so the
+ * result is the same as if the entries were updated one by one.
+ */
+VOID PhpUpdateExistingProcessItems(
+    _Inout_ PPH_PROCESS_UPDATE_PARAMETERS Parameters,
+    _Inout_updates_(Count) PPH_PROCESS_UPDATE_ENTRY Entries,
+    _In_ ULONG Count,
+    _Out_ PPH_PROCESS_UPDATE_CHUNK Result
+    )
+{
+    PH_PROCESS_UPDATE_CHUNK chunks[PH_PROCESS_UPDATE_MAXIMUM_CHUNKS];
+    ULONG numberOfChunks;
+    ULONG chunkSize;
+    ULONG i;
+
+    numberOfChunks = 1;
+
+    if (Count >= PH_PROCESS_UPDATE_PARALLEL_THRESHOLD && PhSystemBasicInformation.NumberOfProcessors > 1)
+    {
+        numberOfChunks = min((ULONG)PhSystemBasicInformation.NumberOfProcessors, PH_PROCESS_UPDATE_MAXIMUM_CHUNKS);
+        numberOfChunks = min(numberOfChunks, Count / PH_PROCESS_UPDATE_MINIMUM_CHUNK_SIZE);
+
+        if (!PhpProcessUpdateWorkQueueInitialized)
+        {
+            if (NT_SUCCESS(NtCreateEvent(&PhpProcessUpdateEventHandle, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+            {
+                PhInitializeWorkQueue(&PhpProcessUpdateWorkQueue, 0, PH_PROCESS_UPDATE_MAXIMUM_CHUNKS - 1, 5000);
+                PhpProcessUpdateWorkQueueInitialized = TRUE;
+            }
+        }
+
+        if (!PhpProcessUpdateWorkQueueInitialized)
+            numberOfChunks = 1;
+    }
+
+    chunkSize = (Count + numberOfChunks - 1) / numberOfChunks;
+
+    for (i = 0; i < numberOfChunks; i++)
+    {
+        ULONG startIndex;
+
+        startIndex = min(i * chunkSize, Count);
+
+        chunks[i].Parameters = Parameters;
+        chunks[i].Entries = &Entries[startIndex];
+        chunks[i].Count = min((i + 1) * chunkSize, Count) - startIndex;
+        chunks[i].MaxCpuValue = 0;
+        chunks[i].MaxCpuProcessItem = NULL;
+        chunks[i].MaxIoValue = 0;
+        chunks[i].MaxIoProcessItem = NULL;
+    }
+
+    // The current thread takes the first chunk and then waits for the others.
+    if (numberOfChunks > 1)
+    {
+        Parameters->PendingChunks = numberOfChunks - 1;
+
+        for (i = 1; i < numberOfChunks; i++)
+            PhQueueItemWorkQueue(&PhpProcessUpdateWorkQueue, PhpProcessUpdateChunkWorker, &chunks[i]);
+    }
+
+    PhpUpdateProcessItemChunk(&chunks[0]);
+
+    if (numberOfChunks > 1)
+        NtWaitForSingleObject(PhpProcessUpdateEventHandle, FALSE, NULL);
+
+    *Result = chunks[0];
+
+    for (i = 1; i < numberOfChunks; i++)
+    {
+        if (Result->MaxCpuValue < chunks[i].MaxCpuValue)
+        {
+            Result->MaxCpuValue = chunks[i].MaxCpuValue;
+            Result->MaxCpuProcessItem = chunks[i].MaxCpuProcessItem;
+        }
+
+        if (Result->MaxIoValue < chunks[i].MaxIoValue)
+        {
+            Result->MaxIoValue = chunks[i].MaxIoValue;
+            Result->MaxIoProcessItem = chunks[i].MaxIoProcessItem;
+        }
+    }
+}
+
+VOID PhProcessProviderUpdate(
+    _In_ PVOID Object
+    )
+{
+    static ULONG runCount = 0;
+    static PSYSTEM_PROCESS_INFORMATION pidBuckets[PROCESS_ID_BUCKETS];
+
+    // Note about locking:
+    // Since this is the only function that is allowed to
+    // modify the process hashtable, locking is not needed
+    // for shared accesses. However, exclusive accesses
+    // need locking.
+
+    PPH_PROCESS_SNAPSHOT snapshot;
+    PVOID processes;
+    PSYSTEM_PROCESS_INFORMATION process;
+    ULONG bucketIndex;
+
+    BOOLEAN isCycleCpuUsageEnabled = FALSE;
+
+    ULONG64 sysTotalTime; // total time for this update period
+    ULONG64 sysTotalCycleTime = 0; // total cycle time for this update period
+    ULONG64 sysIdleCycleTime = 0; // total idle cycle time for this update period
+    FLOAT maxCpuValue = 0;
+    PPH_PROCESS_ITEM maxCpuProcessItem = NULL;
+    ULONG64 maxIoValue = 0;
+    PPH_PROCESS_ITEM maxIoProcessItem = NULL;
+
+    PH_PROCESS_UPDATE_PARAMETERS updateParameters;
+    PH_PROCESS_UPDATE_CHUNK updateResult;
+    ULONG numberOfUpdateEntries = 0;
+
+    ULONG64 traceStartTime;
+
+    // Pre-update tasks
+
+    traceStartTime = PhBeginTraceSpan();
+
+    if (runCount % 8 == 0)
+    {
+        PhUpdateDosDevicePrefixes();
+    }
+
+    // Purging is incremental, so a small part of the record set is examined on each run.
+    if (PhEnablePurgeProcessRecords)
+        PhPurgeProcessRecords();
+
+    PhEndTraceSpan(L"procprv", L"Pre-update", traceStartTime);
+
+    isCycleCpuUsageEnabled = WindowsVersion >= WINDOWS_7 && PhEnableCycleCpuUsage;
+
+    traceStartTime = PhBeginTraceSpan();
+
+    if (!PhProcessStatisticsInitialized)
+    {
+        PhpInitializeProcessStatistics();
+        PhProcessStatisticsInitialized = TRUE;
+    }
+
+    PhpUpdatePerfInformation();
+
+    if (isCycleCpuUsageEnabled)
+    {
+        PhpUpdateCpuInformation(FALSE, &sysTotalTime);
+        PhpUpdateCpuCycleInformation(&sysIdleCycleTime);
+    }
+    else
+    {
+        PhpUpdateCpuInformation(TRUE, &sysTotalTime);
+    }
+
+    if (runCount != 0)
+    {
+        PhTimeSequenceNumber++;
+    }
+
+    PhEndTraceSpan(L"procprv", L"CPU information", traceStartTime);
+
+    // Get the process list.
+
+    PhTotalProcesses = 0;
+    PhTotalThreads = 0;
+    PhTotalHandles = 0;
+
+    traceStartTime = PhBeginTraceSpan();
+
+    if (!NT_SUCCESS(PhCreateProcessSnapshot(&snapshot)))
+        return;
+
+    PhEndTraceSpan(L"procprv", L"Snapshot", traceStartTime);
+
+    processes = snapshot->Processes;
 
     // Notes on cycle-based CPU usage:
     //
@@ -1911,6 +2602,8 @@ VOID PhProcessProviderUpdate(
     // Note that we use the UniqueProcessKey field as the next node pointer to avoid having to
     // allocate extra memory.
 
+    traceStartTime = PhBeginTraceSpan();
+
     memset(pidBuckets, 0, sizeof(pidBuckets));
 
     process = PH_FIRST_PROCESS(processes);
@@ -1958,7 +2651,11 @@ VOID PhProcessProviderUpdate(
         PhInterruptsProcessInformation.KernelTime = PhCpuTotals.InterruptTime;
     }
 
+    PhEndTraceSpan(L"procprv", L"Bucketing", traceStartTime);
+
     // Look for dead processes.
+    traceStartTime = PhBeginTraceSpan();
+
     {
         PPH_LIST processesToRemove = NULL;
         ULONG i;
@@ -2057,7 +2754,11 @@ VOID PhProcessProviderUpdate(
         }
     }
 
+    PhEndTraceSpan(L"procprv", L"Dead processes", traceStartTime);
+
     // Go through the queued process query data.
+    traceStartTime = PhBeginTraceSpan();
+
     if (RtlQueryDepthSList(&PhProcessQueryDataListHead) != 0)
     {
         PSLIST_ENTRY entry;
@@ -2094,7 +2795,10 @@ VOID PhProcessProviderUpdate(
 
     PhCpuTotalCycleDelta = sysTotalCycleTime;
 
+    PhEndTraceSpan(L"procprv", L"Query data", traceStartTime);
+
     // Look for new processes and update existing ones.
+    traceStartTime = PhBeginTraceSpan();
     process = PH_FIRST_PROCESS(processes);
 
     while (process)
@@ -2185,162 +2889,28 @@ VOID PhProcessProviderUpdate(
         }
         else
         {
-            BOOLEAN modified = FALSE;
-            BOOLEAN isSuspended;
-            ULONG contextSwitches;
-            FLOAT newCpuUsage;
-            FLOAT kernelCpuUsage;
-            FLOAT userCpuUsage;
-
-            PhpGetProcessThreadInformation(process, &isSuspended, &contextSwitches);
-            PhpUpdateDynamicInfoProcessItem(processItem, process);
-
-            // Update the deltas.
-            PhUpdateDelta(&processItem->CpuKernelDelta, process->KernelTime.QuadPart);
-            PhUpdateDelta(&processItem->CpuUserDelta, process->UserTime.QuadPart);
-            PhUpdateDelta(&processItem->IoReadDelta, process->ReadTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoWriteDelta, process->WriteTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoOtherDelta, process->OtherTransferCount.QuadPart);
-            PhUpdateDelta(&processItem->IoReadCountDelta, process->ReadOperationCount.QuadPart);
-            PhUpdateDelta(&processItem->IoWriteCountDelta, process->WriteOperationCount.QuadPart);
-            PhUpdateDelta(&processItem->IoOtherCountDelta, process->OtherOperationCount.QuadPart);
-            PhUpdateDelta(&processItem->ContextSwitchesDelta, contextSwitches);
-            PhUpdateDelta(&processItem->PageFaultsDelta, process->PageFaultCount);
-            PhUpdateDelta(&processItem->CycleTimeDelta, process->CycleTime);
-            PhUpdateDelta(&processItem->PrivateBytesDelta, process->PagefileUsage);
-
-            processItem->SequenceNumber++;
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoReadHistory, processItem->IoReadDelta.Delta);
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoWriteHistory, processItem->IoWriteDelta.Delta);
-            PhAddItemCircularBuffer_ULONG64(&processItem->IoOtherHistory, processItem->IoOtherDelta.Delta);
-
-            PhAddItemCircularBuffer_SIZE_T(&processItem->PrivateBytesHistory, processItem->VmCounters.PagefileUsage);
-            //PhAddItemCircularBuffer_SIZE_T(&processItem->WorkingSetHistory, processItem->VmCounters.WorkingSetSize);
-
-            if (processItem->JustProcessed)
-            {
-                processItem->JustProcessed = FALSE;
-                modified = TRUE;
-            }
-
-            if (isCycleCpuUsageEnabled)
-            {
-                FLOAT totalDelta;
-
-                newCpuUsage = (FLOAT)processItem->CycleTimeDelta.Delta / sysTotalCycleTime;
-
-                // Calculate the kernel/user CPU usage based on the kernel/user time. If the kernel and
-                // user deltas are both zero, we'll just have to use an estimate. Currently, we split
-                // the CPU usage evenly across the kernel and user components, except when the total
-                // user time is zero, in which case we assign it all to the kernel component.
-
-                totalDelta = (FLOAT)(processItem->CpuKernelDelta.Delta + processItem->CpuUserDelta.Delta);
-
-                if (totalDelta != 0)
-                {
-                    kernelCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuKernelDelta.Delta / totalDelta);
-                    userCpuUsage = newCpuUsage * ((FLOAT)processItem->CpuUserDelta.Delta / totalDelta);
-                }
-                else
-                {
-                    if (processItem->UserTime.QuadPart != 0)
-                    {
-                        kernelCpuUsage = newCpuUsage / 2;
-                        userCpuUsage = newCpuUsage / 2;
-                    }
-                    else
-                    {
-                        kernelCpuUsage = newCpuUsage;
-                        userCpuUsage = 0;
-                    }
-                }
-            }
-            else
-            {
-                kernelCpuUsage = (FLOAT)processItem->CpuKernelDelta.Delta / sysTotalTime;
-                userCpuUsage = (FLOAT)processItem->CpuUserDelta.Delta / sysTotalTime;
-                newCpuUsage = kernelCpuUsage + userCpuUsage;
-            }
-
-            processItem->CpuUsage = newCpuUsage;
-            processItem->CpuKernelUsage = kernelCpuUsage;
-            processItem->CpuUserUsage = userCpuUsage;
-
-            PhAddItemCircularBuffer_FLOAT(&processItem->CpuKernelHistory, kernelCpuUsage);
-            PhAddItemCircularBuffer_FLOAT(&processItem->CpuUserHistory, userCpuUsage);
-
-            // Max. values
-
-            if (processItem->ProcessId != NULL)
-            {
-                if (maxCpuValue < newCpuUsage)
-                {
-                    maxCpuValue = newCpuUsage;
-                    maxCpuProcessItem = processItem;
-                }
-
-                // I/O for Other is not included because it is too generic.
-                if (maxIoValue < processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta)
-                {
-                    maxIoValue = processItem->IoReadDelta.Delta + processItem->IoWriteDelta.Delta;
-                    maxIoProcessItem = processItem;
-                }
-            }
-
-            // Debugged
-            if (processItem->QueryHandle)
-            {
-                BOOLEAN isBeingDebugged;
-
-                if (NT_SUCCESS(PhGetProcessIsBeingDebugged(
-                    processItem->QueryHandle,
-                    &isBeingDebugged
-                    )) && processItem->IsBeingDebugged != isBeingDebugged)
-                {
-                    processItem->IsBeingDebugged = isBeingDebugged;
-                    modified = TRUE;
-                }
-            }
-
-            // Suspended
-            if (processItem->IsSuspended != isSuspended)
-            {
-                processItem->IsSuspended = isSuspended;
-                modified = TRUE;
-            }
+            PPH_PROCESS_UPDATE_ENTRY entry;
 
-            // .NET
-            if (processItem->UpdateIsDotNet)
+            // Existing items are updated once the whole list has been walked, so that
+            // the work can be divided between several threads.
+            if (!PhpProcessUpdateEntries)
             {
-                BOOLEAN isDotNet;
-
-                if (NT_SUCCESS(PhGetProcessIsDotNet(processItem->ProcessId, &isDotNet)))
-                {
-                    processItem->IsDotNet = isDotNet;
-                    modified = TRUE;
-                }
-
-                processItem->UpdateIsDotNet = FALSE;
+                PhpProcessUpdateEntriesAllocated = 256;
+                PhpProcessUpdateEntries = PhAllocate(PhpProcessUpdateEntriesAllocated * sizeof(PH_PROCESS_UPDATE_ENTRY));
             }
-
-            // Immersive
-            if (processItem->QueryHandle && IsImmersiveProcess_I)
+            else if (numberOfUpdateEntries == PhpProcessUpdateEntriesAllocated)
             {
-                BOOLEAN isImmersive;
-
-                isImmersive = !!IsImmersiveProcess_I(processItem->QueryHandle);
-
-                if (processItem->IsImmersive != isImmersive)
-                {
-                    processItem->IsImmersive = isImmersive;
-                    modified = TRUE;
-                }
+                PhpProcessUpdateEntriesAllocated *= 2;
+                PhpProcessUpdateEntries = PhReAllocate(
+                    PhpProcessUpdateEntries,
+                    PhpProcessUpdateEntriesAllocated * sizeof(PH_PROCESS_UPDATE_ENTRY)
+                    );
             }
 
-            if (modified)
-            {
-                PhInvokeCallback(&PhProcessModifiedEvent, processItem);
-            }
+            entry = &PhpProcessUpdateEntries[numberOfUpdateEntries++];
+            entry->ProcessItem = processItem;
+            entry->Process = process;
+            entry->Modified = FALSE;
 
             // No reference added by PhpLookupProcessItem.
         }
@@ -2369,9 +2939,46 @@ VOID PhProcessProviderUpdate(
         }
     }
 
-    if (PhProcessInformation)
-        PhFree(PhProcessInformation);
+    PhEndTraceSpan(L"procprv", L"New processes", traceStartTime);
+
+    // Update the existing process items.
+
+    traceStartTime = PhBeginTraceSpan();
+
+    updateParameters.IsCycleCpuUsageEnabled = isCycleCpuUsageEnabled;
+    updateParameters.SysTotalTime = sysTotalTime;
+    updateParameters.SysTotalCycleTime = sysTotalCycleTime;
+    updateParameters.PendingChunks = 0;
+
+    PhpUpdateExistingProcessItems(&updateParameters, PhpProcessUpdateEntries, numberOfUpdateEntries, &updateResult);
+
+    maxCpuValue = updateResult.MaxCpuValue;
+    maxCpuProcessItem = updateResult.MaxCpuProcessItem;
+    maxIoValue = updateResult.MaxIoValue;
+    maxIoProcessItem = updateResult.MaxIoProcessItem;
+
+    // Raise the modified events from this thread, in process list order.
+    {
+        ULONG i;
+
+        for (i = 0; i < numberOfUpdateEntries; i++)
+        {
+            if (PhpProcessUpdateEntries[i].Modified)
+                PhInvokeCallback(&PhProcessModifiedEvent, PhpProcessUpdateEntries[i].ProcessItem);
+        }
+    }
+
+    PhEndTraceSpan(L"procprv", L"Existing processes", traceStartTime);
+
+    // Share the snapshot with everyone else who needs a process list. The buffer
+    // must not be modified from this point on.
+    traceStartTime = PhBeginTraceSpan();
+    PhPublishProcessSnapshot(snapshot);
+
+    if (PhpProcessSnapshot)
+        PhDereferenceObject(PhpProcessSnapshot);
 
+    PhpProcessSnapshot = snapshot;
     PhProcessInformation = processes;
 
     if (PhpTsProcesses)
@@ -2439,6 +3046,8 @@ VOID PhProcessProviderUpdate(
         }
     }
 
+    PhEndTraceSpan(L"procprv", L"Records and history", traceStartTime);
+
     PhInvokeCallback(&PhProcessesUpdatedEvent, NULL);
     runCount++;
 }
@@ -2452,7 +3061,6 @@ PPH_PROCESS_RECORD PhpCreateProcessRecord(
     processRecord = PhAllocate(sizeof(PH_PROCESS_RECORD));
     memset(processRecord, 0, sizeof(PH_PROCESS_RECORD));
 
-    InitializeListHead(&processRecord->ListEntry);
     processRecord->RefCount = 1;
 
     processRecord->ProcessId = ProcessItem->ProcessId;
@@ -2484,121 +3092,98 @@ PPH_PROCESS_RECORD PhpCreateProcessRecord(
     return processRecord;
 }
 
-PPH_PROCESS_RECORD PhpSearchProcessRecordList(
-    _In_ PLARGE_INTEGER Time,
-    _Out_opt_ PULONG Index,
-    _Out_opt_ PULONG InsertIndex
+LONG NTAPI PhpProcessRecordCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
     )
 {
-    PPH_PROCESS_RECORD processRecord;
-    LONG low;
-    LONG high;
-    LONG i;
-    BOOLEAN found = FALSE;
-    INT comparison;
+    PPH_PROCESS_RECORD record1 = CONTAINING_RECORD(Links1, PH_PROCESS_RECORD, Links);
+    PPH_PROCESS_RECORD record2 = CONTAINING_RECORD(Links2, PH_PROCESS_RECORD, Links);
+    INT result;
 
-    if (PhProcessRecordList->Count == 0)
-    {
-        if (Index)
-            *Index = 0;
-        if (InsertIndex)
-            *InsertIndex = 0;
+    result = uint64cmp(record1->CreateTime.QuadPart, record2->CreateTime.QuadPart);
 
-        return NULL;
-    }
+    if (result == 0)
+        result = uintptrcmp((ULONG_PTR)record1->ProcessId, (ULONG_PTR)record2->ProcessId);
 
-    low = 0;
-    high = PhProcessRecordList->Count - 1;
+    return result;
+}
 
-    // Do a binary search.
-    do
-    {
-        i = (low + high) / 2;
-        processRecord = (PPH_PROCESS_RECORD)PhProcessRecordList->Items[i];
+LONG NTAPI PhpProcessRecordProcessIdCompareFunction(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    PPH_PROCESS_RECORD record1 = CONTAINING_RECORD(Links1, PH_PROCESS_RECORD, ProcessIdLinks);
+    PPH_PROCESS_RECORD record2 = CONTAINING_RECORD(Links2, PH_PROCESS_RECORD, ProcessIdLinks);
+    INT result;
 
-        comparison = uint64cmp(Time->QuadPart, processRecord->CreateTime.QuadPart);
+    result = uintptrcmp((ULONG_PTR)record1->ProcessId, (ULONG_PTR)record2->ProcessId);
 
-        if (comparison == 0)
-        {
-            found = TRUE;
-            break;
-        }
-        else if (comparison < 0)
-        {
-            high = i - 1;
-        }
-        else
-        {
-            low = i + 1;
-        }
-    } while (low <= high);
+    if (result == 0)
+        result = uint64cmp(record1->CreateTime.QuadPart, record2->CreateTime.QuadPart);
 
-    if (Index)
-        *Index = i;
+    return result;
+}
 
-    if (found)
-    {
-        return processRecord;
-    }
-    else
-    {
-        if (InsertIndex)
-            *InsertIndex = i + (comparison > 0);
+/**
+ * Finds the last element in a tree which is less than or equal to a given element.
+ *
+ * \param Tree The tree.
+ * \param Element The element to compare with.
+ *
+ * \return The element that was found, or NULL if all elements are greater than
+ * \a Element.
+ */
+PPH_AVL_LINKS PhpFindFloorElementAvlTree(
+    _In_ PPH_AVL_TREE Tree,
+    _In_ PPH_AVL_LINKS Element
+    )
+{
+    PPH_AVL_LINKS links;
+    LONG result;
 
-        return NULL;
-    }
+    links = PhFindElementAvlTree2(Tree, Element, &result);
+
+    if (links && result < 0)
+        links = PhPredecessorElementAvlTree(links);
+
+    return links;
 }
 
 VOID PhpAddProcessRecord(
     _Inout_ PPH_PROCESS_RECORD ProcessRecord
     )
 {
-    PPH_PROCESS_RECORD processRecord;
-    ULONG insertIndex;
+    PPH_AVL_LINKS links;
 
-    PhAcquireQueuedLockExclusive(&PhProcessRecordListLock);
+    PhAcquireQueuedLockExclusive(&PhProcessRecordSetLock);
 
-    processRecord = PhpSearchProcessRecordList(&ProcessRecord->CreateTime, NULL, &insertIndex);
+    links = PhAddElementAvlTree(&PhProcessRecordSet, &ProcessRecord->Links);
 
-    if (!processRecord)
-    {
-        // Insert the process record, keeping the list sorted.
-        PhInsertItemList(PhProcessRecordList, insertIndex, ProcessRecord);
-    }
+    // A process is uniquely identified by its ID and create time, and each process
+    // only has one process item.
+    assert(!links);
+
+    if (!links)
+        PhAddElementAvlTree(&PhpProcessRecordProcessIdSet, &ProcessRecord->ProcessIdLinks);
     else
-    {
-        // Link the process record with the existing one that we found.
-        InsertTailList(&processRecord->ListEntry, &ProcessRecord->ListEntry);
-    }
+        ProcessRecord->Flags |= PH_PROCESS_RECORD_NOT_INDEXED;
 
-    PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
+    PhReleaseQueuedLockExclusive(&PhProcessRecordSetLock);
 }
 
 VOID PhpRemoveProcessRecord(
     _Inout_ PPH_PROCESS_RECORD ProcessRecord
     )
 {
-    ULONG i;
-    PPH_PROCESS_RECORD headProcessRecord;
-
-    PhAcquireQueuedLockExclusive(&PhProcessRecordListLock);
-
-    headProcessRecord = PhpSearchProcessRecordList(&ProcessRecord->CreateTime, &i, NULL);
-    assert(headProcessRecord);
-
-    // Unlink the record from the list.
-    RemoveEntryList(&ProcessRecord->ListEntry);
-
-    if (ProcessRecord == headProcessRecord)
-    {
-        // Remove the slot completely, or choose a new head record.
-        if (IsListEmpty(&headProcessRecord->ListEntry))
-            PhRemoveItemList(PhProcessRecordList, i);
-        else
-            PhProcessRecordList->Items[i] = CONTAINING_RECORD(headProcessRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-    }
+    if (ProcessRecord->Flags & PH_PROCESS_RECORD_NOT_INDEXED)
+        return;
 
-    PhReleaseQueuedLockExclusive(&PhProcessRecordListLock);
+    PhAcquireQueuedLockExclusive(&PhProcessRecordSetLock);
+    PhRemoveElementAvlTree(&PhProcessRecordSet, &ProcessRecord->Links);
+    PhRemoveElementAvlTree(&PhpProcessRecordProcessIdSet, &ProcessRecord->ProcessIdLinks);
+    PhReleaseQueuedLockExclusive(&PhProcessRecordSetLock);
 }
 
 VOID PhReferenceProcessRecord(
@@ -2642,26 +3227,6 @@ VOID PhDereferenceProcessRecord(
     }
 }
 
-PPH_PROCESS_RECORD PhpFindProcessRecord(
-    _In_ PPH_PROCESS_RECORD ProcessRecord,
-    _In_ HANDLE ProcessId
-    )
-{
-    PPH_PROCESS_RECORD startProcessRecord;
-
-    startProcessRecord = ProcessRecord;
-
-    do
-    {
-        if (ProcessRecord->ProcessId == ProcessId)
-            return ProcessRecord;
-
-        ProcessRecord = CONTAINING_RECORD(ProcessRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-    } while (ProcessRecord != startProcessRecord);
-
-    return NULL;
-}
-
 /**
  * Finds a process record.
  *
@@ -2678,140 +3243,133 @@ PPH_PROCESS_RECORD PhFindProcessRecord(
     _In_ PLARGE_INTEGER Time
     )
 {
-    PPH_PROCESS_RECORD processRecord;
-    ULONG i;
-    BOOLEAN found;
+    PH_PROCESS_RECORD lookupRecord;
+    PPH_PROCESS_RECORD processRecord = NULL;
+    PPH_AVL_LINKS links;
 
-    if (PhProcessRecordList->Count == 0)
+    if (PhProcessRecordSet.Count == 0)
         return NULL;
 
-    PhAcquireQueuedLockShared(&PhProcessRecordListLock);
+    lookupRecord.CreateTime = *Time;
 
-    processRecord = PhpSearchProcessRecordList(Time, &i, NULL);
+    PhAcquireQueuedLockShared(&PhProcessRecordSetLock);
 
-    if (!processRecord)
+    if (ProcessId)
     {
-        // This is expected. Now we search backwards to find the newest matching element
-        // older than the given time.
+        // Find the newest record for this process ID that was created before the given time.
 
-        found = FALSE;
+        lookupRecord.ProcessId = ProcessId;
+        links = PhpFindFloorElementAvlTree(&PhpProcessRecordProcessIdSet, &lookupRecord.ProcessIdLinks);
 
-        while (TRUE)
+        if (links)
         {
-            processRecord = (PPH_PROCESS_RECORD)PhProcessRecordList->Items[i];
-
-            if (processRecord->CreateTime.QuadPart < Time->QuadPart)
-            {
-                if (ProcessId)
-                {
-                    processRecord = PhpFindProcessRecord(processRecord, ProcessId);
+            processRecord = CONTAINING_RECORD(links, PH_PROCESS_RECORD, ProcessIdLinks);
 
-                    if (processRecord)
-                        found = TRUE;
-                }
-                else
-                {
-                    found = TRUE;
-                }
-
-                if (found)
-                    break;
-            }
-
-            if (i == 0)
-                break;
-
-            i--;
+            if (processRecord->ProcessId != ProcessId)
+                processRecord = NULL;
         }
     }
     else
     {
-        if (ProcessId)
-        {
-            processRecord = PhpFindProcessRecord(processRecord, ProcessId);
+        // Find the newest record of any process that was created before the given time.
 
-            if (processRecord)
-                found = TRUE;
-            else
-                found = FALSE;
-        }
-        else
-        {
-            found = TRUE;
-        }
+        lookupRecord.ProcessId = (HANDLE)MAXULONG_PTR;
+        links = PhpFindFloorElementAvlTree(&PhProcessRecordSet, &lookupRecord.Links);
+
+        if (links)
+            processRecord = CONTAINING_RECORD(links, PH_PROCESS_RECORD, Links);
     }
 
-    if (found)
+    if (processRecord)
     {
         // The record might have had its last reference just cleared but it hasn't
-        // been removed from the list yet.
+        // been removed from the set yet.
         if (!PhReferenceProcessRecordSafe(processRecord))
-            found = FALSE;
+            processRecord = NULL;
     }
 
-    PhReleaseQueuedLockShared(&PhProcessRecordListLock);
+    PhReleaseQueuedLockShared(&PhProcessRecordSetLock);
 
-    if (found)
-        return processRecord;
-    else
-        return NULL;
+    return processRecord;
 }
 
 /**
  * Deletes unused process records.
+ *
+ * \remarks Each call only examines a limited number of records, continuing
+ * from where the previous call stopped.
  */
 VOID PhPurgeProcessRecords(
     VOID
     )
 {
+    PH_PROCESS_RECORD lookupRecord;
     PPH_PROCESS_RECORD processRecord;
-    PPH_PROCESS_RECORD startProcessRecord;
+    PPH_AVL_LINKS links;
     ULONG i;
     LARGE_INTEGER threshold;
     PPH_LIST derefList = NULL;
 
-    if (PhProcessRecordList->Count == 0)
+    if (PhProcessRecordSet.Count == 0)
         return;
 
     // Get the oldest statistics time.
     PhGetStatisticsTime(NULL, PhTimeHistory.Count - 1, &threshold);
 
-    PhAcquireQueuedLockShared(&PhProcessRecordListLock);
+    PhAcquireQueuedLockShared(&PhProcessRecordSetLock);
 
-    for (i = 0; i < PhProcessRecordList->Count; i++)
+    if (PhpPurgeCursorValid)
     {
-        processRecord = PhProcessRecordList->Items[i];
-        startProcessRecord = processRecord;
+        // Continue with the first record after the last one we examined.
 
-        do
-        {
-            ULONG requiredFlags;
+        lookupRecord.CreateTime = PhpPurgeCursorCreateTime;
+        lookupRecord.ProcessId = PhpPurgeCursorProcessId;
+        links = PhpFindFloorElementAvlTree(&PhProcessRecordSet, &lookupRecord.Links);
+
+        if (links)
+            links = PhSuccessorElementAvlTree(links);
+        else
+            links = PhMinimumElementAvlTree(&PhProcessRecordSet);
+    }
+    else
+    {
+        links = PhMinimumElementAvlTree(&PhProcessRecordSet);
+    }
+
+    for (i = 0; links && i < PH_PROCESS_RECORD_PURGE_BATCH_SIZE; i++)
+    {
+        ULONG requiredFlags;
 
-            requiredFlags = PH_PROCESS_RECORD_DEAD | PH_PROCESS_RECORD_STAT_REF;
+        processRecord = CONTAINING_RECORD(links, PH_PROCESS_RECORD, Links);
+        requiredFlags = PH_PROCESS_RECORD_DEAD | PH_PROCESS_RECORD_STAT_REF;
 
-            if ((processRecord->Flags & requiredFlags) == requiredFlags)
+        if ((processRecord->Flags & requiredFlags) == requiredFlags)
+        {
+            // Check if the process exit time is before the oldest statistics time.
+            // If so we can dereference the process record.
+            if (processRecord->ExitTime.QuadPart < threshold.QuadPart)
             {
-                // Check if the process exit time is before the oldest statistics time.
-                // If so we can dereference the process record.
-                if (processRecord->ExitTime.QuadPart < threshold.QuadPart)
-                {
-                    // Clear the stat ref bit; this is to make sure we don't try to
-                    // dereference the record twice (e.g. if someone else currently holds
-                    // a reference to the record and it doesn't get removed immediately).
-                    processRecord->Flags &= ~PH_PROCESS_RECORD_STAT_REF;
+                // Clear the stat ref bit; this is to make sure we don't try to
+                // dereference the record twice (e.g. if someone else currently holds
+                // a reference to the record and it doesn't get removed immediately).
+                processRecord->Flags &= ~PH_PROCESS_RECORD_STAT_REF;
 
-                    if (!derefList)
-                        derefList = PhCreateList(2);
+                if (!derefList)
+                    derefList = PhCreateList(2);
 
-                    PhAddItemList(derefList, processRecord);
-                }
+                PhAddItemList(derefList, processRecord);
             }
+        }
 
-            processRecord = CONTAINING_RECORD(processRecord->ListEntry.Flink, PH_PROCESS_RECORD, ListEntry);
-        } while (processRecord != startProcessRecord);
+        PhpPurgeCursorCreateTime = processRecord->CreateTime;
+        PhpPurgeCursorProcessId = processRecord->ProcessId;
+        links = PhSuccessorElementAvlTree(links);
     }
 
-    PhReleaseQueuedLockShared(&PhProcessRecordListLock);
+    // Start from the beginning next time if we reached the end of the set.
+    PhpPurgeCursorValid = !!links;
+
+    PhReleaseQueuedLockShared(&PhProcessRecordSetLock);
 
     if (derefList)
     {
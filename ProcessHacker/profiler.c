@@ -0,0 +1,607 @@
+/*
+ * Process Hacker -
+ *   sampling profiler
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The profiler periodically captures the stacks of the busiest threads in a
+ * process and adds them to a call tree. On each tick, the threads are ranked by
+ * the CPU time they have used since the previous tick, and the stacks of the top
+ * threads are captured in parallel. The user stack is always walked, which
+ * requires suspending the thread. When KProcessHacker is available, the kernel
+ * stack is captured as well.
+ *
+ * Only return addresses are stored while profiling. Symbols are loaded and
+ * resolved when the profile is exported.
+ */
+
+#include <phapp.h>
+#include <kphuser.h>
+
+#define PH_PROFILER_MAXIMUM_FRAMES (62 - 1) // 62 limit for XP and Server 2003.
+#define PH_PROFILER_MAXIMUM_THREADS 64
+
+typedef struct _PH_PROFILER_THREAD
+{
+    HANDLE ThreadId;
+    HANDLE ThreadHandle;
+    ULONG64 CpuTime;
+    ULONG64 CpuDelta;
+    ULONG RunId;
+} PH_PROFILER_THREAD, *PPH_PROFILER_THREAD;
+
+typedef struct _PH_PROFILER_CAPTURE
+{
+    PPH_PROFILER Profiler;
+    HANDLE ThreadHandle;
+    CLIENT_ID ClientId;
+    PLONG PendingCaptures;
+    HANDLE EventHandle;
+} PH_PROFILER_CAPTURE, *PPH_PROFILER_CAPTURE;
+
+typedef struct _PH_PROFILER_WALK_CONTEXT
+{
+    PVOID Frames[PH_PROFILER_MAXIMUM_FRAMES];
+    ULONG NumberOfFrames;
+} PH_PROFILER_WALK_CONTEXT, *PPH_PROFILER_WALK_CONTEXT;
+
+typedef struct _PH_PROFILER_RESOLVE_CONTEXT
+{
+    PPH_SYMBOL_PROVIDER SymbolProvider;
+    HANDLE LoadingProcessId;
+    HANDLE ProcessId;
+} PH_PROFILER_RESOLVE_CONTEXT, *PPH_PROFILER_RESOLVE_CONTEXT;
+
+VOID NTAPI PhpProfilerDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhProfilerType;
+
+static PH_INITONCE PhProfilerInitOnce = PH_INITONCE_INIT;
+
+static BOOLEAN NTAPI PhpProfilerThreadHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PPH_PROFILER_THREAD)Entry1)->ThreadId == ((PPH_PROFILER_THREAD)Entry2)->ThreadId;
+}
+
+static ULONG NTAPI PhpProfilerThreadHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return HandleToUlong(((PPH_PROFILER_THREAD)Entry)->ThreadId) / 4;
+}
+
+/**
+ * Creates a profiler for a process.
+ *
+ * \param ProcessId The ID of the process to profile.
+ * \param Interval The time between samples, in milliseconds.
+ * \param MaximumThreads The maximum number of threads to sample on each tick.
+ *
+ * \return The new profiler, or NULL if it could not be created.
+ */
+PPH_PROFILER PhCreateProfiler(
+    _In_ HANDLE ProcessId,
+    _In_ ULONG Interval,
+    _In_ ULONG MaximumThreads
+    )
+{
+    PPH_PROFILER profiler;
+
+    if (PhBeginInitOnce(&PhProfilerInitOnce))
+    {
+        PhCreateObjectType(&PhProfilerType, L"Profiler", 0, PhpProfilerDeleteProcedure);
+        PhEndInitOnce(&PhProfilerInitOnce);
+    }
+
+    if (!NT_SUCCESS(PhCreateObject(&profiler, sizeof(PH_PROFILER), 0, PhProfilerType)))
+        return NULL;
+
+    memset(profiler, 0, sizeof(PH_PROFILER));
+    profiler->ProcessId = ProcessId;
+    profiler->Interval = max(Interval, 1);
+    profiler->MaximumThreads = min(max(MaximumThreads, 1), PH_PROFILER_MAXIMUM_THREADS);
+    profiler->CallTree = PhCreateCallTree();
+    profiler->ThreadHashtable = PhCreateHashtable(
+        sizeof(PH_PROFILER_THREAD),
+        PhpProfilerThreadHashtableCompareFunction,
+        PhpProfilerThreadHashtableHashFunction,
+        32
+        );
+
+    PhInitializeWorkQueue(&profiler->WorkQueue, 0, profiler->MaximumThreads, 1000);
+
+    // This handle is used to walk user stacks.
+    PhOpenProcess(&profiler->ProcessHandle, PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, ProcessId);
+
+    if (profiler->ProcessHandle)
+        profiler->UnwindCache = PhCreateUnwindCache(profiler->ProcessHandle, NULL);
+
+    return profiler;
+}
+
+VOID NTAPI PhpProfilerDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_PROFILER profiler = Object;
+    PPH_PROFILER_THREAD thread;
+    ULONG enumerationKey = 0;
+
+    PhStopProfiler(profiler);
+    PhDeleteWorkQueue(&profiler->WorkQueue);
+
+    while (PhEnumHashtable(profiler->ThreadHashtable, (PPVOID)&thread, &enumerationKey))
+    {
+        if (thread->ThreadHandle)
+            NtClose(thread->ThreadHandle);
+    }
+
+    PhDereferenceObject(profiler->ThreadHashtable);
+    PhDereferenceObject(profiler->CallTree);
+
+    if (profiler->UnwindCache)
+        PhDereferenceObject(profiler->UnwindCache);
+    if (profiler->ProcessHandle)
+        NtClose(profiler->ProcessHandle);
+}
+
+static BOOLEAN NTAPI PhpProfilerWalkCallback(
+    _In_ PPH_THREAD_STACK_FRAME StackFrame,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROFILER_WALK_CONTEXT context = Context;
+
+    context->Frames[context->NumberOfFrames++] = StackFrame->PcAddress;
+
+    return context->NumberOfFrames < PH_PROFILER_MAXIMUM_FRAMES;
+}
+
+static NTSTATUS PhpCaptureProfilerSample(
+    _In_ PPH_PROFILER_CAPTURE Capture
+    )
+{
+    NTSTATUS status;
+    PPH_PROFILER profiler = Capture->Profiler;
+    PH_PROFILER_WALK_CONTEXT context;
+
+    context.NumberOfFrames = 0;
+
+    if (profiler->ProcessHandle)
+    {
+        ULONG flags;
+
+        // KProcessHacker only captures the kernel stack, so it cannot replace the walk
+        // of the user stack.
+        flags = PH_WALK_I386_STACK | PH_WALK_AMD64_STACK;
+
+        if (KphIsConnected())
+            flags |= PH_WALK_KERNEL_STACK;
+
+        status = PhWalkThreadStackEx(
+            Capture->ThreadHandle,
+            profiler->ProcessHandle,
+            &Capture->ClientId,
+            flags,
+            PhpProfilerWalkCallback,
+            &context,
+            profiler->UnwindCache
+            );
+    }
+    else if (KphIsConnected())
+    {
+        // Without access to the process, only the kernel stack can be captured.
+        status = KphCaptureStackBackTraceThread(
+            Capture->ThreadHandle,
+            1,
+            PH_PROFILER_MAXIMUM_FRAMES,
+            context.Frames,
+            &context.NumberOfFrames,
+            NULL
+            );
+    }
+    else
+    {
+        status = STATUS_ACCESS_DENIED;
+    }
+
+    // The walk can report an error for one kind of stack while still returning
+    // frames for another.
+    if (context.NumberOfFrames != 0)
+        PhAddSampleCallTree(profiler->CallTree, context.Frames, context.NumberOfFrames);
+    else
+        _InterlockedIncrement(&profiler->NumberOfFailures);
+
+    return status;
+}
+
+static NTSTATUS PhpProfilerCaptureWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_PROFILER_CAPTURE capture = Parameter;
+
+    PhpCaptureProfilerSample(capture);
+
+    if (_InterlockedDecrement(capture->PendingCaptures) == 0)
+        NtSetEvent(capture->EventHandle, NULL);
+
+    return STATUS_SUCCESS;
+}
+
+static int __cdecl PhpProfilerThreadCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_PROFILER_THREAD thread1 = *(PPH_PROFILER_THREAD *)elem1;
+    PPH_PROFILER_THREAD thread2 = *(PPH_PROFILER_THREAD *)elem2;
+
+    return -uint64cmp(thread1->CpuDelta, thread2->CpuDelta);
+}
+
+static VOID PhpProfilerTick(
+    _Inout_ PPH_PROFILER Profiler
+    )
+{
+    PVOID processes;
+    PSYSTEM_PROCESS_INFORMATION process;
+    PPH_LIST busyThreads;
+    PPH_LIST deadThreads;
+    PPH_PROFILER_THREAD thread;
+    PH_PROFILER_CAPTURE captures[PH_PROFILER_MAXIMUM_THREADS];
+    LONG pendingCaptures;
+    ULONG numberOfCaptures;
+    ULONG enumerationKey;
+    ULONG i;
+
+    if (!NT_SUCCESS(PhEnumProcesses(&processes)))
+        return;
+
+    if (!(process = PhFindProcessInformation(processes, Profiler->ProcessId)))
+    {
+        PhFree(processes);
+        return;
+    }
+
+    Profiler->RunId++;
+    busyThreads = PhCreateList(process->NumberOfThreads);
+
+    // Rank the threads by the CPU time used since the last tick. A running thread
+    // counts as busy even if its CPU time has not been updated yet. Entries move
+    // when the hashtable is resized, so thread IDs are collected here and looked
+    // up once all threads have been added.
+    for (i = 0; i < process->NumberOfThreads; i++)
+    {
+        PSYSTEM_THREAD_INFORMATION threadInfo = &process->Threads[i];
+        PH_PROFILER_THREAD lookupThread;
+        ULONG64 cpuTime;
+        BOOLEAN added;
+
+        lookupThread.ThreadId = threadInfo->ClientId.UniqueThread;
+        lookupThread.ThreadHandle = NULL;
+        lookupThread.CpuTime = 0;
+        lookupThread.RunId = 0;
+        thread = PhAddEntryHashtableEx(Profiler->ThreadHashtable, &lookupThread, &added);
+
+        cpuTime = threadInfo->KernelTime.QuadPart + threadInfo->UserTime.QuadPart;
+        thread->CpuDelta = added ? 0 : cpuTime - thread->CpuTime;
+        thread->CpuTime = cpuTime;
+        thread->RunId = Profiler->RunId;
+
+        if (thread->CpuDelta != 0 || threadInfo->ThreadState == Running)
+            PhAddItemList(busyThreads, lookupThread.ThreadId);
+    }
+
+    PhFree(processes);
+
+    // Forget threads that have exited.
+
+    deadThreads = PhCreateList(4);
+    enumerationKey = 0;
+
+    while (PhEnumHashtable(Profiler->ThreadHashtable, (PPVOID)&thread, &enumerationKey))
+    {
+        if (thread->RunId != Profiler->RunId)
+            PhAddItemList(deadThreads, thread->ThreadId);
+    }
+
+    for (i = 0; i < deadThreads->Count; i++)
+    {
+        PH_PROFILER_THREAD lookupThread;
+
+        lookupThread.ThreadId = deadThreads->Items[i];
+        thread = PhFindEntryHashtable(Profiler->ThreadHashtable, &lookupThread);
+
+        if (thread->ThreadHandle)
+            NtClose(thread->ThreadHandle);
+
+        PhRemoveEntryHashtable(Profiler->ThreadHashtable, &lookupThread);
+    }
+
+    PhDereferenceObject(deadThreads);
+
+    for (i = 0; i < busyThreads->Count; i++)
+    {
+        PH_PROFILER_THREAD lookupThread;
+
+        lookupThread.ThreadId = busyThreads->Items[i];
+        busyThreads->Items[i] = PhFindEntryHashtable(Profiler->ThreadHashtable, &lookupThread);
+    }
+
+    qsort(busyThreads->Items, busyThreads->Count, sizeof(PVOID), PhpProfilerThreadCompare);
+
+    numberOfCaptures = 0;
+
+    for (i = 0; i < busyThreads->Count && numberOfCaptures < Profiler->MaximumThreads; i++)
+    {
+        thread = busyThreads->Items[i];
+
+        if (!thread->ThreadHandle)
+        {
+            PhOpenThread(
+                &thread->ThreadHandle,
+                THREAD_GET_CONTEXT | THREAD_SUSPEND_RESUME | ThreadQueryAccess,
+                thread->ThreadId
+                );
+
+            if (!thread->ThreadHandle)
+                continue;
+        }
+
+        captures[numberOfCaptures].Profiler = Profiler;
+        captures[numberOfCaptures].ThreadHandle = thread->ThreadHandle;
+        captures[numberOfCaptures].ClientId.UniqueProcess = Profiler->ProcessId;
+        captures[numberOfCaptures].ClientId.UniqueThread = thread->ThreadId;
+        captures[numberOfCaptures].PendingCaptures = &pendingCaptures;
+        captures[numberOfCaptures].EventHandle = Profiler->CaptureEventHandle;
+        numberOfCaptures++;
+    }
+
+    PhDereferenceObject(busyThreads);
+    _InterlockedIncrement(&Profiler->NumberOfTicks);
+
+    if (numberOfCaptures == 0)
+        return;
+
+    // The current thread captures the first stack and then waits for the others.
+
+    pendingCaptures = numberOfCaptures - 1;
+
+    for (i = 1; i < numberOfCaptures; i++)
+        PhQueueItemWorkQueue(&Profiler->WorkQueue, PhpProfilerCaptureWorker, &captures[i]);
+
+    PhpCaptureProfilerSample(&captures[0]);
+
+    if (numberOfCaptures > 1)
+        NtWaitForSingleObject(Profiler->CaptureEventHandle, FALSE, NULL);
+}
+
+static NTSTATUS PhpProfilerThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_PROFILER profiler = Parameter;
+    LARGE_INTEGER timeout;
+
+    while (NtWaitForSingleObject(
+        profiler->StopEventHandle,
+        FALSE,
+        PhTimeoutFromMilliseconds(&timeout, profiler->Interval)
+        ) == STATUS_TIMEOUT)
+    {
+        PhpProfilerTick(profiler);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Starts sampling.
+ *
+ * \param Profiler The profiler.
+ */
+NTSTATUS PhStartProfiler(
+    _Inout_ PPH_PROFILER Profiler
+    )
+{
+    NTSTATUS status;
+
+    if (Profiler->SamplerThreadHandle)
+        return STATUS_SUCCESS;
+
+    if (!Profiler->StopEventHandle)
+    {
+        if (!NT_SUCCESS(status = NtCreateEvent(&Profiler->StopEventHandle, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE)))
+            return status;
+    }
+
+    if (!Profiler->CaptureEventHandle)
+    {
+        if (!NT_SUCCESS(status = NtCreateEvent(&Profiler->CaptureEventHandle, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+            return status;
+    }
+
+    NtResetEvent(Profiler->StopEventHandle, NULL);
+
+    if (!(Profiler->SamplerThreadHandle = PhCreateThread(0, PhpProfilerThreadStart, Profiler)))
+        return STATUS_UNSUCCESSFUL;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Stops sampling. Samples that have already been captured are kept.
+ *
+ * \param Profiler The profiler.
+ */
+VOID PhStopProfiler(
+    _Inout_ PPH_PROFILER Profiler
+    )
+{
+    if (Profiler->SamplerThreadHandle)
+    {
+        NtSetEvent(Profiler->StopEventHandle, NULL);
+        NtWaitForSingleObject(Profiler->SamplerThreadHandle, FALSE, NULL);
+        NtClose(Profiler->SamplerThreadHandle);
+        Profiler->SamplerThreadHandle = NULL;
+    }
+
+    if (Profiler->StopEventHandle)
+    {
+        NtClose(Profiler->StopEventHandle);
+        Profiler->StopEventHandle = NULL;
+    }
+
+    if (Profiler->CaptureEventHandle)
+    {
+        NtClose(Profiler->CaptureEventHandle);
+        Profiler->CaptureEventHandle = NULL;
+    }
+}
+
+static BOOLEAN NTAPI PhpProfilerLoadSymbolsCallback(
+    _In_ PPH_MODULE_INFO Module,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROFILER_RESOLVE_CONTEXT context = Context;
+
+    // Ignore user-mode modules in the list of kernel modules.
+    if (
+        context->LoadingProcessId == SYSTEM_PROCESS_ID &&
+        context->ProcessId != SYSTEM_PROCESS_ID &&
+        (ULONG_PTR)Module->BaseAddress <= PhSystemBasicInformation.MaximumUserModeAddress
+        )
+        return TRUE;
+
+    PhLoadModuleSymbolProvider(
+        context->SymbolProvider,
+        Module->FileName->Buffer,
+        (ULONG64)Module->BaseAddress,
+        Module->Size
+        );
+
+    return TRUE;
+}
+
+static VOID NTAPI PhpProfilerResolveCallback(
+    _In_reads_(Count) PVOID *Addresses,
+    _In_ ULONG Count,
+    _Out_writes_(Count) PPH_STRING *Names,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROFILER_RESOLVE_CONTEXT context = Context;
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        PH_SYMBOL_RESOLVE_LEVEL resolveLevel;
+        PPH_STRING fileName;
+        PPH_STRING symbolName;
+        PPH_STRING baseName;
+        PPH_STRING symbol;
+
+        symbol = PhGetSymbolFromAddress(
+            context->SymbolProvider,
+            (ULONG64)Addresses[i],
+            &resolveLevel,
+            &fileName,
+            &symbolName,
+            NULL
+            );
+
+        // Name frames by function so that different return addresses in the same
+        // function are combined.
+        switch (resolveLevel)
+        {
+        case PhsrlFunction:
+            baseName = PhGetBaseName(fileName);
+            Names[i] = PhConcatStrings(3, baseName->Buffer, L"!", symbolName->Buffer);
+            PhDereferenceObject(baseName);
+            break;
+        case PhsrlModule:
+            Names[i] = PhGetBaseName(fileName);
+            break;
+        default:
+            Names[i] = NULL;
+            break;
+        }
+
+        if (fileName)
+            PhDereferenceObject(fileName);
+        if (symbolName)
+            PhDereferenceObject(symbolName);
+        if (symbol)
+            PhDereferenceObject(symbol);
+    }
+}
+
+/**
+ * Exports the samples captured by a profiler in the folded stack format.
+ *
+ * \param Profiler The profiler.
+ *
+ * \return The folded stacks, one per line. See PhExportFoldedCallTree().
+ *
+ * \remarks Symbols for the process and the kernel are loaded by this function.
+ */
+PPH_STRING PhExportFoldedProfiler(
+    _In_ PPH_PROFILER Profiler
+    )
+{
+    PH_PROFILER_RESOLVE_CONTEXT context;
+    PPH_STRING folded;
+
+    context.SymbolProvider = PhCreateSymbolProvider(Profiler->ProcessId);
+    context.ProcessId = Profiler->ProcessId;
+
+    if (context.SymbolProvider->IsRealHandle)
+    {
+        context.LoadingProcessId = Profiler->ProcessId;
+        PhEnumGenericModules(
+            Profiler->ProcessId,
+            context.SymbolProvider->ProcessHandle,
+            0,
+            PhpProfilerLoadSymbolsCallback,
+            &context
+            );
+    }
+
+    context.LoadingProcessId = SYSTEM_PROCESS_ID;
+    PhEnumGenericModules(
+        SYSTEM_PROCESS_ID,
+        NULL,
+        0,
+        PhpProfilerLoadSymbolsCallback,
+        &context
+        );
+
+    folded = PhExportFoldedCallTree(Profiler->CallTree, PhpProfilerResolveCallback, &context);
+    PhDereferenceObject(context.SymbolProvider);
+
+    return folded;
+}
@@ -0,0 +1,385 @@
+/*
+ * Process Hacker -
+ *   regular expression matching
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This module wraps PCRE so that callers do not depend on the engine. A pattern is
+ * compiled and studied once, and the compiled pattern is immutable, so it can be
+ * shared by any number of threads.
+ *
+ * The bundled PCRE only matches 8-bit subjects. Subjects that are plain ASCII (the
+ * common case for memory strings and object names) are narrowed with a simple loop,
+ * and other subjects are converted to the ANSI code page as before. No allocation
+ * is needed for subjects shorter than PH_REGEX_LOCAL_BUFFER_SIZE characters.
+ */
+
+#include <phapp.h>
+#include "pcre/pcre.h"
+
+#define PH_REGEX_LOCAL_BUFFER_SIZE 512
+#define PH_REGEX_PARALLEL_THRESHOLD 4096
+#define PH_REGEX_MAXIMUM_WORKERS 16
+
+typedef struct _PH_REGEX
+{
+    pcre *Expression;
+    pcre_extra *ExtraData;
+    ULONG Flags;
+} PH_REGEX;
+
+typedef struct _PH_REGEX_PARTITION
+{
+    PPH_REGEX Regex;
+    PPH_LIST Items;
+    ULONG StartIndex;
+    ULONG EndIndex;
+    PPH_REGEX_GET_TEXT GetText;
+    PVOID Context;
+    PBOOLEAN Matches;
+    ULONG NumberOfMatches;
+} PH_REGEX_PARTITION, *PPH_REGEX_PARTITION;
+
+VOID NTAPI PhpRegexDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhRegexType;
+
+static PH_INITONCE PhRegexInitOnce = PH_INITONCE_INIT;
+
+static VOID PhpInitializeRegex(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&PhRegexInitOnce))
+    {
+        PhCreateObjectType(&PhRegexType, L"Regex", 0, PhpRegexDeleteProcedure);
+        PhEndInitOnce(&PhRegexInitOnce);
+    }
+}
+
+/**
+ * Compiles a regular expression.
+ *
+ * \param Pattern The pattern.
+ * \param Flags A combination of flags.
+ * \li \c PH_REGEX_IGNORE_CASE Matching is case-insensitive.
+ * \li \c PH_REGEX_DOT_ALL The dot metacharacter also matches new lines.
+ * \param ErrorMessage A variable which receives a description of the error if the
+ * function fails. You must free the string using PhDereferenceObject() when you no
+ * longer need it.
+ *
+ * \return The compiled expression, or NULL if the pattern is invalid or there is not
+ * enough memory.
+ */
+PPH_REGEX PhCreateRegex(
+    _In_ PPH_STRINGREF Pattern,
+    _In_ ULONG Flags,
+    _Out_opt_ PPH_STRING *ErrorMessage
+    )
+{
+    NTSTATUS status;
+    PPH_REGEX regex;
+    PPH_ANSI_STRING pattern;
+    pcre *expression;
+    int options;
+    const char *errorString;
+    int errorOffset;
+
+    PhpInitializeRegex();
+
+    pattern = PhCreateAnsiStringFromUnicodeEx(Pattern->Buffer, Pattern->Length);
+    options = 0;
+
+    if (Flags & PH_REGEX_IGNORE_CASE)
+        options |= PCRE_CASELESS;
+    if (Flags & PH_REGEX_DOT_ALL)
+        options |= PCRE_DOTALL;
+
+    expression = pcre_compile2(
+        pattern->Buffer,
+        options,
+        NULL,
+        &errorString,
+        &errorOffset,
+        NULL
+        );
+    PhDereferenceObject(pattern);
+
+    if (!expression)
+    {
+        if (ErrorMessage)
+            *ErrorMessage = PhFormatString(L"\"%S\" at position %d", errorString, errorOffset);
+
+        return NULL;
+    }
+
+    if (!NT_SUCCESS(status = PhCreateObject(&regex, sizeof(PH_REGEX), 0, PhRegexType)))
+    {
+        pcre_free(expression);
+
+        if (ErrorMessage)
+        {
+            if (!(*ErrorMessage = PhGetNtMessage(status)))
+                *ErrorMessage = PhCreateString(L"Insufficient memory");
+        }
+
+        return NULL;
+    }
+
+    regex->Expression = expression;
+    regex->ExtraData = pcre_study(expression, 0, &errorString);
+    regex->Flags = Flags;
+
+    return regex;
+}
+
+VOID NTAPI PhpRegexDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_REGEX regex = Object;
+
+    if (regex->ExtraData)
+        pcre_free(regex->ExtraData);
+
+    pcre_free(regex->Expression);
+}
+
+static BOOLEAN PhpExecuteRegex(
+    _In_ PPH_REGEX Regex,
+    _In_ PCHAR Subject,
+    _In_ ULONG SubjectLength
+    )
+{
+    int r;
+
+    // Guard against stack overflows.
+    __try
+    {
+        r = pcre_exec(
+            Regex->Expression,
+            Regex->ExtraData,
+            Subject,
+            SubjectLength,
+            0,
+            0,
+            NULL,
+            0
+            );
+    }
+    __except (SIMPLE_EXCEPTION_FILTER(GetExceptionCode() == STATUS_STACK_OVERFLOW))
+    {
+        r = -1;
+
+        if (!_resetstkoflw())
+        {
+            PhRaiseStatus(STATUS_STACK_OVERFLOW);
+        }
+    }
+
+    return r >= 0;
+}
+
+/**
+ * Determines whether a string matches a regular expression.
+ *
+ * \param Regex The compiled expression.
+ * \param Text The string to search.
+ *
+ * \return TRUE if the expression matches any part of the string, otherwise FALSE.
+ */
+BOOLEAN PhMatchRegex(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_STRINGREF Text
+    )
+{
+    CHAR localBuffer[PH_REGEX_LOCAL_BUFFER_SIZE];
+    PCHAR buffer;
+    SIZE_T bufferSize;
+    SIZE_T count;
+    SIZE_T i;
+    ULONG subjectLength;
+    BOOLEAN result;
+
+    if (Text->Length > MAXLONG)
+        return FALSE;
+
+    count = Text->Length / sizeof(WCHAR);
+
+    // A multi-byte code page may need two bytes for each character.
+    bufferSize = Text->Length;
+
+    if (bufferSize <= sizeof(localBuffer))
+        buffer = localBuffer;
+    else
+        buffer = PhAllocate(bufferSize);
+
+    for (i = 0; i < count; i++)
+    {
+        if (Text->Buffer[i] >= 0x80)
+            break;
+
+        buffer[i] = (CHAR)Text->Buffer[i];
+    }
+
+    if (i == count)
+    {
+        subjectLength = (ULONG)count;
+    }
+    else if (!NT_SUCCESS(RtlUnicodeToMultiByteN(
+        buffer,
+        (ULONG)bufferSize,
+        &subjectLength,
+        Text->Buffer,
+        (ULONG)Text->Length
+        )))
+    {
+        if (buffer != localBuffer)
+            PhFree(buffer);
+
+        return FALSE;
+    }
+
+    result = PhpExecuteRegex(Regex, buffer, subjectLength);
+
+    if (buffer != localBuffer)
+        PhFree(buffer);
+
+    return result;
+}
+
+static VOID PhpMatchRegexPartition(
+    _Inout_ PPH_REGEX_PARTITION Partition
+    )
+{
+    ULONG i;
+
+    for (i = Partition->StartIndex; i < Partition->EndIndex; i++)
+    {
+        PPH_STRINGREF text;
+
+        text = Partition->GetText(Partition->Items->Items[i], Partition->Context);
+
+        if (text && PhMatchRegex(Partition->Regex, text))
+        {
+            Partition->Matches[i] = TRUE;
+            Partition->NumberOfMatches++;
+        }
+        else
+        {
+            Partition->Matches[i] = FALSE;
+        }
+    }
+}
+
+static NTSTATUS PhpMatchRegexWorkerThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PhpMatchRegexPartition(Parameter);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Matches a regular expression against each item in a list.
+ *
+ * \param Regex The compiled expression.
+ * \param Items The list of items.
+ * \param GetText A callback which returns the text of an item. The callback may be
+ * called concurrently from multiple threads.
+ * \param Context A user-defined value to pass to the callback.
+ * \param Matches An array which receives, for each item, whether the expression
+ * matches the text of the item.
+ *
+ * \return The number of items that match.
+ *
+ * \remarks Large lists are divided between a number of worker threads.
+ */
+ULONG PhMatchRegexList(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_LIST Items,
+    _In_ PPH_REGEX_GET_TEXT GetText,
+    _In_opt_ PVOID Context,
+    _Out_writes_(Items->Count) PBOOLEAN Matches
+    )
+{
+    PH_REGEX_PARTITION partitions[PH_REGEX_MAXIMUM_WORKERS];
+    HANDLE threadHandles[PH_REGEX_MAXIMUM_WORKERS];
+    ULONG numberOfWorkers;
+    ULONG partitionSize;
+    ULONG numberOfMatches;
+    ULONG i;
+
+    numberOfWorkers = 1;
+
+    if (Items->Count >= PH_REGEX_PARALLEL_THRESHOLD)
+    {
+        numberOfWorkers = PhSystemBasicInformation.NumberOfProcessors;
+
+        if (numberOfWorkers > PH_REGEX_MAXIMUM_WORKERS)
+            numberOfWorkers = PH_REGEX_MAXIMUM_WORKERS;
+        if (numberOfWorkers == 0)
+            numberOfWorkers = 1;
+    }
+
+    partitionSize = (Items->Count + numberOfWorkers - 1) / numberOfWorkers;
+
+    for (i = 0; i < numberOfWorkers; i++)
+    {
+        partitions[i].Regex = Regex;
+        partitions[i].Items = Items;
+        partitions[i].StartIndex = min(i * partitionSize, Items->Count);
+        partitions[i].EndIndex = min((i + 1) * partitionSize, Items->Count);
+        partitions[i].GetText = GetText;
+        partitions[i].Context = Context;
+        partitions[i].Matches = Matches;
+        partitions[i].NumberOfMatches = 0;
+    }
+
+    // The current thread takes the first partition. If a worker thread cannot be
+    // created, its partition is processed here as well.
+    for (i = 1; i < numberOfWorkers; i++)
+    {
+        threadHandles[i] = PhCreateThread(0, PhpMatchRegexWorkerThreadStart, &partitions[i]);
+    }
+
+    PhpMatchRegexPartition(&partitions[0]);
+    numberOfMatches = partitions[0].NumberOfMatches;
+
+    for (i = 1; i < numberOfWorkers; i++)
+    {
+        if (threadHandles[i])
+        {
+            NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+            NtClose(threadHandles[i]);
+        }
+        else
+        {
+            PhpMatchRegexPartition(&partitions[i]);
+        }
+
+        numberOfMatches += partitions[i].NumberOfMatches;
+    }
+
+    return numberOfMatches;
+}
@@ -1391,6 +1391,46 @@ PhShowProcessRecordDialog(
     _In_ PPH_PROCESS_RECORD Record
     );
 
+// regex
+
+#define PH_REGEX_IGNORE_CASE 0x1
+#define PH_REGEX_DOT_ALL 0x2
+
+typedef struct _PH_REGEX *PPH_REGEX;
+
+typedef PPH_STRINGREF (NTAPI *PPH_REGEX_GET_TEXT)(
+    _In_ PVOID Item,
+    _In_opt_ PVOID Context
+    );
+
+PHAPPAPI
+PPH_REGEX
+NTAPI
+PhCreateRegex(
+    _In_ PPH_STRINGREF Pattern,
+    _In_ ULONG Flags,
+    _Out_opt_ PPH_STRING *ErrorMessage
+    );
+
+PHAPPAPI
+BOOLEAN
+NTAPI
+PhMatchRegex(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_STRINGREF Text
+    );
+
+PHAPPAPI
+ULONG
+NTAPI
+PhMatchRegexList(
+    _In_ PPH_REGEX Regex,
+    _In_ PPH_LIST Items,
+    _In_ PPH_REGEX_GET_TEXT GetText,
+    _In_opt_ PVOID Context,
+    _Out_writes_(Items->Count) PBOOLEAN Matches
+    );
+
 // srvctl
 
 #define WM_PH_SET_LIST_VIEW_SETTINGS (WM_APP + 701)
@@ -726,11 +726,111 @@ VOID PhConvertIgnoredSettings(
     PhReleaseQueuedLockExclusive(&PhSettingsLock);
 }
 
-mxml_type_t PhpSettingsLoadCallback(
-    _In_ mxml_node_t *node
+typedef struct _PH_SETTINGS_LOAD_CONTEXT
+{
+    PPH_STRING SettingName;
+    PPH_STRING SettingValue;
+    PPH_LIST Settings; // pairs of setting names and values
+} PH_SETTINGS_LOAD_CONTEXT, *PPH_SETTINGS_LOAD_CONTEXT;
+
+/**
+ * Applies a setting read from a settings file.
+ *
+ * \remarks The settings lock must be held exclusively.
+ */
+VOID PhpLoadSetting(
+    _In_ PPH_STRING SettingName,
+    _In_ PPH_STRING SettingValue
     )
 {
-    return MXML_OPAQUE;
+    PPH_SETTING setting;
+
+    setting = PhpLookupSetting(&SettingName->sr);
+
+    if (setting)
+    {
+        PhpFreeSettingValue(setting->Type, setting);
+
+        if (!PhpSettingFromString(
+            setting->Type,
+            &SettingValue->sr,
+            SettingValue,
+            setting
+            ))
+        {
+            PhpSettingFromString(
+                setting->Type,
+                &setting->DefaultValue,
+                NULL,
+                setting
+                );
+        }
+    }
+    else
+    {
+        setting = PhAllocate(sizeof(PH_SETTING));
+        setting->Name.Buffer = PhAllocateCopy(SettingName->Buffer, SettingName->Length + sizeof(WCHAR));
+        setting->Name.Length = SettingName->Length;
+        PhReferenceObject(SettingValue);
+        setting->u.Pointer = SettingValue;
+
+        PhAddItemList(PhIgnoredSettings, setting);
+    }
+}
+
+int PhpSettingsStreamCallback(
+    _In_ mxml_stream_event_t Event,
+    _In_ mxml_stream_node_t *Node,
+    _In_ PVOID Context
+    )
+{
+    PPH_SETTINGS_LOAD_CONTEXT context = Context;
+
+    // Settings are the children of the root element:
+    // <settings><setting name="...">value</setting>...</settings>
+
+    if (Node->depth != 2)
+        return 0;
+
+    switch (Event)
+    {
+    case MXML_STREAM_ELEMENT_OPEN:
+        if (Node->num_attrs >= 1 && stricmp(Node->attrs[0].name, "name") == 0)
+            context->SettingName = PhCreateStringEx((PWSTR)Node->attrs[0].value, Node->attrs[0].length * sizeof(WCHAR));
+        break;
+    case MXML_STREAM_DATA:
+        if (context->SettingName)
+        {
+            if (!context->SettingValue)
+            {
+                context->SettingValue = PhCreateStringEx((PWSTR)Node->text, Node->length * sizeof(WCHAR));
+            }
+            else
+            {
+                PH_STRINGREF text;
+
+                text.Buffer = (PWSTR)Node->text;
+                text.Length = Node->length * sizeof(WCHAR);
+                PhSwapReference2(&context->SettingValue, PhConcatStringRef2(&context->SettingValue->sr, &text));
+            }
+        }
+        break;
+    case MXML_STREAM_ELEMENT_CLOSE:
+        if (context->SettingName)
+        {
+            if (!context->SettingValue)
+                context->SettingValue = PhReferenceEmptyString();
+
+            // The references are transferred to the list.
+            PhAddItemList(context->Settings, context->SettingName);
+            PhAddItemList(context->Settings, context->SettingValue);
+            context->SettingName = NULL;
+            context->SettingValue = NULL;
+        }
+        break;
+    }
+
+    return 0;
 }
 
 NTSTATUS PhLoadSettings(
@@ -740,8 +840,9 @@ NTSTATUS PhLoadSettings(
     NTSTATUS status;
     HANDLE fileHandle;
     LARGE_INTEGER fileSize;
-    mxml_node_t *topNode;
-    mxml_node_t *currentNode;
+    PH_SETTINGS_LOAD_CONTEXT context;
+    int result;
+    ULONG i;
 
     PhpClearIgnoredSettings();
 
@@ -765,140 +866,55 @@ NTSTATUS PhLoadSettings(
         return status;
     }
 
-    topNode = mxmlLoadFd(NULL, fileHandle, PhpSettingsLoadCallback);
+    // The file is read in one pass without building a tree. The settings
+    // are collected first and only applied once the whole file has been
+    // read, so a corrupt file does not leave the settings half-loaded.
+    context.SettingName = NULL;
+    context.SettingValue = NULL;
+    context.Settings = PhCreateList(512);
+    result = mxmlStreamLoadFd(fileHandle, PhpSettingsStreamCallback, &context);
     NtClose(fileHandle);
 
-    if (!topNode)
-        return STATUS_FILE_CORRUPT_ERROR;
-
-    if (topNode->type != MXML_ELEMENT)
-    {
-        mxmlDelete(topNode);
-        return STATUS_FILE_CORRUPT_ERROR;
-    }
-
-    currentNode = topNode->child;
+    if (context.SettingName)
+        PhDereferenceObject(context.SettingName);
+    if (context.SettingValue)
+        PhDereferenceObject(context.SettingValue);
 
-    while (currentNode)
+    if (result == 0)
     {
-        PPH_STRING settingName = NULL;
-
-        if (
-            currentNode->type == MXML_ELEMENT &&
-            currentNode->value.element.num_attrs >= 1 &&
-            stricmp(currentNode->value.element.attrs[0].name, "name") == 0
-            )
-        {
-            settingName = PhCreateStringFromAnsi(currentNode->value.element.attrs[0].value);
-        }
-
-        if (settingName)
-        {
-            PPH_STRING settingValue;
-
-            settingValue = PhGetOpaqueXmlNodeText(currentNode);
-
-            PhAcquireQueuedLockExclusive(&PhSettingsLock);
+        PhAcquireQueuedLockExclusive(&PhSettingsLock);
 
-            {
-                PPH_SETTING setting;
-
-                setting = PhpLookupSetting(&settingName->sr);
-
-                if (setting)
-                {
-                    PhpFreeSettingValue(setting->Type, setting);
-
-                    if (!PhpSettingFromString(
-                        setting->Type,
-                        &settingValue->sr,
-                        settingValue,
-                        setting
-                        ))
-                    {
-                        PhpSettingFromString(
-                            setting->Type,
-                            &setting->DefaultValue,
-                            NULL,
-                            setting
-                            );
-                    }
-                }
-                else
-                {
-                    setting = PhAllocate(sizeof(PH_SETTING));
-                    setting->Name.Buffer = PhAllocateCopy(settingName->Buffer, settingName->Length + sizeof(WCHAR));
-                    setting->Name.Length = settingName->Length;
-                    PhReferenceObject(settingValue);
-                    setting->u.Pointer = settingValue;
-
-                    PhAddItemList(PhIgnoredSettings, setting);
-                }
-            }
+        for (i = 0; i < context.Settings->Count; i += 2)
+            PhpLoadSetting(context.Settings->Items[i], context.Settings->Items[i + 1]);
 
-            PhReleaseQueuedLockExclusive(&PhSettingsLock);
+        PhReleaseQueuedLockExclusive(&PhSettingsLock);
+    }
 
-            PhDereferenceObject(settingValue);
-            PhDereferenceObject(settingName);
-        }
+    for (i = 0; i < context.Settings->Count; i++)
+        PhDereferenceObject(context.Settings->Items[i]);
 
-        currentNode = currentNode->next;
-    }
+    PhDereferenceObject(context.Settings);
 
-    mxmlDelete(topNode);
+    if (result != 0)
+        return STATUS_FILE_CORRUPT_ERROR;
 
     PhUpdateCachedSettings();
 
     return STATUS_SUCCESS;
 }
 
-char *PhpSettingsSaveCallback(
-    _In_ mxml_node_t *node,
-    _In_ int position
-    )
-{
-    if (STR_IEQUAL(node->value.element.name, "setting"))
-    {
-        if (position == MXML_WS_BEFORE_OPEN)
-            return "  ";
-        else if (position == MXML_WS_AFTER_CLOSE)
-            return "\r\n";
-    }
-    else if (STR_IEQUAL(node->value.element.name, "settings"))
-    {
-        if (position == MXML_WS_AFTER_OPEN)
-            return "\r\n";
-    }
-
-    return NULL;
-}
-
-mxml_node_t *PhpCreateSettingElement(
-    _Inout_ mxml_node_t *ParentNode,
+VOID PhpWriteSettingElement(
+    _Inout_ mxml_stream_writer_t *Writer,
     _In_ PPH_STRINGREF SettingName,
     _In_ PPH_STRINGREF SettingValue
     )
 {
-    mxml_node_t *settingNode;
-    mxml_node_t *textNode;
-    PPH_ANSI_STRING settingNameAnsi;
-    PPH_ANSI_STRING settingValueAnsi;
-
-    // Create the setting element.
-
-    settingNode = mxmlNewElement(ParentNode, "setting");
-
-    settingNameAnsi = PhCreateAnsiStringFromUnicodeEx(SettingName->Buffer, SettingName->Length);
-    mxmlElementSetAttr(settingNode, "name", settingNameAnsi->Buffer);
-    PhDereferenceObject(settingNameAnsi);
-
-    // Set the value.
-
-    settingValueAnsi = PhCreateAnsiStringFromUnicodeEx(SettingValue->Buffer, SettingValue->Length);
-    textNode = mxmlNewOpaque(settingNode, settingValueAnsi->Buffer);
-    PhDereferenceObject(settingValueAnsi);
-
-    return settingNode;
+    mxmlStreamWriteRaw(Writer, "  ");
+    mxmlStreamWriteElementOpen(Writer, "setting");
+    mxmlStreamWriteAttr(Writer, "name", SettingName->Buffer, (int)(SettingName->Length / sizeof(WCHAR)));
+    mxmlStreamWriteText(Writer, SettingValue->Buffer, (int)(SettingValue->Length / sizeof(WCHAR)));
+    mxmlStreamWriteElementClose(Writer, "setting");
+    mxmlStreamWriteRaw(Writer, "\r\n");
 }
 
 NTSTATUS PhSaveSettings(
@@ -907,37 +923,33 @@ NTSTATUS PhSaveSettings(
 {
     NTSTATUS status;
     HANDLE fileHandle;
-    mxml_node_t *topNode;
+    mxml_stream_writer_t writer;
     PH_HASHTABLE_ENUM_CONTEXT enumContext;
     PPH_SETTING setting;
+    PPH_LIST settings;
+    ULONG i;
 
-    topNode = mxmlNewElement(MXML_NO_PARENT, "settings");
-
+    // Take a copy of the settings so the lock is not held while the file
+    // is written. The list contains pairs of setting names and values.
     PhAcquireQueuedLockShared(&PhSettingsLock);
 
+    settings = PhCreateList((PhSettingsHashtable->Count + PhIgnoredSettings->Count) * 2);
+
     PhBeginEnumHashtable(PhSettingsHashtable, &enumContext);
 
     while (setting = PhNextEnumHashtable(&enumContext))
     {
-        PPH_STRING settingValue;
-
-        settingValue = PhpSettingToString(setting->Type, setting);
-        PhpCreateSettingElement(topNode, &setting->Name, &settingValue->sr);
-        PhDereferenceObject(settingValue);
+        PhAddItemList(settings, PhCreateStringEx(setting->Name.Buffer, setting->Name.Length));
+        PhAddItemList(settings, PhpSettingToString(setting->Type, setting));
     }
 
-    // Write the ignored settings.
+    // Copy the ignored settings.
+    for (i = 0; i < PhIgnoredSettings->Count; i++)
     {
-        ULONG i;
-
-        for (i = 0; i < PhIgnoredSettings->Count; i++)
-        {
-            PPH_STRING settingValue;
-
-            setting = PhIgnoredSettings->Items[i];
-            settingValue = setting->u.Pointer;
-            PhpCreateSettingElement(topNode, &setting->Name, &settingValue->sr);
-        }
+        setting = PhIgnoredSettings->Items[i];
+        PhAddItemList(settings, PhCreateStringEx(setting->Name.Buffer, setting->Name.Length));
+        PhReferenceObject(setting->u.Pointer);
+        PhAddItemList(settings, setting->u.Pointer);
     }
 
     PhReleaseQueuedLockShared(&PhSettingsLock);
@@ -974,16 +986,37 @@ NTSTATUS PhSaveSettings(
         );
 
     if (!NT_SUCCESS(status))
+        goto CleanupExit;
+
+    // Settings are written directly to the file as UTF-8.
+    mxmlStreamWriterInit(&writer, fileHandle);
+    mxmlStreamWriteElementOpen(&writer, "settings");
+    mxmlStreamWriteRaw(&writer, "\r\n");
+
+    for (i = 0; i < settings->Count; i += 2)
     {
-        mxmlDelete(topNode);
-        return status;
+        PhpWriteSettingElement(
+            &writer,
+            &((PPH_STRING)settings->Items[i])->sr,
+            &((PPH_STRING)settings->Items[i + 1])->sr
+            );
     }
 
-    mxmlSaveFd(topNode, fileHandle, PhpSettingsSaveCallback);
-    mxmlDelete(topNode);
+    mxmlStreamWriteElementClose(&writer, "settings");
+    mxmlStreamWriteRaw(&writer, "\r\n");
+
+    if (mxmlStreamWriterClose(&writer) != 0)
+        status = STATUS_UNSUCCESSFUL;
+
     NtClose(fileHandle);
 
-    return STATUS_SUCCESS;
+CleanupExit:
+    for (i = 0; i < settings->Count; i++)
+        PhDereferenceObject(settings->Items[i]);
+
+    PhDereferenceObject(settings);
+
+    return status;
 }
 
 VOID PhResetSettings(
@@ -46,6 +46,22 @@ typedef EVT_HANDLE (WINAPI *_EvtSubscribe)(
     _In_ DWORD Flags
     );
 
+typedef EVT_HANDLE (WINAPI *_EvtCreateRenderContext)(
+    _In_ DWORD ValuePathsCount,
+    _In_ LPCWSTR *ValuePaths,
+    _In_ DWORD Flags
+    );
+
+typedef BOOL (WINAPI *_EvtRender)(
+    _In_ EVT_HANDLE Context,
+    _In_ EVT_HANDLE Fragment,
+    _In_ DWORD Flags,
+    _In_ DWORD BufferSize,
+    _Out_ PVOID Buffer,
+    _Out_ PDWORD BufferUsed,
+    _Out_ PDWORD PropertyCount
+    );
+
 typedef struct _PHP_SERVICE_NAME_ENTRY
 {
     PH_HASH_ENTRY HashEntry;
@@ -53,6 +69,23 @@ typedef struct _PHP_SERVICE_NAME_ENTRY
     ENUM_SERVICE_STATUS_PROCESS *ServiceEntry;
 } PHP_SERVICE_NAME_ENTRY, *PPHP_SERVICE_NAME_ENTRY;
 
+typedef struct _PHP_SERVICE_DISPLAY_NAME_ENTRY
+{
+    PH_STRINGREF DisplayName;
+    PPH_SERVICE_ITEM ServiceItem;
+} PHP_SERVICE_DISPLAY_NAME_ENTRY, *PPHP_SERVICE_DISPLAY_NAME_ENTRY;
+
+typedef struct _PHP_DIRTY_SERVICE_ENTRY
+{
+    PPH_STRING Name;
+    BOOLEAN IsDisplayName;
+    BOOLEAN NeedsConfigUpdate;
+} PHP_DIRTY_SERVICE_ENTRY, *PPHP_DIRTY_SERVICE_ENTRY;
+
+// When non-polling is active, all services are enumerated at this interval (in
+// milliseconds) in case any changes were not notified.
+#define PH_SERVICE_RESCAN_INTERVAL (60 * 1000)
+
 VOID NTAPI PhpServiceItemDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -67,6 +100,15 @@ ULONG NTAPI PhpServiceHashtableHashFunction(
     _In_ PVOID Entry
     );
 
+BOOLEAN NTAPI PhpServiceDisplayNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpServiceDisplayNameHashFunction(
+    _In_ PVOID Entry
+    );
+
 VOID PhpAddProcessItemService(
     _In_ PPH_PROCESS_ITEM ProcessItem,
     _In_ PPH_SERVICE_ITEM ServiceItem
@@ -77,6 +119,12 @@ VOID PhpRemoveProcessItemService(
     _In_ PPH_SERVICE_ITEM ServiceItem
     );
 
+VOID PhpMarkServiceDirty(
+    _In_ PPH_STRINGREF Name,
+    _In_ BOOLEAN IsDisplayName,
+    _In_ BOOLEAN NeedsConfigUpdate
+    );
+
 VOID PhpInitializeServiceNonPoll(
     VOID
     );
@@ -85,6 +133,8 @@ PPH_OBJECT_TYPE PhServiceItemType;
 
 PPH_HASHTABLE PhServiceHashtable;
 PH_QUEUED_LOCK PhServiceHashtableLock = PH_QUEUED_LOCK_INIT;
+// Indexes service items by display name. Protected by PhServiceHashtableLock.
+static PPH_HASHTABLE PhpServiceDisplayNameHashtable;
 
 PHAPPAPI PH_CALLBACK_DECLARE(PhServiceAddedEvent);
 PHAPPAPI PH_CALLBACK_DECLARE(PhServiceModifiedEvent);
@@ -99,6 +149,16 @@ static ULONG PhpNonPollGate;
 static _NotifyServiceStatusChangeW NotifyServiceStatusChangeW_I;
 static _EvtClose EvtClose_I;
 static _EvtSubscribe EvtSubscribe_I;
+static _EvtCreateRenderContext EvtCreateRenderContext_I;
+static _EvtRender EvtRender_I;
+static EVT_HANDLE PhpNonPollRenderContext;
+
+static PH_QUEUED_LOCK PhpDirtyServiceListLock = PH_QUEUED_LOCK_INIT;
+static PPH_LIST PhpDirtyServiceList = NULL;
+static ULONG64 PhpLastFullScanTime;
+
+static PH_SERVICE_PROVIDER_STATISTICS PhpServiceProviderStatistics;
+static LONG PhpServiceNotificationCount;
 
 BOOLEAN PhServiceProviderInitialization(
     VOID
@@ -119,6 +179,13 @@ BOOLEAN PhServiceProviderInitialization(
         40
         );
 
+    PhpServiceDisplayNameHashtable = PhCreateHashtable(
+        sizeof(PHP_SERVICE_DISPLAY_NAME_ENTRY),
+        PhpServiceDisplayNameCompareFunction,
+        PhpServiceDisplayNameHashFunction,
+        40
+        );
+
     return TRUE;
 }
 
@@ -216,6 +283,26 @@ ULONG PhpServiceHashtableHashFunction(
     return PhpHashStringIgnoreCase(serviceItem->Key.Buffer, serviceItem->Key.Length / sizeof(WCHAR));
 }
 
+BOOLEAN PhpServiceDisplayNameCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPHP_SERVICE_DISPLAY_NAME_ENTRY entry1 = Entry1;
+    PPHP_SERVICE_DISPLAY_NAME_ENTRY entry2 = Entry2;
+
+    return PhEqualStringRef(&entry1->DisplayName, &entry2->DisplayName, TRUE);
+}
+
+ULONG PhpServiceDisplayNameHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPHP_SERVICE_DISPLAY_NAME_ENTRY entry = Entry;
+
+    return PhpHashStringIgnoreCase(entry->DisplayName.Buffer, entry->DisplayName.Length / sizeof(WCHAR));
+}
+
 PPH_SERVICE_ITEM PhpLookupServiceItem(
     _In_ PPH_STRINGREF Name
     )
@@ -264,16 +351,68 @@ VOID PhMarkNeedsConfigUpdateServiceItem(
     )
 {
     ServiceItem->NeedsConfigUpdate = TRUE;
+    // The service provider may only query services which have been marked as dirty.
+    PhpMarkServiceDirty(&ServiceItem->Name->sr, FALSE, TRUE);
+}
+
+static VOID PhpAddServiceItemDisplayName(
+    _In_ PPH_SERVICE_ITEM ServiceItem
+    )
+{
+    PHP_SERVICE_DISPLAY_NAME_ENTRY entry;
+
+    if (!ServiceItem->DisplayName)
+        return;
+
+    // Display names are unique in practice. If two services do share one, the
+    // first service keeps the entry.
+    entry.DisplayName = ServiceItem->DisplayName->sr;
+    entry.ServiceItem = ServiceItem;
+    PhAddEntryHashtable(PhpServiceDisplayNameHashtable, &entry);
+}
+
+static VOID PhpRemoveServiceItemDisplayName(
+    _In_ PPH_SERVICE_ITEM ServiceItem
+    )
+{
+    PHP_SERVICE_DISPLAY_NAME_ENTRY lookupEntry;
+    PPHP_SERVICE_DISPLAY_NAME_ENTRY entry;
+
+    if (!ServiceItem->DisplayName)
+        return;
+
+    lookupEntry.DisplayName = ServiceItem->DisplayName->sr;
+    entry = PhFindEntryHashtable(PhpServiceDisplayNameHashtable, &lookupEntry);
+
+    if (entry && entry->ServiceItem == ServiceItem)
+        PhRemoveEntryHashtable(PhpServiceDisplayNameHashtable, &lookupEntry);
 }
 
 VOID PhpRemoveServiceItem(
     _In_ PPH_SERVICE_ITEM ServiceItem
     )
 {
+    PhpRemoveServiceItemDisplayName(ServiceItem);
     PhRemoveEntryHashtable(PhServiceHashtable, &ServiceItem);
     PhDereferenceObject(ServiceItem);
 }
 
+PPH_SERVICE_ITEM PhpLookupServiceItemByDisplayName(
+    _In_ PPH_STRINGREF DisplayName
+    )
+{
+    PHP_SERVICE_DISPLAY_NAME_ENTRY lookupEntry;
+    PPHP_SERVICE_DISPLAY_NAME_ENTRY entry;
+
+    lookupEntry.DisplayName = *DisplayName;
+    entry = PhFindEntryHashtable(PhpServiceDisplayNameHashtable, &lookupEntry);
+
+    if (entry)
+        return entry->ServiceItem;
+    else
+        return NULL;
+}
+
 PH_SERVICE_CHANGE PhGetServiceChange(
     _In_ PPH_SERVICE_MODIFIED_DATA Data
     )
@@ -402,6 +541,8 @@ VOID PhpUpdateServiceItemConfig(
 {
     SC_HANDLE serviceHandle;
 
+    PhpServiceProviderStatistics.ConfigQueries++;
+
     serviceHandle = OpenService(ScManagerHandle, ServiceItem->Name->Buffer, SERVICE_QUERY_CONFIG);
 
     if (serviceHandle)
@@ -437,6 +578,401 @@ static ULONG PhpHashServiceNameEntry(
     return PhHashBytes((PUCHAR)Value->Name.Buffer, Value->Name.Length);
 }
 
+static VOID PhpProcessServiceRemoved(
+    _In_ PPH_SERVICE_ITEM ServiceItem
+    )
+{
+    // Remove the service from its process.
+    if (ServiceItem->ProcessId)
+    {
+        PPH_PROCESS_ITEM processItem;
+
+        processItem = PhReferenceProcessItem((HANDLE)ServiceItem->ProcessId);
+
+        if (processItem)
+        {
+            PhpRemoveProcessItemService(processItem, ServiceItem);
+            PhDereferenceObject(processItem);
+        }
+    }
+
+    // Raise the service removed event.
+    PhInvokeCallback(&PhServiceRemovedEvent, ServiceItem);
+}
+
+static VOID PhpProcessServiceEntry(
+    _In_ SC_HANDLE ScManagerHandle,
+    _In_ ENUM_SERVICE_STATUS_PROCESS *ServiceEntry
+    )
+{
+    PPH_SERVICE_ITEM serviceItem;
+    PH_STRINGREF name;
+
+    PhInitializeStringRef(&name, ServiceEntry->lpServiceName);
+    serviceItem = PhpLookupServiceItem(&name);
+
+    if (!serviceItem)
+    {
+        // Create the service item and fill in basic information.
+
+        serviceItem = PhCreateServiceItem(ServiceEntry);
+
+        PhpUpdateServiceItemConfig(ScManagerHandle, serviceItem);
+
+        // Add the service to its process, if appropriate.
+        if (
+            (
+            serviceItem->State == SERVICE_RUNNING ||
+            serviceItem->State == SERVICE_PAUSED
+            ) &&
+            serviceItem->ProcessId
+            )
+        {
+            PPH_PROCESS_ITEM processItem;
+
+            if (processItem = PhReferenceProcessItem(serviceItem->ProcessId))
+            {
+                PhpAddProcessItemService(processItem, serviceItem);
+                PhDereferenceObject(processItem);
+            }
+            else
+            {
+                // The process doesn't exist yet (to us). Set the pending
+                // flag and when the process is added this will be
+                // fixed.
+                serviceItem->PendingProcess = TRUE;
+            }
+        }
+
+        // Add the service item to the hashtable.
+        PhAcquireQueuedLockExclusive(&PhServiceHashtableLock);
+        PhAddEntryHashtable(PhServiceHashtable, &serviceItem);
+        PhpAddServiceItemDisplayName(serviceItem);
+        PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
+
+        // Raise the service added event.
+        PhInvokeCallback(&PhServiceAddedEvent, serviceItem);
+    }
+    else
+    {
+        BOOLEAN displayNameChanged;
+
+        displayNameChanged =
+            ServiceEntry->lpDisplayName &&
+            (!serviceItem->DisplayName || !PhEqualString2(serviceItem->DisplayName, ServiceEntry->lpDisplayName, FALSE));
+
+        if (
+            serviceItem->Type != ServiceEntry->ServiceStatusProcess.dwServiceType ||
+            serviceItem->State != ServiceEntry->ServiceStatusProcess.dwCurrentState ||
+            serviceItem->ControlsAccepted != ServiceEntry->ServiceStatusProcess.dwControlsAccepted ||
+            serviceItem->ProcessId != (HANDLE)ServiceEntry->ServiceStatusProcess.dwProcessId ||
+            serviceItem->NeedsConfigUpdate ||
+            displayNameChanged
+            )
+        {
+            PH_SERVICE_MODIFIED_DATA serviceModifiedData;
+            PH_SERVICE_CHANGE serviceChange;
+
+            // The service has been "modified".
+
+            serviceModifiedData.Service = serviceItem;
+            memset(&serviceModifiedData.OldService, 0, sizeof(PH_SERVICE_ITEM));
+            serviceModifiedData.OldService.Type = serviceItem->Type;
+            serviceModifiedData.OldService.State = serviceItem->State;
+            serviceModifiedData.OldService.ControlsAccepted = serviceItem->ControlsAccepted;
+            serviceModifiedData.OldService.ProcessId = serviceItem->ProcessId;
+
+            if (displayNameChanged)
+            {
+                // The old display name may still be in use by other threads, so its reference
+                // is moved into the modified data and released after the event has been raised.
+                PhAcquireQueuedLockExclusive(&PhServiceHashtableLock);
+                PhpRemoveServiceItemDisplayName(serviceItem);
+                serviceModifiedData.OldService.DisplayName = serviceItem->DisplayName;
+                serviceItem->DisplayName = PhCreateString(ServiceEntry->lpDisplayName);
+                PhpAddServiceItemDisplayName(serviceItem);
+                PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
+            }
+
+            // Update the service item.
+            serviceItem->Type = ServiceEntry->ServiceStatusProcess.dwServiceType;
+            serviceItem->State = ServiceEntry->ServiceStatusProcess.dwCurrentState;
+            serviceItem->ControlsAccepted = ServiceEntry->ServiceStatusProcess.dwControlsAccepted;
+            serviceItem->ProcessId = (HANDLE)ServiceEntry->ServiceStatusProcess.dwProcessId;
+
+            if (serviceItem->ProcessId)
+                PhPrintUInt32(serviceItem->ProcessIdString, (ULONG)serviceItem->ProcessId);
+            else
+                serviceItem->ProcessIdString[0] = 0;
+
+            // Add/remove the service from its process.
+
+            serviceChange = PhGetServiceChange(&serviceModifiedData);
+
+            if (
+                (serviceChange == ServiceStarted && serviceItem->ProcessId) ||
+                (serviceChange == ServiceStopped && serviceModifiedData.OldService.ProcessId)
+                )
+            {
+                PPH_PROCESS_ITEM processItem;
+
+                if (serviceChange == ServiceStarted)
+                    processItem = PhReferenceProcessItem(serviceItem->ProcessId);
+                else
+                    processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId);
+
+                if (processItem)
+                {
+                    if (serviceChange == ServiceStarted)
+                        PhpAddProcessItemService(processItem, serviceItem);
+                    else
+                        PhpRemoveProcessItemService(processItem, serviceItem);
+
+                    PhDereferenceObject(processItem);
+                }
+                else
+                {
+                    if (serviceChange == ServiceStarted)
+                        serviceItem->PendingProcess = TRUE;
+                    else
+                        serviceItem->PendingProcess = FALSE;
+                }
+            }
+            else if (
+                serviceItem->State == SERVICE_RUNNING &&
+                serviceItem->ProcessId != serviceModifiedData.OldService.ProcessId &&
+                serviceItem->ProcessId
+                )
+            {
+                PPH_PROCESS_ITEM processItem;
+
+                // The service stopped and started, and the only change we have detected
+                // is in the process ID.
+
+                if (processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId))
+                {
+                    PhpRemoveProcessItemService(processItem, serviceItem);
+                    PhDereferenceObject(processItem);
+                }
+
+                if (processItem = PhReferenceProcessItem(serviceItem->ProcessId))
+                {
+                    PhpAddProcessItemService(processItem, serviceItem);
+                    PhDereferenceObject(processItem);
+                }
+                else
+                {
+                    serviceItem->PendingProcess = TRUE;
+                }
+            }
+
+            // Do a config update if necessary.
+            if (serviceItem->NeedsConfigUpdate)
+            {
+                PhpUpdateServiceItemConfig(ScManagerHandle, serviceItem);
+                serviceItem->NeedsConfigUpdate = FALSE;
+            }
+
+            // Raise the service modified event.
+            PhInvokeCallback(&PhServiceModifiedEvent, &serviceModifiedData);
+
+            if (serviceModifiedData.OldService.DisplayName)
+                PhDereferenceObject(serviceModifiedData.OldService.DisplayName);
+        }
+    }
+
+    // Pending states are not notified, so keep querying the service until it settles.
+    switch (ServiceEntry->ServiceStatusProcess.dwCurrentState)
+    {
+    case SERVICE_START_PENDING:
+    case SERVICE_STOP_PENDING:
+    case SERVICE_CONTINUE_PENDING:
+    case SERVICE_PAUSE_PENDING:
+        PhpMarkServiceDirty(&name, FALSE, FALSE);
+        break;
+    }
+}
+
+VOID PhpMarkServiceDirty(
+    _In_ PPH_STRINGREF Name,
+    _In_ BOOLEAN IsDisplayName,
+    _In_ BOOLEAN NeedsConfigUpdate
+    )
+{
+    PPHP_DIRTY_SERVICE_ENTRY entry;
+
+    if (!PhpNonPollActive)
+        return;
+
+    entry = PhAllocate(sizeof(PHP_DIRTY_SERVICE_ENTRY));
+    entry->Name = PhCreateStringEx(Name->Buffer, Name->Length);
+    entry->IsDisplayName = IsDisplayName;
+    entry->NeedsConfigUpdate = NeedsConfigUpdate;
+
+    PhAcquireQueuedLockExclusive(&PhpDirtyServiceListLock);
+
+    if (!PhpDirtyServiceList)
+        PhpDirtyServiceList = PhCreateList(16);
+
+    PhAddItemList(PhpDirtyServiceList, entry);
+
+    PhReleaseQueuedLockExclusive(&PhpDirtyServiceListLock);
+}
+
+static PPH_LIST PhpTakeDirtyServiceList(
+    VOID
+    )
+{
+    PPH_LIST list;
+
+    PhAcquireQueuedLockExclusive(&PhpDirtyServiceListLock);
+    list = PhpDirtyServiceList;
+    PhpDirtyServiceList = NULL;
+    PhReleaseQueuedLockExclusive(&PhpDirtyServiceListLock);
+
+    return list;
+}
+
+static VOID PhpFreeDirtyServiceList(
+    _In_ PPH_LIST List
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < List->Count; i++)
+    {
+        PPHP_DIRTY_SERVICE_ENTRY entry = List->Items[i];
+
+        PhDereferenceObject(entry->Name);
+        PhFree(entry);
+    }
+
+    PhDereferenceObject(List);
+}
+
+static VOID PhpUpdateServiceByName(
+    _In_ SC_HANDLE ScManagerHandle,
+    _In_ PPH_STRING Name
+    )
+{
+    PPH_SERVICE_ITEM serviceItem;
+    SC_HANDLE serviceHandle;
+    ENUM_SERVICE_STATUS_PROCESS serviceEntry;
+    WCHAR displayName[257];
+    ULONG returnLength;
+
+    PhpServiceProviderStatistics.ServicesQueried++;
+
+    serviceItem = PhpLookupServiceItem(&Name->sr);
+    serviceHandle = OpenService(ScManagerHandle, Name->Buffer, SERVICE_QUERY_STATUS);
+
+    if (!serviceHandle)
+    {
+        if (GetLastError() == ERROR_SERVICE_DOES_NOT_EXIST)
+        {
+            if (serviceItem)
+            {
+                PhpProcessServiceRemoved(serviceItem);
+
+                PhAcquireQueuedLockExclusive(&PhServiceHashtableLock);
+                PhpRemoveServiceItem(serviceItem);
+                PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
+            }
+        }
+        else
+        {
+            // We can't tell what happened to the service, so enumerate all services
+            // on the next run.
+            PhpNonPollGate = 1;
+        }
+
+        return;
+    }
+
+    if (!QueryServiceStatusEx(
+        serviceHandle,
+        SC_STATUS_PROCESS_INFO,
+        (PBYTE)&serviceEntry.ServiceStatusProcess,
+        sizeof(SERVICE_STATUS_PROCESS),
+        &returnLength
+        ))
+    {
+        CloseServiceHandle(serviceHandle);
+        return;
+    }
+
+    CloseServiceHandle(serviceHandle);
+
+    serviceEntry.lpServiceName = Name->Buffer;
+
+    if (serviceItem)
+    {
+        serviceEntry.lpDisplayName = serviceItem->DisplayName->Buffer;
+    }
+    else
+    {
+        returnLength = sizeof(displayName) / sizeof(WCHAR);
+
+        if (GetServiceDisplayName(ScManagerHandle, Name->Buffer, displayName, &returnLength))
+            serviceEntry.lpDisplayName = displayName;
+        else
+            serviceEntry.lpDisplayName = Name->Buffer;
+    }
+
+    PhpProcessServiceEntry(ScManagerHandle, &serviceEntry);
+}
+
+static VOID PhpUpdateDirtyServices(
+    _In_ SC_HANDLE ScManagerHandle
+    )
+{
+    PPH_LIST dirtyList;
+    ULONG i;
+
+    if (!(dirtyList = PhpTakeDirtyServiceList()))
+        return;
+
+    PhpServiceProviderStatistics.IncrementalUpdates++;
+
+    for (i = 0; i < dirtyList->Count; i++)
+    {
+        PPHP_DIRTY_SERVICE_ENTRY entry = dirtyList->Items[i];
+        PPH_SERVICE_ITEM serviceItem;
+        PPH_STRING name;
+
+        if (entry->IsDisplayName)
+        {
+            // Events from the Service Control Manager only contain display names.
+            serviceItem = PhpLookupServiceItemByDisplayName(&entry->Name->sr);
+
+            if (!serviceItem)
+            {
+                // This is a new service or its display name has changed. Only a full
+                // scan can find it.
+                PhpNonPollGate = 1;
+                continue;
+            }
+
+            name = serviceItem->Name;
+        }
+        else
+        {
+            serviceItem = PhpLookupServiceItem(&entry->Name->sr);
+            name = entry->Name;
+        }
+
+        if (serviceItem && entry->NeedsConfigUpdate)
+            serviceItem->NeedsConfigUpdate = TRUE;
+
+        // The service item may be removed by the update.
+        PhReferenceObject(name);
+        PhpUpdateServiceByName(ScManagerHandle, name);
+        PhDereferenceObject(name);
+    }
+
+    PhpFreeDirtyServiceList(dirtyList);
+}
+
 VOID PhServiceProviderUpdate(
     _In_ PVOID Object
     )
@@ -469,9 +1005,18 @@ VOID PhServiceProviderUpdate(
 
         if (PhpNonPollActive)
         {
-            if (InterlockedExchange(&PhpNonPollGate, 0) == 0)
+            // Only the services which have been marked as dirty by notifications are
+            // queried. All services are still enumerated when a notification could not be
+            // attributed to a service, and at a slow interval because driver changes are
+            // never notified.
+            if (
+                InterlockedExchange(&PhpNonPollGate, 0) == 0 &&
+                NtGetTickCount64() - PhpLastFullScanTime < PH_SERVICE_RESCAN_INTERVAL
+                )
             {
-                // Non-poll gate is closed; skip all processing.
+                if (scManagerHandle)
+                    PhpUpdateDirtyServices(scManagerHandle);
+
                 goto UpdateEnd;
             }
         }
@@ -485,11 +1030,23 @@ VOID PhServiceProviderUpdate(
             return;
     }
 
+    // The full scan supersedes any services which have been marked as dirty.
+    {
+        PPH_LIST dirtyList;
+
+        if (dirtyList = PhpTakeDirtyServiceList())
+            PhpFreeDirtyServiceList(dirtyList);
+    }
+
     services = PhEnumServices(scManagerHandle, 0, 0, &numberOfServices);
 
     if (!services)
         return;
 
+    PhpLastFullScanTime = NtGetTickCount64();
+    PhpServiceProviderStatistics.FullScans++;
+    PhpServiceProviderStatistics.ServicesEnumerated += numberOfServices;
+
     // Build a hash set containing the service names.
 
     // This has caused a massive decrease in background CPU usage, and
@@ -560,22 +1117,7 @@ VOID PhServiceProviderUpdate(
 
             if (!found)
             {
-                // Remove the service from its process.
-                if ((*serviceItem)->ProcessId)
-                {
-                    PPH_PROCESS_ITEM processItem;
-
-                    processItem = PhReferenceProcessItem((HANDLE)(*serviceItem)->ProcessId);
-
-                    if (processItem)
-                    {
-                        PhpRemoveProcessItemService(processItem, *serviceItem);
-                        PhDereferenceObject(processItem);
-                    }
-                }
-
-                // Raise the service removed event.
-                PhInvokeCallback(&PhServiceRemovedEvent, *serviceItem);
+                PhpProcessServiceRemoved(*serviceItem);
 
                 if (!servicesToRemove)
                     servicesToRemove = PhCreateList(2);
@@ -603,160 +1145,10 @@ VOID PhServiceProviderUpdate(
     {
         for (hashEntry = nameHashSet[i]; hashEntry; hashEntry = hashEntry->Next)
         {
-            PPH_SERVICE_ITEM serviceItem;
             PPHP_SERVICE_NAME_ENTRY nameEntry;
-            ENUM_SERVICE_STATUS_PROCESS *serviceEntry;
 
             nameEntry = CONTAINING_RECORD(hashEntry, PHP_SERVICE_NAME_ENTRY, HashEntry);
-            serviceEntry = nameEntry->ServiceEntry;
-            serviceItem = PhpLookupServiceItem(&nameEntry->Name);
-
-            if (!serviceItem)
-            {
-                // Create the service item and fill in basic information.
-
-                serviceItem = PhCreateServiceItem(serviceEntry);
-
-                PhpUpdateServiceItemConfig(scManagerHandle, serviceItem);
-
-                // Add the service to its process, if appropriate.
-                if (
-                    (
-                    serviceItem->State == SERVICE_RUNNING ||
-                    serviceItem->State == SERVICE_PAUSED
-                    ) &&
-                    serviceItem->ProcessId
-                    )
-                {
-                    PPH_PROCESS_ITEM processItem;
-
-                    if (processItem = PhReferenceProcessItem(serviceItem->ProcessId))
-                    {
-                        PhpAddProcessItemService(processItem, serviceItem);
-                        PhDereferenceObject(processItem);
-                    }
-                    else
-                    {
-                        // The process doesn't exist yet (to us). Set the pending
-                        // flag and when the process is added this will be
-                        // fixed.
-                        serviceItem->PendingProcess = TRUE;
-                    }
-                }
-
-                // Add the service item to the hashtable.
-                PhAcquireQueuedLockExclusive(&PhServiceHashtableLock);
-                PhAddEntryHashtable(PhServiceHashtable, &serviceItem);
-                PhReleaseQueuedLockExclusive(&PhServiceHashtableLock);
-
-                // Raise the service added event.
-                PhInvokeCallback(&PhServiceAddedEvent, serviceItem);
-            }
-            else
-            {
-                if (
-                    serviceItem->Type != serviceEntry->ServiceStatusProcess.dwServiceType ||
-                    serviceItem->State != serviceEntry->ServiceStatusProcess.dwCurrentState ||
-                    serviceItem->ControlsAccepted != serviceEntry->ServiceStatusProcess.dwControlsAccepted ||
-                    serviceItem->ProcessId != (HANDLE)serviceEntry->ServiceStatusProcess.dwProcessId ||
-                    serviceItem->NeedsConfigUpdate
-                    )
-                {
-                    PH_SERVICE_MODIFIED_DATA serviceModifiedData;
-                    PH_SERVICE_CHANGE serviceChange;
-
-                    // The service has been "modified".
-
-                    serviceModifiedData.Service = serviceItem;
-                    memset(&serviceModifiedData.OldService, 0, sizeof(PH_SERVICE_ITEM));
-                    serviceModifiedData.OldService.Type = serviceItem->Type;
-                    serviceModifiedData.OldService.State = serviceItem->State;
-                    serviceModifiedData.OldService.ControlsAccepted = serviceItem->ControlsAccepted;
-                    serviceModifiedData.OldService.ProcessId = serviceItem->ProcessId;
-
-                    // Update the service item.
-                    serviceItem->Type = serviceEntry->ServiceStatusProcess.dwServiceType;
-                    serviceItem->State = serviceEntry->ServiceStatusProcess.dwCurrentState;
-                    serviceItem->ControlsAccepted = serviceEntry->ServiceStatusProcess.dwControlsAccepted;
-                    serviceItem->ProcessId = (HANDLE)serviceEntry->ServiceStatusProcess.dwProcessId;
-
-                    if (serviceItem->ProcessId)
-                        PhPrintUInt32(serviceItem->ProcessIdString, (ULONG)serviceItem->ProcessId);
-                    else
-                        serviceItem->ProcessIdString[0] = 0;
-
-                    // Add/remove the service from its process.
-
-                    serviceChange = PhGetServiceChange(&serviceModifiedData);
-
-                    if (
-                        (serviceChange == ServiceStarted && serviceItem->ProcessId) ||
-                        (serviceChange == ServiceStopped && serviceModifiedData.OldService.ProcessId)
-                        )
-                    {
-                        PPH_PROCESS_ITEM processItem;
-
-                        if (serviceChange == ServiceStarted)
-                            processItem = PhReferenceProcessItem(serviceItem->ProcessId);
-                        else
-                            processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId);
-
-                        if (processItem)
-                        {
-                            if (serviceChange == ServiceStarted)
-                                PhpAddProcessItemService(processItem, serviceItem);
-                            else
-                                PhpRemoveProcessItemService(processItem, serviceItem);
-
-                            PhDereferenceObject(processItem);
-                        }
-                        else
-                        {
-                            if (serviceChange == ServiceStarted)
-                                serviceItem->PendingProcess = TRUE;
-                            else
-                                serviceItem->PendingProcess = FALSE;
-                        }
-                    }
-                    else if (
-                        serviceItem->State == SERVICE_RUNNING &&
-                        serviceItem->ProcessId != serviceModifiedData.OldService.ProcessId &&
-                        serviceItem->ProcessId
-                        )
-                    {
-                        PPH_PROCESS_ITEM processItem;
-
-                        // The service stopped and started, and the only change we have detected
-                        // is in the process ID.
-
-                        if (processItem = PhReferenceProcessItem(serviceModifiedData.OldService.ProcessId))
-                        {
-                            PhpRemoveProcessItemService(processItem, serviceItem);
-                            PhDereferenceObject(processItem);
-                        }
-
-                        if (processItem = PhReferenceProcessItem(serviceItem->ProcessId))
-                        {
-                            PhpAddProcessItemService(processItem, serviceItem);
-                            PhDereferenceObject(processItem);
-                        }
-                        else
-                        {
-                            serviceItem->PendingProcess = TRUE;
-                        }
-                    }
-
-                    // Do a config update if necessary.
-                    if (serviceItem->NeedsConfigUpdate)
-                    {
-                        PhpUpdateServiceItemConfig(scManagerHandle, serviceItem);
-                        serviceItem->NeedsConfigUpdate = FALSE;
-                    }
-
-                    // Raise the service modified event.
-                    PhInvokeCallback(&PhServiceModifiedEvent, &serviceModifiedData);
-                }
-            }
+            PhpProcessServiceEntry(scManagerHandle, nameEntry->ServiceEntry);
         }
     }
 
@@ -764,16 +1156,62 @@ VOID PhServiceProviderUpdate(
 
 UpdateEnd:
     PhInvokeCallback(&PhServicesUpdatedEvent, NULL);
+    PhpServiceProviderStatistics.Runs++;
     runCount++;
 }
 
+VOID PhGetServiceProviderStatistics(
+    _Out_ PPH_SERVICE_PROVIDER_STATISTICS Statistics
+    )
+{
+    *Statistics = PhpServiceProviderStatistics;
+    Statistics->Notifications = PhpServiceNotificationCount;
+}
+
 DWORD WINAPI PhpServiceNonPollSubscribeCallback(
     _In_ EVT_SUBSCRIBE_NOTIFY_ACTION Action,
     _In_ PVOID UserContext,
     _In_ EVT_HANDLE Event
     )
 {
-    PhpNonPollGate = 1;
+    EVT_VARIANT values[64];
+    ULONG bufferUsed;
+    ULONG propertyCount;
+    PH_STRINGREF displayName;
+
+    _InterlockedIncrement(&PhpServiceNotificationCount);
+
+    if (
+        Action == EvtSubscribeActionDeliver &&
+        EvtRender_I(
+        PhpNonPollRenderContext,
+        Event,
+        EvtRenderEventValues,
+        sizeof(values),
+        values,
+        &bufferUsed,
+        &propertyCount
+        ) &&
+        propertyCount >= 2 &&
+        values[1].Type == EvtVarTypeString &&
+        values[1].StringVal
+        )
+    {
+        PhInitializeStringRef(&displayName, (PWSTR)values[1].StringVal);
+
+        // Event 7040 is logged when the start type of a service is changed.
+        PhpMarkServiceDirty(
+            &displayName,
+            TRUE,
+            values[0].Type == EvtVarTypeUInt16 && values[0].UInt16Val == 7040
+            );
+    }
+    else
+    {
+        // We don't know which service the event is about.
+        PhpNonPollGate = 1;
+    }
+
     return 0;
 }
 
@@ -785,13 +1223,31 @@ VOID CALLBACK PhpServiceNonPollScNotifyCallback(
 
     if (notifyBuffer->dwNotificationStatus == ERROR_SUCCESS)
     {
+        _InterlockedIncrement(&PhpServiceNotificationCount);
+
         if (notifyBuffer->dwNotificationTriggered & (SERVICE_NOTIFY_CREATED | SERVICE_NOTIFY_DELETED))
         {
+            PWSTR name;
+            PH_STRINGREF nameSr;
+
+            // This is a multi-string. The names of created services are prefixed with a
+            // slash.
+            if (name = notifyBuffer->pszServiceNames)
+            {
+                for (; *name; name += wcslen(name) + 1)
+                {
+                    PhInitializeStringRef(&nameSr, name[0] == '/' ? name + 1 : name);
+                    PhpMarkServiceDirty(&nameSr, FALSE, FALSE);
+                }
+            }
+
             LocalFree(notifyBuffer->pszServiceNames);
         }
     }
-
-    PhpNonPollGate = 1;
+    else
+    {
+        PhpNonPollGate = 1;
+    }
 
     NtSetEvent((HANDLE)notifyBuffer->pContext, NULL);
 }
@@ -800,6 +1256,12 @@ NTSTATUS PhpServiceNonPollThreadStart(
     _In_ PVOID Parameter
     )
 {
+    static LPCWSTR valuePaths[] =
+    {
+        L"Event/System/EventID",
+        L"Event/EventData/Data[@Name='param1']" // the display name of the service
+    };
+
     EVT_HANDLE subscriptionHandle;
     SC_HANDLE scManagerHandle;
     HANDLE notifyEventHandle;
@@ -810,9 +1272,24 @@ NTSTATUS PhpServiceNonPollThreadStart(
     // * NotifyServiceStatusChange provides us with service creation and deletion events.
     // * EvtSubscribe provides us with service state change events (but not pending states).
     // Currently there are two major problems with non-polling:
-    // * Pending state changes are not visible.
+    // * Pending state changes are not visible. Services which are seen in a pending state
+    //   are queried on every run until they leave it.
     // * Driver events (start, stop, delete) are not visible. This is because the SCM must
     //   explicitly check if drivers are loaded - it doesn't get notifications for them either.
+    //   These changes are only picked up by the periodic full scan.
+
+    PhpNonPollRenderContext = EvtCreateRenderContext_I(
+        sizeof(valuePaths) / sizeof(LPCWSTR),
+        valuePaths,
+        EvtRenderContextValues
+        );
+
+    if (!PhpNonPollRenderContext)
+    {
+        PhpNonPollActive = FALSE;
+        PhpNonPollGate = 1;
+        return STATUS_UNSUCCESSFUL;
+    }
 
     subscriptionHandle = EvtSubscribe_I(
         NULL,
@@ -921,6 +1398,16 @@ VOID PhpInitializeServiceNonPoll(
     if (!EvtSubscribe_I)
         return;
 
+    EvtCreateRenderContext_I = (PVOID)GetProcAddress(wevtapiHandle, "EvtCreateRenderContext");
+
+    if (!EvtCreateRenderContext_I)
+        return;
+
+    EvtRender_I = (PVOID)GetProcAddress(wevtapiHandle, "EvtRender");
+
+    if (!EvtRender_I)
+        return;
+
     PhpNonPollActive = TRUE;
     PhpNonPollGate = 1; // initially the gate should be open since we only just initialized everything
 
@@ -51,6 +51,27 @@ typedef struct _PH_THREAD_SYMBOL_LOAD_CONTEXT
     PPH_SYMBOL_PROVIDER SymbolProvider;
 } PH_THREAD_SYMBOL_LOAD_CONTEXT, *PPH_THREAD_SYMBOL_LOAD_CONTEXT;
 
+#define PH_THREAD_UPDATE_PARALLEL_THRESHOLD 256
+#define PH_THREAD_UPDATE_MINIMUM_CHUNK_SIZE 64
+#define PH_THREAD_UPDATE_MAXIMUM_CHUNKS 16
+
+typedef struct _PH_THREAD_UPDATE_ENTRY
+{
+    PSYSTEM_THREAD_INFORMATION Thread;
+    PPH_THREAD_ITEM ThreadItem; // NULL for new threads
+    BOOLEAN Modified;
+} PH_THREAD_UPDATE_ENTRY, *PPH_THREAD_UPDATE_ENTRY;
+
+typedef struct _PH_THREAD_UPDATE_CHUNK
+{
+    PPH_THREAD_PROVIDER ThreadProvider;
+    PPH_THREAD_UPDATE_ENTRY Entries;
+    ULONG Count;
+
+    PLONG PendingChunks;
+    HANDLE EventHandle;
+} PH_THREAD_UPDATE_CHUNK, *PPH_THREAD_UPDATE_CHUNK;
+
 VOID NTAPI PhpThreadProviderDeleteProcedure(
     _In_ PVOID Object,
     _In_ ULONG Flags
@@ -90,6 +111,9 @@ PPH_OBJECT_TYPE PhThreadItemType;
 PH_WORK_QUEUE PhThreadProviderWorkQueue;
 PH_INITONCE PhThreadProviderWorkQueueInitOnce = PH_INITONCE_INIT;
 
+static PH_WORK_QUEUE PhpThreadUpdateWorkQueue;
+static PH_INITONCE PhpThreadUpdateWorkQueueInitOnce = PH_INITONCE_INIT;
+
 BOOLEAN PhThreadProviderInitialization(
     VOID
     )
@@ -452,6 +476,35 @@ ULONG PhpThreadHashtableHashFunction(
     return (ULONG)(*(PPH_THREAD_ITEM *)Entry)->ThreadId / 4;
 }
 
+/**
+ * Finds a thread item without referencing it.
+ *
+ * \remarks This function must only be called while the thread provider is being
+ * updated. Since the update is the only operation that modifies the hashtable, no
+ * locking is needed.
+ */
+static PPH_THREAD_ITEM PhpLookupThreadItem(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ HANDLE ThreadId
+    )
+{
+    PH_THREAD_ITEM lookupThreadItem;
+    PPH_THREAD_ITEM lookupThreadItemPtr = &lookupThreadItem;
+    PPH_THREAD_ITEM *threadItemPtr;
+
+    lookupThreadItem.ThreadId = ThreadId;
+
+    threadItemPtr = (PPH_THREAD_ITEM *)PhFindEntryHashtable(
+        ThreadProvider->ThreadHashtable,
+        &lookupThreadItemPtr
+        );
+
+    if (threadItemPtr)
+        return *threadItemPtr;
+    else
+        return NULL;
+}
+
 PPH_THREAD_ITEM PhReferenceThreadItem(
     _In_ PPH_THREAD_PROVIDER ThreadProvider,
     _In_ HANDLE ThreadId
@@ -688,15 +741,31 @@ VOID PhThreadProviderInitialUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider
     )
 {
-    PVOID processes;
+    PPH_PROCESS_SNAPSHOT snapshot;
 
-    if (NT_SUCCESS(PhEnumProcesses(&processes)))
+    if (NT_SUCCESS(PhGetProcessSnapshot(0, &snapshot)))
     {
-        PhpThreadProviderUpdate(ThreadProvider, processes);
-        PhFree(processes);
+        PhpThreadProviderUpdate(ThreadProvider, snapshot->Processes);
+        PhDereferenceObject(snapshot);
     }
 }
 
+/**
+ * Updates a thread provider using the specified process information
+ * instead of the information from the last process provider run.
+ *
+ * \param ThreadProvider The thread provider.
+ * \param ProcessInformation A buffer containing process information,
+ * as returned by PhEnumProcesses().
+ */
+VOID PhUpdateThreadProvider(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _In_ PVOID ProcessInformation
+    )
+{
+    PhpThreadProviderUpdate(ThreadProvider, ProcessInformation);
+}
+
 VOID PhpThreadProviderCallbackHandler(
     _In_opt_ PVOID Parameter,
     _In_opt_ PVOID Context
@@ -708,6 +777,285 @@ VOID PhpThreadProviderCallbackHandler(
     }
 }
 
+/**
+ * Updates an item for a thread that was already present in the previous update.
+ *
+ * \param ThreadProvider The thread provider.
+ * \param Entry The entry for the thread item. The Modified field is set if the
+ * thread modified event needs to be raised for the item.
+ *
+ * \remarks This function may be called from any thread. It only modifies the
+ * thread item given by \a Entry.
+ */
+VOID PhpUpdateExistingThreadItem(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _Inout_ PPH_THREAD_UPDATE_ENTRY Entry
+    )
+{
+    PPH_THREAD_ITEM threadItem = Entry->ThreadItem;
+    PSYSTEM_THREAD_INFORMATION thread = Entry->Thread;
+    BOOLEAN modified = FALSE;
+
+    if (threadItem->JustResolved)
+        modified = TRUE;
+
+    threadItem->KernelTime = thread->KernelTime;
+    threadItem->UserTime = thread->UserTime;
+
+    threadItem->Priority = thread->Priority;
+    threadItem->BasePriority = thread->BasePriority;
+
+    threadItem->State = (KTHREAD_STATE)thread->ThreadState;
+
+    if (threadItem->WaitReason != thread->WaitReason)
+    {
+        threadItem->WaitReason = thread->WaitReason;
+        modified = TRUE;
+    }
+
+    // If the resolve level is only at address, it probably
+    // means symbols weren't loaded the last time we
+    // tried to get the start address. Try again.
+    if (threadItem->StartAddressResolveLevel == PhsrlAddress)
+    {
+        if (PhTestEvent(&ThreadProvider->SymbolsLoadedEvent))
+        {
+            PPH_STRING newStartAddressString;
+
+            newStartAddressString = PhpGetThreadBasicStartAddress(
+                ThreadProvider,
+                threadItem->StartAddress,
+                &threadItem->StartAddressResolveLevel
+                );
+
+            PhSwapReference2(
+                &threadItem->StartAddressString,
+                newStartAddressString
+                );
+
+            modified = TRUE;
+        }
+    }
+
+    // If we couldn't resolve the start address to a
+    // module+offset, use the StartAddress instead
+    // of the Win32StartAddress and try again.
+    // Note that we check the resolve level again
+    // because we may have changed it in the previous
+    // block.
+    if (
+        threadItem->JustResolved &&
+        threadItem->StartAddressResolveLevel == PhsrlAddress
+        )
+    {
+        if (threadItem->StartAddress != (ULONG64)thread->StartAddress)
+        {
+            threadItem->StartAddress = (ULONG64)thread->StartAddress;
+            PhpQueueThreadQuery(ThreadProvider, threadItem);
+        }
+    }
+
+    // Update the context switch count.
+    {
+        ULONG oldDelta;
+
+        oldDelta = threadItem->ContextSwitchesDelta.Delta;
+        PhUpdateDelta(&threadItem->ContextSwitchesDelta, thread->ContextSwitches);
+
+        if (threadItem->ContextSwitchesDelta.Delta != oldDelta)
+        {
+            modified = TRUE;
+        }
+    }
+
+    // Update the cycle count.
+    if (WINDOWS_HAS_CYCLE_TIME)
+    {
+        ULONG64 cycles;
+        ULONG64 oldDelta;
+
+        oldDelta = threadItem->CyclesDelta.Delta;
+
+        if (NT_SUCCESS(PhpGetThreadCycleTime(
+            ThreadProvider,
+            threadItem,
+            &cycles
+            )))
+        {
+            PhUpdateDelta(&threadItem->CyclesDelta, cycles);
+
+            if (threadItem->CyclesDelta.Delta != oldDelta)
+            {
+                modified = TRUE;
+            }
+        }
+    }
+
+    // Update the CPU time deltas.
+    PhUpdateDelta(&threadItem->CpuKernelDelta, threadItem->KernelTime.QuadPart);
+    PhUpdateDelta(&threadItem->CpuUserDelta, threadItem->UserTime.QuadPart);
+
+    // Update the CPU usage.
+    // If the cycle time isn't available, we'll fall back to using the CPU time.
+    if (WINDOWS_HAS_CYCLE_TIME && PhEnableCycleCpuUsage && (ThreadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID || threadItem->ThreadHandle))
+    {
+        threadItem->CpuUsage = (FLOAT)threadItem->CyclesDelta.Delta / PhCpuTotalCycleDelta;
+    }
+    else
+    {
+        threadItem->CpuUsage = (FLOAT)(threadItem->CpuKernelDelta.Delta + threadItem->CpuUserDelta.Delta) /
+            (PhCpuKernelDelta.Delta + PhCpuUserDelta.Delta + PhCpuIdleDelta.Delta);
+    }
+
+    // Update the Win32 priority.
+    {
+        LONG oldPriorityWin32 = threadItem->PriorityWin32;
+
+        threadItem->PriorityWin32 = GetThreadPriority(threadItem->ThreadHandle);
+
+        if (threadItem->PriorityWin32 != oldPriorityWin32)
+        {
+            modified = TRUE;
+        }
+    }
+
+    // Update the GUI thread status.
+
+    if (threadItem->ThreadHandle && KphIsConnected())
+    {
+        PVOID win32Thread;
+
+        if (NT_SUCCESS(KphQueryInformationThread(
+            threadItem->ThreadHandle,
+            KphThreadWin32Thread,
+            &win32Thread,
+            sizeof(PVOID),
+            NULL
+            )))
+        {
+            BOOLEAN oldIsGuiThread = threadItem->IsGuiThread;
+
+            threadItem->IsGuiThread = win32Thread != NULL;
+
+            if (threadItem->IsGuiThread != oldIsGuiThread)
+                modified = TRUE;
+        }
+    }
+    else
+    {
+        GUITHREADINFO info = { sizeof(GUITHREADINFO) };
+        BOOLEAN oldIsGuiThread = threadItem->IsGuiThread;
+
+        threadItem->IsGuiThread = !!GetGUIThreadInfo((ULONG)threadItem->ThreadId, &info);
+
+        if (threadItem->IsGuiThread != oldIsGuiThread)
+            modified = TRUE;
+    }
+
+    threadItem->JustResolved = FALSE;
+
+    Entry->Modified = modified;
+}
+
+VOID PhpUpdateThreadItemChunk(
+    _Inout_ PPH_THREAD_UPDATE_CHUNK Chunk
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Chunk->Count; i++)
+    {
+        if (Chunk->Entries[i].ThreadItem)
+            PhpUpdateExistingThreadItem(Chunk->ThreadProvider, &Chunk->Entries[i]);
+    }
+}
+
+NTSTATUS PhpThreadUpdateChunkWorker(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_THREAD_UPDATE_CHUNK chunk = Parameter;
+
+    PhpUpdateThreadItemChunk(chunk);
+
+    if (_InterlockedDecrement(chunk->PendingChunks) == 0)
+        NtSetEvent(chunk->EventHandle, NULL);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Updates the items for threads that were already present in the previous update.
+ *
+ * \param ThreadProvider The thread provider.
+ * \param Entries An array of entries, in thread list order. Entries for new threads
+ * are skipped.
+ * \param Count The number of entries.
+ *
+ * \remarks Processes with many threads are divided into chunks which are updated
+ * concurrently.
+ */
+VOID PhpUpdateExistingThreadItems(
+    _In_ PPH_THREAD_PROVIDER ThreadProvider,
+    _Inout_updates_(Count) PPH_THREAD_UPDATE_ENTRY Entries,
+    _In_ ULONG Count
+    )
+{
+    PH_THREAD_UPDATE_CHUNK chunks[PH_THREAD_UPDATE_MAXIMUM_CHUNKS];
+    LONG pendingChunks;
+    HANDLE eventHandle = NULL;
+    ULONG numberOfChunks;
+    ULONG chunkSize;
+    ULONG i;
+
+    numberOfChunks = 1;
+
+    if (Count >= PH_THREAD_UPDATE_PARALLEL_THRESHOLD && PhSystemBasicInformation.NumberOfProcessors > 1)
+    {
+        numberOfChunks = min((ULONG)PhSystemBasicInformation.NumberOfProcessors, PH_THREAD_UPDATE_MAXIMUM_CHUNKS);
+        numberOfChunks = min(numberOfChunks, Count / PH_THREAD_UPDATE_MINIMUM_CHUNK_SIZE);
+
+        if (PhBeginInitOnce(&PhpThreadUpdateWorkQueueInitOnce))
+        {
+            PhInitializeWorkQueue(&PhpThreadUpdateWorkQueue, 0, PH_THREAD_UPDATE_MAXIMUM_CHUNKS - 1, 5000);
+            PhEndInitOnce(&PhpThreadUpdateWorkQueueInitOnce);
+        }
+
+        // More than one thread provider can be updated at the same time (e.g. an initial
+        // update on the GUI thread), so each update waits on its own event.
+        if (!NT_SUCCESS(NtCreateEvent(&eventHandle, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+            numberOfChunks = 1;
+    }
+
+    chunkSize = (Count + numberOfChunks - 1) / numberOfChunks;
+    pendingChunks = numberOfChunks - 1;
+
+    for (i = 0; i < numberOfChunks; i++)
+    {
+        ULONG startIndex;
+
+        startIndex = min(i * chunkSize, Count);
+
+        chunks[i].ThreadProvider = ThreadProvider;
+        chunks[i].Entries = &Entries[startIndex];
+        chunks[i].Count = min((i + 1) * chunkSize, Count) - startIndex;
+        chunks[i].PendingChunks = &pendingChunks;
+        chunks[i].EventHandle = eventHandle;
+    }
+
+    // The current thread takes the first chunk and then waits for the others.
+    for (i = 1; i < numberOfChunks; i++)
+        PhQueueItemWorkQueue(&PhpThreadUpdateWorkQueue, PhpThreadUpdateChunkWorker, &chunks[i]);
+
+    PhpUpdateThreadItemChunk(&chunks[0]);
+
+    if (numberOfChunks > 1)
+        NtWaitForSingleObject(eventHandle, FALSE, NULL);
+
+    if (eventHandle)
+        NtClose(eventHandle);
+}
+
 VOID PhpThreadProviderUpdate(
     _In_ PPH_THREAD_PROVIDER ThreadProvider,
     _In_ PVOID ProcessInformation
@@ -718,6 +1066,8 @@ VOID PhpThreadProviderUpdate(
     SYSTEM_PROCESS_INFORMATION localProcess;
     PSYSTEM_THREAD_INFORMATION threads;
     ULONG numberOfThreads;
+    PPH_THREAD_UPDATE_ENTRY entries;
+    ULONG numberOfExistingThreads;
     ULONG i;
 
     process = PhFindProcessInformation(ProcessInformation, threadProvider->ProcessId);
@@ -736,15 +1086,51 @@ VOID PhpThreadProviderUpdate(
     // System Idle Process has one thread per CPU.
     // They all have a TID of 0, but we can't have
     // multiple TIDs, so we'll assign unique TIDs.
-    if (threadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID)
+    // The process information may be shared with
+    // other threads, so we modify a copy.
+    if (threadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID && numberOfThreads != 0)
     {
+        threads = PhAllocateCopy(threads, numberOfThreads * sizeof(SYSTEM_THREAD_INFORMATION));
+
         for (i = 0; i < numberOfThreads; i++)
         {
             threads[i].ClientId.UniqueThread = (HANDLE)i;
         }
     }
 
-    // Look for dead threads.
+    // Find the item for each thread, and mark the items whose threads still exist
+    // with the current run ID.
+
+    entries = NULL;
+    numberOfExistingThreads = 0;
+
+    if (numberOfThreads != 0)
+        entries = PhAllocate(numberOfThreads * sizeof(PH_THREAD_UPDATE_ENTRY));
+
+    for (i = 0; i < numberOfThreads; i++)
+    {
+        PPH_THREAD_ITEM threadItem;
+
+        threadItem = PhpLookupThreadItem(threadProvider, threads[i].ClientId.UniqueThread);
+
+        // Ignore duplicate thread IDs, so that each item is only updated once.
+        if (threadItem && threadItem->SeenRunId == threadProvider->RunId)
+        {
+            threadItem = NULL;
+        }
+        else if (threadItem)
+        {
+            threadItem->SeenRunId = threadProvider->RunId;
+            numberOfExistingThreads++;
+        }
+
+        entries[i].Thread = &threads[i];
+        entries[i].ThreadItem = threadItem;
+        entries[i].Modified = FALSE;
+    }
+
+    // Look for dead threads. These are the items that were not marked.
+    if (numberOfExistingThreads < threadProvider->ThreadHashtable->Count)
     {
         PPH_LIST threadsToRemove = NULL;
         ULONG enumerationKey = 0;
@@ -752,21 +1138,7 @@ VOID PhpThreadProviderUpdate(
 
         while (PhEnumHashtable(threadProvider->ThreadHashtable, (PPVOID)&threadItem, &enumerationKey))
         {
-            BOOLEAN found = FALSE;
-
-            // Check if the thread still exists.
-            for (i = 0; i < numberOfThreads; i++)
-            {
-                PSYSTEM_THREAD_INFORMATION thread = &threads[i];
-
-                if ((*threadItem)->ThreadId == thread->ClientId.UniqueThread)
-                {
-                    found = TRUE;
-                    break;
-                }
-            }
-
-            if (!found)
+            if ((*threadItem)->SeenRunId != threadProvider->RunId)
             {
                 // Raise the thread removed event.
                 PhInvokeCallback(&threadProvider->ThreadRemovedEvent, *threadItem);
@@ -823,19 +1195,27 @@ VOID PhpThreadProviderUpdate(
         }
     }
 
-    // Look for new threads and update existing ones.
+    // Update existing threads.
+    PhpUpdateExistingThreadItems(threadProvider, entries, numberOfThreads);
+
+    // Look for new threads, and raise the modified events in thread list order.
     for (i = 0; i < numberOfThreads; i++)
     {
         PSYSTEM_THREAD_INFORMATION thread = &threads[i];
         PPH_THREAD_ITEM threadItem;
 
-        threadItem = PhReferenceThreadItem(threadProvider, thread->ClientId.UniqueThread);
+        threadItem = entries[i].ThreadItem;
 
         if (!threadItem)
         {
             PVOID startAddress = NULL;
 
+            // Skip duplicate thread IDs.
+            if (PhpLookupThreadItem(threadProvider, thread->ClientId.UniqueThread))
+                continue;
+
             threadItem = PhCreateThreadItem(thread->ClientId.UniqueThread);
+            threadItem->SeenRunId = threadProvider->RunId;
 
             threadItem->CreateTime = thread->CreateTime;
             threadItem->KernelTime = thread->KernelTime;
@@ -955,178 +1335,18 @@ VOID PhpThreadProviderUpdate(
             // Raise the thread added event.
             PhInvokeCallback(&threadProvider->ThreadAddedEvent, threadItem);
         }
-        else
+        else if (entries[i].Modified)
         {
-            BOOLEAN modified = FALSE;
-
-            if (threadItem->JustResolved)
-                modified = TRUE;
-
-            threadItem->KernelTime = thread->KernelTime;
-            threadItem->UserTime = thread->UserTime;
-
-            threadItem->Priority = thread->Priority;
-            threadItem->BasePriority = thread->BasePriority;
-
-            threadItem->State = (KTHREAD_STATE)thread->ThreadState;
-
-            if (threadItem->WaitReason != thread->WaitReason)
-            {
-                threadItem->WaitReason = thread->WaitReason;
-                modified = TRUE;
-            }
-
-            // If the resolve level is only at address, it probably
-            // means symbols weren't loaded the last time we
-            // tried to get the start address. Try again.
-            if (threadItem->StartAddressResolveLevel == PhsrlAddress)
-            {
-                if (PhTestEvent(&threadProvider->SymbolsLoadedEvent))
-                {
-                    PPH_STRING newStartAddressString;
-
-                    newStartAddressString = PhpGetThreadBasicStartAddress(
-                        threadProvider,
-                        threadItem->StartAddress,
-                        &threadItem->StartAddressResolveLevel
-                        );
-
-                    PhSwapReference2(
-                        &threadItem->StartAddressString,
-                        newStartAddressString
-                        );
-
-                    modified = TRUE;
-                }
-            }
-
-            // If we couldn't resolve the start address to a
-            // module+offset, use the StartAddress instead
-            // of the Win32StartAddress and try again.
-            // Note that we check the resolve level again
-            // because we may have changed it in the previous
-            // block.
-            if (
-                threadItem->JustResolved &&
-                threadItem->StartAddressResolveLevel == PhsrlAddress
-                )
-            {
-                if (threadItem->StartAddress != (ULONG64)thread->StartAddress)
-                {
-                    threadItem->StartAddress = (ULONG64)thread->StartAddress;
-                    PhpQueueThreadQuery(threadProvider, threadItem);
-                }
-            }
-
-            // Update the context switch count.
-            {
-                ULONG oldDelta;
-
-                oldDelta = threadItem->ContextSwitchesDelta.Delta;
-                PhUpdateDelta(&threadItem->ContextSwitchesDelta, thread->ContextSwitches);
-
-                if (threadItem->ContextSwitchesDelta.Delta != oldDelta)
-                {
-                    modified = TRUE;
-                }
-            }
-
-            // Update the cycle count.
-            if (WINDOWS_HAS_CYCLE_TIME)
-            {
-                ULONG64 cycles;
-                ULONG64 oldDelta;
-
-                oldDelta = threadItem->CyclesDelta.Delta;
-
-                if (NT_SUCCESS(PhpGetThreadCycleTime(
-                    threadProvider,
-                    threadItem,
-                    &cycles
-                    )))
-                {
-                    PhUpdateDelta(&threadItem->CyclesDelta, cycles);
-
-                    if (threadItem->CyclesDelta.Delta != oldDelta)
-                    {
-                        modified = TRUE;
-                    }
-                }
-            }
-
-            // Update the CPU time deltas.
-            PhUpdateDelta(&threadItem->CpuKernelDelta, threadItem->KernelTime.QuadPart);
-            PhUpdateDelta(&threadItem->CpuUserDelta, threadItem->UserTime.QuadPart);
-
-            // Update the CPU usage.
-            // If the cycle time isn't available, we'll fall back to using the CPU time.
-            if (WINDOWS_HAS_CYCLE_TIME && PhEnableCycleCpuUsage && (threadProvider->ProcessId == SYSTEM_IDLE_PROCESS_ID || threadItem->ThreadHandle))
-            {
-                threadItem->CpuUsage = (FLOAT)threadItem->CyclesDelta.Delta / PhCpuTotalCycleDelta;
-            }
-            else
-            {
-                threadItem->CpuUsage = (FLOAT)(threadItem->CpuKernelDelta.Delta + threadItem->CpuUserDelta.Delta) /
-                    (PhCpuKernelDelta.Delta + PhCpuUserDelta.Delta + PhCpuIdleDelta.Delta);
-            }
-
-            // Update the Win32 priority.
-            {
-                LONG oldPriorityWin32 = threadItem->PriorityWin32;
-
-                threadItem->PriorityWin32 = GetThreadPriority(threadItem->ThreadHandle);
-
-                if (threadItem->PriorityWin32 != oldPriorityWin32)
-                {
-                    modified = TRUE;
-                }
-            }
-
-            // Update the GUI thread status.
-
-            if (threadItem->ThreadHandle && KphIsConnected())
-            {
-                PVOID win32Thread;
-
-                if (NT_SUCCESS(KphQueryInformationThread(
-                    threadItem->ThreadHandle,
-                    KphThreadWin32Thread,
-                    &win32Thread,
-                    sizeof(PVOID),
-                    NULL
-                    )))
-                {
-                    BOOLEAN oldIsGuiThread = threadItem->IsGuiThread;
-
-                    threadItem->IsGuiThread = win32Thread != NULL;
-
-                    if (threadItem->IsGuiThread != oldIsGuiThread)
-                        modified = TRUE;
-                }
-            }
-            else
-            {
-                GUITHREADINFO info = { sizeof(GUITHREADINFO) };
-                BOOLEAN oldIsGuiThread = threadItem->IsGuiThread;
-
-                threadItem->IsGuiThread = !!GetGUIThreadInfo((ULONG)threadItem->ThreadId, &info);
-
-                if (threadItem->IsGuiThread != oldIsGuiThread)
-                    modified = TRUE;
-            }
-
-            threadItem->JustResolved = FALSE;
-
-            if (modified)
-            {
-                // Raise the thread modified event.
-                PhInvokeCallback(&threadProvider->ThreadModifiedEvent, threadItem);
-            }
-
-            PhDereferenceObject(threadItem);
+            // Raise the thread modified event.
+            PhInvokeCallback(&threadProvider->ThreadModifiedEvent, threadItem);
         }
     }
 
+    if (entries)
+        PhFree(entries);
+    if (threads != process->Threads)
+        PhFree(threads);
+
     PhInvokeCallback(&threadProvider->UpdatedEvent, NULL);
     threadProvider->RunId++;
 }
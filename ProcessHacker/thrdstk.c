@@ -525,6 +525,7 @@ static NTSTATUS PhpRefreshThreadStackThreadStart(
     PTHREAD_STACK_CONTEXT threadStackContext = Parameter;
     CLIENT_ID clientId;
     BOOLEAN defaultWalk;
+    PPH_UNWIND_CACHE unwindCache = NULL;
 
     clientId.UniqueProcess = threadStackContext->ProcessId;
     clientId.UniqueThread = threadStackContext->ThreadId;
@@ -552,14 +553,24 @@ static NTSTATUS PhpRefreshThreadStackThreadStart(
 
     if (defaultWalk)
     {
-        status = PhWalkThreadStack(
+#ifdef _M_X64
+        // Modules may be unloaded between refreshes, so the unwind data is only
+        // kept for the duration of one walk.
+        unwindCache = PhCreateUnwindCache(threadStackContext->SymbolProvider->ProcessHandle, NULL);
+#endif
+
+        status = PhWalkThreadStackEx(
             threadStackContext->ThreadHandle,
             threadStackContext->SymbolProvider->ProcessHandle,
             &clientId,
             PH_WALK_I386_STACK | PH_WALK_AMD64_STACK | PH_WALK_KERNEL_STACK,
             PhpWalkThreadStackCallback,
-            threadStackContext
+            threadStackContext,
+            unwindCache
             );
+
+        if (unwindCache)
+            PhDereferenceObject(unwindCache);
     }
 
     if (threadStackContext->NewList->Count != 0)
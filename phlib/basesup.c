@@ -64,8 +64,26 @@
 
 #include <phbase.h>
 #include <phintrnl.h>
+#include <refp.h>
 #include <math.h>
 
+#define PH_INTERN_SHARD_COUNT 16
+// The hash of an interned string is stored after the null terminator.
+#define PH_INTERN_HASH_OFFSET(Length) (((Length) + sizeof(WCHAR) + sizeof(ULONG) - 1) & ~(sizeof(ULONG) - 1))
+
+typedef struct _PH_INTERN_ENTRY
+{
+    PH_STRINGREF Key;
+    ULONG Hash;
+    PPH_STRING String;
+} PH_INTERN_ENTRY, *PPH_INTERN_ENTRY;
+
+typedef struct _PH_INTERN_SHARD
+{
+    PH_QUEUED_LOCK Lock;
+    PPH_HASHTABLE Hashtable;
+} PH_INTERN_SHARD, *PPH_INTERN_SHARD;
+
 typedef struct _PHP_BASE_THREAD_CONTEXT
 {
     PUSER_THREAD_START_ROUTINE StartAddress;
@@ -97,9 +115,24 @@ VOID NTAPI PhpHashtableDeleteProcedure(
     _In_ ULONG Flags
     );
 
+VOID NTAPI PhpInternedStringDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+BOOLEAN NTAPI PhpInternEntryCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+ULONG NTAPI PhpInternEntryHashFunction(
+    _In_ PVOID Entry
+    );
+
 // Types
 
 PPH_OBJECT_TYPE PhStringType;
+PPH_OBJECT_TYPE PhInternedStringType;
 PPH_OBJECT_TYPE PhAnsiStringType;
 PPH_OBJECT_TYPE PhFullStringType;
 PPH_OBJECT_TYPE PhListType;
@@ -111,6 +144,12 @@ PPH_OBJECT_TYPE PhHashtableType;
 static BOOLEAN PhpSse2Available;
 static PPH_STRING PhSharedEmptyString = NULL;
 
+// String interning
+
+static PH_INTERN_SHARD PhpInternShards[PH_INTERN_SHARD_COUNT];
+static ULONG PhpInternLookupCount = 0;
+static ULONG PhpInternHitCount = 0;
+
 // Threads
 
 static PH_FREE_LIST PhpBaseThreadContextFreeList;
@@ -153,6 +192,14 @@ BOOLEAN PhInitializeBase(
         )))
         return FALSE;
 
+    if (!NT_SUCCESS(PhCreateObjectType(
+        &PhInternedStringType,
+        L"InternedString",
+        0,
+        PhpInternedStringDeleteProcedure
+        )))
+        return FALSE;
+
     if (!NT_SUCCESS(PhCreateObjectType(
         &PhAnsiStringType,
         L"AnsiString",
@@ -195,6 +242,21 @@ BOOLEAN PhInitializeBase(
 
     PhInitializeFreeList(&PhpBaseThreadContextFreeList, sizeof(PHP_BASE_THREAD_CONTEXT), 16);
 
+    {
+        ULONG i;
+
+        for (i = 0; i < PH_INTERN_SHARD_COUNT; i++)
+        {
+            PhInitializeQueuedLock(&PhpInternShards[i].Lock);
+            PhpInternShards[i].Hashtable = PhCreateHashtable(
+                sizeof(PH_INTERN_ENTRY),
+                PhpInternEntryCompareFunction,
+                PhpInternEntryHashFunction,
+                64
+                );
+        }
+    }
+
 #ifdef DEBUG
     PhDbgThreadDbgTlsIndex = TlsAlloc();
     InitializeListHead(&PhDbgThreadListHead);
@@ -2058,6 +2120,253 @@ PPH_STRING PhReferenceEmptyString(
     return string;
 }
 
+FORCEINLINE PULONG PhpGetInternedStringHashPointer(
+    _In_ PPH_STRING String
+    )
+{
+    return (PULONG)PTR_ADD_OFFSET(String->Data, PH_INTERN_HASH_OFFSET(String->Length));
+}
+
+FORCEINLINE PPH_INTERN_SHARD PhpGetInternShard(
+    _In_ ULONG Hash
+    )
+{
+    // The hashtables use the low bits of the hash, so use the high bits here.
+    return &PhpInternShards[(Hash >> 28) & (PH_INTERN_SHARD_COUNT - 1)];
+}
+
+VOID NTAPI PhpInternedStringDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_STRING string = Object;
+    PPH_INTERN_SHARD shard;
+    PH_INTERN_ENTRY lookupEntry;
+    PPH_INTERN_ENTRY entry;
+
+    lookupEntry.Key = string->sr;
+    lookupEntry.Hash = *PhpGetInternedStringHashPointer(string);
+    shard = PhpGetInternShard(lookupEntry.Hash);
+
+    // A new string with the same contents may have replaced this one (see
+    // PhInternStringRef), so make sure we only remove ourselves.
+    PhAcquireQueuedLockExclusive(&shard->Lock);
+
+    entry = PhFindEntryHashtable(shard->Hashtable, &lookupEntry);
+
+    if (entry && entry->String == string)
+        PhRemoveEntryHashtable(shard->Hashtable, &lookupEntry);
+
+    PhReleaseQueuedLockExclusive(&shard->Lock);
+}
+
+BOOLEAN NTAPI PhpInternEntryCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_INTERN_ENTRY entry1 = Entry1;
+    PPH_INTERN_ENTRY entry2 = Entry2;
+
+    return
+        entry1->Hash == entry2->Hash &&
+        entry1->Key.Length == entry2->Key.Length &&
+        memcmp(entry1->Key.Buffer, entry2->Key.Buffer, entry1->Key.Length) == 0;
+}
+
+ULONG NTAPI PhpInternEntryHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return ((PPH_INTERN_ENTRY)Entry)->Hash;
+}
+
+/**
+ * Obtains a reference to a shared string with the specified contents.
+ *
+ * \param String The contents of the string.
+ *
+ * \return A string object of type \ref PhInternedStringType. You must
+ * dereference it using PhDereferenceObject() when you no longer need it.
+ *
+ * \remarks The returned string is shared between all callers that intern
+ * equal contents, so it must never be modified. Two interned strings are
+ * equal if and only if they are the same object (see \ref PhEqualInternedString).
+ * Interned strings are removed from the table when their last reference is
+ * released.
+ */
+PPH_STRING PhInternStringRef(
+    _In_ PPH_STRINGREF String
+    )
+{
+    PPH_INTERN_SHARD shard;
+    PH_INTERN_ENTRY lookupEntry;
+    PPH_INTERN_ENTRY entry;
+    PPH_STRING string;
+    SIZE_T hashOffset;
+    BOOLEAN added;
+
+    lookupEntry.Key = *String;
+    lookupEntry.Hash = PhHashBytes((PUCHAR)String->Buffer, String->Length);
+    shard = PhpGetInternShard(lookupEntry.Hash);
+
+    _InterlockedIncrement((PLONG)&PhpInternLookupCount);
+
+    PhAcquireQueuedLockShared(&shard->Lock);
+
+    entry = PhFindEntryHashtable(shard->Hashtable, &lookupEntry);
+
+    // The string may be in the process of being deleted.
+    if (entry && PhReferenceObjectSafe(entry->String))
+        string = entry->String;
+    else
+        string = NULL;
+
+    PhReleaseQueuedLockShared(&shard->Lock);
+
+    if (string)
+    {
+        _InterlockedIncrement((PLONG)&PhpInternHitCount);
+        return string;
+    }
+
+    hashOffset = PH_INTERN_HASH_OFFSET(String->Length);
+
+    if (!NT_SUCCESS(PhCreateObject(
+        &string,
+        FIELD_OFFSET(PH_STRING, Data) + hashOffset + sizeof(ULONG),
+        0,
+        PhInternedStringType
+        )))
+        return NULL;
+
+    string->Length = String->Length;
+    string->Buffer = string->Data;
+    memcpy(string->Buffer, String->Buffer, String->Length);
+    *(PWCHAR)PTR_ADD_OFFSET(string->Buffer, String->Length) = 0;
+    *PhpGetInternedStringHashPointer(string) = lookupEntry.Hash;
+
+    PhAcquireQueuedLockExclusive(&shard->Lock);
+
+    entry = PhAddEntryHashtableEx(shard->Hashtable, &lookupEntry, &added);
+
+    if (added)
+    {
+        entry->Key = string->sr;
+        entry->String = string;
+    }
+    else if (PhReferenceObjectSafe(entry->String))
+    {
+        PPH_STRING existingString = entry->String;
+
+        // Someone else interned the same contents while we weren't holding the lock.
+        PhReleaseQueuedLockExclusive(&shard->Lock);
+        PhDereferenceObject(string);
+        _InterlockedIncrement((PLONG)&PhpInternHitCount);
+
+        return existingString;
+    }
+    else
+    {
+        // Replace the string which is being deleted. Its delete procedure will see
+        // that it is no longer in the table.
+        entry->Key = string->sr;
+        entry->String = string;
+    }
+
+    PhReleaseQueuedLockExclusive(&shard->Lock);
+
+    return string;
+}
+
+/**
+ * Obtains a reference to a shared string with the same contents as
+ * an existing string.
+ *
+ * \param String A string object. If this is already an interned string,
+ * a new reference to it is returned.
+ *
+ * \return An interned string. See \ref PhInternStringRef.
+ */
+PPH_STRING PhInternString(
+    _In_ PPH_STRING String
+    )
+{
+    if (PhIsInternedString(String))
+    {
+        PhReferenceObject(String);
+        return String;
+    }
+
+    return PhInternStringRef(&String->sr);
+}
+
+/**
+ * Gets the hash of an interned string.
+ *
+ * \param String An interned string.
+ *
+ * \return The hash that was computed when the string was interned.
+ */
+ULONG PhGetInternedStringHash(
+    _In_ PPH_STRING String
+    )
+{
+    assert(PhIsInternedString(String));
+
+    return *PhpGetInternedStringHashPointer(String);
+}
+
+/**
+ * Gets memory usage information for interned strings.
+ *
+ * \param Statistics A variable which receives the statistics.
+ */
+VOID PhGetInternedStringStatistics(
+    _Out_ PPH_INTERNED_STRING_STATISTICS Statistics
+    )
+{
+    ULONG i;
+
+    memset(Statistics, 0, sizeof(PH_INTERNED_STRING_STATISTICS));
+
+    for (i = 0; i < PH_INTERN_SHARD_COUNT; i++)
+    {
+        PPH_INTERN_SHARD shard = &PhpInternShards[i];
+        PPH_INTERN_ENTRY entry;
+        ULONG enumerationKey;
+
+        PhAcquireQueuedLockShared(&shard->Lock);
+
+        enumerationKey = 0;
+
+        while (PhEnumHashtable(shard->Hashtable, &entry, &enumerationKey))
+        {
+            SIZE_T size;
+            LONG refCount;
+
+            size = PhObjectToObjectHeader(entry->String)->Size + FIELD_OFFSET(PH_OBJECT_HEADER, Body);
+            refCount = PhObjectToObjectHeader(entry->String)->RefCount;
+
+            // Skip strings which are being deleted.
+            if (refCount <= 0)
+                continue;
+
+            Statistics->NumberOfStrings++;
+            Statistics->NumberOfReferences += refCount;
+            Statistics->NumberOfBytes += size;
+            // Without interning, every reference would have its own copy of the string.
+            Statistics->NumberOfReferencedBytes += size * refCount;
+        }
+
+        PhReleaseQueuedLockShared(&shard->Lock);
+    }
+
+    Statistics->NumberOfLookups = PhpInternLookupCount;
+    Statistics->NumberOfHits = PhpInternHitCount;
+}
+
 /**
  * Concatenates multiple strings.
  *
@@ -0,0 +1,441 @@
+/*
+ * Process Hacker -
+ *   call trees
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A call tree aggregates stack samples into a prefix tree, where each node is a
+ * return address and the path from the root to a node is a call stack. Samples can
+ * be added from any number of threads without a lock: new nodes are allocated from
+ * blocks using an interlocked index and are linked into their parent's child list
+ * using a compare-exchange, and counts are updated with interlocked increments.
+ * Nodes are never removed.
+ *
+ * Addresses are only converted to names when the tree is exported, and each
+ * distinct address is resolved exactly once, in address order.
+ */
+
+#include <ph.h>
+
+#define PH_CALL_TREE_BLOCK_SIZE 1024
+
+typedef struct _PH_CALL_TREE_BLOCK
+{
+    struct _PH_CALL_TREE_BLOCK *Next;
+    LONG NextIndex;
+    PH_CALL_TREE_NODE Nodes[PH_CALL_TREE_BLOCK_SIZE];
+} PH_CALL_TREE_BLOCK, *PPH_CALL_TREE_BLOCK;
+
+typedef struct _PH_CALL_TREE_EXPORT_CONTEXT
+{
+    PVOID *Addresses;
+    PPH_STRING *Names;
+    ULONG NumberOfAddresses;
+
+    PH_STRING_BUILDER Path;
+    PPH_LIST Stacks;
+} PH_CALL_TREE_EXPORT_CONTEXT, *PPH_CALL_TREE_EXPORT_CONTEXT;
+
+typedef struct _PH_CALL_TREE_FOLDED_STACK
+{
+    PPH_STRING Path;
+    ULONG Count;
+} PH_CALL_TREE_FOLDED_STACK, *PPH_CALL_TREE_FOLDED_STACK;
+
+VOID NTAPI PhpCallTreeDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhCallTreeType;
+
+static PH_INITONCE PhCallTreeInitOnce = PH_INITONCE_INIT;
+
+/**
+ * Creates a call tree.
+ *
+ * \return The new call tree, or NULL if it could not be created.
+ */
+PPH_CALL_TREE PhCreateCallTree(
+    VOID
+    )
+{
+    PPH_CALL_TREE callTree;
+    PPH_CALL_TREE_BLOCK block;
+
+    if (PhBeginInitOnce(&PhCallTreeInitOnce))
+    {
+        PhCreateObjectType(&PhCallTreeType, L"CallTree", 0, PhpCallTreeDeleteProcedure);
+        PhEndInitOnce(&PhCallTreeInitOnce);
+    }
+
+    if (!NT_SUCCESS(PhCreateObject(&callTree, sizeof(PH_CALL_TREE), 0, PhCallTreeType)))
+        return NULL;
+
+    memset(&callTree->Root, 0, sizeof(PH_CALL_TREE_NODE));
+    callTree->NumberOfSamples = 0;
+    callTree->NumberOfNodes = 0;
+
+    block = PhAllocate(sizeof(PH_CALL_TREE_BLOCK));
+    block->Next = NULL;
+    block->NextIndex = 0;
+    callTree->CurrentBlock = block;
+
+    return callTree;
+}
+
+VOID NTAPI PhpCallTreeDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_CALL_TREE callTree = Object;
+    PPH_CALL_TREE_BLOCK block;
+    PPH_CALL_TREE_BLOCK nextBlock;
+
+    for (block = callTree->CurrentBlock; block; block = nextBlock)
+    {
+        nextBlock = block->Next;
+        PhFree(block);
+    }
+}
+
+static PPH_CALL_TREE_NODE PhpAllocateCallTreeNode(
+    _Inout_ PPH_CALL_TREE CallTree
+    )
+{
+    PPH_CALL_TREE_BLOCK block;
+    PPH_CALL_TREE_BLOCK newBlock;
+    LONG index;
+
+    while (TRUE)
+    {
+        block = CallTree->CurrentBlock;
+        index = _InterlockedIncrement(&block->NextIndex) - 1;
+
+        if (index < PH_CALL_TREE_BLOCK_SIZE)
+        {
+            _InterlockedIncrement(&CallTree->NumberOfNodes);
+            memset(&block->Nodes[index], 0, sizeof(PH_CALL_TREE_NODE));
+
+            return &block->Nodes[index];
+        }
+
+        // The block is full. Try to install a new one; if another thread got there
+        // first, use its block instead.
+
+        newBlock = PhAllocate(sizeof(PH_CALL_TREE_BLOCK));
+        newBlock->Next = block;
+        newBlock->NextIndex = 0;
+
+        if (_InterlockedCompareExchangePointer(&CallTree->CurrentBlock, newBlock, block) != block)
+            PhFree(newBlock);
+    }
+}
+
+static PPH_CALL_TREE_NODE PhpFindChildCallTreeNode(
+    _In_opt_ PPH_CALL_TREE_NODE FirstChild,
+    _In_opt_ PPH_CALL_TREE_NODE LastChild,
+    _In_ PVOID Address
+    )
+{
+    PPH_CALL_TREE_NODE node;
+
+    for (node = FirstChild; node != LastChild; node = node->NextSibling)
+    {
+        if (node->Address == Address)
+            return node;
+    }
+
+    return NULL;
+}
+
+static PPH_CALL_TREE_NODE PhpFindOrAddChildCallTreeNode(
+    _Inout_ PPH_CALL_TREE CallTree,
+    _Inout_ PPH_CALL_TREE_NODE Parent,
+    _In_ PVOID Address
+    )
+{
+    PPH_CALL_TREE_NODE firstChild;
+    PPH_CALL_TREE_NODE oldFirstChild;
+    PPH_CALL_TREE_NODE node;
+    PPH_CALL_TREE_NODE newNode;
+
+    firstChild = Parent->FirstChild;
+
+    if (node = PhpFindChildCallTreeNode(firstChild, NULL, Address))
+        return node;
+
+    newNode = PhpAllocateCallTreeNode(CallTree);
+    newNode->Parent = Parent;
+    newNode->Address = Address;
+
+    while (TRUE)
+    {
+        newNode->NextSibling = firstChild;
+        oldFirstChild = _InterlockedCompareExchangePointer(&Parent->FirstChild, newNode, firstChild);
+
+        if (oldFirstChild == firstChild)
+            return newNode;
+
+        // Other threads have added children. Only those children need to be checked,
+        // since new children are always added at the front of the list.
+        if (node = PhpFindChildCallTreeNode(oldFirstChild, firstChild, Address))
+        {
+            // The node we allocated stays unused until the tree is freed.
+            return node;
+        }
+
+        firstChild = oldFirstChild;
+    }
+}
+
+/**
+ * Adds a stack sample to a call tree.
+ *
+ * \param CallTree The call tree.
+ * \param Frames An array of return addresses, with the innermost frame first. This
+ * is the order used by RtlCaptureStackBackTrace() and
+ * KphCaptureStackBackTraceThread().
+ * \param NumberOfFrames The number of entries in \a Frames. Only the innermost
+ * PH_CALL_TREE_MAXIMUM_DEPTH frames are used.
+ *
+ * \remarks This function can be called concurrently from multiple threads.
+ */
+VOID PhAddSampleCallTree(
+    _Inout_ PPH_CALL_TREE CallTree,
+    _In_reads_(NumberOfFrames) PVOID *Frames,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    PPH_CALL_TREE_NODE node;
+    ULONG i;
+
+    if (NumberOfFrames > PH_CALL_TREE_MAXIMUM_DEPTH)
+        NumberOfFrames = PH_CALL_TREE_MAXIMUM_DEPTH;
+
+    node = &CallTree->Root;
+    _InterlockedIncrement(&node->InclusiveCount);
+
+    for (i = NumberOfFrames; i != 0; i--)
+    {
+        node = PhpFindOrAddChildCallTreeNode(CallTree, node, Frames[i - 1]);
+        _InterlockedIncrement(&node->InclusiveCount);
+    }
+
+    _InterlockedIncrement(&node->ExclusiveCount);
+    _InterlockedIncrement(&CallTree->NumberOfSamples);
+}
+
+static VOID PhpCollectAddressesCallTree(
+    _In_ PPH_CALL_TREE_NODE Node,
+    _Inout_ PPH_LIST Addresses
+    )
+{
+    PPH_CALL_TREE_NODE child;
+
+    for (child = Node->FirstChild; child; child = child->NextSibling)
+    {
+        PhAddItemList(Addresses, child->Address);
+        PhpCollectAddressesCallTree(child, Addresses);
+    }
+}
+
+static int __cdecl PhpCallTreeAddressCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    return uintptrcmp(*(PULONG_PTR)elem1, *(PULONG_PTR)elem2);
+}
+
+static int __cdecl PhpCallTreeFoldedStackCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    return PhCompareString(
+        (*(PPH_CALL_TREE_FOLDED_STACK *)elem1)->Path,
+        (*(PPH_CALL_TREE_FOLDED_STACK *)elem2)->Path,
+        FALSE
+        );
+}
+
+static PPH_STRING PhpGetNameCallTree(
+    _In_ PPH_CALL_TREE_EXPORT_CONTEXT Context,
+    _In_ PVOID Address
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG mid;
+
+    low = 0;
+    high = Context->NumberOfAddresses;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+
+        if ((ULONG_PTR)Context->Addresses[mid] < (ULONG_PTR)Address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    assert(low < Context->NumberOfAddresses && Context->Addresses[low] == Address);
+
+    return Context->Names[low];
+}
+
+static VOID PhpFoldCallTree(
+    _Inout_ PPH_CALL_TREE_EXPORT_CONTEXT Context,
+    _In_ PPH_CALL_TREE_NODE Node
+    )
+{
+    PPH_CALL_TREE_NODE child;
+    SIZE_T length;
+    PPH_CALL_TREE_FOLDED_STACK stack;
+
+    for (child = Node->FirstChild; child; child = child->NextSibling)
+    {
+        length = Context->Path.String->Length / sizeof(WCHAR);
+
+        if (length != 0)
+            PhAppendCharStringBuilder(&Context->Path, ';');
+
+        PhAppendStringBuilder(&Context->Path, PhpGetNameCallTree(Context, child->Address));
+
+        if (child->ExclusiveCount != 0)
+        {
+            stack = PhAllocate(sizeof(PH_CALL_TREE_FOLDED_STACK));
+            stack->Path = PhCreateStringEx(Context->Path.String->Buffer, Context->Path.String->Length);
+            stack->Count = child->ExclusiveCount;
+            PhAddItemList(Context->Stacks, stack);
+        }
+
+        PhpFoldCallTree(Context, child);
+
+        PhRemoveStringBuilder(&Context->Path, length, Context->Path.String->Length / sizeof(WCHAR) - length);
+    }
+}
+
+/**
+ * Exports a call tree in the folded stack format, which can be read by flame graph
+ * tools.
+ *
+ * \param CallTree The call tree.
+ * \param ResolveCallback A callback function which converts addresses to names. If
+ * NULL, addresses are formatted as hexadecimal numbers.
+ * \param Context A user-defined value to pass to the callback function.
+ *
+ * \return A string containing one line for each distinct stack, consisting of the
+ * names of the frames from the outermost to the innermost separated by semicolons,
+ * followed by a space and the number of samples. Lines are sorted, and stacks whose
+ * frames have the same names are combined.
+ */
+PPH_STRING PhExportFoldedCallTree(
+    _In_ PPH_CALL_TREE CallTree,
+    _In_opt_ PPH_CALL_TREE_RESOLVE_CALLBACK ResolveCallback,
+    _In_opt_ PVOID Context
+    )
+{
+    PH_CALL_TREE_EXPORT_CONTEXT context;
+    PPH_LIST addresses;
+    PH_STRING_BUILDER stringBuilder;
+    ULONG count;
+    ULONG i;
+    ULONG j;
+
+    // Find the distinct addresses and resolve them all at once.
+
+    addresses = PhCreateList(CallTree->NumberOfNodes + 1);
+    PhpCollectAddressesCallTree(&CallTree->Root, addresses);
+    qsort(addresses->Items, addresses->Count, sizeof(PVOID), PhpCallTreeAddressCompare);
+
+    count = 0;
+
+    for (i = 0; i < addresses->Count; i++)
+    {
+        if (count == 0 || addresses->Items[count - 1] != addresses->Items[i])
+            addresses->Items[count++] = addresses->Items[i];
+    }
+
+    context.Addresses = addresses->Items;
+    context.NumberOfAddresses = count;
+    context.Names = PhAllocate(sizeof(PPH_STRING) * (count + 1));
+    memset(context.Names, 0, sizeof(PPH_STRING) * count);
+
+    if (ResolveCallback && count != 0)
+        ResolveCallback(context.Addresses, count, context.Names, Context);
+
+    for (i = 0; i < count; i++)
+    {
+        if (!context.Names[i])
+            context.Names[i] = PhFormatString(L"0x%Ix", context.Addresses[i]);
+    }
+
+    // Build the stacks, then sort them so that stacks with the same names are next
+    // to each other.
+
+    PhInitializeStringBuilder(&context.Path, 0x100);
+    context.Stacks = PhCreateList(64);
+    PhpFoldCallTree(&context, &CallTree->Root);
+    PhDeleteStringBuilder(&context.Path);
+
+    qsort(context.Stacks->Items, context.Stacks->Count, sizeof(PVOID), PhpCallTreeFoldedStackCompare);
+
+    PhInitializeStringBuilder(&stringBuilder, 0x1000);
+
+    for (i = 0; i < context.Stacks->Count; i = j)
+    {
+        PPH_CALL_TREE_FOLDED_STACK stack = context.Stacks->Items[i];
+        ULONG total = stack->Count;
+
+        for (j = i + 1; j < context.Stacks->Count; j++)
+        {
+            PPH_CALL_TREE_FOLDED_STACK otherStack = context.Stacks->Items[j];
+
+            if (!PhEqualString(stack->Path, otherStack->Path, FALSE))
+                break;
+
+            total += otherStack->Count;
+        }
+
+        PhAppendStringBuilder(&stringBuilder, stack->Path);
+        PhAppendFormatStringBuilder(&stringBuilder, L" %u\n", total);
+    }
+
+    for (i = 0; i < context.Stacks->Count; i++)
+    {
+        PPH_CALL_TREE_FOLDED_STACK stack = context.Stacks->Items[i];
+
+        PhDereferenceObject(stack->Path);
+        PhFree(stack);
+    }
+
+    PhDereferenceObject(context.Stacks);
+
+    for (i = 0; i < count; i++)
+        PhDereferenceObject(context.Names[i]);
+
+    PhFree(context.Names);
+    PhDereferenceObject(addresses);
+
+    return PhFinalStringBuilderString(&stringBuilder);
+}
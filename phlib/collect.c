@@ -963,3 +963,720 @@ VOID PhEnumAvlTree(
         break;
     }
 }
+
+// B+ trees
+//
+// Leaf nodes store entries, and internal nodes store separator keys followed by
+// child pointers. The separator key at index i is less than or equal to every
+// entry in the subtree of child i + 1, and greater than every entry in the subtree
+// of child i. Nodes are a fixed size so that each level of a search touches a few
+// contiguous cache lines instead of a separate allocation for each entry.
+//
+// Insertion splits full nodes on the way down, and removal ensures that each child
+// has more than the minimum number of entries before descending into it, so neither
+// operation has to walk back up the tree.
+
+#define PH_BTREE_NODE_SIZE 1024
+#define PH_BTREE_MINIMUM_CAPACITY 4
+#define PH_BTREE_ALIGN(Size) (((Size) + 15) & ~15)
+
+typedef struct _PH_BTREE_NODE
+{
+    struct _PH_BTREE_NODE *Next; // next leaf node
+    ULONG Count; // number of entries in a leaf node, or number of keys in an internal node
+    BOOLEAN IsLeaf;
+} PH_BTREE_NODE;
+
+#define PH_BTREE_HEADER_SIZE PH_BTREE_ALIGN(sizeof(PH_BTREE_NODE))
+
+#define PhpEntryBTree(Tree, Node, Index) \
+    PTR_ADD_OFFSET((Node), PH_BTREE_HEADER_SIZE + (SIZE_T)(Index) * (Tree)->EntrySize)
+#define PhpKeyBTree(Tree, Node, Index) \
+    PTR_ADD_OFFSET((Node), (Tree)->KeysOffset + (SIZE_T)(Index) * (Tree)->EntrySize)
+#define PhpChildrenBTree(Node) \
+    ((PPH_BTREE_NODE *)PTR_ADD_OFFSET((Node), PH_BTREE_HEADER_SIZE))
+
+#define PhpIsFullNodeBTree(Tree, Node) \
+    ((Node)->Count == ((Node)->IsLeaf ? (Tree)->LeafCapacity : (Tree)->InternalCapacity))
+#define PhpMinimumCountBTree(Tree, Node) \
+    ((Node)->IsLeaf ? (Tree)->LeafCapacity / 2 : ((Tree)->InternalCapacity - 1) / 2)
+
+/**
+ * Initializes a B+ tree.
+ *
+ * \param Tree The tree.
+ * \param EntrySize The size of each entry in the tree.
+ * \param CompareFunction A function used to compare entries.
+ */
+VOID PhInitializeBTree(
+    _Out_ PPH_BTREE Tree,
+    _In_ ULONG EntrySize,
+    _In_ PPH_BTREE_COMPARE_FUNCTION CompareFunction
+    )
+{
+    ULONG leafCapacity;
+    ULONG internalCapacity;
+
+    leafCapacity = (PH_BTREE_NODE_SIZE - PH_BTREE_HEADER_SIZE) / EntrySize;
+    internalCapacity = (PH_BTREE_NODE_SIZE - PH_BTREE_HEADER_SIZE - 16) / (EntrySize + sizeof(PVOID));
+
+    if (leafCapacity < PH_BTREE_MINIMUM_CAPACITY)
+        leafCapacity = PH_BTREE_MINIMUM_CAPACITY;
+    if (internalCapacity < PH_BTREE_MINIMUM_CAPACITY)
+        internalCapacity = PH_BTREE_MINIMUM_CAPACITY;
+
+    Tree->Root = NULL;
+    Tree->Count = 0;
+    Tree->Height = 0;
+    Tree->EntrySize = EntrySize;
+    Tree->LeafCapacity = leafCapacity;
+    Tree->InternalCapacity = internalCapacity;
+    Tree->KeysOffset = PH_BTREE_HEADER_SIZE + PH_BTREE_ALIGN((internalCapacity + 1) * sizeof(PVOID));
+    Tree->CompareFunction = CompareFunction;
+}
+
+static PPH_BTREE_NODE PhpCreateNodeBTree(
+    _In_ PPH_BTREE Tree,
+    _In_ BOOLEAN IsLeaf
+    )
+{
+    PPH_BTREE_NODE node;
+
+    if (IsLeaf)
+        node = PhAllocate(PH_BTREE_HEADER_SIZE + Tree->LeafCapacity * Tree->EntrySize);
+    else
+        node = PhAllocate(Tree->KeysOffset + Tree->InternalCapacity * Tree->EntrySize);
+
+    node->Next = NULL;
+    node->Count = 0;
+    node->IsLeaf = IsLeaf;
+
+    return node;
+}
+
+static VOID PhpDestroyNodeBTree(
+    _In_ PPH_BTREE_NODE Node
+    )
+{
+    ULONG i;
+
+    if (!Node->IsLeaf)
+    {
+        for (i = 0; i <= Node->Count; i++)
+            PhpDestroyNodeBTree(PhpChildrenBTree(Node)[i]);
+    }
+
+    PhFree(Node);
+}
+
+/**
+ * Frees all memory used by a B+ tree. The tree is left empty.
+ *
+ * \param Tree The tree.
+ */
+VOID PhDeleteBTree(
+    _Inout_ PPH_BTREE Tree
+    )
+{
+    if (Tree->Root)
+        PhpDestroyNodeBTree(Tree->Root);
+
+    Tree->Root = NULL;
+    Tree->Count = 0;
+    Tree->Height = 0;
+}
+
+/**
+ * Finds the first entry in a leaf node which is greater than or equal to \a Entry.
+ */
+static ULONG PhpLowerBoundBTree(
+    _In_ PPH_BTREE Tree,
+    _In_ PPH_BTREE_NODE Node,
+    _In_ PVOID Entry,
+    _Out_ PBOOLEAN Found
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG mid;
+    LONG result;
+
+    low = 0;
+    high = Node->Count;
+    *Found = FALSE;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        result = Tree->CompareFunction(Entry, PhpEntryBTree(Tree, Node, mid));
+
+        if (result > 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            if (result == 0)
+                *Found = TRUE;
+
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Finds the child of an internal node whose subtree may contain \a Entry.
+ */
+static ULONG PhpChildIndexBTree(
+    _In_ PPH_BTREE Tree,
+    _In_ PPH_BTREE_NODE Node,
+    _In_ PVOID Entry
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG mid;
+
+    low = 0;
+    high = Node->Count;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+
+        if (Tree->CompareFunction(Entry, PhpKeyBTree(Tree, Node, mid)) >= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ * Splits a full child of a node that is not full.
+ */
+static VOID PhpSplitChildBTree(
+    _In_ PPH_BTREE Tree,
+    _Inout_ PPH_BTREE_NODE Parent,
+    _In_ ULONG Index
+    )
+{
+    PPH_BTREE_NODE *children;
+    PPH_BTREE_NODE child;
+    PPH_BTREE_NODE sibling;
+    PVOID separator;
+    ULONG count;
+
+    children = PhpChildrenBTree(Parent);
+    child = children[Index];
+    sibling = PhpCreateNodeBTree(Tree, child->IsLeaf);
+
+    if (child->IsLeaf)
+    {
+        // The upper half of the entries move to the new leaf, and the first of them
+        // becomes the separator.
+        count = child->Count / 2;
+        sibling->Count = child->Count - count;
+        memcpy(PhpEntryBTree(Tree, sibling, 0), PhpEntryBTree(Tree, child, count), sibling->Count * Tree->EntrySize);
+        child->Count = count;
+
+        sibling->Next = child->Next;
+        child->Next = sibling;
+
+        separator = PhpEntryBTree(Tree, sibling, 0);
+    }
+    else
+    {
+        // The middle key moves up to the parent.
+        count = child->Count / 2;
+        sibling->Count = child->Count - count - 1;
+        memcpy(PhpKeyBTree(Tree, sibling, 0), PhpKeyBTree(Tree, child, count + 1), sibling->Count * Tree->EntrySize);
+        memcpy(PhpChildrenBTree(sibling), &PhpChildrenBTree(child)[count + 1], (sibling->Count + 1) * sizeof(PVOID));
+        child->Count = count;
+
+        separator = PhpKeyBTree(Tree, child, count);
+    }
+
+    memmove(
+        PhpKeyBTree(Tree, Parent, Index + 1),
+        PhpKeyBTree(Tree, Parent, Index),
+        (Parent->Count - Index) * Tree->EntrySize
+        );
+    memmove(&children[Index + 2], &children[Index + 1], (Parent->Count - Index) * sizeof(PVOID));
+    memcpy(PhpKeyBTree(Tree, Parent, Index), separator, Tree->EntrySize);
+    children[Index + 1] = sibling;
+    Parent->Count++;
+}
+
+/**
+ * Adds an entry to a B+ tree.
+ *
+ * \param Tree The tree.
+ * \param Entry The entry. The entry is copied into the tree.
+ * \param Added A variable which receives TRUE if the entry was added, or FALSE if
+ * an equal entry already exists.
+ *
+ * \return A pointer to the entry as stored in the tree, or to the existing entry.
+ * The pointer is only valid until the tree is modified.
+ */
+PVOID PhAddEntryBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_ PVOID Entry,
+    _Out_opt_ PBOOLEAN Added
+    )
+{
+    PPH_BTREE_NODE node;
+    PPH_BTREE_NODE child;
+    ULONG index;
+    BOOLEAN found;
+
+    if (!Tree->Root)
+    {
+        Tree->Root = PhpCreateNodeBTree(Tree, TRUE);
+        Tree->Height = 1;
+    }
+
+    if (PhpIsFullNodeBTree(Tree, Tree->Root))
+    {
+        node = PhpCreateNodeBTree(Tree, FALSE);
+        PhpChildrenBTree(node)[0] = Tree->Root;
+        Tree->Root = node;
+        Tree->Height++;
+        PhpSplitChildBTree(Tree, node, 0);
+    }
+
+    node = Tree->Root;
+
+    while (!node->IsLeaf)
+    {
+        index = PhpChildIndexBTree(Tree, node, Entry);
+        child = PhpChildrenBTree(node)[index];
+
+        if (PhpIsFullNodeBTree(Tree, child))
+        {
+            PhpSplitChildBTree(Tree, node, index);
+
+            if (Tree->CompareFunction(Entry, PhpKeyBTree(Tree, node, index)) >= 0)
+                index++;
+
+            child = PhpChildrenBTree(node)[index];
+        }
+
+        node = child;
+    }
+
+    index = PhpLowerBoundBTree(Tree, node, Entry, &found);
+
+    if (found)
+    {
+        if (Added)
+            *Added = FALSE;
+
+        return PhpEntryBTree(Tree, node, index);
+    }
+
+    memmove(
+        PhpEntryBTree(Tree, node, index + 1),
+        PhpEntryBTree(Tree, node, index),
+        (node->Count - index) * Tree->EntrySize
+        );
+    memcpy(PhpEntryBTree(Tree, node, index), Entry, Tree->EntrySize);
+    node->Count++;
+    Tree->Count++;
+
+    if (Added)
+        *Added = TRUE;
+
+    return PhpEntryBTree(Tree, node, index);
+}
+
+/**
+ * Merges a child of a node with its right sibling.
+ */
+static VOID PhpMergeChildrenBTree(
+    _In_ PPH_BTREE Tree,
+    _Inout_ PPH_BTREE_NODE Parent,
+    _In_ ULONG Index
+    )
+{
+    PPH_BTREE_NODE *children;
+    PPH_BTREE_NODE left;
+    PPH_BTREE_NODE right;
+
+    children = PhpChildrenBTree(Parent);
+    left = children[Index];
+    right = children[Index + 1];
+
+    if (left->IsLeaf)
+    {
+        memcpy(PhpEntryBTree(Tree, left, left->Count), PhpEntryBTree(Tree, right, 0), right->Count * Tree->EntrySize);
+        left->Count += right->Count;
+        left->Next = right->Next;
+    }
+    else
+    {
+        // The separator moves down between the keys of the two nodes.
+        memcpy(PhpKeyBTree(Tree, left, left->Count), PhpKeyBTree(Tree, Parent, Index), Tree->EntrySize);
+        memcpy(PhpKeyBTree(Tree, left, left->Count + 1), PhpKeyBTree(Tree, right, 0), right->Count * Tree->EntrySize);
+        memcpy(&PhpChildrenBTree(left)[left->Count + 1], PhpChildrenBTree(right), (right->Count + 1) * sizeof(PVOID));
+        left->Count += right->Count + 1;
+    }
+
+    memmove(
+        PhpKeyBTree(Tree, Parent, Index),
+        PhpKeyBTree(Tree, Parent, Index + 1),
+        (Parent->Count - Index - 1) * Tree->EntrySize
+        );
+    memmove(&children[Index + 1], &children[Index + 2], (Parent->Count - Index - 1) * sizeof(PVOID));
+    Parent->Count--;
+
+    PhFree(right);
+}
+
+/**
+ * Ensures that a child of a node has more than the minimum number of entries by
+ * moving an entry from a sibling, or by merging it with a sibling.
+ */
+static VOID PhpFillChildBTree(
+    _In_ PPH_BTREE Tree,
+    _Inout_ PPH_BTREE_NODE Parent,
+    _In_ ULONG Index
+    )
+{
+    PPH_BTREE_NODE *children;
+    PPH_BTREE_NODE child;
+    PPH_BTREE_NODE sibling;
+
+    children = PhpChildrenBTree(Parent);
+    child = children[Index];
+
+    if (Index > 0 && children[Index - 1]->Count > PhpMinimumCountBTree(Tree, children[Index - 1]))
+    {
+        // Move the last entry of the left sibling.
+
+        sibling = children[Index - 1];
+
+        if (child->IsLeaf)
+        {
+            memmove(PhpEntryBTree(Tree, child, 1), PhpEntryBTree(Tree, child, 0), child->Count * Tree->EntrySize);
+            memcpy(PhpEntryBTree(Tree, child, 0), PhpEntryBTree(Tree, sibling, sibling->Count - 1), Tree->EntrySize);
+            memcpy(PhpKeyBTree(Tree, Parent, Index - 1), PhpEntryBTree(Tree, child, 0), Tree->EntrySize);
+        }
+        else
+        {
+            memmove(PhpKeyBTree(Tree, child, 1), PhpKeyBTree(Tree, child, 0), child->Count * Tree->EntrySize);
+            memmove(&PhpChildrenBTree(child)[1], &PhpChildrenBTree(child)[0], (child->Count + 1) * sizeof(PVOID));
+            memcpy(PhpKeyBTree(Tree, child, 0), PhpKeyBTree(Tree, Parent, Index - 1), Tree->EntrySize);
+            PhpChildrenBTree(child)[0] = PhpChildrenBTree(sibling)[sibling->Count];
+            memcpy(PhpKeyBTree(Tree, Parent, Index - 1), PhpKeyBTree(Tree, sibling, sibling->Count - 1), Tree->EntrySize);
+        }
+
+        child->Count++;
+        sibling->Count--;
+    }
+    else if (Index < Parent->Count && children[Index + 1]->Count > PhpMinimumCountBTree(Tree, children[Index + 1]))
+    {
+        // Move the first entry of the right sibling.
+
+        sibling = children[Index + 1];
+
+        if (child->IsLeaf)
+        {
+            memcpy(PhpEntryBTree(Tree, child, child->Count), PhpEntryBTree(Tree, sibling, 0), Tree->EntrySize);
+            memmove(PhpEntryBTree(Tree, sibling, 0), PhpEntryBTree(Tree, sibling, 1), (sibling->Count - 1) * Tree->EntrySize);
+            memcpy(PhpKeyBTree(Tree, Parent, Index), PhpEntryBTree(Tree, sibling, 0), Tree->EntrySize);
+        }
+        else
+        {
+            memcpy(PhpKeyBTree(Tree, child, child->Count), PhpKeyBTree(Tree, Parent, Index), Tree->EntrySize);
+            PhpChildrenBTree(child)[child->Count + 1] = PhpChildrenBTree(sibling)[0];
+            memcpy(PhpKeyBTree(Tree, Parent, Index), PhpKeyBTree(Tree, sibling, 0), Tree->EntrySize);
+            memmove(PhpKeyBTree(Tree, sibling, 0), PhpKeyBTree(Tree, sibling, 1), (sibling->Count - 1) * Tree->EntrySize);
+            memmove(&PhpChildrenBTree(sibling)[0], &PhpChildrenBTree(sibling)[1], sibling->Count * sizeof(PVOID));
+        }
+
+        child->Count++;
+        sibling->Count--;
+    }
+    else if (Index > 0)
+    {
+        PhpMergeChildrenBTree(Tree, Parent, Index - 1);
+    }
+    else
+    {
+        PhpMergeChildrenBTree(Tree, Parent, Index);
+    }
+}
+
+/**
+ * Removes an entry from a B+ tree.
+ *
+ * \param Tree The tree.
+ * \param Entry An entry which is equal to the entry to remove.
+ *
+ * \return TRUE if the entry was removed, or FALSE if it was not found.
+ */
+BOOLEAN PhRemoveEntryBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_ PVOID Entry
+    )
+{
+    PPH_BTREE_NODE node;
+    PPH_BTREE_NODE child;
+    ULONG index;
+    BOOLEAN found;
+
+    node = Tree->Root;
+
+    if (!node)
+        return FALSE;
+
+    while (!node->IsLeaf)
+    {
+        index = PhpChildIndexBTree(Tree, node, Entry);
+        child = PhpChildrenBTree(node)[index];
+
+        if (child->Count <= PhpMinimumCountBTree(Tree, child))
+        {
+            PhpFillChildBTree(Tree, node, index);
+
+            if (node == Tree->Root && node->Count == 0)
+            {
+                // The root only has one child left, so the tree becomes shorter.
+                Tree->Root = PhpChildrenBTree(node)[0];
+                Tree->Height--;
+                PhFree(node);
+                node = Tree->Root;
+            }
+
+            // Search the node again, since its keys may have changed.
+            continue;
+        }
+
+        node = child;
+    }
+
+    index = PhpLowerBoundBTree(Tree, node, Entry, &found);
+
+    if (!found)
+        return FALSE;
+
+    memmove(
+        PhpEntryBTree(Tree, node, index),
+        PhpEntryBTree(Tree, node, index + 1),
+        (node->Count - index - 1) * Tree->EntrySize
+        );
+    node->Count--;
+    Tree->Count--;
+
+    if (Tree->Count == 0)
+    {
+        PhFree(Tree->Root);
+        Tree->Root = NULL;
+        Tree->Height = 0;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Finds an entry in a B+ tree.
+ *
+ * \param Tree The tree.
+ * \param Entry An entry which is equal to the entry to find.
+ *
+ * \return A pointer to the entry as stored in the tree, or NULL if it was not
+ * found. The pointer is only valid until the tree is modified.
+ */
+PVOID PhFindEntryBTree(
+    _In_ PPH_BTREE Tree,
+    _In_ PVOID Entry
+    )
+{
+    PPH_BTREE_NODE node;
+    ULONG index;
+    BOOLEAN found;
+
+    node = Tree->Root;
+
+    if (!node)
+        return NULL;
+
+    while (!node->IsLeaf)
+        node = PhpChildrenBTree(node)[PhpChildIndexBTree(Tree, node, Entry)];
+
+    index = PhpLowerBoundBTree(Tree, node, Entry, &found);
+
+    if (found)
+        return PhpEntryBTree(Tree, node, index);
+    else
+        return NULL;
+}
+
+/**
+ * Builds a B+ tree from an array of entries. This is much faster than adding the
+ * entries one at a time.
+ *
+ * \param Tree The tree. The tree must be empty.
+ * \param Entries An array of entries, sorted in ascending order. The array must not
+ * contain equal entries.
+ * \param Count The number of entries.
+ */
+VOID PhBulkLoadBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_reads_bytes_(Count * Tree->EntrySize) PVOID Entries,
+    _In_ ULONG Count
+    )
+{
+    PPH_BTREE_NODE *nodes;
+    PVOID *lowKeys;
+    ULONG numberOfNodes;
+    ULONG numberOfParents;
+    ULONG offset;
+    ULONG count;
+    ULONG i;
+    ULONG j;
+
+    assert(Tree->Count == 0);
+
+    if (Count == 0)
+        return;
+
+    // Create the leaf nodes. The entries are divided evenly so that every node has
+    // at least the minimum number of entries.
+
+    numberOfNodes = (Count + Tree->LeafCapacity - 1) / Tree->LeafCapacity;
+    nodes = PhAllocate(numberOfNodes * sizeof(PPH_BTREE_NODE));
+    lowKeys = PhAllocate(numberOfNodes * sizeof(PVOID));
+    offset = 0;
+
+    for (i = 0; i < numberOfNodes; i++)
+    {
+        count = (Count - offset) / (numberOfNodes - i);
+
+        nodes[i] = PhpCreateNodeBTree(Tree, TRUE);
+        memcpy(PhpEntryBTree(Tree, nodes[i], 0), PTR_ADD_OFFSET(Entries, (SIZE_T)offset * Tree->EntrySize), count * Tree->EntrySize);
+        nodes[i]->Count = count;
+        lowKeys[i] = PhpEntryBTree(Tree, nodes[i], 0);
+
+        if (i != 0)
+            nodes[i - 1]->Next = nodes[i];
+
+        offset += count;
+    }
+
+    Tree->Height = 1;
+
+    // Create each level of internal nodes. The separator for a child is the smallest
+    // entry in its subtree.
+
+    while (numberOfNodes > 1)
+    {
+        numberOfParents = (numberOfNodes + Tree->InternalCapacity) / (Tree->InternalCapacity + 1);
+        offset = 0;
+
+        for (i = 0; i < numberOfParents; i++)
+        {
+            PPH_BTREE_NODE parent;
+
+            count = (numberOfNodes - offset) / (numberOfParents - i);
+            parent = PhpCreateNodeBTree(Tree, FALSE);
+
+            for (j = 0; j < count; j++)
+            {
+                PhpChildrenBTree(parent)[j] = nodes[offset + j];
+
+                if (j != 0)
+                    memcpy(PhpKeyBTree(Tree, parent, j - 1), lowKeys[offset + j], Tree->EntrySize);
+            }
+
+            parent->Count = count - 1;
+
+            // i <= offset, so this does not overwrite nodes that have not been processed yet.
+            nodes[i] = parent;
+            lowKeys[i] = lowKeys[offset];
+
+            offset += count;
+        }
+
+        numberOfNodes = numberOfParents;
+        Tree->Height++;
+    }
+
+    Tree->Root = nodes[0];
+    Tree->Count = Count;
+
+    PhFree(lowKeys);
+    PhFree(nodes);
+}
+
+/**
+ * Begins an enumeration of a B+ tree.
+ *
+ * \param Tree The tree.
+ * \param Entry The entry at which to start. The enumeration begins with the first
+ * entry that is greater than or equal to this entry. Specify NULL to start with
+ * the smallest entry in the tree.
+ * \param Context A variable which receives the enumeration state.
+ *
+ * \remarks The tree must not be modified during the enumeration. To enumerate a
+ * range, begin the enumeration at the start of the range and stop when the
+ * returned entry is past the end of the range.
+ */
+VOID PhBeginEnumBTree(
+    _In_ PPH_BTREE Tree,
+    _In_opt_ PVOID Entry,
+    _Out_ PPH_BTREE_ENUM_CONTEXT Context
+    )
+{
+    PPH_BTREE_NODE node;
+    BOOLEAN found;
+
+    Context->Tree = Tree;
+    Context->Leaf = NULL;
+    Context->Index = 0;
+
+    node = Tree->Root;
+
+    if (!node)
+        return;
+
+    while (!node->IsLeaf)
+    {
+        if (Entry)
+            node = PhpChildrenBTree(node)[PhpChildIndexBTree(Tree, node, Entry)];
+        else
+            node = PhpChildrenBTree(node)[0];
+    }
+
+    Context->Leaf = node;
+
+    if (Entry)
+        Context->Index = PhpLowerBoundBTree(Tree, node, Entry, &found);
+}
+
+/**
+ * Gets the next entry in an enumeration of a B+ tree.
+ *
+ * \param Context The enumeration state.
+ *
+ * \return The next entry in ascending order, or NULL if there are no more entries.
+ */
+PVOID PhNextEnumBTree(
+    _Inout_ PPH_BTREE_ENUM_CONTEXT Context
+    )
+{
+    while (Context->Leaf && Context->Index >= Context->Leaf->Count)
+    {
+        Context->Leaf = Context->Leaf->Next;
+        Context->Index = 0;
+    }
+
+    if (!Context->Leaf)
+        return NULL;
+
+    return PhpEntryBTree(Context->Tree, Context->Leaf, Context->Index++);
+}
@@ -58,9 +58,8 @@ PHLIBAPI ACCESS_MASK ThreadSetAccess;
 PHLIBAPI ACCESS_MASK ThreadAllAccess;
 
 // Internal data
-#ifdef DEBUG
-PHLIB_STATISTICS_BLOCK PhLibStatisticsBlock;
-#endif
+PHLIB_STATISTICS_BLOCK PhLibStatisticsBlocks[PHLIB_STATISTICS_BLOCKS];
+ULONG (NTAPI *PhLibGetCurrentProcessorNumber)(VOID) = NULL;
 
 NTSTATUS PhInitializePhLib(
     VOID
@@ -95,6 +94,8 @@ NTSTATUS PhInitializePhLibEx(
 
     PhInitializeWindowsVersion();
 
+    PhLibStatisticsInitialization();
+
     if (Flags & PHLIB_INIT_MODULE_NTIMPORTS)
     {
         if (!PhInitializeImports())
@@ -276,3 +277,144 @@ static VOID PhInitializeWindowsVersion(
         ThreadAllAccess = STANDARD_RIGHTS_REQUIRED | SYNCHRONIZE | 0x3ff;
     }
 }
+
+VOID PhLibStatisticsInitialization(
+    VOID
+    )
+{
+    PVOID ntdll;
+
+    ntdll = GetModuleHandle(L"ntdll.dll");
+
+    if (ntdll)
+        PhLibGetCurrentProcessorNumber = (PVOID)GetProcAddress(ntdll, "RtlGetCurrentProcessorNumber");
+}
+
+/**
+ * Gets the phlib statistics, summed over all processors.
+ *
+ * \param Statistics A variable which receives the statistics.
+ */
+VOID PhQueryLibStatistics(
+    _Out_ PPHLIB_STATISTICS_BLOCK Statistics
+    )
+{
+    PULONG values = (PULONG)Statistics;
+    ULONG i;
+    ULONG j;
+
+    memset(Statistics, 0, sizeof(PHLIB_STATISTICS_BLOCK));
+
+    for (i = 0; i < PHLIB_STATISTICS_BLOCKS; i++)
+    {
+        PULONG blockValues = (PULONG)&PhLibStatisticsBlocks[i];
+
+        for (j = 0; j < sizeof(PHLIB_STATISTICS_BLOCK) / sizeof(ULONG); j++)
+            values[j] += *(volatile ULONG *)&blockValues[j];
+    }
+}
+
+typedef struct _PHP_STATISTIC_NAME
+{
+    PWSTR Name;
+    ULONG Offset;
+} PHP_STATISTIC_NAME, *PPHP_STATISTIC_NAME;
+
+#define PHP_STATISTIC(Name) { L#Name, FIELD_OFFSET(PHLIB_STATISTICS_BLOCK, Name) }
+
+static PHP_STATISTIC_NAME PhpLibCounterNames[] =
+{
+    PHP_STATISTIC(BaseThreadsCreated),
+    PHP_STATISTIC(BaseThreadsCreateFailed),
+    PHP_STATISTIC(BaseStringBuildersCreated),
+    PHP_STATISTIC(BaseStringBuildersResized),
+    PHP_STATISTIC(RefObjectsCreated),
+    PHP_STATISTIC(RefObjectsDestroyed),
+    PHP_STATISTIC(RefObjectsAllocated),
+    PHP_STATISTIC(RefObjectsFreed),
+    PHP_STATISTIC(RefObjectsAllocatedFromSmallFreeList),
+    PHP_STATISTIC(RefObjectsFreedToSmallFreeList),
+    PHP_STATISTIC(RefObjectsAllocatedFromTypeFreeList),
+    PHP_STATISTIC(RefObjectsFreedToTypeFreeList),
+    PHP_STATISTIC(RefObjectsDeleteDeferred),
+    PHP_STATISTIC(RefAutoPoolsCreated),
+    PHP_STATISTIC(RefAutoPoolsDestroyed),
+    PHP_STATISTIC(RefAutoPoolsDynamicAllocated),
+    PHP_STATISTIC(RefAutoPoolsDynamicResized),
+    PHP_STATISTIC(QlBlockSpins),
+    PHP_STATISTIC(QlBlockWaits),
+    PHP_STATISTIC(QlAcquireExclusiveBlocks),
+    PHP_STATISTIC(QlAcquireSharedBlocks),
+    PHP_STATISTIC(WqWorkQueueThreadsCreated),
+    PHP_STATISTIC(WqWorkQueueThreadsCreateFailed),
+    PHP_STATISTIC(WqWorkItemsQueued),
+    PHP_STATISTIC(ProvProviderRuns),
+    PHP_STATISTIC(ProvProviderBoostedRuns),
+    PHP_STATISTIC(ProvProviderSkippedRuns),
+    PHP_STATISTIC(ProvProviderLateRuns)
+};
+
+static PHP_STATISTIC_NAME PhpLibHistogramNames[] =
+{
+    PHP_STATISTIC(RefDeleteProcedureTime),
+    PHP_STATISTIC(QlBlockWaitTime),
+    PHP_STATISTIC(WqWorkItemWaitTime),
+    PHP_STATISTIC(WqWorkItemRunTime),
+    PHP_STATISTIC(ProvProviderRunTime)
+};
+
+/**
+ * Formats the phlib statistics as a JSON object.
+ *
+ * \return A string containing an object with a "counters" member, which maps
+ * counter names to values, and a "histograms" member, which maps histogram names
+ * to arrays of bucket counts. See PH_STATISTICS_HISTOGRAM for the bucket ranges.
+ */
+PPH_STRING PhFormatLibStatistics(
+    VOID
+    )
+{
+    PHLIB_STATISTICS_BLOCK statistics;
+    PH_STRING_BUILDER sb;
+    ULONG i;
+    ULONG j;
+
+    PhQueryLibStatistics(&statistics);
+    PhInitializeStringBuilder(&sb, 2048);
+
+    PhAppendFormatStringBuilder(
+        &sb,
+        L"{\n  \"version\": 1,\n  \"processors\": %u,\n  \"timeUnit\": \"tsc\",\n  \"counters\": {",
+        (ULONG)PhSystemBasicInformation.NumberOfProcessors
+        );
+
+    for (i = 0; i < sizeof(PhpLibCounterNames) / sizeof(PHP_STATISTIC_NAME); i++)
+    {
+        PhAppendFormatStringBuilder(
+            &sb,
+            L"%s\n    \"%s\": %u",
+            i != 0 ? L"," : L"",
+            PhpLibCounterNames[i].Name,
+            *(PULONG)PTR_ADD_OFFSET(&statistics, PhpLibCounterNames[i].Offset)
+            );
+    }
+
+    PhAppendStringBuilder2(&sb, L"\n  },\n  \"histograms\": {");
+
+    for (i = 0; i < sizeof(PhpLibHistogramNames) / sizeof(PHP_STATISTIC_NAME); i++)
+    {
+        PPH_STATISTICS_HISTOGRAM histogram;
+
+        histogram = PTR_ADD_OFFSET(&statistics, PhpLibHistogramNames[i].Offset);
+        PhAppendFormatStringBuilder(&sb, L"%s\n    \"%s\": [", i != 0 ? L"," : L"", PhpLibHistogramNames[i].Name);
+
+        for (j = 0; j < PH_STATISTICS_HISTOGRAM_BUCKETS; j++)
+            PhAppendFormatStringBuilder(&sb, j != 0 ? L", %u" : L"%u", histogram->Buckets[j]);
+
+        PhAppendCharStringBuilder(&sb, ']');
+    }
+
+    PhAppendStringBuilder2(&sb, L"\n  }\n}\n");
+
+    return PhFinalStringBuilderString(&sb);
+}
@@ -32,7 +32,6 @@ typedef enum _PH_QUERY_OBJECT_WORK
 
 typedef struct _PH_QUERY_OBJECT_CONTEXT
 {
-    LOGICAL Initialized;
     PH_QUERY_OBJECT_WORK Work;
 
     HANDLE Handle;
@@ -44,16 +43,70 @@ typedef struct _PH_QUERY_OBJECT_CONTEXT
     ULONG ReturnLength;
 } PH_QUERY_OBJECT_CONTEXT, *PPH_QUERY_OBJECT_CONTEXT;
 
+typedef struct _PH_QUERY_OBJECT_WORKER
+{
+    HANDLE ThreadHandle;
+    PVOID Fiber;
+    HANDLE StartEvent;
+    HANDLE CompletedEvent;
+    PH_QUERY_OBJECT_CONTEXT Context;
+
+    // The worker thread only ever touches this buffer, never the caller's, so
+    // a query which completes after the worker has been abandoned cannot
+    // write to freed memory.
+    PVOID Buffer;
+    ULONG BufferSize;
+} PH_QUERY_OBJECT_WORKER, *PPH_QUERY_OBJECT_WORKER;
+
+typedef struct _PH_QUERY_OBJECT_BLACKLIST_ENTRY
+{
+    ULONG ObjectTypeNumber;
+    ACCESS_MASK GrantedAccess;
+    ULONG64 TickCount; // when the entry was added
+} PH_QUERY_OBJECT_BLACKLIST_ENTRY, *PPH_QUERY_OBJECT_BLACKLIST_ENTRY;
+
+#define PH_QUERY_OBJECT_MAXIMUM_WORKERS 4
+#define PH_QUERY_OBJECT_DEFAULT_TIMEOUT 1000
+#define PH_QUERY_OBJECT_TERMINATE_TIMEOUT 1000
+#define PH_QUERY_OBJECT_MAXIMUM_BLACKLIST 64
+#define PH_QUERY_OBJECT_BLACKLIST_LIFETIME (5 * 60 * 1000)
+
+typedef struct _PH_HANDLE_NAME_CACHE_ENTRY
+{
+    PVOID Object;
+    ULONG ObjectTypeNumber;
+    ULONG Generation;
+    PPH_STRING TypeName;
+    PPH_STRING ObjectName;
+    PPH_STRING BestObjectName;
+} PH_HANDLE_NAME_CACHE_ENTRY, *PPH_HANDLE_NAME_CACHE_ENTRY;
+
+#define PH_HANDLE_NAME_CACHE_GENERATION_INTERVAL 2000
+#define PH_HANDLE_NAME_CACHE_MAXIMUM_AGE 3
+#define PH_HANDLE_NAME_CACHE_MAXIMUM_ENTRIES 16384
+
 NTSTATUS PhpQueryObjectThreadStart(
     _In_ PVOID Parameter
     );
 
-static HANDLE PhQueryObjectThreadHandle = NULL;
-static PVOID PhQueryObjectFiber = NULL;
-static PH_QUEUED_LOCK PhQueryObjectMutex;
-static HANDLE PhQueryObjectStartEvent = NULL;
-static HANDLE PhQueryObjectCompletedEvent = NULL;
-static PH_QUERY_OBJECT_CONTEXT PhQueryObjectContext;
+static PH_QUEUED_LOCK PhQueryObjectPoolLock = PH_QUEUED_LOCK_INIT;
+static PH_QUEUED_LOCK PhQueryObjectPoolCondition = PH_QUEUED_LOCK_INIT;
+static PPH_QUERY_OBJECT_WORKER PhQueryObjectIdleWorkers[PH_QUERY_OBJECT_MAXIMUM_WORKERS];
+static ULONG PhQueryObjectNumberOfIdleWorkers = 0;
+static ULONG PhQueryObjectNumberOfWorkers = 0;
+static PPH_QUERY_OBJECT_WORKER PhQueryObjectAbandonedWorkers[PH_QUERY_OBJECT_MAXIMUM_WORKERS];
+static ULONG PhQueryObjectNumberOfAbandonedWorkers = 0;
+
+static PH_QUEUED_LOCK PhQueryObjectBlacklistLock = PH_QUEUED_LOCK_INIT;
+static PH_QUERY_OBJECT_BLACKLIST_ENTRY PhQueryObjectBlacklist[PH_QUERY_OBJECT_MAXIMUM_BLACKLIST];
+static ULONG PhQueryObjectBlacklistCount = 0;
+
+static PH_QUEUED_LOCK PhHandleNameCacheLock = PH_QUEUED_LOCK_INIT;
+static PPH_HASHTABLE PhHandleNameCacheHashtable = NULL;
+static ULONG PhHandleNameCacheGeneration = 0;
+static ULONG PhHandleNameCacheFlushCount = 0;
+static LONG PhHandleNameCacheHits = 0;
+static LONG PhHandleNameCacheMisses = 0;
 
 static PPH_STRING PhObjectTypeNames[MAX_OBJECT_TYPE_NUMBER] = { 0 };
 static PPH_GET_CLIENT_ID_NAME PhHandleGetClientIdName = NULL;
@@ -399,55 +452,15 @@ _Callback_ PPH_STRING PhStdGetClientIdName(
     _In_ PCLIENT_ID ClientId
     )
 {
-    static PH_QUEUED_LOCK cachedProcessesLock = PH_QUEUED_LOCK_INIT;
-    static PVOID processes = NULL;
-    static ULONG lastProcessesTickCount = 0;
-
+    PPH_PROCESS_SNAPSHOT snapshot;
     PPH_STRING name;
-    ULONG tickCount;
     PSYSTEM_PROCESS_INFORMATION processInfo;
 
-    // Get a new process list only if 2 seconds have passed
-    // since the last update.
+    // A process list up to 2 seconds old is good enough here.
+    if (!NT_SUCCESS(PhGetProcessSnapshot(2000, &snapshot)))
+        return PhCreateString(L"(Error querying processes)");
 
-    tickCount = GetTickCount();
-
-    if (tickCount - lastProcessesTickCount >= 2000)
-    {
-        PhAcquireQueuedLockExclusive(&cachedProcessesLock);
-
-        // Re-check the tick count.
-        if (tickCount - lastProcessesTickCount >= 2000)
-        {
-            if (processes)
-            {
-                PhFree(processes);
-                processes = NULL;
-            }
-
-            if (!NT_SUCCESS(PhEnumProcesses(&processes)))
-            {
-                PhReleaseQueuedLockExclusive(&cachedProcessesLock);
-                return PhCreateString(L"(Error querying processes)");
-            }
-
-            lastProcessesTickCount = tickCount;
-        }
-
-        PhReleaseQueuedLockExclusive(&cachedProcessesLock);
-    }
-
-    // Get a lock on the process list and get a name for the client ID.
-
-    PhAcquireQueuedLockShared(&cachedProcessesLock);
-
-    if (!processes)
-    {
-        PhReleaseQueuedLockShared(&cachedProcessesLock);
-        return NULL;
-    }
-
-    processInfo = PhFindProcessInformation(processes, ClientId->UniqueProcess);
+    processInfo = PhFindProcessInformation(snapshot->Processes, ClientId->UniqueProcess);
 
     if (ClientId->UniqueThread)
     {
@@ -484,7 +497,7 @@ _Callback_ PPH_STRING PhStdGetClientIdName(
         }
     }
 
-    PhReleaseQueuedLockShared(&cachedProcessesLock);
+    PhDereferenceObject(snapshot);
 
     return name;
 }
@@ -1031,6 +1044,7 @@ NTSTATUS PhGetHandleInformationEx(
         // if the handle is in the current process.
         if (ProcessHandle != NtCurrentProcess())
         {
+            // Keep the granted access so it can be queried below.
             status = NtDuplicateObject(
                 ProcessHandle,
                 Handle,
@@ -1038,7 +1052,7 @@ NTSTATUS PhGetHandleInformationEx(
                 &dupHandle,
                 0,
                 0,
-                0
+                DUPLICATE_SAME_ACCESS
                 );
 
             if (!NT_SUCCESS(status))
@@ -1107,15 +1121,36 @@ NTSTATUS PhGetHandleInformationEx(
         }
         else if (hackLevel == 1)
         {
+            OBJECT_BASIC_INFORMATION basicInfo;
             POBJECT_NAME_INFORMATION buffer;
 
+            // Name queries which hang are remembered by object type and
+            // granted access, so we need the access of the handle.
+            if (BasicInformation)
+            {
+                basicInfo.GrantedAccess = BasicInformation->GrantedAccess;
+            }
+            else if (!NT_SUCCESS(NtQueryObject(
+                dupHandle,
+                ObjectBasicInformation,
+                &basicInfo,
+                sizeof(OBJECT_BASIC_INFORMATION),
+                NULL
+                )))
+            {
+                basicInfo.GrantedAccess = 0;
+            }
+
             buffer = PhAllocate(0x800);
 
-            status = PhQueryObjectNameHack(
+            status = PhQueryObjectNameHackEx(
                 dupHandle,
+                ObjectTypeNumber,
+                basicInfo.GrantedAccess,
                 buffer,
                 0x800,
-                NULL
+                NULL,
+                PH_QUERY_OBJECT_DEFAULT_TIMEOUT
                 );
 
             if (NT_SUCCESS(status))
@@ -1206,111 +1241,844 @@ CleanupExit:
     return status;
 }
 
-BOOLEAN PhpHeadQueryObjectHack(
-    VOID
+BOOLEAN NTAPI PhpHandleNameCacheCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    PPH_HANDLE_NAME_CACHE_ENTRY entry1 = Entry1;
+    PPH_HANDLE_NAME_CACHE_ENTRY entry2 = Entry2;
+
+    return entry1->Object == entry2->Object && entry1->ObjectTypeNumber == entry2->ObjectTypeNumber;
+}
+
+ULONG NTAPI PhpHandleNameCacheHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    PPH_HANDLE_NAME_CACHE_ENTRY entry = Entry;
+
+#ifdef _M_IX86
+    return PhHashInt32((ULONG)entry->Object) ^ entry->ObjectTypeNumber;
+#else
+    return PhHashInt64((ULONG64)entry->Object) ^ entry->ObjectTypeNumber;
+#endif
+}
+
+VOID PhpClearHandleNameCacheEntry(
+    _Inout_ PPH_HANDLE_NAME_CACHE_ENTRY Entry
+    )
+{
+    if (Entry->TypeName)
+        PhDereferenceObject(Entry->TypeName);
+    if (Entry->ObjectName)
+        PhDereferenceObject(Entry->ObjectName);
+    if (Entry->BestObjectName)
+        PhDereferenceObject(Entry->BestObjectName);
+}
+
+/**
+ * Removes entries which were created before the specified generation.
+ *
+ * \remarks The cache lock must be held exclusively.
+ */
+VOID PhpTrimHandleNameCache(
+    _In_ ULONG MinimumGeneration
     )
 {
-    PhAcquireQueuedLockExclusive(&PhQueryObjectMutex);
+    PH_HASHTABLE_ENUM_CONTEXT enumContext;
+    PPH_HANDLE_NAME_CACHE_ENTRY entry;
+    PPH_LIST staleEntries = NULL;
+    ULONG i;
 
-    // Create a query thread if we don't have one.
-    if (!PhQueryObjectThreadHandle)
+    PhBeginEnumHashtable(PhHandleNameCacheHashtable, &enumContext);
+
+    while (entry = PhNextEnumHashtable(&enumContext))
     {
-        PhQueryObjectThreadHandle = CreateThread(NULL, 0, PhpQueryObjectThreadStart, NULL, 0, NULL);
+        if ((LONG)(entry->Generation - MinimumGeneration) < 0)
+        {
+            if (!staleEntries)
+                staleEntries = PhCreateList(64);
+
+            PhAddItemList(staleEntries, entry);
+        }
+    }
 
-        if (!PhQueryObjectThreadHandle)
+    if (staleEntries)
+    {
+        for (i = 0; i < staleEntries->Count; i++)
         {
-            PhReleaseQueuedLockExclusive(&PhQueryObjectMutex);
-            return FALSE;
+            PH_HANDLE_NAME_CACHE_ENTRY lookupEntry;
+
+            entry = staleEntries->Items[i];
+            lookupEntry.Object = entry->Object;
+            lookupEntry.ObjectTypeNumber = entry->ObjectTypeNumber;
+
+            PhpClearHandleNameCacheEntry(entry);
+            PhRemoveEntryHashtable(PhHandleNameCacheHashtable, &lookupEntry);
         }
+
+        PhDereferenceObject(staleEntries);
     }
+}
 
-    // Create the events if they don't exist.
+/**
+ * Gets the current cache generation, removing expired entries if a new
+ * generation has started.
+ */
+ULONG PhpGetHandleNameCacheGeneration(
+    VOID
+    )
+{
+    ULONG generation;
 
-    if (!PhQueryObjectStartEvent)
+    generation = PhHandleNameCacheFlushCount + NtGetTickCount() / PH_HANDLE_NAME_CACHE_GENERATION_INTERVAL;
+
+    if (generation != PhHandleNameCacheGeneration)
     {
-        if (!NT_SUCCESS(NtCreateEvent(
-            &PhQueryObjectStartEvent,
-            EVENT_ALL_ACCESS,
-            NULL,
-            SynchronizationEvent,
-            FALSE
-            )))
+        PhAcquireQueuedLockExclusive(&PhHandleNameCacheLock);
+
+        if (generation != PhHandleNameCacheGeneration)
         {
-            PhReleaseQueuedLockExclusive(&PhQueryObjectMutex);
-            return FALSE;
+            PhHandleNameCacheGeneration = generation;
+
+            if (PhHandleNameCacheHashtable)
+                PhpTrimHandleNameCache(generation - PH_HANDLE_NAME_CACHE_MAXIMUM_AGE + 1);
         }
+
+        PhReleaseQueuedLockExclusive(&PhHandleNameCacheLock);
+    }
+
+    return generation;
+}
+
+/**
+ * Stores names of a handle in the cache. Names which are already cached
+ * for the object are kept.
+ *
+ * \remarks The cache lock must be held exclusively.
+ */
+VOID PhpAddHandleNameCacheEntry(
+    _In_ PPH_HANDLE_NAME_CACHE_ENTRY LookupEntry,
+    _In_ ULONG Generation,
+    _In_opt_ PPH_STRING TypeName,
+    _In_opt_ PPH_STRING ObjectName,
+    _In_opt_ PPH_STRING BestObjectName
+    )
+{
+    PPH_HANDLE_NAME_CACHE_ENTRY entry;
+
+    if (!PhHandleNameCacheHashtable)
+    {
+        PhHandleNameCacheHashtable = PhCreateHashtable(
+            sizeof(PH_HANDLE_NAME_CACHE_ENTRY),
+            PhpHandleNameCacheCompareFunction,
+            PhpHandleNameCacheHashFunction,
+            256
+            );
     }
 
-    if (!PhQueryObjectCompletedEvent)
+    entry = PhFindEntryHashtable(PhHandleNameCacheHashtable, LookupEntry);
+
+    if (entry)
     {
-        if (!NT_SUCCESS(NtCreateEvent(
-            &PhQueryObjectCompletedEvent,
-            EVENT_ALL_ACCESS,
-            NULL,
-            SynchronizationEvent,
-            FALSE
-            )))
+        if ((LONG)(Generation - entry->Generation) >= PH_HANDLE_NAME_CACHE_MAXIMUM_AGE)
         {
-            PhReleaseQueuedLockExclusive(&PhQueryObjectMutex);
-            return FALSE;
+            // Replace the expired entry.
+            PhpClearHandleNameCacheEntry(entry);
+            entry->Generation = Generation;
+            entry->TypeName = NULL;
+            entry->ObjectName = NULL;
+            entry->BestObjectName = NULL;
         }
     }
+    else if (PhHandleNameCacheHashtable->Count < PH_HANDLE_NAME_CACHE_MAXIMUM_ENTRIES)
+    {
+        entry = PhAddEntryHashtableEx(PhHandleNameCacheHashtable, LookupEntry, NULL);
+        entry->Generation = Generation;
+        entry->TypeName = NULL;
+        entry->ObjectName = NULL;
+        entry->BestObjectName = NULL;
+    }
 
-    return TRUE;
+    if (!entry)
+        return;
+
+    if (TypeName && !entry->TypeName)
+    {
+        entry->TypeName = TypeName;
+        PhReferenceObject(TypeName);
+    }
+
+    if (ObjectName && !entry->ObjectName)
+    {
+        entry->ObjectName = ObjectName;
+        PhReferenceObject(ObjectName);
+    }
+
+    if (BestObjectName && !entry->BestObjectName)
+    {
+        entry->BestObjectName = BestObjectName;
+        PhReferenceObject(BestObjectName);
+    }
 }
 
-NTSTATUS PhpTailQueryObjectHack(
-    _Out_opt_ PULONG ReturnLength
+/**
+ * Gets the names of a handle, using a cache shared by all callers
+ * in the process.
+ *
+ * \param ProcessHandle A handle to the process in which the
+ * handle resides.
+ * \param Handle The handle value.
+ * \param ObjectTypeNumber The object type number of the handle.
+ * You can specify -1 for this parameter if the object type number
+ * is not known.
+ * \param Object The address of the object, as returned by
+ * PhEnumHandles(). If NULL, the cache is not used.
+ * \param SubStatus A variable which receives the NTSTATUS value of
+ * the last component that fails.
+ * \param TypeName A variable which receives the object type name.
+ * \param ObjectName A variable which receives the object name.
+ * \param BestObjectName A variable which receives the formatted
+ * object name.
+ *
+ * \remarks Names are cached by object address and type number. Since
+ * object addresses can be reused, entries expire after a few seconds
+ * whether or not they are used. Only the requested names are queried,
+ * and each name is cached separately once it has been queried
+ * successfully.
+ */
+NTSTATUS PhGetHandleInformationCached(
+    _In_ HANDLE ProcessHandle,
+    _In_ HANDLE Handle,
+    _In_ ULONG ObjectTypeNumber,
+    _In_opt_ PVOID Object,
+    _Out_opt_ PNTSTATUS SubStatus,
+    _Out_opt_ PPH_STRING *TypeName,
+    _Out_opt_ PPH_STRING *ObjectName,
+    _Out_opt_ PPH_STRING *BestObjectName
     )
 {
     NTSTATUS status;
-    LARGE_INTEGER timeout;
+    NTSTATUS subStatus;
+    ULONG generation;
+    PH_HANDLE_NAME_CACHE_ENTRY lookupEntry;
+    PPH_HANDLE_NAME_CACHE_ENTRY entry;
+    PPH_STRING typeName = NULL;
+    PPH_STRING objectName = NULL;
+    PPH_STRING bestObjectName = NULL;
 
-    PhQueryObjectContext.Initialized = TRUE;
+    if (!Object)
+    {
+        return PhGetHandleInformationEx(ProcessHandle, Handle, ObjectTypeNumber, 0, SubStatus,
+            NULL, TypeName, ObjectName, BestObjectName, NULL);
+    }
 
-    // Allow the worker thread to start.
-    NtSetEvent(PhQueryObjectStartEvent, NULL);
-    // Wait for the work to complete, with a timeout of 1 second.
-    timeout.QuadPart = -1000 * PH_TIMEOUT_MS;
-    status = NtWaitForSingleObject(PhQueryObjectCompletedEvent, FALSE, &timeout);
+    generation = PhpGetHandleNameCacheGeneration();
+    lookupEntry.Object = Object;
+    lookupEntry.ObjectTypeNumber = ObjectTypeNumber;
 
-    PhQueryObjectContext.Initialized = FALSE;
+    PhAcquireQueuedLockShared(&PhHandleNameCacheLock);
 
-    // Return normally if the work was completed.
-    if (status == STATUS_WAIT_0)
+    if (PhHandleNameCacheHashtable)
+        entry = PhFindEntryHashtable(PhHandleNameCacheHashtable, &lookupEntry);
+    else
+        entry = NULL;
+
+    if (
+        entry && (LONG)(generation - entry->Generation) < PH_HANDLE_NAME_CACHE_MAXIMUM_AGE &&
+        (!TypeName || entry->TypeName) &&
+        (!ObjectName || entry->ObjectName) &&
+        (!BestObjectName || entry->BestObjectName)
+        )
     {
-        ULONG returnLength;
+        if (TypeName)
+        {
+            *TypeName = entry->TypeName;
+            PhReferenceObject(entry->TypeName);
+        }
+
+        if (ObjectName)
+        {
+            *ObjectName = entry->ObjectName;
+            PhReferenceObject(entry->ObjectName);
+        }
+
+        if (BestObjectName)
+        {
+            *BestObjectName = entry->BestObjectName;
+            PhReferenceObject(entry->BestObjectName);
+        }
 
-        status = PhQueryObjectContext.Status;
-        returnLength = PhQueryObjectContext.ReturnLength;
+        PhReleaseQueuedLockShared(&PhHandleNameCacheLock);
 
-        PhReleaseQueuedLockExclusive(&PhQueryObjectMutex);
+        _InterlockedIncrement(&PhHandleNameCacheHits);
 
-        if (ReturnLength)
-            *ReturnLength = returnLength;
+        if (SubStatus)
+            *SubStatus = STATUS_SUCCESS;
+
+        return STATUS_SUCCESS;
+    }
 
+    PhReleaseQueuedLockShared(&PhHandleNameCacheLock);
+
+    _InterlockedIncrement(&PhHandleNameCacheMisses);
+
+    // The type name is always queried before the object name, and the object
+    // name before the best object name, so those are kept as well.
+    status = PhGetHandleInformationEx(
+        ProcessHandle,
+        Handle,
+        ObjectTypeNumber,
+        0,
+        &subStatus,
+        NULL,
+        &typeName,
+        (ObjectName || BestObjectName) ? &objectName : NULL,
+        BestObjectName ? &bestObjectName : NULL,
+        NULL
+        );
+
+    if (!NT_SUCCESS(status))
         return status;
+
+    if (typeName)
+    {
+        PhAcquireQueuedLockExclusive(&PhHandleNameCacheLock);
+        PhpAddHandleNameCacheEntry(&lookupEntry, generation, typeName, objectName, bestObjectName);
+        PhReleaseQueuedLockExclusive(&PhHandleNameCacheLock);
     }
-    // Kill the worker thread if it took too long.
-    // else if (status == STATUS_TIMEOUT)
-    else
+
+    if (SubStatus)
+        *SubStatus = subStatus;
+
+    if (TypeName)
+        *TypeName = typeName;
+    else if (typeName)
+        PhDereferenceObject(typeName);
+
+    if (ObjectName)
+        *ObjectName = objectName;
+    else if (objectName)
+        PhDereferenceObject(objectName);
+
+    if (BestObjectName)
+        *BestObjectName = bestObjectName;
+    else if (bestObjectName)
+        PhDereferenceObject(bestObjectName);
+
+    return status;
+}
+
+/**
+ * Removes all entries from the handle name cache.
+ */
+VOID PhFlushHandleNameCache(
+    VOID
+    )
+{
+    // Start a new generation which no existing entry belongs to.
+    _InterlockedExchangeAdd((PLONG)&PhHandleNameCacheFlushCount, PH_HANDLE_NAME_CACHE_MAXIMUM_AGE);
+    PhpGetHandleNameCacheGeneration();
+}
+
+/**
+ * Gets statistics for the handle name cache.
+ *
+ * \param Statistics A variable which receives the statistics.
+ */
+VOID PhGetHandleNameCacheStatistics(
+    _Out_ PPH_HANDLE_NAME_CACHE_STATISTICS Statistics
+    )
+{
+    PhAcquireQueuedLockShared(&PhHandleNameCacheLock);
+    Statistics->Hits = PhHandleNameCacheHits;
+    Statistics->Misses = PhHandleNameCacheMisses;
+    Statistics->Count = PhHandleNameCacheHashtable ? PhHandleNameCacheHashtable->Count : 0;
+    Statistics->Generation = PhHandleNameCacheGeneration;
+    PhReleaseQueuedLockShared(&PhHandleNameCacheLock);
+}
+
+BOOLEAN PhpIsQueryObjectBlacklisted(
+    _In_ ULONG ObjectTypeNumber,
+    _In_ ACCESS_MASK GrantedAccess
+    )
+{
+    BOOLEAN found = FALSE;
+    ULONG64 tickCount;
+    ULONG i;
+
+    tickCount = NtGetTickCount64();
+
+    PhAcquireQueuedLockShared(&PhQueryObjectBlacklistLock);
+
+    for (i = 0; i < PhQueryObjectBlacklistCount; i++)
     {
-        // Kill the thread.
-        if (NT_SUCCESS(NtTerminateThread(PhQueryObjectThreadHandle, STATUS_TIMEOUT)))
+        if (PhQueryObjectBlacklist[i].ObjectTypeNumber == ObjectTypeNumber &&
+            PhQueryObjectBlacklist[i].GrantedAccess == GrantedAccess &&
+            tickCount - PhQueryObjectBlacklist[i].TickCount < PH_QUERY_OBJECT_BLACKLIST_LIFETIME)
         {
-            PhQueryObjectThreadHandle = NULL;
+            found = TRUE;
+            break;
+        }
+    }
+
+    PhReleaseQueuedLockShared(&PhQueryObjectBlacklistLock);
+
+    return found;
+}
 
-            // Delete the fiber (and free the thread stack).
-            DeleteFiber(PhQueryObjectFiber);
-            PhQueryObjectFiber = NULL;
+VOID PhpAddQueryObjectBlacklist(
+    _In_ ULONG ObjectTypeNumber,
+    _In_ ACCESS_MASK GrantedAccess
+    )
+{
+    ULONG64 tickCount;
+    ULONG index;
+    ULONG i;
+
+    tickCount = NtGetTickCount64();
+
+    PhAcquireQueuedLockExclusive(&PhQueryObjectBlacklistLock);
+
+    // Entries expire, since a hang is often caused by a single object (e.g. a
+    // pipe with a pending synchronous read) rather than by every object with
+    // the same type and access. An existing entry for the same combination is
+    // refreshed; otherwise the oldest entry is replaced once the list is full.
+    index = PhQueryObjectBlacklistCount;
+
+    for (i = 0; i < PhQueryObjectBlacklistCount; i++)
+    {
+        if (PhQueryObjectBlacklist[i].ObjectTypeNumber == ObjectTypeNumber &&
+            PhQueryObjectBlacklist[i].GrantedAccess == GrantedAccess)
+        {
+            index = i;
+            break;
         }
+    }
 
-        PhReleaseQueuedLockExclusive(&PhQueryObjectMutex);
+    if (index == PH_QUERY_OBJECT_MAXIMUM_BLACKLIST)
+    {
+        index = 0;
 
-        return STATUS_UNSUCCESSFUL;
+        for (i = 1; i < PhQueryObjectBlacklistCount; i++)
+        {
+            if (PhQueryObjectBlacklist[i].TickCount < PhQueryObjectBlacklist[index].TickCount)
+                index = i;
+        }
+    }
+
+    PhQueryObjectBlacklist[index].ObjectTypeNumber = ObjectTypeNumber;
+    PhQueryObjectBlacklist[index].GrantedAccess = GrantedAccess;
+    PhQueryObjectBlacklist[index].TickCount = tickCount;
+
+    if (index == PhQueryObjectBlacklistCount)
+        PhQueryObjectBlacklistCount++;
+
+    PhReleaseQueuedLockExclusive(&PhQueryObjectBlacklistLock);
+}
+
+PPH_QUERY_OBJECT_WORKER PhpCreateQueryObjectWorker(
+    VOID
+    )
+{
+    PPH_QUERY_OBJECT_WORKER worker;
+
+    worker = PhAllocate(sizeof(PH_QUERY_OBJECT_WORKER));
+    memset(worker, 0, sizeof(PH_QUERY_OBJECT_WORKER));
+
+    if (!NT_SUCCESS(NtCreateEvent(&worker->StartEvent, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+        goto ErrorExit;
+    if (!NT_SUCCESS(NtCreateEvent(&worker->CompletedEvent, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE)))
+        goto ErrorExit;
+
+    worker->ThreadHandle = CreateThread(NULL, 0, PhpQueryObjectThreadStart, worker, 0, NULL);
+
+    if (!worker->ThreadHandle)
+        goto ErrorExit;
+
+    return worker;
+
+ErrorExit:
+    if (worker->StartEvent)
+        NtClose(worker->StartEvent);
+    if (worker->CompletedEvent)
+        NtClose(worker->CompletedEvent);
+
+    PhFree(worker);
+
+    return NULL;
+}
+
+VOID PhpDestroyQueryObjectWorker(
+    _In_ PPH_QUERY_OBJECT_WORKER Worker
+    )
+{
+    // Delete the fiber (and free the thread stack).
+    if (Worker->Fiber)
+        DeleteFiber(Worker->Fiber);
+
+    NtClose(Worker->ThreadHandle);
+    NtClose(Worker->StartEvent);
+    NtClose(Worker->CompletedEvent);
+
+    if (Worker->Buffer)
+        PhFree(Worker->Buffer);
+
+    PhFree(Worker);
+}
+
+/**
+ * Frees abandoned workers whose threads have since exited.
+ *
+ * emarks The pool lock must be held exclusively.
+ */
+VOID PhpReapAbandonedQueryObjectWorkers(
+    VOID
+    )
+{
+    ULONG i;
+    LARGE_INTEGER timeout;
+
+    for (i = 0; i < PhQueryObjectNumberOfAbandonedWorkers; )
+    {
+        PPH_QUERY_OBJECT_WORKER worker = PhQueryObjectAbandonedWorkers[i];
+
+        timeout.QuadPart = 0;
+
+        if (NtWaitForSingleObject(worker->ThreadHandle, FALSE, &timeout) == STATUS_WAIT_0)
+        {
+            PhpDestroyQueryObjectWorker(worker);
+            PhQueryObjectAbandonedWorkers[i] = PhQueryObjectAbandonedWorkers[--PhQueryObjectNumberOfAbandonedWorkers];
+            PhQueryObjectNumberOfWorkers--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/**
+ * Takes an idle query worker from the pool, creating one if necessary.
+ * If the pool is at its maximum size, the function waits until a worker
+ * becomes available.
+ *
+ * eturn A worker, or NULL if a worker could not be created or every
+ * worker in the pool is hung.
+ */
+PPH_QUERY_OBJECT_WORKER PhpAcquireQueryObjectWorker(
+    VOID
+    )
+{
+    PPH_QUERY_OBJECT_WORKER worker = NULL;
+
+    PhAcquireQueuedLockExclusive(&PhQueryObjectPoolLock);
+
+    while (TRUE)
+    {
+        // Abandoned workers still count towards the maximum until their
+        // threads have actually exited.
+        PhpReapAbandonedQueryObjectWorkers();
+
+        if (
+            PhQueryObjectNumberOfIdleWorkers != 0 ||
+            PhQueryObjectNumberOfWorkers < PH_QUERY_OBJECT_MAXIMUM_WORKERS
+            )
+            break;
+
+        if (PhQueryObjectNumberOfAbandonedWorkers == PH_QUERY_OBJECT_MAXIMUM_WORKERS)
+        {
+            PhReleaseQueuedLockExclusive(&PhQueryObjectPoolLock);
+            return NULL;
+        }
+
+        PhWaitForCondition(&PhQueryObjectPoolCondition, &PhQueryObjectPoolLock, NULL);
+    }
+
+    if (PhQueryObjectNumberOfIdleWorkers != 0)
+    {
+        worker = PhQueryObjectIdleWorkers[--PhQueryObjectNumberOfIdleWorkers];
+    }
+    else
+    {
+        worker = PhpCreateQueryObjectWorker();
+
+        if (worker)
+            PhQueryObjectNumberOfWorkers++;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhQueryObjectPoolLock);
+
+    return worker;
+}
+
+VOID PhpReleaseQueryObjectWorker(
+    _In_ PPH_QUERY_OBJECT_WORKER Worker
+    )
+{
+    PhAcquireQueuedLockExclusive(&PhQueryObjectPoolLock);
+    PhQueryObjectIdleWorkers[PhQueryObjectNumberOfIdleWorkers++] = Worker;
+    PhReleaseQueuedLockExclusive(&PhQueryObjectPoolLock);
+
+    PhPulseCondition(&PhQueryObjectPoolCondition);
+}
+
+/**
+ * Removes a hung query worker from the pool and terminates it.
+ *
+ * \remarks If the thread does not exit in time, the worker is kept (and
+ * counted against the maximum number of workers) until it does.
+ */
+VOID PhpAbandonQueryObjectWorker(
+    _In_ PPH_QUERY_OBJECT_WORKER Worker
+    )
+{
+    BOOLEAN terminated = FALSE;
+    LARGE_INTEGER timeout;
+
+    if (NT_SUCCESS(NtTerminateThread(Worker->ThreadHandle, STATUS_TIMEOUT)))
+    {
+        // Termination of a thread blocked in the kernel may itself never
+        // complete, so the wait is bounded.
+        terminated = NtWaitForSingleObject(
+            Worker->ThreadHandle,
+            FALSE,
+            PhTimeoutFromMilliseconds(&timeout, PH_QUERY_OBJECT_TERMINATE_TIMEOUT)
+            ) == STATUS_WAIT_0;
+    }
+
+    PhAcquireQueuedLockExclusive(&PhQueryObjectPoolLock);
+
+    if (terminated)
+    {
+        PhpDestroyQueryObjectWorker(Worker);
+        PhQueryObjectNumberOfWorkers--;
+    }
+    else
+    {
+        // The thread may still write to the worker and its buffer.
+        PhQueryObjectAbandonedWorkers[PhQueryObjectNumberOfAbandonedWorkers++] = Worker;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhQueryObjectPoolLock);
+
+    PhPulseCondition(&PhQueryObjectPoolCondition);
+}
+
+/**
+ * Makes sure the buffer owned by a worker is at least the specified size.
+ * The worker must be idle.
+ */
+BOOLEAN PhpReserveQueryObjectWorkerBuffer(
+    _Inout_ PPH_QUERY_OBJECT_WORKER Worker,
+    _In_ ULONG Size
+    )
+{
+    if (Worker->BufferSize < Size)
+    {
+        PVOID buffer;
+
+        if (!(buffer = PhAllocateSafe(Size)))
+            return FALSE;
+
+        if (Worker->Buffer)
+            PhFree(Worker->Buffer);
+
+        Worker->Buffer = buffer;
+        Worker->BufferSize = Size;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Copies the input of a request into the buffer owned by a worker.
+ */
+NTSTATUS PhpPrepareQueryObjectWorker(
+    _Inout_ PPH_QUERY_OBJECT_WORKER Worker,
+    _In_ PPH_QUERY_OBJECT_CONTEXT Context
+    )
+{
+    NTSTATUS status;
+    ULONG length;
+
+    Worker->Context = *Context;
+
+    if (Context->Work == SetSecurityHack)
+    {
+        // The security descriptor may be absolute, in which case it only
+        // contains pointers to the caller's memory.
+        length = 0;
+        RtlMakeSelfRelativeSD(Context->Buffer, NULL, &length);
+
+        if (length == 0)
+            return STATUS_INVALID_SECURITY_DESCR;
+    }
+    else
+    {
+        length = Context->Length;
+    }
+
+    if (!PhpReserveQueryObjectWorkerBuffer(Worker, max(length, 1)))
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (Context->Work == SetSecurityHack)
+    {
+        if (!NT_SUCCESS(status = RtlMakeSelfRelativeSD(Context->Buffer, Worker->Buffer, &length)))
+            return status;
+    }
+
+    Worker->Context.Buffer = Worker->Buffer;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Copies the output of a completed request from the buffer owned by a
+ * worker.
+ */
+VOID PhpCompleteQueryObjectWorker(
+    _In_ PPH_QUERY_OBJECT_WORKER Worker,
+    _Inout_ PPH_QUERY_OBJECT_CONTEXT Context
+    )
+{
+    Context->Status = Worker->Context.Status;
+    Context->ReturnLength = Worker->Context.ReturnLength;
+
+    if (Context->Work == SetSecurityHack || Context->Length == 0)
+        return;
+
+    memcpy(Context->Buffer, Worker->Buffer, Context->Length);
+
+    // The name buffer points into the worker's buffer.
+    if (
+        Context->Work == QueryNameHack &&
+        NT_SUCCESS(Context->Status) &&
+        Context->Length >= sizeof(OBJECT_NAME_INFORMATION)
+        )
+    {
+        POBJECT_NAME_INFORMATION nameInfo = Context->Buffer;
+
+        if (nameInfo->Name.Buffer)
+        {
+            nameInfo->Name.Buffer = (PWSTR)PTR_ADD_OFFSET(
+                Context->Buffer,
+                (ULONG_PTR)nameInfo->Name.Buffer - (ULONG_PTR)Worker->Buffer
+                );
+        }
     }
 }
 
+/**
+ * Performs an object query on a pool worker, terminating the worker if the
+ * query does not complete in time.
+ *
+ * \param Context The query to perform. On return, the \a Status and
+ * \a ReturnLength fields contain the results.
+ * \param Timeout The timeout, in milliseconds.
+ *
+ * \return TRUE if the query completed, otherwise FALSE.
+ */
+BOOLEAN PhpExecuteQueryObjectHack(
+    _Inout_ PPH_QUERY_OBJECT_CONTEXT Context,
+    _In_ ULONG Timeout
+    )
+{
+    NTSTATUS status;
+    PPH_QUERY_OBJECT_WORKER worker;
+    LARGE_INTEGER timeout;
+
+    worker = PhpAcquireQueryObjectWorker();
+
+    if (!worker)
+    {
+        Context->Status = STATUS_INSUFFICIENT_RESOURCES;
+        return TRUE;
+    }
+
+    if (!NT_SUCCESS(status = PhpPrepareQueryObjectWorker(worker, Context)))
+    {
+        PhpReleaseQueryObjectWorker(worker);
+        Context->Status = status;
+        return TRUE;
+    }
+
+    // Allow the worker thread to start.
+    NtSetEvent(worker->StartEvent, NULL);
+
+    // Wait for the work to complete.
+    if (NtWaitForSingleObject(
+        worker->CompletedEvent,
+        FALSE,
+        PhTimeoutFromMilliseconds(&timeout, Timeout)
+        ) == STATUS_WAIT_0)
+    {
+        PhpCompleteQueryObjectWorker(worker, Context);
+        PhpReleaseQueryObjectWorker(worker);
+
+        return TRUE;
+    }
+    else
+    {
+        PhpAbandonQueryObjectWorker(worker);
+
+        return FALSE;
+    }
+}
+
+/**
+ * Queries the name of an object, guarding against hangs.
+ *
+ * \param Handle A handle to the object.
+ * \param ObjectTypeNumber The object type number of the handle, or -1 if it
+ * is not known.
+ * \param GrantedAccess The access granted by the handle.
+ * \param ObjectNameInformation The buffer which receives the name.
+ * \param ObjectNameInformationLength The size of the buffer, in bytes.
+ * \param ReturnLength A variable which receives the number of bytes required.
+ * \param Timeout The time to wait for the query, in milliseconds.
+ *
+ * \retval STATUS_IO_TIMEOUT The query did not complete in time, or handles
+ * with the same object type and granted access are known to hang.
+ *
+ * \remarks The query is performed on a worker thread which is terminated if
+ * it does not complete within the timeout. Queries from different threads
+ * run in parallel on separate workers.
+ */
+NTSTATUS PhQueryObjectNameHackEx(
+    _In_ HANDLE Handle,
+    _In_ ULONG ObjectTypeNumber,
+    _In_ ACCESS_MASK GrantedAccess,
+    _Out_writes_bytes_(ObjectNameInformationLength) POBJECT_NAME_INFORMATION ObjectNameInformation,
+    _In_ ULONG ObjectNameInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _In_ ULONG Timeout
+    )
+{
+    PH_QUERY_OBJECT_CONTEXT context;
+
+    if (PhpIsQueryObjectBlacklisted(ObjectTypeNumber, GrantedAccess))
+        return STATUS_IO_TIMEOUT;
+
+    context.Work = QueryNameHack;
+    context.Handle = Handle;
+    context.Buffer = ObjectNameInformation;
+    context.Length = ObjectNameInformationLength;
+    context.ReturnLength = 0;
+
+    if (!PhpExecuteQueryObjectHack(&context, Timeout))
+    {
+        PhpAddQueryObjectBlacklist(ObjectTypeNumber, GrantedAccess);
+        return STATUS_IO_TIMEOUT;
+    }
+
+    if (ReturnLength)
+        *ReturnLength = context.ReturnLength;
+
+    return context.Status;
+}
+
 NTSTATUS PhQueryObjectNameHack(
     _In_ HANDLE Handle,
     _Out_writes_bytes_(ObjectNameInformationLength) POBJECT_NAME_INFORMATION ObjectNameInformation,
@@ -1318,15 +2086,21 @@ NTSTATUS PhQueryObjectNameHack(
     _Out_opt_ PULONG ReturnLength
     )
 {
-    if (!PhpHeadQueryObjectHack())
+    PH_QUERY_OBJECT_CONTEXT context;
+
+    context.Work = QueryNameHack;
+    context.Handle = Handle;
+    context.Buffer = ObjectNameInformation;
+    context.Length = ObjectNameInformationLength;
+    context.ReturnLength = 0;
+
+    if (!PhpExecuteQueryObjectHack(&context, PH_QUERY_OBJECT_DEFAULT_TIMEOUT))
         return STATUS_UNSUCCESSFUL;
 
-    PhQueryObjectContext.Work = QueryNameHack;
-    PhQueryObjectContext.Handle = Handle;
-    PhQueryObjectContext.Buffer = ObjectNameInformation;
-    PhQueryObjectContext.Length = ObjectNameInformationLength;
+    if (ReturnLength)
+        *ReturnLength = context.ReturnLength;
 
-    return PhpTailQueryObjectHack(ReturnLength);
+    return context.Status;
 }
 
 NTSTATUS PhQueryObjectSecurityHack(
@@ -1337,16 +2111,22 @@ NTSTATUS PhQueryObjectSecurityHack(
     _Out_opt_ PULONG ReturnLength
     )
 {
-    if (!PhpHeadQueryObjectHack())
+    PH_QUERY_OBJECT_CONTEXT context;
+
+    context.Work = QuerySecurityHack;
+    context.Handle = Handle;
+    context.SecurityInformation = SecurityInformation;
+    context.Buffer = Buffer;
+    context.Length = Length;
+    context.ReturnLength = 0;
+
+    if (!PhpExecuteQueryObjectHack(&context, PH_QUERY_OBJECT_DEFAULT_TIMEOUT))
         return STATUS_UNSUCCESSFUL;
 
-    PhQueryObjectContext.Work = QuerySecurityHack;
-    PhQueryObjectContext.Handle = Handle;
-    PhQueryObjectContext.SecurityInformation = SecurityInformation;
-    PhQueryObjectContext.Buffer = Buffer;
-    PhQueryObjectContext.Length = Length;
+    if (ReturnLength)
+        *ReturnLength = context.ReturnLength;
 
-    return PhpTailQueryObjectHack(ReturnLength);
+    return context.Status;
 }
 
 NTSTATUS PhSetObjectSecurityHack(
@@ -1355,64 +2135,65 @@ NTSTATUS PhSetObjectSecurityHack(
     _In_ PVOID Buffer
     )
 {
-    if (!PhpHeadQueryObjectHack())
-        return STATUS_UNSUCCESSFUL;
+    PH_QUERY_OBJECT_CONTEXT context;
+
+    context.Work = SetSecurityHack;
+    context.Handle = Handle;
+    context.SecurityInformation = SecurityInformation;
+    context.Buffer = Buffer;
 
-    PhQueryObjectContext.Work = SetSecurityHack;
-    PhQueryObjectContext.Handle = Handle;
-    PhQueryObjectContext.SecurityInformation = SecurityInformation;
-    PhQueryObjectContext.Buffer = Buffer;
+    if (!PhpExecuteQueryObjectHack(&context, PH_QUERY_OBJECT_DEFAULT_TIMEOUT))
+        return STATUS_UNSUCCESSFUL;
 
-    return PhpTailQueryObjectHack(NULL);
+    return context.Status;
 }
 
 NTSTATUS PhpQueryObjectThreadStart(
     _In_ PVOID Parameter
     )
 {
-    PhQueryObjectFiber = ConvertThreadToFiber(Parameter);
+    PPH_QUERY_OBJECT_WORKER worker = Parameter;
+    PPH_QUERY_OBJECT_CONTEXT context = &worker->Context;
+
+    worker->Fiber = ConvertThreadToFiber(Parameter);
 
     while (TRUE)
     {
         // Wait for work.
-        if (NtWaitForSingleObject(PhQueryObjectStartEvent, FALSE, NULL) != STATUS_WAIT_0)
+        if (NtWaitForSingleObject(worker->StartEvent, FALSE, NULL) != STATUS_WAIT_0)
             continue;
 
-        // Make sure we actually have work.
-        if (PhQueryObjectContext.Initialized)
+        switch (context->Work)
         {
-            switch (PhQueryObjectContext.Work)
-            {
-            case QueryNameHack:
-                PhQueryObjectContext.Status = NtQueryObject(
-                    PhQueryObjectContext.Handle,
-                    ObjectNameInformation,
-                    PhQueryObjectContext.Buffer,
-                    PhQueryObjectContext.Length,
-                    &PhQueryObjectContext.ReturnLength
-                    );
-                break;
-            case QuerySecurityHack:
-                PhQueryObjectContext.Status = NtQuerySecurityObject(
-                    PhQueryObjectContext.Handle,
-                    PhQueryObjectContext.SecurityInformation,
-                    (PSECURITY_DESCRIPTOR)PhQueryObjectContext.Buffer,
-                    PhQueryObjectContext.Length,
-                    &PhQueryObjectContext.ReturnLength
-                    );
-                break;
-            case SetSecurityHack:
-                PhQueryObjectContext.Status = NtSetSecurityObject(
-                    PhQueryObjectContext.Handle,
-                    PhQueryObjectContext.SecurityInformation,
-                    (PSECURITY_DESCRIPTOR)PhQueryObjectContext.Buffer
-                    );
-                break;
-            }
-
-            // Work done.
-            NtSetEvent(PhQueryObjectCompletedEvent, NULL);
+        case QueryNameHack:
+            context->Status = NtQueryObject(
+                context->Handle,
+                ObjectNameInformation,
+                context->Buffer,
+                context->Length,
+                &context->ReturnLength
+                );
+            break;
+        case QuerySecurityHack:
+            context->Status = NtQuerySecurityObject(
+                context->Handle,
+                context->SecurityInformation,
+                (PSECURITY_DESCRIPTOR)context->Buffer,
+                context->Length,
+                &context->ReturnLength
+                );
+            break;
+        case SetSecurityHack:
+            context->Status = NtSetSecurityObject(
+                context->Handle,
+                context->SecurityInformation,
+                (PSECURITY_DESCRIPTOR)context->Buffer
+                );
+            break;
         }
+
+        // Work done.
+        NtSetEvent(worker->CompletedEvent, NULL);
     }
 
     return STATUS_SUCCESS;
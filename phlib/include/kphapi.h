@@ -112,6 +112,61 @@ typedef struct _ETWREG_BASIC_INFORMATION
     ULONG_PTR SessionId;
 } ETWREG_BASIC_INFORMATION, *PETWREG_BASIC_INFORMATION;
 
+// Batches
+
+typedef enum _KPH_BATCH_OPERATION_TYPE
+{
+    KphBatchQueryInformationProcess = 1,
+    KphBatchQueryInformationThread = 2,
+    KphBatchQueryInformationObject = 3,
+    MaxKphBatchOperationType
+} KPH_BATCH_OPERATION_TYPE;
+
+/**
+ * A single operation in a batch.
+ *
+ * The output of each operation is written to the data area of the batch output
+ * buffer, which begins immediately after the array of KPH_BATCH_RESULT structures
+ * (one for each operation).
+ */
+typedef struct _KPH_BATCH_OPERATION
+{
+    KPH_BATCH_OPERATION_TYPE Type;
+    /** The offset of the output buffer of the operation, relative to the data area. */
+    ULONG DataOffset;
+    /** The length of the output buffer of the operation. */
+    ULONG DataLength;
+    ULONG Reserved;
+    union
+    {
+        struct
+        {
+            HANDLE ProcessHandle;
+            KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass;
+        } QueryInformationProcess;
+        struct
+        {
+            HANDLE ThreadHandle;
+            KPH_THREAD_INFORMATION_CLASS ThreadInformationClass;
+        } QueryInformationThread;
+        struct
+        {
+            HANDLE ProcessHandle;
+            HANDLE Handle;
+            KPH_OBJECT_INFORMATION_CLASS ObjectInformationClass;
+        } QueryInformationObject;
+    } u;
+} KPH_BATCH_OPERATION, *PKPH_BATCH_OPERATION;
+
+typedef struct _KPH_BATCH_RESULT
+{
+    NTSTATUS Status;
+    ULONG ReturnLength;
+} KPH_BATCH_RESULT, *PKPH_BATCH_RESULT;
+
+#define KPH_BATCH_MAXIMUM_OPERATIONS 1024
+#define KPH_BATCH_DATA_ALIGNMENT 8
+
 // Device
 
 #define KPH_DEVICE_SHORT_NAME L"KProcessHacker2"
@@ -172,6 +227,7 @@ typedef struct _KPH_DYN_CONFIGURATION
 
 // General
 #define KPH_GETFEATURES KPH_CTL_CODE(0)
+#define KPH_EXECUTEBATCH KPH_CTL_CODE(1)
 
 // Processes
 #define KPH_OPENPROCESS KPH_CTL_CODE(50)
@@ -337,6 +337,117 @@ KphQueryInformationDriver(
     _Out_opt_ PULONG ReturnLength
     );
 
+// Batches
+
+typedef struct _KPH_BATCH
+{
+    PKPH_BATCH_OPERATION Operations;
+    ULONG Count;
+    ULONG AllocatedCount;
+
+    /** The total length of the data area, including alignment padding. */
+    ULONG DataLength;
+    /** The output buffer from the last execution. */
+    PVOID Output;
+    ULONG AllocatedOutputLength;
+} KPH_BATCH, *PKPH_BATCH;
+
+/**
+ * Executes an encoded batch. This has the same semantics as the KPH_EXECUTEBATCH
+ * request.
+ *
+ * \param Operations An array of operations.
+ * \param OperationsLength The size of the array, in bytes.
+ * \param Output The output buffer.
+ * \param OutputLength The size of the output buffer, in bytes.
+ * \param Context A user-defined value passed to KphExecuteBatchEx().
+ */
+typedef NTSTATUS (NTAPI *PKPH_BATCH_DISPATCH_ROUTINE)(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+KphInitializeBatch(
+    _Out_ PKPH_BATCH Batch
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+KphDeleteBatch(
+    _Inout_ PKPH_BATCH Batch
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+KphClearBatch(
+    _Inout_ PKPH_BATCH Batch
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+KphAddQueryInformationProcessBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass,
+    _In_ ULONG ProcessInformationLength
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+KphAddQueryInformationThreadBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ThreadHandle,
+    _In_ KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
+    _In_ ULONG ThreadInformationLength
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+KphAddQueryInformationObjectBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ HANDLE Handle,
+    _In_ KPH_OBJECT_INFORMATION_CLASS ObjectInformationClass,
+    _In_ ULONG ObjectInformationLength
+    );
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+KphExecuteBatch(
+    _Inout_ PKPH_BATCH Batch
+    );
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+KphExecuteBatchEx(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ PKPH_BATCH_DISPATCH_ROUTINE DispatchRoutine,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+NTSTATUS
+NTAPI
+KphGetResultBatch(
+    _In_ PKPH_BATCH Batch,
+    _In_ ULONG Index,
+    _Out_opt_ PVOID *Buffer,
+    _Out_opt_ PULONG ReturnLength
+    );
+
 // kphdata
 
 NTSTATUS KphInitializeDynamicPackage(
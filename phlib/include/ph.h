@@ -369,6 +369,19 @@ NTSTATUS PhWalkThreadStack(
     _In_opt_ PVOID Context
     );
 
+struct _PH_UNWIND_CACHE;
+
+PHLIBAPI
+NTSTATUS PhWalkThreadStackEx(
+    _In_ HANDLE ThreadHandle,
+    _In_opt_ HANDLE ProcessHandle,
+    _In_opt_ PCLIENT_ID ClientId,
+    _In_ ULONG Flags,
+    _In_ PPH_WALK_THREAD_STACK_CALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _In_opt_ struct _PH_UNWIND_CACHE *UnwindCache
+    );
+
 PHLIBAPI
 NTSTATUS PhGetJobProcessIdList(
     _In_ HANDLE JobHandle,
@@ -655,6 +668,36 @@ NTSTATUS PhEnumProcessesEx(
     _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass
     );
 
+typedef struct _PH_PROCESS_SNAPSHOT
+{
+    PVOID Processes;
+    ULONG BufferSize;
+    LARGE_INTEGER QueryTime;
+} PH_PROCESS_SNAPSHOT, *PPH_PROCESS_SNAPSHOT;
+
+PHLIBAPI extern PPH_OBJECT_TYPE PhProcessSnapshotType;
+
+PHLIBAPI
+NTSTATUS PhCreateProcessSnapshot(
+    _Out_ PPH_PROCESS_SNAPSHOT *Snapshot
+    );
+
+PHLIBAPI
+VOID PhPublishProcessSnapshot(
+    _In_ PPH_PROCESS_SNAPSHOT Snapshot
+    );
+
+PHLIBAPI
+PPH_PROCESS_SNAPSHOT PhReferenceProcessSnapshot(
+    VOID
+    );
+
+PHLIBAPI
+NTSTATUS PhGetProcessSnapshot(
+    _In_ ULONG MaximumAge,
+    _Out_ PPH_PROCESS_SNAPSHOT *Snapshot
+    );
+
 PHLIBAPI
 NTSTATUS PhEnumProcessesForSession(
     _Out_ PVOID *Processes,
@@ -1001,6 +1044,36 @@ NTSTATUS PhGetHandleInformationEx(
     _Reserved_ PVOID *ExtraInformation
     );
 
+typedef struct _PH_HANDLE_NAME_CACHE_STATISTICS
+{
+    ULONG Hits;
+    ULONG Misses;
+    ULONG Count;
+    ULONG Generation;
+} PH_HANDLE_NAME_CACHE_STATISTICS, *PPH_HANDLE_NAME_CACHE_STATISTICS;
+
+PHLIBAPI
+NTSTATUS PhGetHandleInformationCached(
+    _In_ HANDLE ProcessHandle,
+    _In_ HANDLE Handle,
+    _In_ ULONG ObjectTypeNumber,
+    _In_opt_ PVOID Object,
+    _Out_opt_ PNTSTATUS SubStatus,
+    _Out_opt_ PPH_STRING *TypeName,
+    _Out_opt_ PPH_STRING *ObjectName,
+    _Out_opt_ PPH_STRING *BestObjectName
+    );
+
+PHLIBAPI
+VOID PhFlushHandleNameCache(
+    VOID
+    );
+
+PHLIBAPI
+VOID PhGetHandleNameCacheStatistics(
+    _Out_ PPH_HANDLE_NAME_CACHE_STATISTICS Statistics
+    );
+
 NTSTATUS PhQueryObjectNameHack(
     _In_ HANDLE Handle,
     _Out_writes_bytes_(ObjectNameInformationLength) POBJECT_NAME_INFORMATION ObjectNameInformation,
@@ -1008,6 +1081,16 @@ NTSTATUS PhQueryObjectNameHack(
     _Out_opt_ PULONG ReturnLength
     );
 
+NTSTATUS PhQueryObjectNameHackEx(
+    _In_ HANDLE Handle,
+    _In_ ULONG ObjectTypeNumber,
+    _In_ ACCESS_MASK GrantedAccess,
+    _Out_writes_bytes_(ObjectNameInformationLength) POBJECT_NAME_INFORMATION ObjectNameInformation,
+    _In_ ULONG ObjectNameInformationLength,
+    _Out_opt_ PULONG ReturnLength,
+    _In_ ULONG Timeout
+    );
+
 NTSTATUS PhQueryObjectSecurityHack(
     _In_ HANDLE Handle,
     _In_ SECURITY_INFORMATION SecurityInformation,
@@ -1120,6 +1203,21 @@ NTSTATUS PhLoadRemoteMappedImage(
     _Out_ PPH_REMOTE_MAPPED_IMAGE RemoteMappedImage
     );
 
+typedef NTSTATUS (NTAPI *PPH_READ_VIRTUAL_MEMORY_CALLBACK)(
+    _In_ HANDLE ProcessHandle,
+    _In_ PVOID BaseAddress,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize,
+    _Out_opt_ PSIZE_T NumberOfBytesRead
+    );
+
+NTSTATUS PhLoadRemoteMappedImageEx(
+    _In_ HANDLE ProcessHandle,
+    _In_ PVOID ViewBase,
+    _In_ PPH_READ_VIRTUAL_MEMORY_CALLBACK ReadVirtualMemoryCallback,
+    _Out_ PPH_REMOTE_MAPPED_IMAGE RemoteMappedImage
+    );
+
 NTSTATUS PhUnloadRemoteMappedImage(
     _Inout_ PPH_REMOTE_MAPPED_IMAGE RemoteMappedImage
     );
@@ -1620,6 +1718,10 @@ typedef VOID (NTAPI *PPH_PROVIDER_FUNCTION)(
     _In_ PVOID Object
     );
 
+typedef ULONG64 (NTAPI *PPH_PROVIDER_CLOCK_FUNCTION)(
+    VOID
+    );
+
 struct _PH_PROVIDER_THREAD;
 typedef struct _PH_PROVIDER_THREAD *PPH_PROVIDER_THREAD;
 
@@ -1633,6 +1735,15 @@ typedef struct _PH_PROVIDER_REGISTRATION
     BOOLEAN Enabled;
     BOOLEAN Unregistering;
     BOOLEAN Boosting;
+
+    // Scheduling
+    ULONG Interval; // in milliseconds, or 0 to run on every tick
+    ULONG Deadline; // in milliseconds
+    ULONG Cost; // estimated run time, in microseconds
+    ULONG64 NextRunTime; // tick count
+    BOOLEAN Deferred;
+    ULONG SkippedRuns;
+    ULONG LateRuns;
 } PH_PROVIDER_REGISTRATION, *PPH_PROVIDER_REGISTRATION;
 
 typedef struct _PH_PROVIDER_THREAD
@@ -1645,6 +1756,9 @@ typedef struct _PH_PROVIDER_THREAD
     PH_QUEUED_LOCK Lock;
     LIST_ENTRY ListHead;
     ULONG BoostCount;
+
+    ULONG Budget; // per-tick budget in microseconds, or 0 for no budget
+    PPH_PROVIDER_CLOCK_FUNCTION Clock; // NULL to use the system tick count
 } PH_PROVIDER_THREAD, *PPH_PROVIDER_THREAD;
 
 PHLIBAPI
@@ -1674,6 +1788,18 @@ VOID PhSetIntervalProviderThread(
     _In_ ULONG Interval
     );
 
+PHLIBAPI
+VOID PhSetBudgetProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ ULONG Budget
+    );
+
+PHLIBAPI
+VOID PhSetClockProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_opt_ PPH_PROVIDER_CLOCK_FUNCTION Clock
+    );
+
 PHLIBAPI
 VOID PhRegisterProvider(
     _Inout_ PPH_PROVIDER_THREAD ProviderThread,
@@ -1709,6 +1835,14 @@ VOID PhSetEnabledProvider(
     _In_ BOOLEAN Enabled
     );
 
+PHLIBAPI
+VOID PhSetScheduleProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG Interval,
+    _In_ ULONG Deadline,
+    _In_ ULONG Cost
+    );
+
 // symprv
 
 extern PPH_OBJECT_TYPE PhSymbolProviderType;
@@ -1839,6 +1973,219 @@ VOID PhSetSearchPathSymbolProvider(
     _In_ PWSTR Path
     );
 
+// unwind
+
+typedef struct _PH_UNWIND_CACHE *PPH_UNWIND_CACHE;
+
+extern PPH_OBJECT_TYPE PhUnwindCacheType;
+
+#define PH_UNWIND_RSP 4
+#define PH_UNWIND_RBP 5
+
+typedef struct _PH_UNWIND_CONTEXT
+{
+    ULONG64 Rip;
+    ULONG64 Registers[16]; // Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi, R8 - R15
+} PH_UNWIND_CONTEXT, *PPH_UNWIND_CONTEXT;
+
+typedef struct _PH_UNWIND_STATE
+{
+    PPH_UNWIND_CACHE Cache;
+    PH_UNWIND_CONTEXT Context;
+
+    ULONG64 BufferAddress;
+    SIZE_T BufferLength;
+    PVOID Buffer;
+} PH_UNWIND_STATE, *PPH_UNWIND_STATE;
+
+PHLIBAPI
+PPH_UNWIND_CACHE PhCreateUnwindCache(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PPH_READ_VIRTUAL_MEMORY_CALLBACK ReadVirtualMemory
+    );
+
+PHLIBAPI
+NTSTATUS PhAddModuleUnwindCache(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 BaseAddress
+    );
+
+PHLIBAPI
+VOID PhInitializeUnwindState(
+    _Out_ PPH_UNWIND_STATE State,
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ PPH_UNWIND_CONTEXT Context
+    );
+
+PHLIBAPI
+VOID PhDeleteUnwindState(
+    _Inout_ PPH_UNWIND_STATE State
+    );
+
+PHLIBAPI
+NTSTATUS PhReadMemoryUnwindState(
+    _Inout_ PPH_UNWIND_STATE State,
+    _In_ ULONG64 Address,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    );
+
+PHLIBAPI
+NTSTATUS PhUnwindFrame(
+    _Inout_ PPH_UNWIND_STATE State
+    );
+
+// calltree
+
+extern PPH_OBJECT_TYPE PhCallTreeType;
+
+#define PH_CALL_TREE_MAXIMUM_DEPTH 256
+
+typedef struct _PH_CALL_TREE_NODE
+{
+    struct _PH_CALL_TREE_NODE *Parent;
+    struct _PH_CALL_TREE_NODE *NextSibling;
+    struct _PH_CALL_TREE_NODE *FirstChild;
+    PVOID Address;
+    LONG InclusiveCount; // samples in which this frame appears
+    LONG ExclusiveCount; // samples in which this is the innermost frame
+} PH_CALL_TREE_NODE, *PPH_CALL_TREE_NODE;
+
+typedef struct _PH_CALL_TREE
+{
+    PH_CALL_TREE_NODE Root;
+    LONG NumberOfSamples;
+    LONG NumberOfNodes;
+    struct _PH_CALL_TREE_BLOCK *CurrentBlock;
+} PH_CALL_TREE, *PPH_CALL_TREE;
+
+/**
+ * A callback function passed to PhExportFoldedCallTree() to
+ * convert addresses to names.
+ *
+ * \param Addresses An array of distinct addresses, in
+ * ascending order.
+ * \param Count The number of addresses.
+ * \param Names An array which receives a name for each
+ * address. Entries which are left as NULL are formatted
+ * as hexadecimal numbers.
+ * \param Context A user-defined value passed to
+ * PhExportFoldedCallTree().
+ */
+typedef VOID (NTAPI *PPH_CALL_TREE_RESOLVE_CALLBACK)(
+    _In_reads_(Count) PVOID *Addresses,
+    _In_ ULONG Count,
+    _Out_writes_(Count) PPH_STRING *Names,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI
+PPH_CALL_TREE PhCreateCallTree(
+    VOID
+    );
+
+PHLIBAPI
+VOID PhAddSampleCallTree(
+    _Inout_ PPH_CALL_TREE CallTree,
+    _In_reads_(NumberOfFrames) PVOID *Frames,
+    _In_ ULONG NumberOfFrames
+    );
+
+PHLIBAPI
+PPH_STRING PhExportFoldedCallTree(
+    _In_ PPH_CALL_TREE CallTree,
+    _In_opt_ PPH_CALL_TREE_RESOLVE_CALLBACK ResolveCallback,
+    _In_opt_ PVOID Context
+    );
+
+// trace
+
+#define PH_TRACE_BUFFER_SIZE 2048 // must be a power of two
+#define PH_TRACE_MAXIMUM_BUFFERS 64
+
+typedef struct _PH_TRACE_EVENT
+{
+    PWSTR Category;
+    PWSTR Name; // if NULL, the span is named by Address
+    PVOID Address;
+    ULONG64 StartTime;
+    ULONG64 EndTime;
+} PH_TRACE_EVENT, *PPH_TRACE_EVENT;
+
+/**
+ * A callback function passed to PhExportTrace() to convert
+ * addresses to names.
+ *
+ * \param Address The address of an event which has no name.
+ * \param Context A user-defined value passed to PhExportTrace().
+ *
+ * \return The name of the address, or NULL to format the address
+ * as a hexadecimal number. Each distinct address is resolved once.
+ */
+typedef PPH_STRING (NTAPI *PPH_TRACE_RESOLVE_CALLBACK)(
+    _In_ PVOID Address,
+    _In_opt_ PVOID Context
+    );
+
+PHLIBAPI extern BOOLEAN PhTraceEnabled;
+
+PHLIBAPI
+VOID PhStartTrace(
+    VOID
+    );
+
+PHLIBAPI
+VOID PhStopTrace(
+    VOID
+    );
+
+PHLIBAPI
+VOID PhRecordTraceSpan(
+    _In_ PWSTR Category,
+    _In_opt_ PWSTR Name,
+    _In_opt_ PVOID Address,
+    _In_ ULONG64 StartTime
+    );
+
+PHLIBAPI
+PPH_STRING PhExportTrace(
+    _In_opt_ PPH_TRACE_RESOLVE_CALLBACK ResolveCallback,
+    _In_opt_ PVOID Context
+    );
+
+/**
+ * Begins a trace span.
+ *
+ * \return A value to pass to PhEndTraceSpan(), or 0 if
+ * tracing is disabled.
+ */
+FORCEINLINE ULONG64 PhBeginTraceSpan(
+    VOID
+    )
+{
+    return PhTraceEnabled ? ReadTimeStampCounter() : 0;
+}
+
+/**
+ * Ends a trace span and records it in the current thread's
+ * trace buffer.
+ *
+ * \param Category The category of the span. This must be a
+ * string literal.
+ * \param Name The name of the span. This must be a string
+ * literal.
+ * \param StartTime The value returned by PhBeginTraceSpan().
+ */
+FORCEINLINE VOID PhEndTraceSpan(
+    _In_ PWSTR Category,
+    _In_ PWSTR Name,
+    _In_ ULONG64 StartTime
+    )
+{
+    if (StartTime != 0)
+        PhRecordTraceSpan(Category, Name, NULL, StartTime);
+}
+
 // svcsup
 
 extern WCHAR *PhServiceTypeStrings[6];
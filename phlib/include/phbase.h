@@ -1196,6 +1196,77 @@ PhReferenceEmptyString(
     VOID
     );
 
+PHLIBAPI extern PPH_OBJECT_TYPE PhInternedStringType;
+
+typedef struct _PH_INTERNED_STRING_STATISTICS
+{
+    ULONG NumberOfStrings;
+    ULONG NumberOfReferences;
+    SIZE_T NumberOfBytes;
+    SIZE_T NumberOfReferencedBytes;
+    ULONG NumberOfLookups;
+    ULONG NumberOfHits;
+} PH_INTERNED_STRING_STATISTICS, *PPH_INTERNED_STRING_STATISTICS;
+
+PHLIBAPI
+PPH_STRING
+NTAPI
+PhInternStringRef(
+    _In_ PPH_STRINGREF String
+    );
+
+PHLIBAPI
+PPH_STRING
+NTAPI
+PhInternString(
+    _In_ PPH_STRING String
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+PhGetInternedStringHash(
+    _In_ PPH_STRING String
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhGetInternedStringStatistics(
+    _Out_ PPH_INTERNED_STRING_STATISTICS Statistics
+    );
+
+/**
+ * Determines whether a string is an interned string.
+ *
+ * \param String A string object.
+ */
+FORCEINLINE BOOLEAN PhIsInternedString(
+    _In_ PPH_STRING String
+    )
+{
+    return PhGetObjectType(String) == PhInternedStringType;
+}
+
+/**
+ * Determines whether two interned strings are equal.
+ *
+ * \param String1 The first string.
+ * \param String2 The second string.
+ *
+ * \remarks Both strings must have been obtained from
+ * \ref PhInternString or \ref PhInternStringRef.
+ */
+FORCEINLINE BOOLEAN PhEqualInternedString(
+    _In_ PPH_STRING String1,
+    _In_ PPH_STRING String2
+    )
+{
+    assert(PhIsInternedString(String1) && PhIsInternedString(String2));
+
+    return String1 == String2;
+}
+
 PHLIBAPI
 PPH_STRING
 NTAPI
@@ -1459,6 +1530,9 @@ FORCEINLINE BOOLEAN PhEqualString(
     _In_ BOOLEAN IgnoreCase
     )
 {
+    if (String1 == String2)
+        return TRUE;
+
     return PhEqualStringRef(&String1->sr, &String2->sr, IgnoreCase);
 }
 
@@ -3347,6 +3421,113 @@ PhEnumAvlTree(
     _In_opt_ PVOID Context
     );
 
+// B+ trees
+
+/**
+ * A comparison function used by a B+ tree.
+ *
+ * \param Entry1 The first entry.
+ * \param Entry2 The second entry.
+ *
+ * \return A negative value if \a Entry1 is less than \a Entry2, zero if they are
+ * equal, or a positive value if \a Entry1 is greater than \a Entry2.
+ */
+typedef LONG (NTAPI *PPH_BTREE_COMPARE_FUNCTION)(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    );
+
+typedef struct _PH_BTREE_NODE *PPH_BTREE_NODE;
+
+/**
+ * A B+ tree. Entries are copied into the tree and are stored in sorted order in
+ * the leaf nodes, which are linked together for fast iteration.
+ */
+typedef struct _PH_BTREE
+{
+    PPH_BTREE_NODE Root;
+    ULONG Count;
+    ULONG Height;
+    ULONG EntrySize;
+    ULONG LeafCapacity;
+    ULONG InternalCapacity;
+    ULONG KeysOffset;
+    PPH_BTREE_COMPARE_FUNCTION CompareFunction;
+} PH_BTREE, *PPH_BTREE;
+
+typedef struct _PH_BTREE_ENUM_CONTEXT
+{
+    PPH_BTREE Tree;
+    PPH_BTREE_NODE Leaf;
+    ULONG Index;
+} PH_BTREE_ENUM_CONTEXT, *PPH_BTREE_ENUM_CONTEXT;
+
+PHLIBAPI
+VOID
+NTAPI
+PhInitializeBTree(
+    _Out_ PPH_BTREE Tree,
+    _In_ ULONG EntrySize,
+    _In_ PPH_BTREE_COMPARE_FUNCTION CompareFunction
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhDeleteBTree(
+    _Inout_ PPH_BTREE Tree
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhAddEntryBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_ PVOID Entry,
+    _Out_opt_ PBOOLEAN Added
+    );
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhRemoveEntryBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_ PVOID Entry
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhFindEntryBTree(
+    _In_ PPH_BTREE Tree,
+    _In_ PVOID Entry
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhBulkLoadBTree(
+    _Inout_ PPH_BTREE Tree,
+    _In_reads_bytes_(Count * Tree->EntrySize) PVOID Entries,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhBeginEnumBTree(
+    _In_ PPH_BTREE Tree,
+    _In_opt_ PVOID Entry,
+    _Out_ PPH_BTREE_ENUM_CONTEXT Context
+    );
+
+PHLIBAPI
+PVOID
+NTAPI
+PhNextEnumBTree(
+    _Inout_ PPH_BTREE_ENUM_CONTEXT Context
+    );
+
 // handle
 
 struct _PH_HANDLE_TABLE;
@@ -3539,6 +3720,7 @@ typedef struct _PH_WORK_QUEUE_ITEM
     LIST_ENTRY ListEntry;
     PTHREAD_START_ROUTINE Function;
     PVOID Context;
+    ULONG64 QueueTimestamp;
 } PH_WORK_QUEUE_ITEM, *PPH_WORK_QUEUE_ITEM;
 
 VOID PhWorkQueueInitialization(
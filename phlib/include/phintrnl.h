@@ -1,7 +1,18 @@
 #ifndef _PH_PHINTRNL_H
 #define _PH_PHINTRNL_H
 
-typedef struct _PHLIB_STATISTICS_BLOCK
+#define PH_STATISTICS_HISTOGRAM_BUCKETS 32
+
+// Bucket 0 counts values less than 2, and bucket i counts values in [2^i, 2^(i+1)).
+// The last bucket also counts all larger values.
+typedef struct _PH_STATISTICS_HISTOGRAM
+{
+    ULONG Buckets[PH_STATISTICS_HISTOGRAM_BUCKETS];
+} PH_STATISTICS_HISTOGRAM, *PPH_STATISTICS_HISTOGRAM;
+
+// All members must be ULONGs (or arrays of them) so that the per-processor
+// blocks can be summed as arrays.
+typedef struct DECLSPEC_ALIGN(64) _PHLIB_STATISTICS_BLOCK
 {
     // basesup
     ULONG BaseThreadsCreated;
@@ -34,16 +45,77 @@ typedef struct _PHLIB_STATISTICS_BLOCK
     ULONG WqWorkQueueThreadsCreated;
     ULONG WqWorkQueueThreadsCreateFailed;
     ULONG WqWorkItemsQueued;
-} PHLIB_STATISTICS_BLOCK;
 
-#ifdef DEBUG
-extern PHLIB_STATISTICS_BLOCK PhLibStatisticsBlock;
-#endif
+    // provider
+    ULONG ProvProviderRuns;
+    ULONG ProvProviderBoostedRuns;
+    ULONG ProvProviderSkippedRuns;
+    ULONG ProvProviderLateRuns;
 
-#ifdef DEBUG
-#define PHLIB_INC_STATISTIC(Name) (_InterlockedIncrement(&PhLibStatisticsBlock.Name))
-#else
-#define PHLIB_INC_STATISTIC(Name)
-#endif
+    // Histograms of elapsed times, in timestamp counter ticks.
+    PH_STATISTICS_HISTOGRAM RefDeleteProcedureTime;
+    PH_STATISTICS_HISTOGRAM QlBlockWaitTime;
+    PH_STATISTICS_HISTOGRAM WqWorkItemWaitTime;
+    PH_STATISTICS_HISTOGRAM WqWorkItemRunTime;
+    PH_STATISTICS_HISTOGRAM ProvProviderRunTime;
+} PHLIB_STATISTICS_BLOCK, *PPHLIB_STATISTICS_BLOCK;
+
+// Each processor updates its own block, so the counters are cheap enough to keep in
+// release builds. A thread may be moved to another processor while it updates a
+// block, so updates are still interlocked.
+#define PHLIB_STATISTICS_BLOCKS 64
+
+extern PHLIB_STATISTICS_BLOCK PhLibStatisticsBlocks[PHLIB_STATISTICS_BLOCKS];
+extern ULONG (NTAPI *PhLibGetCurrentProcessorNumber)(VOID);
+
+FORCEINLINE PPHLIB_STATISTICS_BLOCK PhGetLibStatisticsBlock(
+    VOID
+    )
+{
+    ULONG index;
+
+    // RtlGetCurrentProcessorNumber is not available on XP. Spread the threads
+    // out instead.
+    if (PhLibGetCurrentProcessorNumber)
+        index = PhLibGetCurrentProcessorNumber();
+    else
+        index = HandleToUlong(NtCurrentTeb()->ClientId.UniqueThread) / 4;
+
+    return &PhLibStatisticsBlocks[index % PHLIB_STATISTICS_BLOCKS];
+}
+
+FORCEINLINE VOID PhAddLibStatisticsHistogram(
+    _Inout_ PPH_STATISTICS_HISTOGRAM Histogram,
+    _In_ ULONG64 Value
+    )
+{
+    ULONG bucket;
+
+    if ((ULONG)(Value >> 32) != 0)
+        bucket = PH_STATISTICS_HISTOGRAM_BUCKETS - 1;
+    else if (!_BitScanReverse(&bucket, (ULONG)Value))
+        bucket = 0;
+
+    _InterlockedIncrement((PLONG)&Histogram->Buckets[bucket]);
+}
+
+#define PHLIB_INC_STATISTIC(Name) (_InterlockedIncrement((PLONG)&PhGetLibStatisticsBlock()->Name))
+#define PHLIB_STATISTIC_TIMESTAMP() ReadTimeStampCounter()
+#define PHLIB_ADD_STATISTIC_TIME(Name, StartTimestamp) \
+    PhAddLibStatisticsHistogram(&PhGetLibStatisticsBlock()->Name, ReadTimeStampCounter() - (StartTimestamp))
+
+VOID PhLibStatisticsInitialization(
+    VOID
+    );
+
+PHLIBAPI
+VOID PhQueryLibStatistics(
+    _Out_ PPHLIB_STATISTICS_BLOCK Statistics
+    );
+
+PHLIBAPI
+PPH_STRING PhFormatLibStatistics(
+    VOID
+    );
 
 #endif
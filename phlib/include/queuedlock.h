@@ -183,6 +183,94 @@ PhfWaitForWakeEvent(
     _In_opt_ PLARGE_INTEGER Timeout
     );
 
+// Spinning
+
+/** Spin for a budget learned separately for each lock instead of the fixed spin count. */
+#define PH_QUEUED_LOCK_SPIN_ADAPTIVE 0x1
+/** Double the pause between checks of the wait block while spinning. */
+#define PH_QUEUED_LOCK_SPIN_BACKOFF 0x2
+
+PHLIBAPI extern ULONG PhQueuedLockSpinFlags;
+
+// Lock profiling
+
+#define PH_QUEUED_LOCK_PROFILE_CALL_SITES 16
+
+typedef struct _PH_QUEUED_LOCK_CALL_SITE
+{
+    PVOID Address;
+    ULONG AcquireCount;
+    ULONG ContendedCount;
+    ULONG64 WaitTime;
+    ULONG64 HoldTime;
+} PH_QUEUED_LOCK_CALL_SITE, *PPH_QUEUED_LOCK_CALL_SITE;
+
+typedef struct _PH_QUEUED_LOCK_PROFILE
+{
+    PPH_QUEUED_LOCK Lock;
+    PWSTR Name;
+
+    ULONG ExclusiveAcquireCount;
+    ULONG SharedAcquireCount;
+    ULONG ContendedCount;
+    ULONG SpinCount;
+    ULONG WaitCount;
+    ULONG64 WaitTime;
+    ULONG64 HoldTime;
+
+    ULONG64 OwnerTimestamp;
+    PPH_QUEUED_LOCK_CALL_SITE OwnerCallSite;
+
+    PH_QUEUED_LOCK_CALL_SITE CallSites[PH_QUEUED_LOCK_PROFILE_CALL_SITES];
+    PH_QUEUED_LOCK_CALL_SITE OtherCallSites;
+} PH_QUEUED_LOCK_PROFILE, *PPH_QUEUED_LOCK_PROFILE;
+
+PHLIBAPI extern BOOLEAN PhQueuedLockProfilingEnabled;
+
+PHLIBAPI
+BOOLEAN
+NTAPI
+PhRegisterQueuedLockProfile(
+    _In_ PPH_QUEUED_LOCK QueuedLock,
+    _In_ PWSTR Name
+    );
+
+PHLIBAPI
+VOID
+NTAPI
+PhResetQueuedLockProfiles(
+    VOID
+    );
+
+PHLIBAPI
+ULONG
+NTAPI
+PhQueryQueuedLockProfiles(
+    _Out_writes_to_(Count, return) PPH_QUEUED_LOCK_PROFILE Profiles,
+    _In_ ULONG Count
+    );
+
+PHLIBAPI
+VOID
+FASTCALL
+PhfAcquireQueuedLockExclusiveProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    );
+
+PHLIBAPI
+VOID
+FASTCALL
+PhfAcquireQueuedLockSharedProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    );
+
+PHLIBAPI
+VOID
+FASTCALL
+PhfReleaseQueuedLockExclusiveProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    );
+
 // Inline functions
 
 _Acquires_exclusive_lock_(*QueuedLock)
@@ -190,6 +278,12 @@ FORCEINLINE VOID PhAcquireQueuedLockExclusive(
     _Inout_ PPH_QUEUED_LOCK QueuedLock
     )
 {
+    if (PhQueuedLockProfilingEnabled)
+    {
+        PhfAcquireQueuedLockExclusiveProfiled(QueuedLock);
+        return;
+    }
+
     if (_InterlockedBitTestAndSetPointer((PLONG_PTR)&QueuedLock->Value, PH_QUEUED_LOCK_OWNED_SHIFT))
     {
         // Owned bit was already set. Slow path.
@@ -202,6 +296,12 @@ FORCEINLINE VOID PhAcquireQueuedLockShared(
     _Inout_ PPH_QUEUED_LOCK QueuedLock
     )
 {
+    if (PhQueuedLockProfilingEnabled)
+    {
+        PhfAcquireQueuedLockSharedProfiled(QueuedLock);
+        return;
+    }
+
     if ((ULONG_PTR)_InterlockedCompareExchangePointer(
         (PPVOID)&QueuedLock->Value,
         (PVOID)(PH_QUEUED_LOCK_OWNED | PH_QUEUED_LOCK_SHARED_INC),
@@ -234,6 +334,12 @@ FORCEINLINE VOID PhReleaseQueuedLockExclusive(
 {
     ULONG_PTR value;
 
+    if (PhQueuedLockProfilingEnabled)
+    {
+        PhfReleaseQueuedLockExclusiveProfiled(QueuedLock);
+        return;
+    }
+
     value = (ULONG_PTR)_InterlockedExchangeAddPointer((PLONG_PTR)&QueuedLock->Value, -(LONG_PTR)PH_QUEUED_LOCK_OWNED);
 
     if ((value & (PH_QUEUED_LOCK_WAITERS | PH_QUEUED_LOCK_TRAVERSING)) == PH_QUEUED_LOCK_WAITERS)
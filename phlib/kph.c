@@ -29,6 +29,14 @@ NTSTATUS KphpDeviceIoControl(
     _In_ ULONG InBufferLength
     );
 
+NTSTATUS NTAPI KphpDispatchBatch(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    );
+
 HANDLE PhKphHandle = NULL;
 
 NTSTATUS KphConnect(
@@ -1063,3 +1071,332 @@ NTSTATUS KphQueryInformationDriver(
         sizeof(input)
         );
 }
+
+/**
+ * Initializes a batch of KProcessHacker requests.
+ *
+ * \param Batch The batch.
+ *
+ * \remarks A batch carries a number of query operations which are executed
+ * by the driver in a single request. The output of all operations is packed
+ * into one buffer.
+ */
+VOID KphInitializeBatch(
+    _Out_ PKPH_BATCH Batch
+    )
+{
+    Batch->Operations = NULL;
+    Batch->Count = 0;
+    Batch->AllocatedCount = 0;
+    Batch->DataLength = 0;
+    Batch->Output = NULL;
+    Batch->AllocatedOutputLength = 0;
+}
+
+/**
+ * Frees resources used by a batch.
+ *
+ * \param Batch The batch.
+ */
+VOID KphDeleteBatch(
+    _Inout_ PKPH_BATCH Batch
+    )
+{
+    if (Batch->Operations)
+        PhFree(Batch->Operations);
+    if (Batch->Output)
+        PhFree(Batch->Output);
+}
+
+/**
+ * Removes all operations from a batch. The storage used by the batch is
+ * kept so that it can be reused.
+ *
+ * \param Batch The batch.
+ */
+VOID KphClearBatch(
+    _Inout_ PKPH_BATCH Batch
+    )
+{
+    Batch->Count = 0;
+    Batch->DataLength = 0;
+}
+
+static PKPH_BATCH_OPERATION KphpAddOperationBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ KPH_BATCH_OPERATION_TYPE Type,
+    _In_ ULONG DataLength,
+    _Out_ PULONG Index
+    )
+{
+    PKPH_BATCH_OPERATION operation;
+    ULONG dataOffset;
+    ULONG newDataLength;
+
+    if (Batch->Count == KPH_BATCH_MAXIMUM_OPERATIONS)
+        return NULL;
+
+    // Reserve space for the output in the data area. Each buffer is aligned,
+    // and the results array (8 bytes per operation) preserves the alignment
+    // of the data area.
+
+    dataOffset = Batch->DataLength;
+
+    if (DataLength > MAXLONG - dataOffset - KPH_BATCH_DATA_ALIGNMENT)
+        return NULL;
+
+    newDataLength = (dataOffset + DataLength + KPH_BATCH_DATA_ALIGNMENT - 1) & ~(KPH_BATCH_DATA_ALIGNMENT - 1);
+
+    if (Batch->Count == Batch->AllocatedCount)
+    {
+        if (Batch->AllocatedCount == 0)
+        {
+            Batch->AllocatedCount = 16;
+            Batch->Operations = PhAllocate(Batch->AllocatedCount * sizeof(KPH_BATCH_OPERATION));
+        }
+        else
+        {
+            Batch->AllocatedCount *= 2;
+            Batch->Operations = PhReAllocate(Batch->Operations, Batch->AllocatedCount * sizeof(KPH_BATCH_OPERATION));
+        }
+    }
+
+    operation = &Batch->Operations[Batch->Count];
+    memset(operation, 0, sizeof(KPH_BATCH_OPERATION));
+    operation->Type = Type;
+    operation->DataOffset = dataOffset;
+    operation->DataLength = DataLength;
+
+    Batch->DataLength = newDataLength;
+    *Index = Batch->Count++;
+
+    return operation;
+}
+
+/**
+ * Adds a process query operation to a batch.
+ *
+ * \param Batch The batch.
+ * \param ProcessHandle A handle to a process.
+ * \param ProcessInformationClass The type of information to query.
+ * \param ProcessInformationLength The size of the output buffer to reserve.
+ *
+ * \return The index of the operation, or -1 if the batch is full.
+ */
+ULONG KphAddQueryInformationProcessBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ KPH_PROCESS_INFORMATION_CLASS ProcessInformationClass,
+    _In_ ULONG ProcessInformationLength
+    )
+{
+    PKPH_BATCH_OPERATION operation;
+    ULONG index;
+
+    operation = KphpAddOperationBatch(Batch, KphBatchQueryInformationProcess, ProcessInformationLength, &index);
+
+    if (!operation)
+        return -1;
+
+    operation->u.QueryInformationProcess.ProcessHandle = ProcessHandle;
+    operation->u.QueryInformationProcess.ProcessInformationClass = ProcessInformationClass;
+
+    return index;
+}
+
+/**
+ * Adds a thread query operation to a batch.
+ *
+ * \param Batch The batch.
+ * \param ThreadHandle A handle to a thread.
+ * \param ThreadInformationClass The type of information to query.
+ * \param ThreadInformationLength The size of the output buffer to reserve.
+ *
+ * \return The index of the operation, or -1 if the batch is full.
+ */
+ULONG KphAddQueryInformationThreadBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ThreadHandle,
+    _In_ KPH_THREAD_INFORMATION_CLASS ThreadInformationClass,
+    _In_ ULONG ThreadInformationLength
+    )
+{
+    PKPH_BATCH_OPERATION operation;
+    ULONG index;
+
+    operation = KphpAddOperationBatch(Batch, KphBatchQueryInformationThread, ThreadInformationLength, &index);
+
+    if (!operation)
+        return -1;
+
+    operation->u.QueryInformationThread.ThreadHandle = ThreadHandle;
+    operation->u.QueryInformationThread.ThreadInformationClass = ThreadInformationClass;
+
+    return index;
+}
+
+/**
+ * Adds an object query operation to a batch.
+ *
+ * \param Batch The batch.
+ * \param ProcessHandle A handle to the process which owns the handle.
+ * \param Handle The handle in the other process.
+ * \param ObjectInformationClass The type of information to query.
+ * \param ObjectInformationLength The size of the output buffer to reserve.
+ *
+ * \return The index of the operation, or -1 if the batch is full.
+ */
+ULONG KphAddQueryInformationObjectBatch(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ HANDLE ProcessHandle,
+    _In_ HANDLE Handle,
+    _In_ KPH_OBJECT_INFORMATION_CLASS ObjectInformationClass,
+    _In_ ULONG ObjectInformationLength
+    )
+{
+    PKPH_BATCH_OPERATION operation;
+    ULONG index;
+
+    operation = KphpAddOperationBatch(Batch, KphBatchQueryInformationObject, ObjectInformationLength, &index);
+
+    if (!operation)
+        return -1;
+
+    operation->u.QueryInformationObject.ProcessHandle = ProcessHandle;
+    operation->u.QueryInformationObject.Handle = Handle;
+    operation->u.QueryInformationObject.ObjectInformationClass = ObjectInformationClass;
+
+    return index;
+}
+
+NTSTATUS NTAPI KphpDispatchBatch(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    )
+{
+    struct
+    {
+        PKPH_BATCH_OPERATION Operations;
+        ULONG OperationsLength;
+        PVOID Output;
+        ULONG OutputLength;
+    } input = { Operations, OperationsLength, Output, OutputLength };
+
+    return KphpDeviceIoControl(
+        KPH_EXECUTEBATCH,
+        &input,
+        sizeof(input)
+        );
+}
+
+/**
+ * Executes a batch using KProcessHacker.
+ *
+ * \param Batch The batch.
+ *
+ * \return The status of the request as a whole. Use KphGetResultBatch() to
+ * retrieve the status and output of each operation.
+ */
+NTSTATUS KphExecuteBatch(
+    _Inout_ PKPH_BATCH Batch
+    )
+{
+    return KphExecuteBatchEx(Batch, KphpDispatchBatch, NULL);
+}
+
+/**
+ * Executes a batch.
+ *
+ * \param Batch The batch.
+ * \param DispatchRoutine The function which executes the encoded batch.
+ * \param Context A user-defined value to pass to the dispatch routine.
+ */
+NTSTATUS KphExecuteBatchEx(
+    _Inout_ PKPH_BATCH Batch,
+    _In_ PKPH_BATCH_DISPATCH_ROUTINE DispatchRoutine,
+    _In_opt_ PVOID Context
+    )
+{
+    NTSTATUS status;
+    ULONG outputLength;
+    ULONG i;
+
+    if (Batch->Count == 0)
+        return STATUS_SUCCESS;
+
+    outputLength = Batch->Count * sizeof(KPH_BATCH_RESULT) + Batch->DataLength;
+
+    if (Batch->AllocatedOutputLength < outputLength)
+    {
+        if (Batch->Output)
+            PhFree(Batch->Output);
+
+        Batch->AllocatedOutputLength = outputLength;
+        Batch->Output = PhAllocate(outputLength);
+    }
+
+    // Operations which are not executed (e.g. because the request as a whole
+    // failed) should not appear to have succeeded.
+    for (i = 0; i < Batch->Count; i++)
+    {
+        ((PKPH_BATCH_RESULT)Batch->Output)[i].Status = STATUS_UNSUCCESSFUL;
+        ((PKPH_BATCH_RESULT)Batch->Output)[i].ReturnLength = 0;
+    }
+
+    status = DispatchRoutine(
+        Batch->Operations,
+        Batch->Count * sizeof(KPH_BATCH_OPERATION),
+        Batch->Output,
+        outputLength,
+        Context
+        );
+
+    if (!NT_SUCCESS(status))
+    {
+        for (i = 0; i < Batch->Count; i++)
+            ((PKPH_BATCH_RESULT)Batch->Output)[i].Status = status;
+    }
+
+    return status;
+}
+
+/**
+ * Gets the result of an operation in an executed batch.
+ *
+ * \param Batch The batch.
+ * \param Index The index of the operation.
+ * \param Buffer A variable which receives a pointer to the output of the
+ * operation. The buffer is valid until the batch is executed again or deleted.
+ * \param ReturnLength A variable which receives the return length reported
+ * by the operation.
+ *
+ * \return The status of the operation.
+ */
+NTSTATUS KphGetResultBatch(
+    _In_ PKPH_BATCH Batch,
+    _In_ ULONG Index,
+    _Out_opt_ PVOID *Buffer,
+    _Out_opt_ PULONG ReturnLength
+    )
+{
+    PKPH_BATCH_RESULT result;
+
+    if (Index >= Batch->Count || !Batch->Output)
+        return STATUS_INVALID_PARAMETER_2;
+
+    result = &((PKPH_BATCH_RESULT)Batch->Output)[Index];
+
+    if (Buffer)
+    {
+        *Buffer = PTR_ADD_OFFSET(Batch->Output,
+            Batch->Count * sizeof(KPH_BATCH_RESULT) + Batch->Operations[Index].DataOffset);
+    }
+
+    if (ReturnLength)
+        *ReturnLength = result->ReturnLength;
+
+    return result->Status;
+}
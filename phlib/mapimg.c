@@ -435,6 +435,16 @@ NTSTATUS PhLoadRemoteMappedImage(
     _In_ PVOID ViewBase,
     _Out_ PPH_REMOTE_MAPPED_IMAGE RemoteMappedImage
     )
+{
+    return PhLoadRemoteMappedImageEx(ProcessHandle, ViewBase, PhReadVirtualMemory, RemoteMappedImage);
+}
+
+NTSTATUS PhLoadRemoteMappedImageEx(
+    _In_ HANDLE ProcessHandle,
+    _In_ PVOID ViewBase,
+    _In_ PPH_READ_VIRTUAL_MEMORY_CALLBACK ReadVirtualMemoryCallback,
+    _Out_ PPH_REMOTE_MAPPED_IMAGE RemoteMappedImage
+    )
 {
     NTSTATUS status;
     IMAGE_DOS_HEADER dosHeader;
@@ -444,7 +454,7 @@ NTSTATUS PhLoadRemoteMappedImage(
 
     RemoteMappedImage->ViewBase = ViewBase;
 
-    status = PhReadVirtualMemory(
+    status = ReadVirtualMemoryCallback(
         ProcessHandle,
         ViewBase,
         &dosHeader,
@@ -467,7 +477,7 @@ NTSTATUS PhLoadRemoteMappedImage(
     if (ntHeadersOffset == 0 || ntHeadersOffset >= 0x10000000)
         return STATUS_INVALID_IMAGE_FORMAT;
 
-    status = PhReadVirtualMemory(
+    status = ReadVirtualMemoryCallback(
         ProcessHandle,
         PTR_ADD_OFFSET(ViewBase, ntHeadersOffset),
         &ntHeaders,
@@ -503,7 +513,7 @@ NTSTATUS PhLoadRemoteMappedImage(
 
     RemoteMappedImage->NtHeaders = PhAllocate(ntHeadersSize);
 
-    status = PhReadVirtualMemory(
+    status = ReadVirtualMemoryCallback(
         ProcessHandle,
         PTR_ADD_OFFSET(ViewBase, ntHeadersOffset),
         RemoteMappedImage->NtHeaders,
@@ -27,6 +27,46 @@
 #define PH_DEVICE_PREFIX_LENGTH 64
 #define PH_DEVICE_MUP_PREFIX_MAX_COUNT 16
 
+// The rule only applies to PhGetFileName.
+#define PH_DEVICE_PREFIX_RULE_FILE_NAME_ONLY 0x1
+// The prefix must be followed by a backslash or the end of the name.
+#define PH_DEVICE_PREFIX_RULE_SEPARATOR_OR_END 0x2
+// The prefix must be followed by a backslash.
+#define PH_DEVICE_PREFIX_RULE_SEPARATOR 0x4
+// The replacement is inserted before the prefix instead of replacing it.
+#define PH_DEVICE_PREFIX_RULE_KEEP_PREFIX 0x8
+// If the rule applies, longer prefixes are not considered.
+#define PH_DEVICE_PREFIX_RULE_STOP 0x10
+
+#define PH_DEVICE_PREFIX_TRIE_NO_RULE 0xffff
+
+#define PH_PROCESS_SNAPSHOT_SPARE_BUFFERS 2
+
+typedef struct _PH_DEVICE_PREFIX_RULE
+{
+    PH_STRINGREF Prefix;
+    PH_STRINGREF Replacement;
+    ULONG Flags;
+} PH_DEVICE_PREFIX_RULE, *PPH_DEVICE_PREFIX_RULE;
+
+typedef struct _PH_DEVICE_PREFIX_TRIE_NODE
+{
+    WCHAR Character; // upper case
+    USHORT Rule;
+    ULONG NumberOfChildren;
+    ULONG FirstChild; // children are stored contiguously, sorted by character
+} PH_DEVICE_PREFIX_TRIE_NODE, *PPH_DEVICE_PREFIX_TRIE_NODE;
+
+// An immutable snapshot of all device prefix rules. The snapshot is replaced as a whole
+// when the prefixes change, so lookups never need to acquire a lock.
+typedef struct _PH_DEVICE_PREFIX_TRIE
+{
+    ULONG NumberOfRules;
+    PPH_DEVICE_PREFIX_RULE Rules;
+    ULONG NumberOfNodes;
+    PPH_DEVICE_PREFIX_TRIE_NODE Nodes; // the root is Nodes[0]
+} PH_DEVICE_PREFIX_TRIE, *PPH_DEVICE_PREFIX_TRIE;
+
 typedef BOOLEAN (NTAPI *PPHP_ENUM_PROCESS_MODULES_CALLBACK)(
     _In_ HANDLE ProcessHandle,
     _In_ PLDR_DATA_TABLE_ENTRY Entry,
@@ -43,6 +83,13 @@ typedef BOOLEAN (NTAPI *PPHP_ENUM_PROCESS_MODULES32_CALLBACK)(
     _In_opt_ PVOID Context2
     );
 
+VOID NTAPI PhpProcessSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhProcessSnapshotType;
+
 static PH_INITONCE PhDevicePrefixesInitOnce = PH_INITONCE_INIT;
 
 static UNICODE_STRING PhDevicePrefixes[26];
@@ -52,6 +99,10 @@ static PPH_STRING PhDeviceMupPrefixes[PH_DEVICE_MUP_PREFIX_MAX_COUNT] = { 0 };
 static ULONG PhDeviceMupPrefixesCount = 0;
 static PH_QUEUED_LOCK PhDeviceMupPrefixesLock = PH_QUEUED_LOCK_INIT;
 
+static PPH_DEVICE_PREFIX_TRIE PhDevicePrefixTrie = NULL;
+static PH_QUEUED_LOCK PhDevicePrefixTriePublishLock = PH_QUEUED_LOCK_INIT;
+static PPH_LIST PhDevicePrefixRetiredTries = NULL;
+
 static PH_INITONCE PhPredefineKeyInitOnce = PH_INITONCE_INIT;
 static UNICODE_STRING PhPredefineKeyNames[PH_KEY_MAXIMUM_PREDEFINE] =
 {
@@ -62,6 +113,16 @@ static UNICODE_STRING PhPredefineKeyNames[PH_KEY_MAXIMUM_PREDEFINE] =
 };
 static HANDLE PhPredefineKeyHandles[PH_KEY_MAXIMUM_PREDEFINE] = { 0 };
 
+static PH_INITONCE PhProcessSnapshotInitOnce = PH_INITONCE_INIT;
+static PH_QUEUED_LOCK PhProcessSnapshotLock = PH_QUEUED_LOCK_INIT;
+static PPH_PROCESS_SNAPSHOT PhCurrentProcessSnapshot = NULL;
+// Buffers of deleted snapshots, kept so that a new snapshot does not need to allocate.
+static PVOID PhProcessSnapshotSpareBuffers[PH_PROCESS_SNAPSHOT_SPARE_BUFFERS] = { 0 };
+static ULONG PhProcessSnapshotSpareBufferSizes[PH_PROCESS_SNAPSHOT_SPARE_BUFFERS] = { 0 };
+// Shared by all callers without a lock. Always read and write it using
+// PhpGetProcessSnapshotSizeHint and _InterlockedExchange.
+static LONG PhProcessSnapshotSizeHint = 0x10000;
+
 /**
  * Opens a process.
  *
@@ -2206,12 +2267,53 @@ NTSTATUS PhWalkThreadStack(
     _In_ PPH_WALK_THREAD_STACK_CALLBACK Callback,
     _In_opt_ PVOID Context
     )
+{
+    return PhWalkThreadStackEx(ThreadHandle, ProcessHandle, ClientId, Flags, Callback, Context, NULL);
+}
+
+/**
+ * Walks a thread's stack.
+ *
+ * \param ThreadHandle A handle to a thread.
+ * \param ProcessHandle A handle to the thread's parent
+ * process.
+ * \param ClientId The client ID identifying the thread.
+ * \param Flags A combination of flags.
+ * \param Callback A callback function which is executed
+ * for each stack frame.
+ * \param Context A user-defined value to pass to the
+ * callback function.
+ * \param UnwindCache An unwind cache for the process, used
+ * for AMD64 stacks. If NULL, a temporary cache is created.
+ * Stacks of different threads in the same process can be
+ * walked concurrently using the same cache.
+ *
+ * \remarks See PhWalkThreadStack() for more information.
+ * AMD64 stacks are unwound using the unwind data of each
+ * module. Frames that are not in a module (for example,
+ * dynamically generated code) are passed to dbghelp.
+ */
+NTSTATUS PhWalkThreadStackEx(
+    _In_ HANDLE ThreadHandle,
+    _In_opt_ HANDLE ProcessHandle,
+    _In_opt_ PCLIENT_ID ClientId,
+    _In_ ULONG Flags,
+    _In_ PPH_WALK_THREAD_STACK_CALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _In_opt_ PPH_UNWIND_CACHE UnwindCache
+    )
 {
     NTSTATUS status = STATUS_SUCCESS;
     BOOLEAN suspended = FALSE;
     BOOLEAN processOpened = FALSE;
     BOOLEAN isCurrentThread = FALSE;
     BOOLEAN isSystemProcess = FALSE;
+#ifdef _M_X64
+    PPH_UNWIND_CACHE unwindCache = NULL;
+    PH_UNWIND_STATE unwindState;
+
+    unwindState.Buffer = NULL;
+#endif
 
     // Open a handle to the process if we weren't given one.
     if (!ProcessHandle)
@@ -2309,6 +2411,9 @@ NTSTATUS PhWalkThreadStack(
         STACKFRAME64 stackFrame;
         PH_THREAD_STACK_FRAME threadStackFrame;
         CONTEXT context;
+        PH_UNWIND_CONTEXT unwindContext;
+        ULONG64 params[4];
+        ULONG i;
 
         context.ContextFlags = CONTEXT_ALL;
 
@@ -2318,6 +2423,60 @@ NTSTATUS PhWalkThreadStack(
             )))
             goto SkipAmd64Stack;
 
+        if (UnwindCache)
+            unwindCache = UnwindCache;
+        else
+            unwindCache = PhCreateUnwindCache(ProcessHandle, NULL);
+
+        if (unwindCache)
+        {
+            // The integer registers in CONTEXT are in the same order as in
+            // PH_UNWIND_CONTEXT.
+            unwindContext.Rip = context.Rip;
+            memcpy(unwindContext.Registers, &context.Rax, sizeof(unwindContext.Registers));
+            PhInitializeUnwindState(&unwindState, unwindCache, &unwindContext);
+
+            while (TRUE)
+            {
+                unwindContext = unwindState.Context;
+
+                // If the frame cannot be unwound, let dbghelp continue from here.
+                if (!NT_SUCCESS(PhUnwindFrame(&unwindState)))
+                    break;
+
+                memset(&threadStackFrame, 0, sizeof(PH_THREAD_STACK_FRAME));
+                threadStackFrame.PcAddress = (PVOID)unwindContext.Rip;
+                threadStackFrame.StackAddress = (PVOID)unwindContext.Registers[PH_UNWIND_RSP];
+                threadStackFrame.ReturnAddress = (PVOID)unwindState.Context.Rip;
+                threadStackFrame.FrameAddress = (PVOID)unwindState.Context.Registers[PH_UNWIND_RSP];
+
+                // The home space of the parameters is at the top of the caller's frame.
+                if (NT_SUCCESS(PhReadMemoryUnwindState(
+                    &unwindState,
+                    unwindState.Context.Registers[PH_UNWIND_RSP],
+                    params,
+                    sizeof(params)
+                    )))
+                {
+                    for (i = 0; i < 4; i++)
+                        threadStackFrame.Params[i] = (PVOID)params[i];
+                }
+
+                if (!Callback(&threadStackFrame, Context))
+                    goto ResumeExit;
+
+                // Stop at the end of the stack, or if the stack is corrupt.
+                if (
+                    !unwindState.Context.Rip ||
+                    unwindState.Context.Registers[PH_UNWIND_RSP] <= unwindContext.Registers[PH_UNWIND_RSP]
+                    )
+                    goto SkipAmd64Stack;
+            }
+
+            context.Rip = unwindContext.Rip;
+            memcpy(&context.Rax, unwindContext.Registers, sizeof(unwindContext.Registers));
+        }
+
         memset(&stackFrame, 0, sizeof(STACKFRAME64));
         stackFrame.AddrPC.Mode = AddrModeFlat;
         stackFrame.AddrPC.Offset = context.Rip;
@@ -2434,6 +2593,13 @@ SkipAmd64Stack:
 SkipI386Stack:
 
 ResumeExit:
+#ifdef _M_X64
+    PhDeleteUnwindState(&unwindState);
+
+    if (unwindCache && unwindCache != UnwindCache)
+        PhDereferenceObject(unwindCache);
+#endif
+
     if (suspended)
         NtResumeThread(ThreadHandle, NULL);
 
@@ -4740,6 +4906,257 @@ NTSTATUS PhEnumProcessesEx(
     return status;
 }
 
+FORCEINLINE ULONG PhpGetProcessSnapshotSizeHint(
+    VOID
+    )
+{
+    return (ULONG)*(volatile LONG *)&PhProcessSnapshotSizeHint;
+}
+
+/**
+ * Takes a snapshot of the running processes.
+ *
+ * \param Snapshot A variable which receives the snapshot. You must
+ * dereference the snapshot using PhDereferenceObject() when you no
+ * longer need it.
+ *
+ * \remarks The snapshot is not shared with other callers until it is
+ * passed to PhPublishProcessSnapshot(). Until then, the caller may
+ * modify the process information in the buffer.
+ */
+NTSTATUS PhCreateProcessSnapshot(
+    _Out_ PPH_PROCESS_SNAPSHOT *Snapshot
+    )
+{
+    NTSTATUS status;
+    PPH_PROCESS_SNAPSHOT snapshot;
+    PVOID buffer;
+    ULONG bufferSize;
+    ULONG sizeHint;
+    ULONG returnLength;
+    ULONG i;
+
+    if (PhBeginInitOnce(&PhProcessSnapshotInitOnce))
+    {
+        PhCreateObjectType(&PhProcessSnapshotType, L"ProcessSnapshot", 0, PhpProcessSnapshotDeleteProcedure);
+        PhEndInitOnce(&PhProcessSnapshotInitOnce);
+    }
+
+    // Take a buffer released by an old snapshot, if there is one.
+
+    buffer = NULL;
+    bufferSize = 0;
+
+    PhAcquireQueuedLockExclusive(&PhProcessSnapshotLock);
+
+    for (i = 0; i < PH_PROCESS_SNAPSHOT_SPARE_BUFFERS; i++)
+    {
+        if (PhProcessSnapshotSpareBuffers[i])
+        {
+            buffer = PhProcessSnapshotSpareBuffers[i];
+            bufferSize = PhProcessSnapshotSpareBufferSizes[i];
+            PhProcessSnapshotSpareBuffers[i] = NULL;
+            break;
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhProcessSnapshotLock);
+
+    sizeHint = PhpGetProcessSnapshotSizeHint();
+
+    if (bufferSize < sizeHint)
+    {
+        if (buffer)
+            PhFree(buffer);
+
+        bufferSize = sizeHint;
+        buffer = PhAllocate(bufferSize);
+    }
+
+    while (TRUE)
+    {
+        status = NtQuerySystemInformation(
+            SystemProcessInformation,
+            buffer,
+            bufferSize,
+            &returnLength
+            );
+
+        if (status == STATUS_BUFFER_TOO_SMALL || status == STATUS_INFO_LENGTH_MISMATCH)
+        {
+            // Leave some room so that a few new processes don't cause another
+            // retry on the next query.
+            PhFree(buffer);
+            bufferSize = returnLength + returnLength / 8;
+            buffer = PhAllocate(bufferSize);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    _InterlockedExchange(&PhProcessSnapshotSizeHint, (LONG)(returnLength + returnLength / 8));
+
+    if (!NT_SUCCESS(status = PhCreateObject(&snapshot, sizeof(PH_PROCESS_SNAPSHOT), 0, PhProcessSnapshotType)))
+    {
+        PhFree(buffer);
+        return status;
+    }
+
+    snapshot->Processes = buffer;
+    snapshot->BufferSize = bufferSize;
+    PhQuerySystemTime(&snapshot->QueryTime);
+
+    *Snapshot = snapshot;
+
+    return status;
+}
+
+VOID NTAPI PhpProcessSnapshotDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_PROCESS_SNAPSHOT snapshot = Object;
+    ULONG i;
+
+    // Keep the buffer for the next snapshot unless it is much larger than
+    // what is currently needed.
+    if (snapshot->BufferSize <= PhpGetProcessSnapshotSizeHint() * 4)
+    {
+        PhAcquireQueuedLockExclusive(&PhProcessSnapshotLock);
+
+        for (i = 0; i < PH_PROCESS_SNAPSHOT_SPARE_BUFFERS; i++)
+        {
+            if (!PhProcessSnapshotSpareBuffers[i])
+            {
+                PhProcessSnapshotSpareBuffers[i] = snapshot->Processes;
+                PhProcessSnapshotSpareBufferSizes[i] = snapshot->BufferSize;
+                snapshot->Processes = NULL;
+                break;
+            }
+        }
+
+        PhReleaseQueuedLockExclusive(&PhProcessSnapshotLock);
+    }
+
+    if (snapshot->Processes)
+        PhFree(snapshot->Processes);
+}
+
+/**
+ * Makes a snapshot the current process snapshot.
+ *
+ * \param Snapshot The snapshot to publish. The snapshot must not be
+ * modified after it has been published.
+ *
+ * \remarks The function has no effect if the current snapshot is newer.
+ */
+VOID PhPublishProcessSnapshot(
+    _In_ PPH_PROCESS_SNAPSHOT Snapshot
+    )
+{
+    PPH_PROCESS_SNAPSHOT oldSnapshot;
+
+    PhReferenceObject(Snapshot);
+
+    PhAcquireQueuedLockExclusive(&PhProcessSnapshotLock);
+
+    oldSnapshot = PhCurrentProcessSnapshot;
+
+    if (!oldSnapshot || oldSnapshot->QueryTime.QuadPart <= Snapshot->QueryTime.QuadPart)
+    {
+        PhCurrentProcessSnapshot = Snapshot;
+    }
+    else
+    {
+        oldSnapshot = Snapshot;
+    }
+
+    PhReleaseQueuedLockExclusive(&PhProcessSnapshotLock);
+
+    // Dereference outside of the lock because the delete procedure acquires it.
+    if (oldSnapshot)
+        PhDereferenceObject(oldSnapshot);
+}
+
+/**
+ * Gets the current process snapshot.
+ *
+ * \return The current snapshot, or NULL if no snapshot has been
+ * published. You must dereference the snapshot using
+ * PhDereferenceObject() when you no longer need it.
+ */
+PPH_PROCESS_SNAPSHOT PhReferenceProcessSnapshot(
+    VOID
+    )
+{
+    PPH_PROCESS_SNAPSHOT snapshot;
+
+    PhAcquireQueuedLockShared(&PhProcessSnapshotLock);
+
+    snapshot = PhCurrentProcessSnapshot;
+
+    if (snapshot)
+        PhReferenceObject(snapshot);
+
+    PhReleaseQueuedLockShared(&PhProcessSnapshotLock);
+
+    return snapshot;
+}
+
+/**
+ * Gets a recent snapshot of the running processes.
+ *
+ * \param MaximumAge The maximum age of the snapshot, in milliseconds.
+ * If the current snapshot is older than this, a new snapshot is taken
+ * and published.
+ * \param Snapshot A variable which receives the snapshot. You must
+ * dereference the snapshot using PhDereferenceObject() when you no
+ * longer need it. The snapshot must not be modified.
+ *
+ * \remarks Use this function instead of PhEnumProcesses() when the
+ * information does not need to be current. The process provider
+ * publishes a new snapshot on every update.
+ */
+NTSTATUS PhGetProcessSnapshot(
+    _In_ ULONG MaximumAge,
+    _Out_ PPH_PROCESS_SNAPSHOT *Snapshot
+    )
+{
+    NTSTATUS status;
+    PPH_PROCESS_SNAPSHOT snapshot;
+    LARGE_INTEGER currentTime;
+
+    if (snapshot = PhReferenceProcessSnapshot())
+    {
+        PhQuerySystemTime(&currentTime);
+
+        if (currentTime.QuadPart - snapshot->QueryTime.QuadPart <= (LONG64)MaximumAge * PH_TICKS_PER_MS)
+        {
+            *Snapshot = snapshot;
+            return STATUS_SUCCESS;
+        }
+
+        PhDereferenceObject(snapshot);
+    }
+
+    if (!NT_SUCCESS(status = PhCreateProcessSnapshot(&snapshot)))
+        return status;
+
+    PhPublishProcessSnapshot(snapshot);
+    *Snapshot = snapshot;
+
+    return status;
+}
+
 /**
  * Enumerates the running processes for a session.
  *
@@ -5608,6 +6025,425 @@ VOID PhInitializeDevicePrefixes(
         PhDevicePrefixes[i].Buffer = (PWCHAR)buffer;
         buffer += PH_DEVICE_PREFIX_LENGTH * sizeof(WCHAR);
     }
+
+    PhRegisterQueuedLockProfile(&PhDevicePrefixesLock, L"PhDevicePrefixesLock");
+}
+
+FORCEINLINE WCHAR PhpUpcaseDevicePrefixChar(
+    _In_ WCHAR Character
+    )
+{
+    if (Character < 'a')
+        return Character;
+    else if (Character <= 'z')
+        return Character - ('a' - 'A');
+    else if (Character < 0x80)
+        return Character;
+    else
+        return RtlUpcaseUnicodeChar(Character);
+}
+
+static INT PhpCompareDevicePrefixRules(
+    _In_ PPH_DEVICE_PREFIX_RULE Rule1,
+    _In_ PPH_DEVICE_PREFIX_RULE Rule2
+    )
+{
+    SIZE_T length1 = Rule1->Prefix.Length / sizeof(WCHAR);
+    SIZE_T length2 = Rule2->Prefix.Length / sizeof(WCHAR);
+    SIZE_T i;
+
+    for (i = 0; i < length1 && i < length2; i++)
+    {
+        WCHAR c1 = PhpUpcaseDevicePrefixChar(Rule1->Prefix.Buffer[i]);
+        WCHAR c2 = PhpUpcaseDevicePrefixChar(Rule2->Prefix.Buffer[i]);
+
+        if (c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+
+    return uintcmp((ULONG)length1, (ULONG)length2);
+}
+
+/**
+ * Builds a trie node for a range of sorted rules whose prefixes share
+ * the first \a Depth characters.
+ */
+static VOID PhpBuildDevicePrefixTrieNode(
+    _Inout_ PPH_DEVICE_PREFIX_TRIE Trie,
+    _In_ ULONG NodeIndex,
+    _In_ ULONG Depth,
+    _In_ ULONG First,
+    _In_ ULONG Last
+    )
+{
+    PPH_DEVICE_PREFIX_TRIE_NODE node = &Trie->Nodes[NodeIndex];
+    ULONG i;
+    ULONG j;
+    ULONG k;
+
+    node->Rule = PH_DEVICE_PREFIX_TRIE_NO_RULE;
+    node->NumberOfChildren = 0;
+    node->FirstChild = 0;
+
+    i = First;
+
+    // Rules which end at this node sort before the longer ones. If there are duplicates, the rule
+    // which was added first wins.
+    if (i < Last && Trie->Rules[i].Prefix.Length / sizeof(WCHAR) == Depth)
+    {
+        node->Rule = (USHORT)i;
+
+        while (i < Last && Trie->Rules[i].Prefix.Length / sizeof(WCHAR) == Depth)
+            i++;
+    }
+
+    for (j = i; j < Last; node->NumberOfChildren++)
+    {
+        WCHAR c = PhpUpcaseDevicePrefixChar(Trie->Rules[j].Prefix.Buffer[Depth]);
+
+        while (j < Last && PhpUpcaseDevicePrefixChar(Trie->Rules[j].Prefix.Buffer[Depth]) == c)
+            j++;
+    }
+
+    // Children are allocated contiguously so lookups can binary search them.
+    node->FirstChild = Trie->NumberOfNodes;
+    Trie->NumberOfNodes += node->NumberOfChildren;
+
+    for (j = i, k = node->FirstChild; j < Last; k++)
+    {
+        WCHAR c = PhpUpcaseDevicePrefixChar(Trie->Rules[j].Prefix.Buffer[Depth]);
+        ULONG start = j;
+
+        while (j < Last && PhpUpcaseDevicePrefixChar(Trie->Rules[j].Prefix.Buffer[Depth]) == c)
+            j++;
+
+        Trie->Nodes[k].Character = c;
+        PhpBuildDevicePrefixTrieNode(Trie, k, Depth + 1, start, j);
+    }
+}
+
+/**
+ * Creates a device prefix trie.
+ *
+ * \param Rules An array of rules, in order of priority. The strings are copied
+ * into the trie.
+ * \param NumberOfRules The number of rules.
+ *
+ * \return The trie, which must be freed using PhFree().
+ */
+static PPH_DEVICE_PREFIX_TRIE PhpCreateDevicePrefixTrie(
+    _In_ PPH_DEVICE_PREFIX_RULE Rules,
+    _In_ ULONG NumberOfRules
+    )
+{
+    PPH_DEVICE_PREFIX_TRIE trie;
+    SIZE_T stringLength;
+    ULONG maximumNodes;
+    PWCHAR buffer;
+    ULONG i;
+    ULONG j;
+
+    stringLength = 0;
+    maximumNodes = 1;
+
+    for (i = 0; i < NumberOfRules; i++)
+    {
+        stringLength += Rules[i].Prefix.Length + Rules[i].Replacement.Length;
+        maximumNodes += (ULONG)(Rules[i].Prefix.Length / sizeof(WCHAR));
+    }
+
+    // Allocate the rules, nodes and strings as one block.
+    trie = PhAllocate(
+        sizeof(PH_DEVICE_PREFIX_TRIE) +
+        sizeof(PH_DEVICE_PREFIX_RULE) * NumberOfRules +
+        sizeof(PH_DEVICE_PREFIX_TRIE_NODE) * maximumNodes +
+        stringLength
+        );
+    trie->NumberOfRules = NumberOfRules;
+    trie->Rules = (PPH_DEVICE_PREFIX_RULE)(trie + 1);
+    trie->NumberOfNodes = 1;
+    trie->Nodes = (PPH_DEVICE_PREFIX_TRIE_NODE)(trie->Rules + NumberOfRules);
+    buffer = (PWCHAR)(trie->Nodes + maximumNodes);
+
+    for (i = 0; i < NumberOfRules; i++)
+    {
+        PH_DEVICE_PREFIX_RULE rule;
+
+        rule.Prefix.Buffer = buffer;
+        rule.Prefix.Length = Rules[i].Prefix.Length;
+        memcpy(buffer, Rules[i].Prefix.Buffer, Rules[i].Prefix.Length);
+        buffer = PTR_ADD_OFFSET(buffer, Rules[i].Prefix.Length);
+
+        rule.Replacement.Buffer = buffer;
+        rule.Replacement.Length = Rules[i].Replacement.Length;
+        memcpy(buffer, Rules[i].Replacement.Buffer, Rules[i].Replacement.Length);
+        buffer = PTR_ADD_OFFSET(buffer, Rules[i].Replacement.Length);
+
+        rule.Flags = Rules[i].Flags;
+
+        // Insertion sort. This keeps rules with equal prefixes in order of priority.
+        for (j = i; j > 0 && PhpCompareDevicePrefixRules(&trie->Rules[j - 1], &rule) > 0; j--)
+            trie->Rules[j] = trie->Rules[j - 1];
+
+        trie->Rules[j] = rule;
+    }
+
+    trie->Nodes[0].Character = 0;
+    PhpBuildDevicePrefixTrieNode(trie, 0, 0, 0, NumberOfRules);
+
+    return trie;
+}
+
+static BOOLEAN PhpEqualDevicePrefixTries(
+    _In_ PPH_DEVICE_PREFIX_TRIE Trie1,
+    _In_ PPH_DEVICE_PREFIX_TRIE Trie2
+    )
+{
+    ULONG i;
+
+    if (Trie1->NumberOfRules != Trie2->NumberOfRules)
+        return FALSE;
+
+    for (i = 0; i < Trie1->NumberOfRules; i++)
+    {
+        if (
+            Trie1->Rules[i].Flags != Trie2->Rules[i].Flags ||
+            !PhEqualStringRef(&Trie1->Rules[i].Prefix, &Trie2->Rules[i].Prefix, FALSE) ||
+            !PhEqualStringRef(&Trie1->Rules[i].Replacement, &Trie2->Rules[i].Replacement, FALSE)
+            )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Builds a new device prefix trie from the current DOS device and network
+ * provider prefixes, and publishes it if it differs from the current one.
+ */
+static VOID PhpPublishDevicePrefixTrie(
+    VOID
+    )
+{
+    static PH_STRINGREF backslash = PH_STRINGREF_INIT(L"\\");
+    static PH_STRINGREF empty = PH_STRINGREF_INIT(L"");
+    static PH_STRINGREF dosDevicesPrefix = PH_STRINGREF_INIT(L"\\??\\");
+    static PH_STRINGREF systemRootPrefix = PH_STRINGREF_INIT(L"\\SystemRoot");
+    static PH_STRINGREF windowsPrefix = PH_STRINGREF_INIT(L"\\Windows");
+
+    PH_DEVICE_PREFIX_RULE rules[26 + PH_DEVICE_MUP_PREFIX_MAX_COUNT + 3];
+    ULONG numberOfRules = 0;
+    WCHAR driveNames[26][2];
+    WCHAR systemDriveName[2];
+    PH_STRINGREF systemRoot;
+    PPH_DEVICE_PREFIX_TRIE trie;
+    PPH_DEVICE_PREFIX_TRIE oldTrie;
+    ULONG i;
+
+    PhAcquireQueuedLockExclusive(&PhDevicePrefixTriePublishLock);
+
+    PhAcquireQueuedLockShared(&PhDevicePrefixesLock);
+    PhAcquireQueuedLockShared(&PhDeviceMupPrefixesLock);
+
+    // DOS devices: \Device\HarddiskVolume1\path -> C:\path
+    for (i = 0; i < 26; i++)
+    {
+        if (PhDevicePrefixes[i].Length != 0)
+        {
+            driveNames[i][0] = (WCHAR)('A' + i);
+            driveNames[i][1] = ':';
+            PhUnicodeStringToStringRef(&PhDevicePrefixes[i], &rules[numberOfRules].Prefix);
+            rules[numberOfRules].Replacement.Buffer = driveNames[i];
+            rules[numberOfRules].Replacement.Length = sizeof(driveNames[i]);
+            rules[numberOfRules].Flags = PH_DEVICE_PREFIX_RULE_SEPARATOR_OR_END;
+            numberOfRules++;
+        }
+    }
+
+    // Network providers: \Device\Mup\server\share -> \\server\share
+    // Don't resolve if the name *is* the prefix. Otherwise, we will end up with a useless
+    // string like "\".
+    for (i = 0; i < PhDeviceMupPrefixesCount; i++)
+    {
+        if (PhDeviceMupPrefixes[i]->Length != 0)
+        {
+            rules[numberOfRules].Prefix = PhDeviceMupPrefixes[i]->sr;
+            rules[numberOfRules].Replacement = backslash;
+            rules[numberOfRules].Flags = PH_DEVICE_PREFIX_RULE_SEPARATOR;
+            numberOfRules++;
+        }
+    }
+
+    // "\??\" refers to \GLOBAL??\. Just remove it. This takes precedence over DOS devices
+    // which link to "\??\" paths, such as drives created using subst.
+    rules[numberOfRules].Prefix = dosDevicesPrefix;
+    rules[numberOfRules].Replacement = empty;
+    rules[numberOfRules].Flags = PH_DEVICE_PREFIX_RULE_FILE_NAME_ONLY | PH_DEVICE_PREFIX_RULE_STOP;
+    numberOfRules++;
+
+    // "\SystemRoot" means "C:\Windows".
+    PhGetSystemRoot(&systemRoot);
+    rules[numberOfRules].Prefix = systemRootPrefix;
+    rules[numberOfRules].Replacement = systemRoot;
+    rules[numberOfRules].Flags = PH_DEVICE_PREFIX_RULE_FILE_NAME_ONLY | PH_DEVICE_PREFIX_RULE_STOP;
+    numberOfRules++;
+
+    // If nothing else matches and the file name starts with "\Windows", prepend the system drive.
+    systemDriveName[0] = USER_SHARED_DATA->NtSystemRoot[0];
+    systemDriveName[1] = ':';
+    rules[numberOfRules].Prefix = windowsPrefix;
+    rules[numberOfRules].Replacement.Buffer = systemDriveName;
+    rules[numberOfRules].Replacement.Length = sizeof(systemDriveName);
+    rules[numberOfRules].Flags = PH_DEVICE_PREFIX_RULE_FILE_NAME_ONLY | PH_DEVICE_PREFIX_RULE_KEEP_PREFIX;
+    numberOfRules++;
+
+    trie = PhpCreateDevicePrefixTrie(rules, numberOfRules);
+
+    PhReleaseQueuedLockShared(&PhDeviceMupPrefixesLock);
+    PhReleaseQueuedLockShared(&PhDevicePrefixesLock);
+
+    oldTrie = PhDevicePrefixTrie;
+
+    if (oldTrie && PhpEqualDevicePrefixTries(oldTrie, trie))
+    {
+        // Nothing changed (this is the common case).
+        PhFree(trie);
+    }
+    else
+    {
+        _InterlockedExchangePointer((PVOID *)&PhDevicePrefixTrie, trie);
+
+        // Lookups do not take a lock, so there is no way to tell when a lookup has stopped
+        // using the old trie. It is kept alive instead of being freed. The prefixes only
+        // change when drives are mounted or network providers change, so very few tries
+        // are ever retired.
+        if (oldTrie)
+        {
+            if (!PhDevicePrefixRetiredTries)
+                PhDevicePrefixRetiredTries = PhCreateList(4);
+
+            PhAddItemList(PhDevicePrefixRetiredTries, oldTrie);
+        }
+    }
+
+    PhReleaseQueuedLockExclusive(&PhDevicePrefixTriePublishLock);
+}
+
+FORCEINLINE PPH_DEVICE_PREFIX_TRIE PhpGetDevicePrefixTrie(
+    VOID
+    )
+{
+    if (PhBeginInitOnce(&PhDevicePrefixesInitOnce))
+    {
+        PhInitializeDevicePrefixes();
+        PhUpdateDosDevicePrefixes();
+        PhUpdateMupDevicePrefixes();
+
+        PhEndInitOnce(&PhDevicePrefixesInitOnce);
+    }
+
+    return *(PPH_DEVICE_PREFIX_TRIE volatile *)&PhDevicePrefixTrie;
+}
+
+/**
+ * Finds the rule with the longest prefix that applies to a name.
+ *
+ * \param Trie The device prefix trie.
+ * \param Name The name.
+ * \param FileName TRUE to include rules that only apply to file names.
+ */
+static PPH_DEVICE_PREFIX_RULE PhpFindDevicePrefixRule(
+    _In_ PPH_DEVICE_PREFIX_TRIE Trie,
+    _In_ PPH_STRINGREF Name,
+    _In_ BOOLEAN FileName
+    )
+{
+    PPH_DEVICE_PREFIX_RULE bestRule = NULL;
+    PPH_DEVICE_PREFIX_TRIE_NODE node;
+    SIZE_T count;
+    SIZE_T i;
+
+    node = &Trie->Nodes[0];
+    count = Name->Length / sizeof(WCHAR);
+    i = 0;
+
+    while (TRUE)
+    {
+        WCHAR c;
+        ULONG low;
+        ULONG high;
+
+        if (node->Rule != PH_DEVICE_PREFIX_TRIE_NO_RULE)
+        {
+            PPH_DEVICE_PREFIX_RULE rule = &Trie->Rules[node->Rule];
+            BOOLEAN applies;
+
+            if ((rule->Flags & PH_DEVICE_PREFIX_RULE_FILE_NAME_ONLY) && !FileName)
+                applies = FALSE;
+            else if (rule->Flags & PH_DEVICE_PREFIX_RULE_SEPARATOR_OR_END)
+                applies = i == count || Name->Buffer[i] == '\\';
+            else if (rule->Flags & PH_DEVICE_PREFIX_RULE_SEPARATOR)
+                applies = i != count && Name->Buffer[i] == '\\';
+            else
+                applies = TRUE;
+
+            if (applies)
+            {
+                bestRule = rule;
+
+                if (rule->Flags & PH_DEVICE_PREFIX_RULE_STOP)
+                    break;
+            }
+        }
+
+        if (i == count || node->NumberOfChildren == 0)
+            break;
+
+        c = PhpUpcaseDevicePrefixChar(Name->Buffer[i]);
+        low = node->FirstChild;
+        high = node->FirstChild + node->NumberOfChildren;
+
+        while (low < high)
+        {
+            ULONG middle = (low + high) / 2;
+
+            if (Trie->Nodes[middle].Character < c)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if (low == node->FirstChild + node->NumberOfChildren || Trie->Nodes[low].Character != c)
+            break;
+
+        node = &Trie->Nodes[low];
+        i++;
+    }
+
+    return bestRule;
+}
+
+static PPH_STRING PhpApplyDevicePrefixRule(
+    _In_ PPH_DEVICE_PREFIX_RULE Rule,
+    _In_ PPH_STRINGREF Name
+    )
+{
+    PPH_STRING newName;
+    PH_STRINGREF remainingPart;
+
+    remainingPart = *Name;
+
+    if (!(Rule->Flags & PH_DEVICE_PREFIX_RULE_KEEP_PREFIX))
+    {
+        remainingPart.Buffer = PTR_ADD_OFFSET(remainingPart.Buffer, Rule->Prefix.Length);
+        remainingPart.Length -= Rule->Prefix.Length;
+    }
+
+    newName = PhCreateStringEx(NULL, Rule->Replacement.Length + remainingPart.Length);
+    memcpy(newName->Buffer, Rule->Replacement.Buffer, Rule->Replacement.Length);
+    memcpy(PTR_ADD_OFFSET(newName->Buffer, Rule->Replacement.Length), remainingPart.Buffer, remainingPart.Length);
+
+    return newName;
 }
 
 VOID PhUpdateMupDevicePrefixes(
@@ -5706,6 +6542,8 @@ VOID PhUpdateMupDevicePrefixes(
     PhReleaseQueuedLockExclusive(&PhDeviceMupPrefixesLock);
 
     PhDereferenceObject(providerOrder);
+
+    PhpPublishDevicePrefixTrie();
 }
 
 /**
@@ -5759,9 +6597,13 @@ VOID PhUpdateDosDevicePrefixes(
         }
         else
         {
+            PhAcquireQueuedLockExclusive(&PhDevicePrefixesLock);
             PhDevicePrefixes[i].Length = 0;
+            PhReleaseQueuedLockExclusive(&PhDevicePrefixesLock);
         }
     }
+
+    PhpPublishDevicePrefixTrie();
 }
 
 /**
@@ -5777,103 +6619,14 @@ PPH_STRING PhResolveDevicePrefix(
     _In_ PPH_STRING Name
     )
 {
-    ULONG i;
+    PPH_DEVICE_PREFIX_TRIE trie;
+    PPH_DEVICE_PREFIX_RULE rule;
     PPH_STRING newName = NULL;
 
-    if (PhBeginInitOnce(&PhDevicePrefixesInitOnce))
-    {
-        PhInitializeDevicePrefixes();
-        PhUpdateDosDevicePrefixes();
-        PhUpdateMupDevicePrefixes();
-
-        PhEndInitOnce(&PhDevicePrefixesInitOnce);
-    }
-
-    // Go through the DOS devices and try to find a matching prefix.
-    for (i = 0; i < 26; i++)
-    {
-        BOOLEAN isPrefix = FALSE;
-        PH_STRINGREF prefix;
+    trie = PhpGetDevicePrefixTrie();
 
-        PhAcquireQueuedLockShared(&PhDevicePrefixesLock);
-
-        PhUnicodeStringToStringRef(&PhDevicePrefixes[i], &prefix);
-
-        if (prefix.Length != 0)
-        {
-            if (PhStartsWithStringRef(&Name->sr, &prefix, TRUE))
-            {
-                // To ensure we match the longest prefix, make sure the next character is a backslash or
-                // the path is equal to the prefix.
-                if (Name->Length == prefix.Length || Name->Buffer[prefix.Length / sizeof(WCHAR)] == '\\')
-                {
-                    isPrefix = TRUE;
-                }
-            }
-        }
-
-        PhReleaseQueuedLockShared(&PhDevicePrefixesLock);
-
-        if (isPrefix)
-        {
-            // <letter>:path
-            newName = PhCreateStringEx(NULL, 2 * sizeof(WCHAR) + Name->Length - prefix.Length);
-            newName->Buffer[0] = (WCHAR)('A' + i);
-            newName->Buffer[1] = ':';
-            memcpy(
-                &newName->Buffer[2],
-                &Name->Buffer[prefix.Length / sizeof(WCHAR)],
-                Name->Length - prefix.Length
-                );
-
-            break;
-        }
-    }
-
-    if (i == 26)
-    {
-        // Resolve network providers.
-
-        PhAcquireQueuedLockShared(&PhDeviceMupPrefixesLock);
-
-        for (i = 0; i < PhDeviceMupPrefixesCount; i++)
-        {
-            BOOLEAN isPrefix = FALSE;
-            SIZE_T prefixLength;
-
-            prefixLength = PhDeviceMupPrefixes[i]->Length;
-
-            if (prefixLength != 0)
-            {
-                if (PhStartsWithString(Name, PhDeviceMupPrefixes[i], TRUE))
-                {
-                    // To ensure we match the longest prefix, make sure the next character is a backslash.
-                    // Don't resolve if the name *is* the prefix. Otherwise, we will end up with a useless
-                    // string like "\".
-                    if (Name->Length != prefixLength && Name->Buffer[prefixLength / sizeof(WCHAR)] == '\\')
-                    {
-                        isPrefix = TRUE;
-                    }
-                }
-            }
-
-            if (isPrefix)
-            {
-                // \path
-                newName = PhCreateStringEx(NULL, 1 * sizeof(WCHAR) + Name->Length - prefixLength);
-                newName->Buffer[0] = '\\';
-                memcpy(
-                    &newName->Buffer[1],
-                    &Name->Buffer[prefixLength / sizeof(WCHAR)],
-                    Name->Length - prefixLength
-                    );
-
-                break;
-            }
-        }
-
-        PhReleaseQueuedLockShared(&PhDeviceMupPrefixesLock);
-    }
+    if (trie && (rule = PhpFindDevicePrefixRule(trie, &Name->sr, FALSE)))
+        newName = PhpApplyDevicePrefixRule(rule, &Name->sr);
 
     return newName;
 }
@@ -5896,57 +6649,25 @@ PPH_STRING PhGetFileName(
     _In_ PPH_STRING FileName
     )
 {
-    PPH_STRING newFileName;
-
-    newFileName = FileName;
+    PPH_DEVICE_PREFIX_TRIE trie;
+    PPH_DEVICE_PREFIX_RULE rule;
+    PPH_STRING newFileName = NULL;
 
-    // "\??\" refers to \GLOBAL??\. Just remove it.
-    if (PhStartsWithString2(FileName, L"\\??\\", FALSE))
-    {
-        newFileName = PhCreateStringEx(NULL, FileName->Length - 8);
-        memcpy(newFileName->Buffer, &FileName->Buffer[4], FileName->Length - 8);
-    }
-    // "\SystemRoot" means "C:\Windows".
-    else if (PhStartsWithString2(FileName, L"\\SystemRoot", TRUE))
+    // All of the rules apply to names beginning with a backslash. This includes "\??\",
+    // "\SystemRoot" and "\Windows" as well as the device prefixes.
+    if (FileName->Length != 0 && FileName->Buffer[0] == '\\')
     {
-        PH_STRINGREF systemRoot;
+        trie = PhpGetDevicePrefixTrie();
 
-        PhGetSystemRoot(&systemRoot);
-        newFileName = PhCreateStringEx(NULL, systemRoot.Length + FileName->Length - 22);
-        memcpy(newFileName->Buffer, systemRoot.Buffer, systemRoot.Length);
-        memcpy((PCHAR)newFileName->Buffer + systemRoot.Length, &FileName->Buffer[11], FileName->Length - 22);
+        if (trie && (rule = PhpFindDevicePrefixRule(trie, &FileName->sr, TRUE)))
+            newFileName = PhpApplyDevicePrefixRule(rule, &FileName->sr);
     }
-    else if (FileName->Length != 0 && FileName->Buffer[0] == '\\')
-    {
-        PPH_STRING resolvedName;
-
-        resolvedName = PhResolveDevicePrefix(FileName);
 
-        if (resolvedName)
-        {
-            newFileName = resolvedName;
-        }
-        else
-        {
-            // We didn't find a match.
-            // If the file name starts with "\Windows", prepend the system drive.
-            if (PhStartsWithString2(newFileName, L"\\Windows", TRUE))
-            {
-                newFileName = PhCreateStringEx(NULL, FileName->Length + 4);
-                newFileName->Buffer[0] = USER_SHARED_DATA->NtSystemRoot[0];
-                newFileName->Buffer[1] = ':';
-                memcpy(&newFileName->Buffer[2], FileName->Buffer, FileName->Length);
-            }
-            else
-            {
-                PhReferenceObject(newFileName);
-            }
-        }
-    }
-    else
+    if (!newFileName)
     {
         // Just return the supplied file name. Note that we need
         // to add a reference.
+        newFileName = FileName;
         PhReferenceObject(newFileName);
     }
 
@@ -41,9 +41,21 @@
  * when boosted, always run on the same provider thread. The other option
  * would be to have the boosting thread run the provider function
  * directly, which would involve unnecessary blocking and synchronization.
+ *
+ * By default every provider runs on every tick of its provider thread.
+ * A provider can be given its own interval, in which case it runs on
+ * the first tick at which it is due. A provider thread can also be
+ * given a per-tick budget. If running a due provider would exceed the
+ * budget, the run is deferred to a later tick as long as the provider
+ * can still meet its deadline; this spreads expensive providers across
+ * ticks. Deferred providers are run first in the next tick. The cost
+ * of each provider is estimated from its recent run times. Deferred
+ * runs are counted as skipped, and runs which start after their
+ * deadline are counted as late.
  */
 
 #include <ph.h>
+#include <phintrnl.h>
 
 #ifdef DEBUG
 PPH_LIST PhDbgProviderList;
@@ -69,6 +81,8 @@ VOID PhInitializeProviderThread(
     PhInitializeQueuedLock(&ProviderThread->Lock);
     InitializeListHead(&ProviderThread->ListHead);
     ProviderThread->BoostCount = 0;
+    ProviderThread->Budget = 0;
+    ProviderThread->Clock = NULL;
 
 #ifdef DEBUG
     PhAcquireQueuedLockExclusive(&PhDbgProviderListLock);
@@ -101,6 +115,69 @@ VOID PhDeleteProviderThread(
 #endif
 }
 
+static BOOLEAN PhpScheduleProvider(
+    _In_ PPH_PROVIDER_THREAD ProviderThread,
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG64 TickTime,
+    _In_ ULONG TickCost
+    )
+{
+    ULONG interval;
+    ULONG tolerance;
+    ULONG64 lateness;
+
+    interval = Registration->Interval != 0 ? Registration->Interval : ProviderThread->Interval;
+    // Ticks do not arrive exactly on time, so a provider which is due
+    // within half a tick is run now.
+    tolerance = ProviderThread->Interval / 2;
+
+    if (Registration->NextRunTime == 0)
+    {
+        // This is the first run.
+        Registration->NextRunTime = TickTime;
+        lateness = 0;
+    }
+    else
+    {
+        if (TickTime + tolerance < Registration->NextRunTime)
+            return FALSE;
+
+        lateness = TickTime > Registration->NextRunTime ? TickTime - Registration->NextRunTime : 0;
+    }
+
+    // Defer the run if it would exceed the budget for this tick, unless
+    // waiting for the next tick would miss the deadline. The first run
+    // in a tick is never deferred.
+    if (
+        ProviderThread->Budget != 0 &&
+        TickCost != 0 &&
+        TickCost + Registration->Cost > ProviderThread->Budget &&
+        lateness + ProviderThread->Interval <= Registration->Deadline
+        )
+    {
+        Registration->Deferred = TRUE;
+        Registration->SkippedRuns++;
+        PHLIB_INC_STATISTIC(ProvProviderSkippedRuns);
+        return FALSE;
+    }
+
+    Registration->Deferred = FALSE;
+
+    if (lateness > (ULONG64)Registration->Deadline + tolerance)
+    {
+        Registration->LateRuns++;
+        PHLIB_INC_STATISTIC(ProvProviderLateRuns);
+    }
+
+    // Keep the phase of the schedule unless a whole interval was missed.
+    if (lateness < interval)
+        Registration->NextRunTime += interval;
+    else
+        Registration->NextRunTime = TickTime + interval;
+
+    return TRUE;
+}
+
 NTSTATUS NTAPI PhpProviderThreadStart(
     _In_ PVOID Parameter
     )
@@ -112,6 +189,18 @@ NTSTATUS NTAPI PhpProviderThreadStart(
     PPH_PROVIDER_FUNCTION providerFunction;
     PVOID object;
     LIST_ENTRY tempListHead;
+    LIST_ENTRY deferredListHead;
+    ULONG64 startTimestamp;
+    ULONG64 tickStartTime;
+    ULONG64 runStartTime;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER runStartCounter;
+    LARGE_INTEGER runEndCounter;
+    ULONG64 tickTime;
+    ULONG tickCost;
+    ULONG runCost;
+
+    NtQueryPerformanceCounter(&runStartCounter, &frequency);
 
     while (providerThread->State != ProviderThreadStopping)
     {
@@ -127,6 +216,9 @@ NTSTATUS NTAPI PhpProviderThreadStart(
         // must be in a list (main list or the temp list).
 
         InitializeListHead(&tempListHead);
+        tickStartTime = PhBeginTraceSpan();
+        tickTime = providerThread->Clock ? providerThread->Clock() : NtGetTickCount64();
+        tickCost = 0;
 
         PhAcquireQueuedLockExclusive(&providerThread->Lock);
 
@@ -166,6 +258,8 @@ NTSTATUS NTAPI PhpProviderThreadStart(
             {
                 if (!registration->Enabled || registration->Unregistering)
                     continue;
+                if (!PhpScheduleProvider(providerThread, registration, tickTime, tickCost))
+                    continue;
             }
             else
             {
@@ -188,6 +282,7 @@ NTSTATUS NTAPI PhpProviderThreadStart(
                 assert(registration->Boosting);
                 registration->Boosting = FALSE;
                 providerThread->BoostCount--;
+                PHLIB_INC_STATISTIC(ProvProviderBoostedRuns);
             }
 
             providerFunction = registration->Function;
@@ -199,15 +294,45 @@ NTSTATUS NTAPI PhpProviderThreadStart(
             registration->RunId++;
 
             PhReleaseQueuedLockExclusive(&providerThread->Lock);
+
+            PHLIB_INC_STATISTIC(ProvProviderRuns);
+            startTimestamp = PHLIB_STATISTIC_TIMESTAMP();
+            runStartTime = PhBeginTraceSpan();
+            NtQueryPerformanceCounter(&runStartCounter, NULL);
             providerFunction(object);
+            NtQueryPerformanceCounter(&runEndCounter, NULL);
+            PHLIB_ADD_STATISTIC_TIME(ProvProviderRunTime, startTimestamp);
+
+            // Provider runs are named by their function, which is resolved when the trace
+            // is exported.
+            if (runStartTime != 0)
+                PhRecordTraceSpan(L"provider", NULL, providerFunction, runStartTime);
+
             PhAcquireQueuedLockExclusive(&providerThread->Lock);
 
             if (object)
                 PhDereferenceObject(object);
+
+            runCost = (ULONG)((runEndCounter.QuadPart - runStartCounter.QuadPart) * 1000000 / frequency.QuadPart);
+
+            if (status != STATUS_ALERTED)
+                tickCost += runCost;
+
+            // The registration may have been unregistered (and freed) while the provider
+            // was running. In that case it is no longer at the end of the temp list.
+            if (tempListHead.Blink == &registration->ListEntry)
+            {
+                if (registration->Cost != 0)
+                    registration->Cost = (registration->Cost * 3 + runCost) / 4;
+                else
+                    registration->Cost = runCost;
+            }
         }
 
         // Re-add the items in the temp list to the main list.
 
+        InitializeListHead(&deferredListHead);
+
         while ((listEntry = RemoveHeadList(&tempListHead)) != &tempListHead)
         {
             registration = CONTAINING_RECORD(listEntry, PH_PROVIDER_REGISTRATION, ListEntry);
@@ -216,14 +341,32 @@ NTSTATUS NTAPI PhpProviderThreadStart(
             // the condition that boosted providers are always in front of normal providers.
             // This occurs when the timer is signaled just before a boosting provider alerts
             // our thread.
-            if (!registration->Boosting)
-                InsertTailList(&providerThread->ListHead, listEntry);
-            else
+            if (registration->Boosting)
                 InsertHeadList(&providerThread->ListHead, listEntry);
+            else if (registration->Deferred)
+                InsertTailList(&deferredListHead, listEntry);
+            else
+                InsertTailList(&providerThread->ListHead, listEntry);
         }
 
+        // Deferred providers are inserted after the boosted providers but in front of the
+        // normal providers, so they run first in the next tick.
+
+        listEntry = providerThread->ListHead.Flink;
+
+        while (listEntry != &providerThread->ListHead &&
+            CONTAINING_RECORD(listEntry, PH_PROVIDER_REGISTRATION, ListEntry)->Boosting)
+        {
+            listEntry = listEntry->Flink;
+        }
+
+        while (!IsListEmpty(&deferredListHead))
+            InsertTailList(listEntry, RemoveHeadList(&deferredListHead));
+
         PhReleaseQueuedLockExclusive(&providerThread->Lock);
 
+        PhEndTraceSpan(L"provider", status == STATUS_ALERTED ? L"Boost" : L"Tick", tickStartTime);
+
         // Perform an alertable wait so we can be woken up by
         // someone telling us to boost providers, or to terminate.
         status = NtWaitForSingleObject(
@@ -311,6 +454,42 @@ VOID PhSetIntervalProviderThread(
     }
 }
 
+/**
+ * Sets the per-tick budget for a provider thread.
+ *
+ * \param ProviderThread A pointer to a provider thread object.
+ * \param Budget The maximum total run time of the providers in
+ * each tick, in microseconds, or 0 for no budget. Providers which
+ * would exceed the budget are deferred to later ticks if their
+ * deadlines allow it.
+ */
+VOID PhSetBudgetProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_ ULONG Budget
+    )
+{
+    ProviderThread->Budget = Budget;
+}
+
+/**
+ * Sets the clock used to schedule the providers of a provider thread.
+ *
+ * \param ProviderThread A pointer to a provider thread object.
+ * \param Clock A function which returns the current time in
+ * milliseconds, or NULL to use the system tick count. The function
+ * is called once at the start of each tick.
+ *
+ * \remarks This function is intended for testing, and must not be
+ * called while the provider thread is running.
+ */
+VOID PhSetClockProviderThread(
+    _Inout_ PPH_PROVIDER_THREAD ProviderThread,
+    _In_opt_ PPH_PROVIDER_CLOCK_FUNCTION Clock
+    )
+{
+    ProviderThread->Clock = Clock;
+}
+
 /**
  * Registers a provider with a provider thread.
  *
@@ -339,6 +518,13 @@ VOID PhRegisterProvider(
     Registration->Enabled = FALSE;
     Registration->Unregistering = FALSE;
     Registration->Boosting = FALSE;
+    Registration->Interval = 0;
+    Registration->Deadline = 0;
+    Registration->Cost = 0;
+    Registration->NextRunTime = 0;
+    Registration->Deferred = FALSE;
+    Registration->SkippedRuns = 0;
+    Registration->LateRuns = 0;
 
     if (Object)
         PhReferenceObject(Object);
@@ -491,5 +677,57 @@ VOID PhSetEnabledProvider(
     _In_ BOOLEAN Enabled
     )
 {
-    Registration->Enabled = Enabled;
+    PPH_PROVIDER_THREAD providerThread;
+
+    if (Enabled && !Registration->Enabled)
+    {
+        providerThread = Registration->ProviderThread;
+
+        // Restart the schedule, so the time the provider was disabled
+        // is not counted as lateness.
+        PhAcquireQueuedLockExclusive(&providerThread->Lock);
+        Registration->NextRunTime = 0;
+        Registration->Deferred = FALSE;
+        Registration->Enabled = TRUE;
+        PhReleaseQueuedLockExclusive(&providerThread->Lock);
+    }
+    else
+    {
+        Registration->Enabled = Enabled;
+    }
+}
+
+/**
+ * Sets how often a provider is run.
+ *
+ * \param Registration A pointer to the registration object for
+ * a provider.
+ * \param Interval The interval between each run, in milliseconds,
+ * or 0 to run the provider on every tick of its provider thread.
+ * \param Deadline The time by which a run may be deferred after it
+ * is due, in milliseconds. Use 0 if runs must never be deferred.
+ * \param Cost An estimate of the run time of the provider, in
+ * microseconds, or 0 if unknown. The estimate is refined as the
+ * provider runs.
+ */
+VOID PhSetScheduleProvider(
+    _Inout_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG Interval,
+    _In_ ULONG Deadline,
+    _In_ ULONG Cost
+    )
+{
+    PPH_PROVIDER_THREAD providerThread;
+
+    providerThread = Registration->ProviderThread;
+
+    PhAcquireQueuedLockExclusive(&providerThread->Lock);
+
+    Registration->Interval = Interval;
+    Registration->Deadline = Deadline;
+    Registration->Cost = Cost;
+    Registration->NextRunTime = 0;
+    Registration->Deferred = FALSE;
+
+    PhReleaseQueuedLockExclusive(&providerThread->Lock);
 }
@@ -73,7 +73,15 @@
  *
  * Blocking is implemented through a process-wide keyed event.
  * A spin count is also used before blocking on the keyed
- * event.
+ * event. By default the spin count adapts to each lock: waiters
+ * that are woken while spinning move the lock's budget towards
+ * twice the number of iterations they needed, which tracks recent
+ * hold times, while waiters that give up and block halve it. A
+ * spinner cannot tell whether the owner is running, but an owner
+ * that has been preempted makes spins fail, so such locks stop
+ * spinning. The number of threads spinning at once is also limited
+ * to half the processors. Budgets are kept in a small table
+ * indexed by lock address so that the lock stays pointer-sized.
  *
  * Queued locks can act as condition variables, with
  * wait, pulse and pulse all support. Waiters are released
@@ -104,9 +112,36 @@ VOID FASTCALL PhpfWakeQueuedLockEx(
     _In_ BOOLEAN WakeAll
     );
 
+typedef struct _PH_QUEUED_LOCK_CONTENTION
+{
+    ULONG Spins;
+    ULONG Waits;
+} PH_QUEUED_LOCK_CONTENTION, *PPH_QUEUED_LOCK_CONTENTION;
+
+typedef struct _PH_QUEUED_LOCK_SPIN_STATE
+{
+    ULONG SpinCount; // 0 if no waiter has spun yet
+    ULONG Attempts;
+} PH_QUEUED_LOCK_SPIN_STATE, *PPH_QUEUED_LOCK_SPIN_STATE;
+
 static HANDLE PhQueuedLockKeyedEventHandle;
 static ULONG PhQueuedLockSpinCount = 2000;
 
+#define PH_QUEUED_LOCK_SPIN_STATES 256
+#define PH_QUEUED_LOCK_MINIMUM_SPIN_COUNT 64
+#define PH_QUEUED_LOCK_SPIN_PROBE_INTERVAL 16
+#define PH_QUEUED_LOCK_MAXIMUM_BACKOFF 64
+
+PHLIBAPI ULONG PhQueuedLockSpinFlags = PH_QUEUED_LOCK_SPIN_ADAPTIVE;
+static PH_QUEUED_LOCK_SPIN_STATE PhQueuedLockSpinStates[PH_QUEUED_LOCK_SPIN_STATES];
+static ULONG PhQueuedLockMaximumSpinners = 1;
+static LONG PhQueuedLockSpinners = 0;
+
+#define PH_QUEUED_LOCK_MAXIMUM_PROFILES 64
+
+PHLIBAPI BOOLEAN PhQueuedLockProfilingEnabled = FALSE;
+static PH_QUEUED_LOCK_PROFILE PhQueuedLockProfiles[PH_QUEUED_LOCK_MAXIMUM_PROFILES];
+
 BOOLEAN PhQueuedLockInitialization(
     VOID
     )
@@ -124,6 +159,8 @@ BOOLEAN PhQueuedLockInitialization(
     else
         PhQueuedLockSpinCount = 0;
 
+    PhQueuedLockMaximumSpinners = max((ULONG)PhSystemBasicInformation.NumberOfProcessors / 2, 1);
+
     return TRUE;
 }
 
@@ -288,39 +325,157 @@ FORCEINLINE PPH_QUEUED_WAIT_BLOCK PhpFindLastQueuedWaitBlock(
     return waitBlock;
 }
 
+/**
+ * Spins until a wait block is unblocked or the spin budget
+ * runs out.
+ *
+ * \param WaitBlock A wait block.
+ * \param QueuedLock The queued lock that the wait block was
+ * pushed onto, or NULL to use the fixed spin count.
+ * \param Contention A structure which is updated with the
+ * number of spin iterations. This is only used when profiling.
+ *
+ * \return TRUE if the wait block was unblocked, otherwise
+ * FALSE.
+ */
+FORCEINLINE BOOLEAN PhpSpinOnQueuedWaitBlock(
+    _Inout_ PPH_QUEUED_WAIT_BLOCK WaitBlock,
+    _In_opt_ PPH_QUEUED_LOCK QueuedLock,
+    _Inout_opt_ PPH_QUEUED_LOCK_CONTENTION Contention
+    )
+{
+    ULONG flags;
+    PPH_QUEUED_LOCK_SPIN_STATE spinState;
+    ULONG spinCount;
+    ULONG backoff;
+    BOOLEAN unblocked;
+    ULONG i;
+    ULONG j;
+
+    if (PhQueuedLockSpinCount == 0)
+        return FALSE;
+
+    flags = PhQueuedLockSpinFlags;
+    spinState = NULL;
+    spinCount = PhQueuedLockSpinCount;
+
+    if (QueuedLock && (flags & PH_QUEUED_LOCK_SPIN_ADAPTIVE))
+    {
+        // Spinning only helps if the owner can run, and every spinner takes a processor
+        // away from the owners.
+        if ((ULONG)_InterlockedIncrement(&PhQueuedLockSpinners) > PhQueuedLockMaximumSpinners)
+        {
+            _InterlockedDecrement(&PhQueuedLockSpinners);
+            return FALSE;
+        }
+
+        // The state is updated without synchronization. A lost update only affects the
+        // next waiter's budget.
+        spinState = &PhQueuedLockSpinStates[
+            (ULONG)((ULONG_PTR)QueuedLock / sizeof(PVOID)) % PH_QUEUED_LOCK_SPIN_STATES];
+
+        // Every so often a waiter spins for the full count, so that a lock whose budget
+        // has shrunk can recover when its hold times become short again.
+        if (spinState->SpinCount != 0 && (++spinState->Attempts % PH_QUEUED_LOCK_SPIN_PROBE_INTERVAL) != 0)
+            spinCount = spinState->SpinCount;
+    }
+
+    i = 0;
+    backoff = 1;
+
+    while (TRUE)
+    {
+        if (!(*(volatile ULONG *)&WaitBlock->Flags & PH_QUEUED_WAITER_SPINNING))
+        {
+            unblocked = TRUE;
+            break;
+        }
+
+        if (i >= spinCount)
+        {
+            unblocked = FALSE;
+            break;
+        }
+
+        for (j = backoff; j != 0; j--)
+            YieldProcessor();
+
+        i += backoff;
+
+        if ((flags & PH_QUEUED_LOCK_SPIN_BACKOFF) && backoff < PH_QUEUED_LOCK_MAXIMUM_BACKOFF)
+            backoff *= 2;
+    }
+
+    if (Contention)
+        Contention->Spins += i;
+
+    if (spinState)
+    {
+        LONG oldSpinCount;
+        LONG newSpinCount;
+
+        _InterlockedDecrement(&PhQueuedLockSpinners);
+
+        oldSpinCount = spinState->SpinCount != 0 ? spinState->SpinCount : PhQueuedLockSpinCount;
+
+        if (unblocked)
+        {
+            // Move an eighth of the way towards twice the number of iterations we needed.
+            newSpinCount = min(i * 2 + PH_QUEUED_LOCK_MINIMUM_SPIN_COUNT, PhQueuedLockSpinCount);
+            newSpinCount = oldSpinCount + (newSpinCount - oldSpinCount) / 8;
+        }
+        else
+        {
+            newSpinCount = oldSpinCount / 2;
+        }
+
+        spinState->SpinCount = max(newSpinCount, PH_QUEUED_LOCK_MINIMUM_SPIN_COUNT);
+    }
+
+    return unblocked;
+}
+
 /**
  * Waits for a wait block to be unblocked.
  *
  * \param WaitBlock A wait block.
  * \param Spin TRUE to spin, FALSE to block immediately.
  * \param Timeout A timeout value.
+ * \param QueuedLock The queued lock that the wait block was
+ * pushed onto. This is used to choose the spin count.
+ * \param Contention A structure which is updated with the
+ * number of spin iterations and waits. This is only used when
+ * profiling.
  */
-_May_raise_ FORCEINLINE NTSTATUS PhpBlockOnQueuedWaitBlock(
+_May_raise_ FORCEINLINE NTSTATUS PhpBlockOnQueuedWaitBlockEx(
     _Inout_ PPH_QUEUED_WAIT_BLOCK WaitBlock,
     _In_ BOOLEAN Spin,
-    _In_opt_ PLARGE_INTEGER Timeout
+    _In_opt_ PLARGE_INTEGER Timeout,
+    _In_opt_ PPH_QUEUED_LOCK QueuedLock,
+    _Inout_opt_ PPH_QUEUED_LOCK_CONTENTION Contention
     )
 {
     NTSTATUS status;
-    ULONG i;
 
     if (Spin)
     {
         PHLIB_INC_STATISTIC(QlBlockSpins);
 
-        for (i = PhQueuedLockSpinCount; i != 0; i--)
-        {
-            if (!(*(volatile ULONG *)&WaitBlock->Flags & PH_QUEUED_WAITER_SPINNING))
-                return STATUS_SUCCESS;
-
-            YieldProcessor();
-        }
+        if (PhpSpinOnQueuedWaitBlock(WaitBlock, QueuedLock, Contention))
+            return STATUS_SUCCESS;
     }
 
     if (_interlockedbittestandreset((PLONG)&WaitBlock->Flags, PH_QUEUED_WAITER_SPINNING_SHIFT))
     {
+        ULONG64 startTimestamp;
+
         PHLIB_INC_STATISTIC(QlBlockWaits);
 
+        if (Contention)
+            Contention->Waits++;
+
+        startTimestamp = PHLIB_STATISTIC_TIMESTAMP();
+
         status = NtWaitForKeyedEvent(
             PhQueuedLockKeyedEventHandle,
             WaitBlock,
@@ -328,6 +483,8 @@ _May_raise_ FORCEINLINE NTSTATUS PhpBlockOnQueuedWaitBlock(
             Timeout
             );
 
+        PHLIB_ADD_STATISTIC_TIME(QlBlockWaitTime, startTimestamp);
+
         // If an error occurred (timeout is not an error), raise an exception
         // as it is nearly impossible to recover from this situation.
         if (!NT_SUCCESS(status))
@@ -341,6 +498,15 @@ _May_raise_ FORCEINLINE NTSTATUS PhpBlockOnQueuedWaitBlock(
     return status;
 }
 
+_May_raise_ FORCEINLINE NTSTATUS PhpBlockOnQueuedWaitBlock(
+    _Inout_ PPH_QUEUED_WAIT_BLOCK WaitBlock,
+    _In_ BOOLEAN Spin,
+    _In_opt_ PLARGE_INTEGER Timeout
+    )
+{
+    return PhpBlockOnQueuedWaitBlockEx(WaitBlock, Spin, Timeout, NULL, NULL);
+}
+
 /**
  * Unblocks a wait block.
  *
@@ -670,13 +836,9 @@ VOID FASTCALL PhpfWakeQueuedLockEx(
     }
 }
 
-/**
- * Acquires a queued lock in exclusive mode.
- *
- * \param QueuedLock A queued lock.
- */
-VOID FASTCALL PhfAcquireQueuedLockExclusive(
-    _Inout_ PPH_QUEUED_LOCK QueuedLock
+FORCEINLINE VOID PhpAcquireQueuedLockExclusive(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock,
+    _Inout_opt_ PPH_QUEUED_LOCK_CONTENTION Contention
     )
 {
     ULONG_PTR value;
@@ -714,7 +876,7 @@ VOID FASTCALL PhfAcquireQueuedLockExclusive(
                     PhpfOptimizeQueuedLockList(QueuedLock, currentValue);
 
                 PHLIB_INC_STATISTIC(QlAcquireExclusiveBlocks);
-                PhpBlockOnQueuedWaitBlock(&waitBlock, TRUE, NULL);
+                PhpBlockOnQueuedWaitBlockEx(&waitBlock, TRUE, NULL, QueuedLock, Contention);
             }
         }
 
@@ -723,13 +885,21 @@ VOID FASTCALL PhfAcquireQueuedLockExclusive(
 }
 
 /**
- * Acquires a queued lock in shared mode.
+ * Acquires a queued lock in exclusive mode.
  *
  * \param QueuedLock A queued lock.
  */
-VOID FASTCALL PhfAcquireQueuedLockShared(
+VOID FASTCALL PhfAcquireQueuedLockExclusive(
     _Inout_ PPH_QUEUED_LOCK QueuedLock
     )
+{
+    PhpAcquireQueuedLockExclusive(QueuedLock, NULL);
+}
+
+FORCEINLINE VOID PhpAcquireQueuedLockShared(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock,
+    _Inout_opt_ PPH_QUEUED_LOCK_CONTENTION Contention
+    )
 {
     ULONG_PTR value;
     ULONG_PTR newValue;
@@ -776,7 +946,7 @@ VOID FASTCALL PhfAcquireQueuedLockShared(
                     PhpfOptimizeQueuedLockList(QueuedLock, currentValue);
 
                 PHLIB_INC_STATISTIC(QlAcquireSharedBlocks);
-                PhpBlockOnQueuedWaitBlock(&waitBlock, TRUE, NULL);
+                PhpBlockOnQueuedWaitBlockEx(&waitBlock, TRUE, NULL, QueuedLock, Contention);
             }
         }
 
@@ -784,6 +954,18 @@ VOID FASTCALL PhfAcquireQueuedLockShared(
     }
 }
 
+/**
+ * Acquires a queued lock in shared mode.
+ *
+ * \param QueuedLock A queued lock.
+ */
+VOID FASTCALL PhfAcquireQueuedLockShared(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    )
+{
+    PhpAcquireQueuedLockShared(QueuedLock, NULL);
+}
+
 /**
  * Releases a queued lock in exclusive mode.
  *
@@ -1291,3 +1473,351 @@ NTSTATUS FASTCALL PhfWaitForWakeEvent(
 
     return status;
 }
+
+/*
+ * Lock profiling
+ *
+ * Locks are registered in a fixed-size open addressing table keyed by the lock address,
+ * so the lock word does not change and profiling never needs to allocate memory or take a
+ * lock. Call sites are recorded in a small table in each profile; once it is full, new
+ * call sites are counted together.
+ *
+ * Hold times are only recorded for exclusive owners, since a profile has room for only one
+ * owner.
+ */
+
+FORCEINLINE PPH_QUEUED_LOCK_PROFILE PhpFindQueuedLockProfile(
+    _In_ PPH_QUEUED_LOCK QueuedLock
+    )
+{
+    ULONG index;
+    ULONG i;
+    PPH_QUEUED_LOCK_PROFILE profile;
+    PPH_QUEUED_LOCK lock;
+
+    index = (ULONG)((ULONG_PTR)QueuedLock / sizeof(PVOID));
+
+    for (i = 0; i < PH_QUEUED_LOCK_MAXIMUM_PROFILES; i++)
+    {
+        profile = &PhQueuedLockProfiles[(index + i) % PH_QUEUED_LOCK_MAXIMUM_PROFILES];
+        lock = *(PPH_QUEUED_LOCK volatile *)&profile->Lock;
+
+        if (lock == QueuedLock)
+            return profile;
+        if (!lock)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+FORCEINLINE PPH_QUEUED_LOCK_CALL_SITE PhpFindQueuedLockCallSite(
+    _Inout_ PPH_QUEUED_LOCK_PROFILE Profile,
+    _In_ PVOID Address
+    )
+{
+    ULONG i;
+    PPH_QUEUED_LOCK_CALL_SITE callSite;
+    PVOID address;
+
+    for (i = 0; i < PH_QUEUED_LOCK_PROFILE_CALL_SITES; i++)
+    {
+        callSite = &Profile->CallSites[i];
+        address = *(PVOID volatile *)&callSite->Address;
+
+        if (!address)
+            address = _InterlockedCompareExchangePointer(&callSite->Address, Address, NULL);
+
+        if (!address || address == Address)
+            return callSite;
+    }
+
+    return &Profile->OtherCallSites;
+}
+
+FORCEINLINE VOID PhpRecordQueuedLockContention(
+    _Inout_ PPH_QUEUED_LOCK_PROFILE Profile,
+    _Inout_ PPH_QUEUED_LOCK_CALL_SITE CallSite,
+    _In_ PPH_QUEUED_LOCK_CONTENTION Contention,
+    _In_ ULONG64 WaitTime
+    )
+{
+    _InterlockedIncrement((PLONG)&Profile->ContendedCount);
+    _InterlockedExchangeAdd((PLONG)&Profile->SpinCount, Contention->Spins);
+    _InterlockedExchangeAdd((PLONG)&Profile->WaitCount, Contention->Waits);
+    InterlockedExchangeAdd64((PLONG64)&Profile->WaitTime, WaitTime);
+
+    _InterlockedIncrement((PLONG)&CallSite->ContendedCount);
+    InterlockedExchangeAdd64((PLONG64)&CallSite->WaitTime, WaitTime);
+}
+
+/**
+ * Registers a queued lock for profiling.
+ *
+ * \param QueuedLock A queued lock. The lock must not be freed
+ * while the process is running.
+ * \param Name A name for the lock. The string must not be freed
+ * while the process is running.
+ *
+ * \return TRUE if the lock was registered, or FALSE if too many
+ * locks have been registered.
+ *
+ * \remarks Registered locks are only profiled while
+ * \ref PhQueuedLockProfilingEnabled is TRUE.
+ */
+BOOLEAN NTAPI PhRegisterQueuedLockProfile(
+    _In_ PPH_QUEUED_LOCK QueuedLock,
+    _In_ PWSTR Name
+    )
+{
+    ULONG index;
+    ULONG i;
+    PPH_QUEUED_LOCK_PROFILE profile;
+    PPH_QUEUED_LOCK lock;
+
+    index = (ULONG)((ULONG_PTR)QueuedLock / sizeof(PVOID));
+
+    for (i = 0; i < PH_QUEUED_LOCK_MAXIMUM_PROFILES; i++)
+    {
+        profile = &PhQueuedLockProfiles[(index + i) % PH_QUEUED_LOCK_MAXIMUM_PROFILES];
+        lock = _InterlockedCompareExchangePointer(&profile->Lock, QueuedLock, NULL);
+
+        if (!lock || lock == QueuedLock)
+        {
+            profile->Name = Name;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID PhpResetQueuedLockCallSite(
+    _Inout_ PPH_QUEUED_LOCK_CALL_SITE CallSite
+    )
+{
+    CallSite->AcquireCount = 0;
+    CallSite->ContendedCount = 0;
+    CallSite->WaitTime = 0;
+    CallSite->HoldTime = 0;
+}
+
+/**
+ * Clears the statistics of all registered locks.
+ *
+ * \remarks Locks may be held while their statistics are cleared, so the
+ * registrations, call site addresses and owner information are kept.
+ */
+VOID NTAPI PhResetQueuedLockProfiles(
+    VOID
+    )
+{
+    ULONG i;
+    ULONG j;
+    PPH_QUEUED_LOCK_PROFILE profile;
+
+    for (i = 0; i < PH_QUEUED_LOCK_MAXIMUM_PROFILES; i++)
+    {
+        profile = &PhQueuedLockProfiles[i];
+
+        profile->ExclusiveAcquireCount = 0;
+        profile->SharedAcquireCount = 0;
+        profile->ContendedCount = 0;
+        profile->SpinCount = 0;
+        profile->WaitCount = 0;
+        profile->WaitTime = 0;
+        profile->HoldTime = 0;
+
+        for (j = 0; j < PH_QUEUED_LOCK_PROFILE_CALL_SITES; j++)
+            PhpResetQueuedLockCallSite(&profile->CallSites[j]);
+
+        PhpResetQueuedLockCallSite(&profile->OtherCallSites);
+    }
+}
+
+static int __cdecl PhpQueuedLockProfileCompare(
+    _In_ const void *elem1,
+    _In_ const void *elem2
+    )
+{
+    PPH_QUEUED_LOCK_PROFILE profile1 = (PPH_QUEUED_LOCK_PROFILE)elem1;
+    PPH_QUEUED_LOCK_PROFILE profile2 = (PPH_QUEUED_LOCK_PROFILE)elem2;
+    int result;
+
+    result = -uint64cmp(profile1->WaitTime, profile2->WaitTime);
+
+    if (result == 0)
+        result = -uintcmp(profile1->ContendedCount, profile2->ContendedCount);
+
+    return result;
+}
+
+/**
+ * Gets the statistics of the most contended registered locks.
+ *
+ * \param Profiles An array which receives copies of the lock profiles,
+ * sorted by total wait time in descending order.
+ * \param Count The number of elements in \a Profiles.
+ *
+ * \return The number of profiles copied to \a Profiles.
+ *
+ * \remarks Times are in timestamp counter ticks. The copies are not
+ * atomic, so counters of locks in use may be slightly inconsistent.
+ */
+ULONG NTAPI PhQueryQueuedLockProfiles(
+    _Out_writes_to_(Count, return) PPH_QUEUED_LOCK_PROFILE Profiles,
+    _In_ ULONG Count
+    )
+{
+    PPH_QUEUED_LOCK_PROFILE profiles;
+    ULONG numberOfProfiles;
+    ULONG i;
+
+    profiles = PhAllocate(sizeof(PH_QUEUED_LOCK_PROFILE) * PH_QUEUED_LOCK_MAXIMUM_PROFILES);
+    numberOfProfiles = 0;
+
+    for (i = 0; i < PH_QUEUED_LOCK_MAXIMUM_PROFILES; i++)
+    {
+        if (!PhQueuedLockProfiles[i].Lock)
+            continue;
+
+        profiles[numberOfProfiles] = PhQueuedLockProfiles[i];
+
+        // The lock is published before its name is written, so skip locks which
+        // are still being registered.
+        if (profiles[numberOfProfiles].Lock && profiles[numberOfProfiles].Name)
+            numberOfProfiles++;
+    }
+
+    qsort(profiles, numberOfProfiles, sizeof(PH_QUEUED_LOCK_PROFILE), PhpQueuedLockProfileCompare);
+
+    numberOfProfiles = min(numberOfProfiles, Count);
+    memcpy(Profiles, profiles, sizeof(PH_QUEUED_LOCK_PROFILE) * numberOfProfiles);
+    PhFree(profiles);
+
+    return numberOfProfiles;
+}
+
+/**
+ * Acquires a queued lock in exclusive mode and records
+ * profiling information.
+ *
+ * \param QueuedLock A queued lock.
+ */
+VOID FASTCALL PhfAcquireQueuedLockExclusiveProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    )
+{
+    PPH_QUEUED_LOCK_PROFILE profile;
+    PPH_QUEUED_LOCK_CALL_SITE callSite;
+    PH_QUEUED_LOCK_CONTENTION contention;
+    ULONG64 startTimestamp;
+
+    if (!(profile = PhpFindQueuedLockProfile(QueuedLock)))
+    {
+        if (_InterlockedBitTestAndSetPointer((PLONG_PTR)&QueuedLock->Value, PH_QUEUED_LOCK_OWNED_SHIFT))
+            PhpAcquireQueuedLockExclusive(QueuedLock, NULL);
+
+        return;
+    }
+
+    callSite = PhpFindQueuedLockCallSite(profile, _ReturnAddress());
+
+    if (_InterlockedBitTestAndSetPointer((PLONG_PTR)&QueuedLock->Value, PH_QUEUED_LOCK_OWNED_SHIFT))
+    {
+        contention.Spins = 0;
+        contention.Waits = 0;
+        startTimestamp = ReadTimeStampCounter();
+        PhpAcquireQueuedLockExclusive(QueuedLock, &contention);
+        PhpRecordQueuedLockContention(profile, callSite, &contention, ReadTimeStampCounter() - startTimestamp);
+    }
+
+    _InterlockedIncrement((PLONG)&profile->ExclusiveAcquireCount);
+    _InterlockedIncrement((PLONG)&callSite->AcquireCount);
+
+    // We own the lock, so no one else is using these fields.
+    profile->OwnerCallSite = callSite;
+    profile->OwnerTimestamp = ReadTimeStampCounter();
+}
+
+/**
+ * Acquires a queued lock in shared mode and records
+ * profiling information.
+ *
+ * \param QueuedLock A queued lock.
+ */
+VOID FASTCALL PhfAcquireQueuedLockSharedProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    )
+{
+    PPH_QUEUED_LOCK_PROFILE profile;
+    PPH_QUEUED_LOCK_CALL_SITE callSite;
+    PH_QUEUED_LOCK_CONTENTION contention;
+    ULONG64 startTimestamp;
+    BOOLEAN acquired;
+
+    acquired = (ULONG_PTR)_InterlockedCompareExchangePointer(
+        (PPVOID)&QueuedLock->Value,
+        (PVOID)(PH_QUEUED_LOCK_OWNED | PH_QUEUED_LOCK_SHARED_INC),
+        (PVOID)0
+        ) == 0;
+
+    if (!(profile = PhpFindQueuedLockProfile(QueuedLock)))
+    {
+        if (!acquired)
+            PhpAcquireQueuedLockShared(QueuedLock, NULL);
+
+        return;
+    }
+
+    callSite = PhpFindQueuedLockCallSite(profile, _ReturnAddress());
+
+    if (!acquired)
+    {
+        contention.Spins = 0;
+        contention.Waits = 0;
+        startTimestamp = ReadTimeStampCounter();
+        PhpAcquireQueuedLockShared(QueuedLock, &contention);
+
+        // Other shared owners don't count as contention.
+        if (contention.Spins != 0 || contention.Waits != 0)
+            PhpRecordQueuedLockContention(profile, callSite, &contention, ReadTimeStampCounter() - startTimestamp);
+    }
+
+    _InterlockedIncrement((PLONG)&profile->SharedAcquireCount);
+    _InterlockedIncrement((PLONG)&callSite->AcquireCount);
+}
+
+/**
+ * Releases a queued lock in exclusive mode and records
+ * profiling information.
+ *
+ * \param QueuedLock A queued lock.
+ */
+VOID FASTCALL PhfReleaseQueuedLockExclusiveProfiled(
+    _Inout_ PPH_QUEUED_LOCK QueuedLock
+    )
+{
+    PPH_QUEUED_LOCK_PROFILE profile;
+    ULONG_PTR value;
+
+    if ((profile = PhpFindQueuedLockProfile(QueuedLock)) && profile->OwnerTimestamp)
+    {
+        ULONG64 holdTime;
+
+        holdTime = ReadTimeStampCounter() - profile->OwnerTimestamp;
+        profile->OwnerTimestamp = 0;
+
+        InterlockedExchangeAdd64((PLONG64)&profile->HoldTime, holdTime);
+
+        if (profile->OwnerCallSite)
+            InterlockedExchangeAdd64((PLONG64)&profile->OwnerCallSite->HoldTime, holdTime);
+    }
+
+    value = (ULONG_PTR)_InterlockedExchangeAddPointer((PLONG_PTR)&QueuedLock->Value, -(LONG_PTR)PH_QUEUED_LOCK_OWNED);
+
+    if ((value & (PH_QUEUED_LOCK_WAITERS | PH_QUEUED_LOCK_TRAVERSING)) == PH_QUEUED_LOCK_WAITERS)
+    {
+        PhfWakeForReleaseQueuedLock(QueuedLock, value - PH_QUEUED_LOCK_OWNED);
+    }
+}
@@ -584,10 +584,14 @@ VOID PhpFreeObject(
     /* Call the delete procedure if we have one. */
     if (ObjectHeader->Type->DeleteProcedure)
     {
+        ULONG64 startTimestamp;
+
+        startTimestamp = PHLIB_STATISTIC_TIMESTAMP();
         ObjectHeader->Type->DeleteProcedure(
             PhObjectHeaderToObject(ObjectHeader),
             0
             );
+        PHLIB_ADD_STATISTIC_TIME(RefDeleteProcedureTime, startTimestamp);
     }
 
     if (ObjectHeader->Flags & PHOBJ_FROM_TYPE_FREE_LIST)
@@ -0,0 +1,333 @@
+/*
+ * Process Hacker -
+ *   trace spans
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Trace spans record where time goes on long-running threads such as provider
+ * threads. When tracing is disabled, a span costs one load and one branch. When it is
+ * enabled, a span costs two timestamp counter reads and a TLS lookup, and is written to
+ * a ring buffer owned by the current thread, so recording never takes a lock.
+ *
+ * Buffers are allocated the first time a thread records a span and are never freed, so
+ * the number of buffers is limited; spans from any further threads are dropped. Names
+ * must be string literals because only the pointers are stored.
+ *
+ * Each buffer has a single writer. The exporter copies a buffer while it may be written
+ * to, and then discards any events which may have been overwritten during the copy.
+ */
+
+#include <ph.h>
+
+typedef struct _PH_TRACE_BUFFER
+{
+    HANDLE ThreadId;
+    volatile LONG Count; // total number of events written
+    PH_TRACE_EVENT Events[PH_TRACE_BUFFER_SIZE];
+} PH_TRACE_BUFFER, *PPH_TRACE_BUFFER;
+
+PHLIBAPI BOOLEAN PhTraceEnabled = FALSE;
+
+static ULONG PhpTraceTlsIndex = TLS_OUT_OF_INDEXES;
+static PPH_TRACE_BUFFER PhpTraceBuffers[PH_TRACE_MAXIMUM_BUFFERS];
+static LONG PhpTraceNumberOfBuffers = 0;
+
+static ULONG64 PhpTraceStartTime;
+static LARGE_INTEGER PhpTraceStartCounter;
+
+/**
+ * Starts recording trace spans. Spans recorded before this
+ * call are discarded.
+ */
+VOID PhStartTrace(
+    VOID
+    )
+{
+    static PH_INITONCE initOnce = PH_INITONCE_INIT;
+
+    if (PhBeginInitOnce(&initOnce))
+    {
+        PhpTraceTlsIndex = TlsAlloc();
+        PhEndInitOnce(&initOnce);
+    }
+
+    if (PhpTraceTlsIndex == TLS_OUT_OF_INDEXES)
+        return;
+
+    NtQueryPerformanceCounter(&PhpTraceStartCounter, NULL);
+    PhpTraceStartTime = ReadTimeStampCounter();
+    MemoryBarrier();
+    PhTraceEnabled = TRUE;
+}
+
+/**
+ * Stops recording trace spans. The spans already recorded
+ * can still be exported.
+ */
+VOID PhStopTrace(
+    VOID
+    )
+{
+    PhTraceEnabled = FALSE;
+}
+
+static PPH_TRACE_BUFFER PhpGetTraceBuffer(
+    VOID
+    )
+{
+    PPH_TRACE_BUFFER buffer;
+    LONG index;
+
+    buffer = TlsGetValue(PhpTraceTlsIndex);
+
+    if (buffer)
+        return buffer;
+
+    if (PhpTraceNumberOfBuffers >= PH_TRACE_MAXIMUM_BUFFERS)
+        return NULL;
+
+    index = _InterlockedIncrement(&PhpTraceNumberOfBuffers) - 1;
+
+    if (index >= PH_TRACE_MAXIMUM_BUFFERS)
+        return NULL;
+
+    buffer = PhAllocate(sizeof(PH_TRACE_BUFFER));
+    buffer->ThreadId = NtCurrentTeb()->ClientId.UniqueThread;
+    buffer->Count = 0;
+
+    // Publish the buffer only after it has been initialized.
+    _InterlockedExchangePointer(&PhpTraceBuffers[index], buffer);
+    TlsSetValue(PhpTraceTlsIndex, buffer);
+
+    return buffer;
+}
+
+/**
+ * Records a trace span in the current thread's trace buffer.
+ * The span ends at the current time.
+ *
+ * \param Category The category of the span. This must be a
+ * string literal.
+ * \param Name The name of the span. This must be a string
+ * literal.
+ * \param Address If \a Name is NULL, an address which is
+ * resolved to a name when the trace is exported.
+ * \param StartTime The value returned by PhBeginTraceSpan().
+ */
+VOID PhRecordTraceSpan(
+    _In_ PWSTR Category,
+    _In_opt_ PWSTR Name,
+    _In_opt_ PVOID Address,
+    _In_ ULONG64 StartTime
+    )
+{
+    ULONG64 endTime;
+    PPH_TRACE_BUFFER buffer;
+    LONG count;
+    PPH_TRACE_EVENT event;
+
+    endTime = ReadTimeStampCounter();
+
+    if (!PhTraceEnabled)
+        return;
+    if (!(buffer = PhpGetTraceBuffer()))
+        return;
+
+    count = buffer->Count;
+    event = &buffer->Events[count & (PH_TRACE_BUFFER_SIZE - 1)];
+    event->Category = Category;
+    event->Name = Name;
+    event->Address = Address;
+    event->StartTime = StartTime;
+    event->EndTime = endTime;
+
+    // Make the event visible to the exporter before the count.
+    _InterlockedExchange(&buffer->Count, count + 1);
+}
+
+static VOID PhpAppendJsonStringBuilder(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_ PPH_STRINGREF String
+    )
+{
+    SIZE_T i;
+    WCHAR c;
+
+    PhAppendCharStringBuilder(StringBuilder, '"');
+
+    for (i = 0; i < String->Length / sizeof(WCHAR); i++)
+    {
+        c = String->Buffer[i];
+
+        if (c == '"' || c == '\\')
+        {
+            PhAppendCharStringBuilder(StringBuilder, '\\');
+            PhAppendCharStringBuilder(StringBuilder, c);
+        }
+        else if (c < ' ')
+        {
+            PhAppendFormatStringBuilder(StringBuilder, L"\\u%04x", c);
+        }
+        else
+        {
+            PhAppendCharStringBuilder(StringBuilder, c);
+        }
+    }
+
+    PhAppendCharStringBuilder(StringBuilder, '"');
+}
+
+/**
+ * Exports the recorded trace spans in the Chrome trace event
+ * format.
+ *
+ * \param ResolveCallback A callback function which converts
+ * addresses to names.
+ * \param Context A user-defined value to pass to the callback
+ * function.
+ *
+ * \return A JSON object which can be loaded by chrome://tracing.
+ * Timestamps are in microseconds since the trace was started.
+ */
+PPH_STRING PhExportTrace(
+    _In_opt_ PPH_TRACE_RESOLVE_CALLBACK ResolveCallback,
+    _In_opt_ PVOID Context
+    )
+{
+    PH_STRING_BUILDER sb;
+    PPH_HASHTABLE names;
+    PPH_TRACE_EVENT events;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    ULONG64 time;
+    DOUBLE ticksPerMicrosecond;
+    BOOLEAN first;
+    LONG numberOfBuffers;
+    LONG i;
+
+    NtQueryPerformanceCounter(&counter, &frequency);
+    time = ReadTimeStampCounter();
+
+    // Calibrate the timestamp counter against the performance counter over the whole trace.
+    if (counter.QuadPart > PhpTraceStartCounter.QuadPart)
+    {
+        ticksPerMicrosecond = (DOUBLE)(time - PhpTraceStartTime) * frequency.QuadPart /
+            (counter.QuadPart - PhpTraceStartCounter.QuadPart) / 1000000;
+    }
+    else
+    {
+        ticksPerMicrosecond = 1;
+    }
+
+    PhInitializeStringBuilder(&sb, 4096);
+    PhAppendStringBuilder2(&sb, L"{\"traceEvents\":[");
+
+    names = PhCreateSimpleHashtable(16);
+    events = PhAllocate(sizeof(PH_TRACE_EVENT) * PH_TRACE_BUFFER_SIZE);
+    first = TRUE;
+    numberOfBuffers = min(PhpTraceNumberOfBuffers, PH_TRACE_MAXIMUM_BUFFERS);
+
+    for (i = 0; i < numberOfBuffers; i++)
+    {
+        PPH_TRACE_BUFFER buffer;
+        LONG count;
+        LONG newCount;
+        LONG start;
+        LONG j;
+
+        if (!(buffer = PhpTraceBuffers[i]))
+            continue;
+
+        count = buffer->Count;
+        MemoryBarrier();
+        memcpy(events, buffer->Events, sizeof(PH_TRACE_EVENT) * PH_TRACE_BUFFER_SIZE);
+        MemoryBarrier();
+        newCount = buffer->Count;
+
+        // Events that the writer may have reached while we were copying are skipped.
+        start = max(count - PH_TRACE_BUFFER_SIZE, newCount - PH_TRACE_BUFFER_SIZE + 1);
+        start = max(start, 0);
+
+        for (j = start; j < count; j++)
+        {
+            PPH_TRACE_EVENT event;
+            PH_STRINGREF name;
+            PPH_STRING *entry;
+            PPH_STRING nameString;
+
+            event = &events[j & (PH_TRACE_BUFFER_SIZE - 1)];
+
+            if (event->StartTime < PhpTraceStartTime)
+                continue;
+
+            if (event->Name)
+            {
+                PhInitializeStringRef(&name, event->Name);
+            }
+            else
+            {
+                if (entry = (PPH_STRING *)PhFindItemSimpleHashtable(names, event->Address))
+                {
+                    nameString = *entry;
+                }
+                else
+                {
+                    nameString = NULL;
+
+                    if (ResolveCallback)
+                        nameString = ResolveCallback(event->Address, Context);
+                    if (!nameString)
+                        nameString = PhFormatString(L"0x%Ix", event->Address);
+
+                    PhAddItemSimpleHashtable(names, event->Address, nameString);
+                }
+
+                name = nameString->sr;
+            }
+
+            PhAppendStringBuilder2(&sb, first ? L"\n{\"name\":" : L",\n{\"name\":");
+            PhpAppendJsonStringBuilder(&sb, &name);
+            PhAppendFormatStringBuilder(
+                &sb,
+                L",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}",
+                event->Category,
+                (DOUBLE)(event->StartTime - PhpTraceStartTime) / ticksPerMicrosecond,
+                (DOUBLE)(event->EndTime - event->StartTime) / ticksPerMicrosecond,
+                HandleToUlong(NtCurrentProcessId()),
+                HandleToUlong(buffer->ThreadId)
+                );
+            first = FALSE;
+        }
+    }
+
+    PhAppendStringBuilder2(&sb, L"\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    PhFree(events);
+
+    {
+        ULONG enumerationKey = 0;
+        PPH_KEY_VALUE_PAIR pair;
+
+        while (PhEnumHashtable(names, &pair, &enumerationKey))
+            PhDereferenceObject(pair->Value);
+    }
+
+    PhDereferenceObject(names);
+
+    return PhFinalStringBuilderString(&sb);
+}
@@ -0,0 +1,1098 @@
+/*
+ * Process Hacker -
+ *   x64 stack unwinding
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This module unwinds x64 stacks using the unwind data in each image (the
+ * exception directory and the unwind information it points to), without going
+ * through dbghelp. The function table of each module is read once and kept in an
+ * unwind cache, together with the unwind information that has been used so far.
+ * A cache can be shared by any number of threads walking stacks in the same
+ * process.
+ *
+ * The unwinding rules are the same as RtlVirtualUnwind: prologs are partially
+ * reversed, epilogs are detected by decoding the instructions at the current
+ * address, chained unwind information is followed, and functions without an
+ * entry in the function table are leaf functions. Non-volatile XMM registers are
+ * not tracked.
+ */
+
+#include <ph.h>
+
+#define PH_UNWIND_MAXIMUM_FUNCTIONS 0x100000
+#define PH_UNWIND_MAXIMUM_CHAIN_DEPTH 32
+#define PH_UNWIND_STACK_CHUNK_SIZE 0x2000
+#define PH_UNWIND_EPILOG_BUFFER_SIZE 32
+
+#define PH_UWOP_PUSH_NONVOL 0
+#define PH_UWOP_ALLOC_LARGE 1
+#define PH_UWOP_ALLOC_SMALL 2
+#define PH_UWOP_SET_FPREG 3
+#define PH_UWOP_SAVE_NONVOL 4
+#define PH_UWOP_SAVE_NONVOL_FAR 5
+#define PH_UWOP_EPILOG 6
+#define PH_UWOP_SPARE_CODE 7
+#define PH_UWOP_SAVE_XMM128 8
+#define PH_UWOP_SAVE_XMM128_FAR 9
+#define PH_UWOP_PUSH_MACHFRAME 10
+
+#define PH_UNW_FLAG_CHAININFO 0x4
+
+typedef struct _PH_RUNTIME_FUNCTION
+{
+    ULONG BeginAddress;
+    ULONG EndAddress;
+    ULONG UnwindData;
+} PH_RUNTIME_FUNCTION, *PPH_RUNTIME_FUNCTION;
+
+typedef union _PH_UNWIND_CODE
+{
+    struct
+    {
+        UCHAR CodeOffset;
+        UCHAR UnwindOp : 4;
+        UCHAR OpInfo : 4;
+    };
+    USHORT FrameOffset;
+} PH_UNWIND_CODE, *PPH_UNWIND_CODE;
+
+typedef struct _PH_UNWIND_INFO
+{
+    UCHAR Version : 3;
+    UCHAR Flags : 5;
+    UCHAR SizeOfProlog;
+    UCHAR CountOfCodes;
+    UCHAR FrameRegister : 4;
+    UCHAR FrameOffset : 4;
+    PH_UNWIND_CODE UnwindCode[1];
+} PH_UNWIND_INFO, *PPH_UNWIND_INFO;
+
+typedef struct _PH_UNWIND_MODULE
+{
+    ULONG64 BaseAddress;
+    ULONG64 EndAddress;
+    PPH_RUNTIME_FUNCTION Functions;
+    ULONG NumberOfFunctions;
+
+    PPH_HASHTABLE UnwindInfoHashtable;
+} PH_UNWIND_MODULE, *PPH_UNWIND_MODULE;
+
+typedef struct _PH_UNWIND_MODULE_ENTRY
+{
+    ULONG64 EndAddress;
+    PPH_UNWIND_MODULE Module;
+} PH_UNWIND_MODULE_ENTRY, *PPH_UNWIND_MODULE_ENTRY;
+
+typedef struct _PH_UNWIND_INFO_ENTRY
+{
+    ULONG Rva;
+    PPH_UNWIND_INFO UnwindInfo;
+} PH_UNWIND_INFO_ENTRY, *PPH_UNWIND_INFO_ENTRY;
+
+typedef struct _PH_UNWIND_CACHE
+{
+    HANDLE ProcessHandle;
+    PPH_READ_VIRTUAL_MEMORY_CALLBACK ReadVirtualMemory;
+    BOOLEAN FindModules;
+
+    PH_QUEUED_LOCK Lock;
+    PH_BTREE Modules;
+} PH_UNWIND_CACHE;
+
+VOID NTAPI PhpUnwindCacheDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    );
+
+PPH_OBJECT_TYPE PhUnwindCacheType;
+
+static PH_INITONCE PhUnwindCacheInitOnce = PH_INITONCE_INIT;
+
+static LONG NTAPI PhpUnwindModuleCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return uint64cmp(((PPH_UNWIND_MODULE_ENTRY)Entry1)->EndAddress, ((PPH_UNWIND_MODULE_ENTRY)Entry2)->EndAddress);
+}
+
+static BOOLEAN NTAPI PhpUnwindInfoHashtableCompareFunction(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return ((PPH_UNWIND_INFO_ENTRY)Entry1)->Rva == ((PPH_UNWIND_INFO_ENTRY)Entry2)->Rva;
+}
+
+static ULONG NTAPI PhpUnwindInfoHashtableHashFunction(
+    _In_ PVOID Entry
+    )
+{
+    return PhHashInt32(((PPH_UNWIND_INFO_ENTRY)Entry)->Rva);
+}
+
+/**
+ * Creates an unwind cache.
+ *
+ * \param ProcessHandle A handle to a process. The handle must have
+ * PROCESS_QUERY_INFORMATION and PROCESS_VM_READ access. If \a ReadVirtualMemory is
+ * specified, this value is passed to it and can be any value.
+ * \param ReadVirtualMemory A function used to read memory. If NULL, memory is read
+ * from the process, and modules are found automatically. Otherwise, modules must be
+ * added using PhAddModuleUnwindCache().
+ *
+ * \return The new cache, or NULL if it could not be created.
+ *
+ * \remarks Modules are never removed from the cache, so a cache should not be kept
+ * after modules may have been unloaded from the process.
+ */
+PPH_UNWIND_CACHE PhCreateUnwindCache(
+    _In_ HANDLE ProcessHandle,
+    _In_opt_ PPH_READ_VIRTUAL_MEMORY_CALLBACK ReadVirtualMemory
+    )
+{
+    PPH_UNWIND_CACHE cache;
+
+    if (PhBeginInitOnce(&PhUnwindCacheInitOnce))
+    {
+        PhCreateObjectType(&PhUnwindCacheType, L"UnwindCache", 0, PhpUnwindCacheDeleteProcedure);
+        PhEndInitOnce(&PhUnwindCacheInitOnce);
+    }
+
+    if (!NT_SUCCESS(PhCreateObject(&cache, sizeof(PH_UNWIND_CACHE), 0, PhUnwindCacheType)))
+        return NULL;
+
+    cache->ProcessHandle = ProcessHandle;
+
+    if (ReadVirtualMemory)
+    {
+        cache->ReadVirtualMemory = ReadVirtualMemory;
+        cache->FindModules = FALSE;
+    }
+    else
+    {
+        cache->ReadVirtualMemory = PhReadVirtualMemory;
+        cache->FindModules = TRUE;
+    }
+
+    PhInitializeQueuedLock(&cache->Lock);
+    PhInitializeBTree(&cache->Modules, sizeof(PH_UNWIND_MODULE_ENTRY), PhpUnwindModuleCompareFunction);
+
+    return cache;
+}
+
+static VOID PhpFreeUnwindModule(
+    _In_ PPH_UNWIND_MODULE Module
+    )
+{
+    ULONG enumerationKey = 0;
+    PPH_UNWIND_INFO_ENTRY entry;
+
+    while (PhEnumHashtable(Module->UnwindInfoHashtable, (PPVOID)&entry, &enumerationKey))
+        PhFree(entry->UnwindInfo);
+
+    PhDereferenceObject(Module->UnwindInfoHashtable);
+
+    if (Module->Functions)
+        PhFree(Module->Functions);
+
+    PhFree(Module);
+}
+
+VOID NTAPI PhpUnwindCacheDeleteProcedure(
+    _In_ PVOID Object,
+    _In_ ULONG Flags
+    )
+{
+    PPH_UNWIND_CACHE cache = Object;
+    PH_BTREE_ENUM_CONTEXT enumContext;
+    PPH_UNWIND_MODULE_ENTRY entry;
+
+    PhBeginEnumBTree(&cache->Modules, NULL, &enumContext);
+
+    while (entry = PhNextEnumBTree(&enumContext))
+        PhpFreeUnwindModule(entry->Module);
+
+    PhDeleteBTree(&cache->Modules);
+}
+
+static NTSTATUS PhpReadMemoryUnwindCache(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 Address,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ SIZE_T Length
+    )
+{
+    NTSTATUS status;
+    SIZE_T numberOfBytesRead = 0;
+
+    status = Cache->ReadVirtualMemory(Cache->ProcessHandle, (PVOID)Address, Buffer, Length, &numberOfBytesRead);
+
+    if (NT_SUCCESS(status) && numberOfBytesRead != Length)
+        status = STATUS_PARTIAL_COPY;
+
+    return status;
+}
+
+/**
+ * Reads the function table of a module.
+ */
+static NTSTATUS PhpLoadUnwindModule(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 BaseAddress,
+    _Out_ PPH_UNWIND_MODULE *Module
+    )
+{
+    NTSTATUS status;
+    PH_REMOTE_MAPPED_IMAGE remoteMappedImage;
+    PIMAGE_NT_HEADERS64 ntHeaders;
+    PIMAGE_DATA_DIRECTORY dataDirectory;
+    PPH_UNWIND_MODULE module;
+    ULONG numberOfFunctions;
+
+    if (!NT_SUCCESS(status = PhLoadRemoteMappedImageEx(
+        Cache->ProcessHandle,
+        (PVOID)BaseAddress,
+        Cache->ReadVirtualMemory,
+        &remoteMappedImage
+        )))
+        return status;
+
+    ntHeaders = (PIMAGE_NT_HEADERS64)remoteMappedImage.NtHeaders;
+
+    if (
+        remoteMappedImage.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC ||
+        ntHeaders->FileHeader.SizeOfOptionalHeader < FIELD_OFFSET(IMAGE_OPTIONAL_HEADER64, DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION + 1])
+        )
+    {
+        PhUnloadRemoteMappedImage(&remoteMappedImage);
+        return STATUS_INVALID_IMAGE_FORMAT;
+    }
+
+    module = PhAllocate(sizeof(PH_UNWIND_MODULE));
+    memset(module, 0, sizeof(PH_UNWIND_MODULE));
+    module->BaseAddress = BaseAddress;
+    module->EndAddress = BaseAddress + ntHeaders->OptionalHeader.SizeOfImage;
+    module->UnwindInfoHashtable = PhCreateHashtable(
+        sizeof(PH_UNWIND_INFO_ENTRY),
+        PhpUnwindInfoHashtableCompareFunction,
+        PhpUnwindInfoHashtableHashFunction,
+        64
+        );
+
+    if (ntHeaders->OptionalHeader.NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_EXCEPTION)
+    {
+        dataDirectory = &ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+        numberOfFunctions = dataDirectory->Size / sizeof(PH_RUNTIME_FUNCTION);
+
+        // Put a reasonable limit on the number of entries we read.
+        if (numberOfFunctions > PH_UNWIND_MAXIMUM_FUNCTIONS)
+            numberOfFunctions = 0;
+
+        if (numberOfFunctions != 0)
+        {
+            module->Functions = PhAllocate(numberOfFunctions * sizeof(PH_RUNTIME_FUNCTION));
+
+            if (NT_SUCCESS(PhpReadMemoryUnwindCache(
+                Cache,
+                BaseAddress + dataDirectory->VirtualAddress,
+                module->Functions,
+                numberOfFunctions * sizeof(PH_RUNTIME_FUNCTION)
+                )))
+            {
+                module->NumberOfFunctions = numberOfFunctions;
+            }
+            else
+            {
+                PhFree(module->Functions);
+                module->Functions = NULL;
+            }
+        }
+    }
+
+    PhUnloadRemoteMappedImage(&remoteMappedImage);
+
+    *Module = module;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Adds a module to the cache if it is not already present.
+ */
+static PPH_UNWIND_MODULE PhpInsertUnwindModule(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ PPH_UNWIND_MODULE Module
+    )
+{
+    PH_UNWIND_MODULE_ENTRY entry;
+    PPH_UNWIND_MODULE_ENTRY existingEntry;
+    BOOLEAN added;
+
+    entry.EndAddress = Module->EndAddress;
+    entry.Module = Module;
+
+    PhAcquireQueuedLockExclusive(&Cache->Lock);
+    existingEntry = PhAddEntryBTree(&Cache->Modules, &entry, &added);
+    PhReleaseQueuedLockExclusive(&Cache->Lock);
+
+    if (!added)
+    {
+        // Another thread added the module first.
+        PhpFreeUnwindModule(Module);
+        Module = existingEntry->Module;
+    }
+
+    return Module;
+}
+
+/**
+ * Reads the unwind data of a module and adds it to an unwind cache.
+ *
+ * \param Cache The unwind cache.
+ * \param BaseAddress The base address of the module.
+ */
+NTSTATUS PhAddModuleUnwindCache(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 BaseAddress
+    )
+{
+    NTSTATUS status;
+    PPH_UNWIND_MODULE module;
+
+    if (!NT_SUCCESS(status = PhpLoadUnwindModule(Cache, BaseAddress, &module)))
+        return status;
+
+    PhpInsertUnwindModule(Cache, module);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS PhpFindUnwindModule(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 Address,
+    _Out_ PPH_UNWIND_MODULE *Module
+    )
+{
+    PH_UNWIND_MODULE_ENTRY lookupEntry;
+    PPH_UNWIND_MODULE_ENTRY entry;
+    PH_BTREE_ENUM_CONTEXT enumContext;
+    PPH_UNWIND_MODULE module;
+    MEMORY_BASIC_INFORMATION basicInfo;
+
+    // Find the first module that ends after the address.
+
+    lookupEntry.EndAddress = Address + 1;
+    module = NULL;
+
+    PhAcquireQueuedLockShared(&Cache->Lock);
+
+    PhBeginEnumBTree(&Cache->Modules, &lookupEntry, &enumContext);
+    entry = PhNextEnumBTree(&enumContext);
+
+    if (entry)
+        module = entry->Module;
+
+    PhReleaseQueuedLockShared(&Cache->Lock);
+
+    if (!module || Address < module->BaseAddress || Address >= module->EndAddress)
+    {
+        module = NULL;
+
+        // Find the image that contains the address.
+        if (Cache->FindModules && NT_SUCCESS(NtQueryVirtualMemory(
+            Cache->ProcessHandle,
+            (PVOID)Address,
+            MemoryBasicInformation,
+            &basicInfo,
+            sizeof(MEMORY_BASIC_INFORMATION),
+            NULL
+            )) && basicInfo.Type == MEM_IMAGE)
+        {
+            if (NT_SUCCESS(PhpLoadUnwindModule(Cache, (ULONG64)basicInfo.AllocationBase, &module)))
+            {
+                module = PhpInsertUnwindModule(Cache, module);
+
+                if (Address < module->BaseAddress || Address >= module->EndAddress)
+                    module = NULL;
+            }
+        }
+    }
+
+    if (!module)
+        return STATUS_NOT_FOUND;
+
+    *Module = module;
+
+    return STATUS_SUCCESS;
+}
+
+static PPH_RUNTIME_FUNCTION PhpLookupUnwindFunction(
+    _In_ PPH_UNWIND_MODULE Module,
+    _In_ ULONG Rva
+    )
+{
+    ULONG low;
+    ULONG high;
+    ULONG mid;
+
+    low = 0;
+    high = Module->NumberOfFunctions;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+
+        if (Rva < Module->Functions[mid].BeginAddress)
+            high = mid;
+        else if (Rva >= Module->Functions[mid].EndAddress)
+            low = mid + 1;
+        else
+            return &Module->Functions[mid];
+    }
+
+    return NULL;
+}
+
+/**
+ * Gets the unwind information at an address in a module, reading it if it is
+ * not cached.
+ */
+static NTSTATUS PhpGetUnwindInfo(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ PPH_UNWIND_MODULE Module,
+    _In_ ULONG Rva,
+    _Out_ PPH_UNWIND_INFO *UnwindInfo
+    )
+{
+    NTSTATUS status;
+    PH_UNWIND_INFO_ENTRY lookupEntry;
+    PPH_UNWIND_INFO_ENTRY entry;
+    PH_UNWIND_INFO header;
+    PPH_UNWIND_INFO unwindInfo;
+    ULONG size;
+    BOOLEAN added;
+
+    lookupEntry.Rva = Rva;
+
+    PhAcquireQueuedLockShared(&Cache->Lock);
+    entry = PhFindEntryHashtable(Module->UnwindInfoHashtable, &lookupEntry);
+    unwindInfo = entry ? entry->UnwindInfo : NULL;
+    PhReleaseQueuedLockShared(&Cache->Lock);
+
+    if (unwindInfo)
+    {
+        *UnwindInfo = unwindInfo;
+        return STATUS_SUCCESS;
+    }
+
+    if (!NT_SUCCESS(status = PhpReadMemoryUnwindCache(
+        Cache,
+        Module->BaseAddress + Rva,
+        &header,
+        FIELD_OFFSET(PH_UNWIND_INFO, UnwindCode)
+        )))
+        return status;
+
+    // The unwind codes are followed by a chained function entry or an exception
+    // handler address. Always read enough for a function entry.
+    size = FIELD_OFFSET(PH_UNWIND_INFO, UnwindCode) +
+        ((header.CountOfCodes + 1) & ~1) * sizeof(PH_UNWIND_CODE) +
+        sizeof(PH_RUNTIME_FUNCTION);
+    unwindInfo = PhAllocate(size);
+
+    if (!NT_SUCCESS(status = PhpReadMemoryUnwindCache(Cache, Module->BaseAddress + Rva, unwindInfo, size)))
+    {
+        PhFree(unwindInfo);
+        return status;
+    }
+
+    lookupEntry.UnwindInfo = unwindInfo;
+
+    PhAcquireQueuedLockExclusive(&Cache->Lock);
+
+    entry = PhAddEntryHashtableEx(Module->UnwindInfoHashtable, &lookupEntry, &added);
+
+    if (!added)
+    {
+        // Another thread added the unwind information first.
+        PhFree(unwindInfo);
+        unwindInfo = entry->UnwindInfo;
+    }
+
+    PhReleaseQueuedLockExclusive(&Cache->Lock);
+
+    *UnwindInfo = unwindInfo;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Initializes the state for unwinding a stack.
+ *
+ * \param State The unwind state.
+ * \param Cache The unwind cache to use.
+ * \param Context The register context of the first frame.
+ */
+VOID PhInitializeUnwindState(
+    _Out_ PPH_UNWIND_STATE State,
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ PPH_UNWIND_CONTEXT Context
+    )
+{
+    State->Cache = Cache;
+    State->Context = *Context;
+    State->BufferAddress = 0;
+    State->BufferLength = 0;
+    State->Buffer = NULL;
+}
+
+/**
+ * Frees resources used by an unwind state.
+ *
+ * \param State The unwind state.
+ */
+VOID PhDeleteUnwindState(
+    _Inout_ PPH_UNWIND_STATE State
+    )
+{
+    if (State->Buffer)
+        PhFree(State->Buffer);
+
+    State->Buffer = NULL;
+    State->BufferLength = 0;
+}
+
+/**
+ * Reads stack memory for an unwind.
+ *
+ * \param State The unwind state.
+ * \param Address The address to read from.
+ * \param Buffer A buffer which receives the data.
+ * \param Length The number of bytes to read.
+ *
+ * \remarks Memory is read in large chunks from the given address upwards, since
+ * each frame is at a higher address than the previous one.
+ */
+NTSTATUS PhReadMemoryUnwindState(
+    _Inout_ PPH_UNWIND_STATE State,
+    _In_ ULONG64 Address,
+    _Out_writes_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+    )
+{
+    NTSTATUS status;
+    SIZE_T numberOfBytesRead;
+    SIZE_T chunkSize;
+
+    if (
+        Address < State->BufferAddress ||
+        Address - State->BufferAddress > State->BufferLength ||
+        Length > State->BufferLength - (Address - State->BufferAddress)
+        )
+    {
+        if (Length > PH_UNWIND_STACK_CHUNK_SIZE / 2)
+            return PhpReadMemoryUnwindCache(State->Cache, Address, Buffer, Length);
+
+        if (!State->Buffer)
+            State->Buffer = PhAllocate(PH_UNWIND_STACK_CHUNK_SIZE);
+
+        // End the chunk at a page boundary, since the stack ends at one.
+        chunkSize = PH_UNWIND_STACK_CHUNK_SIZE - (ULONG)(Address & (PAGE_SIZE - 1));
+        numberOfBytesRead = 0;
+        status = State->Cache->ReadVirtualMemory(
+            State->Cache->ProcessHandle,
+            (PVOID)Address,
+            State->Buffer,
+            chunkSize,
+            &numberOfBytesRead
+            );
+
+        if (!NT_SUCCESS(status) && status != STATUS_PARTIAL_COPY)
+            numberOfBytesRead = 0;
+
+        State->BufferAddress = Address;
+        State->BufferLength = numberOfBytesRead;
+
+        // Part of the chunk may not be readable. Read the requested memory on its own
+        // in case the whole chunk failed.
+        if (Length > numberOfBytesRead)
+            return PhpReadMemoryUnwindCache(State->Cache, Address, Buffer, Length);
+    }
+
+    memcpy(Buffer, PTR_ADD_OFFSET(State->Buffer, Address - State->BufferAddress), Length);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS PhpReadStackValue(
+    _Inout_ PPH_UNWIND_STATE State,
+    _In_ ULONG64 Address,
+    _Out_ PULONG64 Value
+    )
+{
+    return PhReadMemoryUnwindState(State, Address, Value, sizeof(ULONG64));
+}
+
+/**
+ * Checks whether the current instruction is in an epilog, and if so, emulates
+ * the rest of the epilog.
+ *
+ * \return TRUE if the address is in an epilog, otherwise FALSE.
+ */
+static BOOLEAN PhpUnwindEpilog(
+    _Inout_ PPH_UNWIND_STATE State,
+    _In_ PPH_UNWIND_MODULE Module,
+    _In_ PPH_RUNTIME_FUNCTION Function,
+    _Inout_ PPH_UNWIND_CONTEXT Context,
+    _Out_ PNTSTATUS Status
+    )
+{
+    UCHAR code[PH_UNWIND_EPILOG_BUFFER_SIZE];
+    ULONG length;
+    ULONG offset;
+    ULONG firstPop;
+    LONG displacement;
+    ULONG64 target;
+    USHORT stackAdjust;
+    NTSTATUS status;
+
+    // The epilog never extends past the end of the function.
+    if (Module->BaseAddress + Function->EndAddress <= Context->Rip)
+        return FALSE;
+
+    length = (ULONG)min(Module->BaseAddress + Function->EndAddress - Context->Rip, sizeof(code));
+
+    if (!NT_SUCCESS(PhpReadMemoryUnwindCache(State->Cache, Context->Rip, code, length)))
+        return FALSE;
+
+#define CHECK_LENGTH(Count) if (offset + (Count) > length) return FALSE;
+
+    // An epilog is an optional "add rsp, imm" or "lea rsp, [reg + disp]", followed by
+    // any number of pops, followed by a return or a jump to another function.
+
+    offset = 0;
+
+    if (length >= 3 && (code[0] & 0xf8) == 0x48)
+    {
+        if (code[0] == 0x48 && code[1] == 0x83 && code[2] == 0xc4)
+        {
+            offset = 4; // add rsp, imm8
+        }
+        else if (code[0] == 0x48 && code[1] == 0x81 && code[2] == 0xc4)
+        {
+            offset = 7; // add rsp, imm32
+        }
+        else if (code[1] == 0x8d && !(code[0] & 0x06) && ((code[2] >> 3) & 7) == 4 && (code[2] & 7) != 4)
+        {
+            if ((code[2] >> 6) == 1)
+                offset = 4; // lea rsp, [reg + disp8]
+            else if ((code[2] >> 6) == 2)
+                offset = 7; // lea rsp, [reg + disp32]
+            else
+                return FALSE;
+        }
+    }
+
+    firstPop = offset;
+
+    while (TRUE)
+    {
+        CHECK_LENGTH(1);
+
+        if ((code[offset] & 0xf0) == 0x40)
+        {
+            // REX prefix. Only REX.B is allowed for a pop.
+            CHECK_LENGTH(2);
+
+            if ((code[offset] & 0x0e) || (code[offset + 1] & 0xf8) != 0x58)
+                break;
+
+            offset += 2;
+            continue;
+        }
+
+        if ((code[offset] & 0xf8) == 0x58)
+        {
+            offset++;
+            continue;
+        }
+
+        break;
+    }
+
+    switch (code[offset])
+    {
+    case 0xc3: // ret
+        stackAdjust = 0;
+        break;
+    case 0xc2: // ret imm16
+        CHECK_LENGTH(3);
+        stackAdjust = *(PUSHORT)&code[offset + 1];
+        break;
+    case 0xf3: // rep ret
+        CHECK_LENGTH(2);
+        if (code[offset + 1] != 0xc3)
+            return FALSE;
+        stackAdjust = 0;
+        break;
+    case 0xe9: // jmp rel32
+    case 0xeb: // jmp rel8
+        if (code[offset] == 0xe9)
+        {
+            CHECK_LENGTH(5);
+            displacement = *(PLONG)&code[offset + 1];
+            target = Context->Rip + offset + 5 + displacement;
+        }
+        else
+        {
+            CHECK_LENGTH(2);
+            displacement = (CHAR)code[offset + 1];
+            target = Context->Rip + offset + 2 + displacement;
+        }
+
+        // A jump within the function is not part of an epilog. A jump to another
+        // function is a tail call.
+        if (target >= Module->BaseAddress + Function->BeginAddress && target < Module->BaseAddress + Function->EndAddress)
+            return FALSE;
+
+        stackAdjust = 0;
+        break;
+    case 0xff: // jmp qword ptr [rip + disp32]
+        CHECK_LENGTH(2);
+        if (code[offset + 1] != 0x25)
+            return FALSE;
+        stackAdjust = 0;
+        break;
+    case 0x48: // rex.w jmp qword ptr [rip + disp32]
+        CHECK_LENGTH(3);
+        if (code[offset + 1] != 0xff || code[offset + 2] != 0x25)
+            return FALSE;
+        stackAdjust = 0;
+        break;
+    default:
+        return FALSE;
+    }
+
+    // This is an epilog. Emulate the instructions.
+
+    offset = 0;
+
+    if (firstPop != 0)
+    {
+        if (code[1] == 0x83)
+        {
+            Context->Registers[PH_UNWIND_RSP] += (CHAR)code[3];
+        }
+        else if (code[1] == 0x81)
+        {
+            Context->Registers[PH_UNWIND_RSP] += *(PLONG)&code[3];
+        }
+        else
+        {
+            ULONG reg = (code[2] & 7) + (code[0] & 1) * 8;
+
+            if ((code[2] >> 6) == 1)
+                Context->Registers[PH_UNWIND_RSP] = Context->Registers[reg] + (CHAR)code[3];
+            else
+                Context->Registers[PH_UNWIND_RSP] = Context->Registers[reg] + *(PLONG)&code[3];
+        }
+
+        offset = firstPop;
+    }
+
+    while (TRUE)
+    {
+        ULONG reg;
+
+        if ((code[offset] & 0xf0) == 0x40 && (code[offset + 1] & 0xf8) == 0x58)
+        {
+            reg = (code[offset + 1] & 7) + 8;
+            offset += 2;
+        }
+        else if ((code[offset] & 0xf8) == 0x58)
+        {
+            reg = code[offset] & 7;
+            offset++;
+        }
+        else
+        {
+            break;
+        }
+
+        if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP], &Context->Registers[reg])))
+        {
+            *Status = status;
+            return TRUE;
+        }
+
+        Context->Registers[PH_UNWIND_RSP] += sizeof(ULONG64);
+    }
+
+    if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP], &Context->Rip)))
+    {
+        *Status = status;
+        return TRUE;
+    }
+
+    Context->Registers[PH_UNWIND_RSP] += sizeof(ULONG64) + stackAdjust;
+    *Status = STATUS_SUCCESS;
+
+    return TRUE;
+}
+
+static ULONG PhpGetUnwindCodeSlots(
+    _In_ PH_UNWIND_CODE UnwindCode
+    )
+{
+    switch (UnwindCode.UnwindOp)
+    {
+    case PH_UWOP_ALLOC_LARGE:
+        return UnwindCode.OpInfo == 0 ? 2 : 3;
+    case PH_UWOP_SAVE_NONVOL:
+    case PH_UWOP_EPILOG:
+    case PH_UWOP_SAVE_XMM128:
+        return 2;
+    case PH_UWOP_SAVE_NONVOL_FAR:
+    case PH_UWOP_SPARE_CODE:
+    case PH_UWOP_SAVE_XMM128_FAR:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * Unwinds a function which has an entry in the function table.
+ */
+static NTSTATUS PhpVirtualUnwind(
+    _Inout_ PPH_UNWIND_STATE State,
+    _In_ PPH_UNWIND_MODULE Module,
+    _In_ PPH_RUNTIME_FUNCTION Function,
+    _Inout_ PPH_UNWIND_CONTEXT Context
+    )
+{
+    NTSTATUS status;
+    PH_RUNTIME_FUNCTION function;
+    PPH_UNWIND_INFO unwindInfo;
+    ULONG rva;
+    ULONG depth;
+    ULONG i;
+    ULONG slots;
+    BOOLEAN inProlog;
+    BOOLEAN primary;
+    BOOLEAN machineFrame;
+    ULONG64 frameBase;
+
+    function = *Function;
+    rva = (ULONG)(Context->Rip - Module->BaseAddress);
+    primary = TRUE;
+    machineFrame = FALSE;
+
+    for (depth = 0; depth < PH_UNWIND_MAXIMUM_CHAIN_DEPTH; depth++)
+    {
+        // The entry may refer to another function table entry instead of unwind
+        // information.
+        if (function.UnwindData & 1)
+        {
+            if (!NT_SUCCESS(status = PhpReadMemoryUnwindCache(
+                State->Cache,
+                Module->BaseAddress + (function.UnwindData & ~1),
+                &function,
+                sizeof(PH_RUNTIME_FUNCTION)
+                )))
+                return status;
+
+            continue;
+        }
+
+        if (!NT_SUCCESS(status = PhpGetUnwindInfo(State->Cache, Module, function.UnwindData, &unwindInfo)))
+            return status;
+
+        if (unwindInfo->Version != 1 && unwindInfo->Version != 2)
+            return STATUS_UNKNOWN_REVISION;
+
+        inProlog = rva >= function.BeginAddress && rva - function.BeginAddress < unwindInfo->SizeOfProlog;
+
+        // Only the primary function can have an epilog.
+        if (primary && !inProlog && !(unwindInfo->Flags & PH_UNW_FLAG_CHAININFO) && unwindInfo->CountOfCodes != 0)
+        {
+            if (PhpUnwindEpilog(State, Module, &function, Context, &status))
+                return status;
+        }
+
+        primary = FALSE;
+
+        // Non-volatile registers are saved relative to the frame register if the
+        // prolog has already set it, otherwise relative to the stack pointer.
+
+        frameBase = Context->Registers[PH_UNWIND_RSP];
+
+        if (unwindInfo->FrameRegister != 0)
+        {
+            BOOLEAN frameRegisterSet = !inProlog;
+
+            if (inProlog)
+            {
+                for (i = 0; i < unwindInfo->CountOfCodes; i += PhpGetUnwindCodeSlots(unwindInfo->UnwindCode[i]))
+                {
+                    if (
+                        unwindInfo->UnwindCode[i].UnwindOp == PH_UWOP_SET_FPREG &&
+                        rva - function.BeginAddress >= unwindInfo->UnwindCode[i].CodeOffset
+                        )
+                    {
+                        frameRegisterSet = TRUE;
+                        break;
+                    }
+                }
+            }
+
+            if (frameRegisterSet)
+                frameBase = Context->Registers[unwindInfo->FrameRegister] - unwindInfo->FrameOffset * 16;
+        }
+
+        for (i = 0; i < unwindInfo->CountOfCodes; i += slots)
+        {
+            PH_UNWIND_CODE unwindCode = unwindInfo->UnwindCode[i];
+            ULONG64 offset;
+
+            slots = PhpGetUnwindCodeSlots(unwindCode);
+
+            if (i + slots > unwindInfo->CountOfCodes)
+                return STATUS_INVALID_IMAGE_FORMAT;
+
+            // Skip operations that have not been executed yet.
+            if (inProlog && rva - function.BeginAddress < unwindCode.CodeOffset)
+                continue;
+
+            switch (unwindCode.UnwindOp)
+            {
+            case PH_UWOP_PUSH_NONVOL:
+                if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP], &Context->Registers[unwindCode.OpInfo])))
+                    return status;
+
+                Context->Registers[PH_UNWIND_RSP] += sizeof(ULONG64);
+                break;
+            case PH_UWOP_ALLOC_LARGE:
+                if (unwindCode.OpInfo == 0)
+                    Context->Registers[PH_UNWIND_RSP] += unwindInfo->UnwindCode[i + 1].FrameOffset * 8;
+                else
+                    Context->Registers[PH_UNWIND_RSP] += unwindInfo->UnwindCode[i + 1].FrameOffset + ((ULONG)unwindInfo->UnwindCode[i + 2].FrameOffset << 16);
+                break;
+            case PH_UWOP_ALLOC_SMALL:
+                Context->Registers[PH_UNWIND_RSP] += unwindCode.OpInfo * 8 + 8;
+                break;
+            case PH_UWOP_SET_FPREG:
+                Context->Registers[PH_UNWIND_RSP] = Context->Registers[unwindInfo->FrameRegister] - unwindInfo->FrameOffset * 16;
+                break;
+            case PH_UWOP_SAVE_NONVOL:
+            case PH_UWOP_SAVE_NONVOL_FAR:
+                if (unwindCode.UnwindOp == PH_UWOP_SAVE_NONVOL)
+                    offset = unwindInfo->UnwindCode[i + 1].FrameOffset * 8;
+                else
+                    offset = unwindInfo->UnwindCode[i + 1].FrameOffset + ((ULONG)unwindInfo->UnwindCode[i + 2].FrameOffset << 16);
+
+                if (!NT_SUCCESS(status = PhpReadStackValue(State, frameBase + offset, &Context->Registers[unwindCode.OpInfo])))
+                    return status;
+                break;
+            case PH_UWOP_EPILOG:
+            case PH_UWOP_SPARE_CODE:
+            case PH_UWOP_SAVE_XMM128:
+            case PH_UWOP_SAVE_XMM128_FAR:
+                break;
+            case PH_UWOP_PUSH_MACHFRAME:
+                // The frame was pushed by the processor for an interrupt or exception,
+                // optionally with an error code.
+                if (unwindCode.OpInfo != 0)
+                    Context->Registers[PH_UNWIND_RSP] += sizeof(ULONG64);
+
+                if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP], &Context->Rip)))
+                    return status;
+                if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP] + 3 * sizeof(ULONG64), &Context->Registers[PH_UNWIND_RSP])))
+                    return status;
+
+                machineFrame = TRUE;
+                break;
+            default:
+                return STATUS_INVALID_IMAGE_FORMAT;
+            }
+        }
+
+        if (!(unwindInfo->Flags & PH_UNW_FLAG_CHAININFO))
+            break;
+
+        function = *(PPH_RUNTIME_FUNCTION)&unwindInfo->UnwindCode[(unwindInfo->CountOfCodes + 1) & ~1];
+    }
+
+    if (depth == PH_UNWIND_MAXIMUM_CHAIN_DEPTH)
+        return STATUS_INVALID_IMAGE_FORMAT;
+
+    if (!machineFrame)
+    {
+        if (!NT_SUCCESS(status = PhpReadStackValue(State, Context->Registers[PH_UNWIND_RSP], &Context->Rip)))
+            return status;
+
+        Context->Registers[PH_UNWIND_RSP] += sizeof(ULONG64);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Unwinds one stack frame.
+ *
+ * \param State The unwind state. On success, the context is updated to the caller
+ * of the current frame.
+ *
+ * \return STATUS_SUCCESS if the frame was unwound, STATUS_NOT_FOUND if the
+ * instruction pointer is not inside a module, or another error code if the unwind
+ * data or the stack could not be read. The context is not modified if the function
+ * fails.
+ */
+NTSTATUS PhUnwindFrame(
+    _Inout_ PPH_UNWIND_STATE State
+    )
+{
+    NTSTATUS status;
+    PH_UNWIND_CONTEXT context;
+    PPH_UNWIND_MODULE module;
+    PPH_RUNTIME_FUNCTION function;
+
+    if (!NT_SUCCESS(status = PhpFindUnwindModule(State->Cache, State->Context.Rip, &module)))
+        return status;
+
+    context = State->Context;
+    function = PhpLookupUnwindFunction(module, (ULONG)(context.Rip - module->BaseAddress));
+
+    if (function)
+    {
+        status = PhpVirtualUnwind(State, module, function, &context);
+    }
+    else
+    {
+        // This is a leaf function, so the return address is at the top of the stack.
+        status = PhpReadStackValue(State, context.Registers[PH_UNWIND_RSP], &context.Rip);
+        context.Registers[PH_UNWIND_RSP] += sizeof(ULONG64);
+    }
+
+    if (NT_SUCCESS(status))
+        State->Context = context;
+
+    return status;
+}
@@ -136,13 +136,21 @@ FORCEINLINE VOID PhpInitializeWorkQueueItem(
 {
     WorkQueueItem->Function = Function;
     WorkQueueItem->Context = Context;
+    WorkQueueItem->QueueTimestamp = PHLIB_STATISTIC_TIMESTAMP();
 }
 
 FORCEINLINE VOID PhpExecuteWorkQueueItem(
     _Inout_ PPH_WORK_QUEUE_ITEM WorkQueueItem
     )
 {
+    ULONG64 startTimestamp;
+
+    startTimestamp = PHLIB_STATISTIC_TIMESTAMP();
+    PhAddLibStatisticsHistogram(&PhGetLibStatisticsBlock()->WqWorkItemWaitTime, startTimestamp - WorkQueueItem->QueueTimestamp);
+
     WorkQueueItem->Function(WorkQueueItem->Context);
+
+    PHLIB_ADD_STATISTIC_TIME(WqWorkItemRunTime, startTimestamp);
 }
 
 BOOLEAN PhpCreateWorkQueueThread(
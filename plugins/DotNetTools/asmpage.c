@@ -927,18 +927,19 @@ BOOLEAN IsProcessSuspended(
     _In_ HANDLE ProcessId
     )
 {
-    PVOID processes;
+    PPH_PROCESS_SNAPSHOT snapshot;
     PSYSTEM_PROCESS_INFORMATION process;
+    BOOLEAN suspended = FALSE;
 
-    if (NT_SUCCESS(PhEnumProcesses(&processes)))
+    if (NT_SUCCESS(PhGetProcessSnapshot(0, &snapshot)))
     {
-        if (process = PhFindProcessInformation(processes, ProcessId))
-            return PhGetProcessIsSuspended(process);
+        if (process = PhFindProcessInformation(snapshot->Processes, ProcessId))
+            suspended = PhGetProcessIsSuspended(process);
 
-        PhFree(processes);
+        PhDereferenceObject(snapshot);
     }
 
-    return FALSE;
+    return suspended;
 }
 
 INT_PTR CALLBACK DotNetAsmPageDlgProc(
@@ -33,10 +33,6 @@ VOID NTAPI NetworkItemsUpdatedCallback(
     _In_opt_ PVOID Context
     );
 
-VOID EtpUpdateProcessInformation(
-    VOID
-    );
-
 static PH_CALLBACK_REGISTRATION EtpProcessesUpdatedCallbackRegistration;
 static PH_CALLBACK_REGISTRATION EtpNetworkItemsUpdatedCallbackRegistration;
 
@@ -67,9 +63,6 @@ PH_CIRCULAR_BUFFER_ULONG EtNetworkSendHistory;
 PH_CIRCULAR_BUFFER_ULONG EtMaxDiskHistory; // ID of max. disk usage process
 PH_CIRCULAR_BUFFER_ULONG EtMaxNetworkHistory; // ID of max. network usage process
 
-PVOID EtpProcessInformation;
-PH_QUEUED_LOCK EtpProcessInformationLock = PH_QUEUED_LOCK_INIT;
-
 VOID EtEtwStatisticsInitialization(
     VOID
     )
@@ -225,12 +218,6 @@ static VOID NTAPI ProcessesUpdatedCallback(
     ULONG64 maxNetworkValue = 0;
     PET_PROCESS_BLOCK maxNetworkBlock = NULL;
 
-    // Since Windows 8, we no longer get the correct process/thread IDs in the
-    // event headers for disk events. We need to update our process information since
-    // etwmon uses our EtThreadIdToProcessId function.
-    if (WindowsVersion >= WINDOWS_8)
-        EtpUpdateProcessInformation();
-
     // ETW is extremely lazy when it comes to flushing buffers, so we must do it
     // manually.
     EtFlushEtwSession();
@@ -368,37 +355,23 @@ static VOID NTAPI NetworkItemsUpdatedCallback(
     }
 }
 
-VOID EtpUpdateProcessInformation(
-    VOID
-    )
-{
-    PhAcquireQueuedLockExclusive(&EtpProcessInformationLock);
-
-    if (EtpProcessInformation)
-    {
-        PhFree(EtpProcessInformation);
-        EtpProcessInformation = NULL;
-    }
-
-    PhEnumProcesses(&EtpProcessInformation);
-
-    PhReleaseQueuedLockExclusive(&EtpProcessInformationLock);
-}
-
 HANDLE EtThreadIdToProcessId(
     _In_ HANDLE ThreadId
     )
 {
+    PPH_PROCESS_SNAPSHOT snapshot;
     PSYSTEM_PROCESS_INFORMATION process;
     ULONG i;
     HANDLE processId;
 
-    if (!EtpProcessInformation)
+    // Since Windows 8, we no longer get the correct process/thread IDs in the
+    // event headers for disk events. The process provider publishes a new
+    // process snapshot every update, so we use that instead of taking our own.
+    if (!(snapshot = PhReferenceProcessSnapshot()))
         return NULL;
 
-    PhAcquireQueuedLockShared(&EtpProcessInformationLock);
-
-    process = PH_FIRST_PROCESS(EtpProcessInformation);
+    processId = NULL;
+    process = PH_FIRST_PROCESS(snapshot->Processes);
 
     do
     {
@@ -407,14 +380,13 @@ HANDLE EtThreadIdToProcessId(
             if (process->Threads[i].ClientId.UniqueThread == ThreadId)
             {
                 processId = process->UniqueProcessId;
-                PhReleaseQueuedLockShared(&EtpProcessInformationLock);
-
-                return processId;
+                goto CleanupExit;
             }
         }
     } while (process = PH_NEXT_PROCESS(process));
 
-    PhReleaseQueuedLockShared(&EtpProcessInformationLock);
+CleanupExit:
+    PhDereferenceObject(snapshot);
 
-    return NULL;
+    return processId;
 }
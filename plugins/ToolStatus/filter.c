@@ -23,273 +23,372 @@
 
 #include "toolstatus.h"
 
-static BOOLEAN WordMatchStringRef(
+PSEARCH_QUERY SearchQuery = NULL;
+
+/**
+ * Compiles search text into a query.
+ *
+ * \param Text The search text. Words are separated by spaces.
+ *
+ * \return The query, or NULL if the text is empty. The query matches if any of its
+ * words is found in the text being searched, ignoring case. Free the query using
+ * FreeSearchQuery().
+ */
+PSEARCH_QUERY CreateSearchQuery(
     _In_ PPH_STRINGREF Text
     )
 {
+    PSEARCH_QUERY query;
+    PWCHAR buffer;
     PH_STRINGREF part;
     PH_STRINGREF remainingPart;
- 
-    remainingPart = SearchboxText->sr;
+    ULONG numberOfWords;
+
+    if (Text->Length == 0)
+        return NULL;
+
+    numberOfWords = 0;
+    remainingPart = *Text;
 
     while (remainingPart.Length != 0)
     {
         PhSplitStringRefAtChar(&remainingPart, ' ', &part, &remainingPart);
 
         if (part.Length != 0)
-        {
-            if (PhFindStringInStringRef(Text, &part, TRUE) != -1)
-                return TRUE;
-        }
+            numberOfWords++;
     }
 
-    return FALSE;
+    query = PhAllocate(FIELD_OFFSET(SEARCH_QUERY, Words) + sizeof(SEARCH_QUERY_WORD) * numberOfWords + Text->Length);
+    query->NumberOfWords = 0;
+    buffer = (PWCHAR)&query->Words[numberOfWords];
+    remainingPart = *Text;
+
+    while (remainingPart.Length != 0)
+    {
+        PSEARCH_QUERY_WORD word;
+        SIZE_T length;
+        SIZE_T i;
+
+        PhSplitStringRefAtChar(&remainingPart, ' ', &part, &remainingPart);
+
+        if (part.Length == 0)
+            continue;
+
+        word = &query->Words[query->NumberOfWords++];
+        length = part.Length / sizeof(WCHAR);
+
+        for (i = 0; i < length; i++)
+            buffer[i] = RtlUpcaseUnicodeChar(part.Buffer[i]);
+
+        word->Text.Buffer = buffer;
+        word->Text.Length = part.Length;
+        buffer += length;
+
+        for (i = 0; i < 256; i++)
+            word->Skip[i] = (USHORT)length;
+
+        // Characters that share a low byte share an entry. Later characters give
+        // smaller shifts, so each entry ends up with the smallest safe shift.
+        for (i = 0; i + 1 < length; i++)
+            word->Skip[word->Text.Buffer[i] & 0xff] = (USHORT)(length - 1 - i);
+    }
+
+    return query;
 }
 
-static BOOLEAN WordMatchString(
-    _In_ PWSTR Text
+VOID FreeSearchQuery(
+    _In_ PSEARCH_QUERY Query
     )
 {
-    PH_STRINGREF text;
-    PH_STRINGREF part;
-    PH_STRINGREF remainingPart;
+    PhFree(Query);
+}
 
-    PhInitializeStringRef(&text, Text);
+static BOOLEAN FindSearchQueryWord(
+    _In_ PSEARCH_QUERY_WORD Word,
+    _In_ PPH_STRINGREF Text,
+    _In_ BOOLEAN TextIsFolded
+    )
+{
+    PWCHAR text = Text->Buffer;
+    PWCHAR pattern = Word->Text.Buffer;
+    SIZE_T textLength = Text->Length / sizeof(WCHAR);
+    SIZE_T patternLength = Word->Text.Length / sizeof(WCHAR);
+    SIZE_T i;
+    SIZE_T j;
+    WCHAR c;
 
-    remainingPart = SearchboxText->sr;
+    if (patternLength > textLength)
+        return FALSE;
 
-    while (remainingPart.Length != 0)
+    i = 0;
+
+    while (i <= textLength - patternLength)
     {
-        PhSplitStringRefAtChar(&remainingPart, ' ', &part, &remainingPart);
+        j = patternLength - 1;
 
-        if (part.Length != 0)
+        while (TRUE)
         {
-            if (PhFindStringInStringRef(&text, &part, TRUE) != -1)
+            c = text[i + j];
+
+            if (!TextIsFolded)
+                c = RtlUpcaseUnicodeChar(c);
+
+            if (c != pattern[j])
+                break;
+            if (j == 0)
                 return TRUE;
+
+            j--;
         }
+
+        c = text[i + patternLength - 1];
+
+        if (!TextIsFolded)
+            c = RtlUpcaseUnicodeChar(c);
+
+        i += Word->Skip[c & 0xff];
     }
 
     return FALSE;
 }
 
-BOOLEAN ProcessTreeFilterCallback(
-    _In_ PPH_TREENEW_NODE Node,
-    _In_opt_ PVOID Context
+static BOOLEAN SearchQueryMatchEx(
+    _In_ PSEARCH_QUERY Query,
+    _In_ PPH_STRINGREF Text,
+    _In_ BOOLEAN TextIsFolded
     )
 {
-    BOOLEAN showItem = FALSE;
-    PPH_PROCESS_NODE processNode = (PPH_PROCESS_NODE)Node;
+    ULONG i;
 
-    if (PhIsNullOrEmptyString(SearchboxText))
-        return TRUE;
-
-    if (processNode->ProcessItem->ProcessName)
+    for (i = 0; i < Query->NumberOfWords; i++)
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->ProcessName->sr))
-            showItem = TRUE;
+        if (FindSearchQueryWord(&Query->Words[i], Text, TextIsFolded))
+            return TRUE;
     }
 
-    if (processNode->ProcessItem->FileName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->FileName->sr))
-            showItem = TRUE;
-    }
-
-    if (processNode->ProcessItem->CommandLine)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->CommandLine->sr))
-            showItem = TRUE;
-    }
+    return FALSE;
+}
 
-    if (processNode->ProcessItem->VersionInfo.CompanyName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.CompanyName->sr))
-            showItem = TRUE;
-    }
+static BOOLEAN SearchQueryMatchStringRef(
+    _In_ PPH_STRINGREF Text
+    )
+{
+    return SearchQueryMatchEx(SearchQuery, Text, FALSE);
+}
 
-    if (processNode->ProcessItem->VersionInfo.FileDescription)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.FileDescription->sr))
-            showItem = TRUE;
-    }
+static BOOLEAN SearchQueryMatchString(
+    _In_ PWSTR Text
+    )
+{
+    PH_STRINGREF text;
 
-    if (processNode->ProcessItem->VersionInfo.FileVersion)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.FileVersion->sr))
-            showItem = TRUE;
-    }
+    PhInitializeStringRef(&text, Text);
 
-    if (processNode->ProcessItem->VersionInfo.ProductName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VersionInfo.ProductName->sr))
-            showItem = TRUE;
-    }
+    return SearchQueryMatchEx(SearchQuery, &text, FALSE);
+}
 
-    if (processNode->ProcessItem->UserName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->UserName->sr))
-            showItem = TRUE;
-    }
+VOID NTAPI ProcessNodeSearchCacheCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    memset(Extension, 0, sizeof(PROCESS_SEARCH_CACHE));
+}
 
-    if (processNode->ProcessItem->IntegrityString)
-    {
-        if (WordMatchString(processNode->ProcessItem->IntegrityString))
-            showItem = TRUE;
-    }
+VOID NTAPI ProcessNodeSearchCacheDeleteCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    )
+{
+    PPROCESS_SEARCH_CACHE cache = Extension;
+    ULONG i;
 
-    if (processNode->ProcessItem->JobName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->JobName->sr))
-            showItem = TRUE;
-    }
+    for (i = 0; i < RTL_NUMBER_OF(cache->Signature.Strings); i++)
+        PhSwapReference(&cache->Signature.Strings[i], NULL);
 
-    if (processNode->ProcessItem->VerifySignerName)
-    {
-        if (WordMatchStringRef(&processNode->ProcessItem->VerifySignerName->sr))
-            showItem = TRUE;
-    }
+    PhSwapReference(&cache->Text, NULL);
+}
 
-    if (processNode->ProcessItem->ProcessIdString)
+static VOID AppendSearchText(
+    _Inout_ PPH_STRING_BUILDER StringBuilder,
+    _In_opt_ PWSTR Text
+    )
+{
+    if (Text)
     {
-        if (WordMatchString(processNode->ProcessItem->ProcessIdString))
-            showItem = TRUE;
+        PhAppendStringBuilder2(StringBuilder, Text);
+        PhAppendCharStringBuilder(StringBuilder, '\n');
     }
+}
 
-    if (processNode->ProcessItem->ParentProcessIdString)
-    {
-        if (WordMatchString(processNode->ProcessItem->ParentProcessIdString))
-            showItem = TRUE;
-    }
+static PPH_STRING CreateProcessSearchText(
+    _In_ PPH_PROCESS_ITEM ProcessItem,
+    _In_ PPROCESS_SEARCH_SIGNATURE Signature
+    )
+{
+    PH_STRING_BUILDER sb;
+    PPH_STRING text;
+    SIZE_T i;
 
-    if (processNode->ProcessItem->SessionIdString)
-    {
-        if (WordMatchString(processNode->ProcessItem->SessionIdString))
-            showItem = TRUE;
-    }
+    PhInitializeStringBuilder(&sb, 256);
 
-    if (processNode->ProcessItem->PackageFullName)
+    // Fields are separated by new lines, which cannot appear in the search box, so a
+    // word never matches across two fields.
+    for (i = 0; i < RTL_NUMBER_OF(Signature->Strings); i++)
     {
-        if (WordMatchStringRef(&processNode->ProcessItem->PackageFullName->sr))
-            showItem = TRUE;
+        if (Signature->Strings[i])
+        {
+            PhAppendStringBuilder(&sb, &Signature->Strings[i]->sr);
+            PhAppendCharStringBuilder(&sb, '\n');
+        }
     }
 
-    if (WordMatchString(PhGetProcessPriorityClassString(processNode->ProcessItem->PriorityClass)))
-        showItem = TRUE;
+    AppendSearchText(&sb, Signature->IntegrityString);
+    AppendSearchText(&sb, ProcessItem->ProcessIdString);
+    AppendSearchText(&sb, ProcessItem->ParentProcessIdString);
+    AppendSearchText(&sb, ProcessItem->SessionIdString);
+    AppendSearchText(&sb, PhGetProcessPriorityClassString(Signature->PriorityClass));
 
-    if (processNode->ProcessItem->VerifyResult != VrUnknown)
+    if (Signature->VerifyResult != VrUnknown)
     {
-        switch (processNode->ProcessItem->VerifyResult)
+        switch (Signature->VerifyResult)
         {
         case VrNoSignature:
-            if (WordMatchString(L"NoSignature"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"NoSignature");
             break;
         case VrTrusted:
-            if (WordMatchString(L"Trusted"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Trusted");
             break;
         case VrExpired:
-            if (WordMatchString(L"Expired"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Expired");
             break;
         case VrRevoked:
-            if (WordMatchString(L"Revoked"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Revoked");
             break;
         case VrDistrust:
-            if (WordMatchString(L"Distrust"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Distrust");
             break;
         case VrSecuritySettings:
-            if (WordMatchString(L"SecuritySettings"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"SecuritySettings");
             break;
         case VrBadSignature:
-            if (WordMatchString(L"BadSignature"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"BadSignature");
             break;
         default:
-            if (WordMatchString(L"Unknown"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Unknown");
             break;
         }
     }
 
-    if (WINDOWS_HAS_UAC && processNode->ProcessItem->ElevationType != TokenElevationTypeDefault)
+    if (WINDOWS_HAS_UAC && Signature->ElevationType != TokenElevationTypeDefault)
     {
-        switch (processNode->ProcessItem->ElevationType)
+        switch (Signature->ElevationType)
         {
         case TokenElevationTypeLimited:
-            if (WordMatchString(L"Limited"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Limited");
             break;
         case TokenElevationTypeFull:
-            if (WordMatchString(L"Full"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Full");
             break;
         default:
-            if (WordMatchString(L"Unknown"))
-                showItem = TRUE;
+            AppendSearchText(&sb, L"Unknown");
             break;
         }
     }
 
-    if (WordMatchString(L"UpdateIsDotNet") && processNode->ProcessItem->UpdateIsDotNet)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsBeingDebugged") && processNode->ProcessItem->IsBeingDebugged)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsDotNet") && processNode->ProcessItem->IsDotNet)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsElevated") && processNode->ProcessItem->IsElevated)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsInJob") && processNode->ProcessItem->IsInJob)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsInSignificantJob") && processNode->ProcessItem->IsInSignificantJob)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsPacked") && processNode->ProcessItem->IsPacked)
-    {
-        showItem = TRUE;
-    }
-
-    if (WordMatchString(L"IsPosix") && processNode->ProcessItem->IsPosix)
-    {
-        showItem = TRUE;
-    }
+    // Flag keywords only match processes that have the flag set.
+    if (ProcessItem->UpdateIsDotNet)
+        AppendSearchText(&sb, L"UpdateIsDotNet");
+    if (ProcessItem->IsBeingDebugged)
+        AppendSearchText(&sb, L"IsBeingDebugged");
+    if (ProcessItem->IsDotNet)
+        AppendSearchText(&sb, L"IsDotNet");
+    if (ProcessItem->IsElevated)
+        AppendSearchText(&sb, L"IsElevated");
+    if (ProcessItem->IsInJob)
+        AppendSearchText(&sb, L"IsInJob");
+    if (ProcessItem->IsInSignificantJob)
+        AppendSearchText(&sb, L"IsInSignificantJob");
+    if (ProcessItem->IsPacked)
+        AppendSearchText(&sb, L"IsPacked");
+    if (ProcessItem->IsPosix)
+        AppendSearchText(&sb, L"IsPosix");
+    if (ProcessItem->IsSuspended)
+        AppendSearchText(&sb, L"IsSuspended");
+    if (ProcessItem->IsWow64)
+        AppendSearchText(&sb, L"IsWow64");
+    if (ProcessItem->IsImmersive)
+        AppendSearchText(&sb, L"IsImmersive");
+
+    text = PhFinalStringBuilderString(&sb);
+
+    for (i = 0; i < text->Length / sizeof(WCHAR); i++)
+        text->Buffer[i] = RtlUpcaseUnicodeChar(text->Buffer[i]);
+
+    return text;
+}
 
-    if (WordMatchString(L"IsSuspended") && processNode->ProcessItem->IsSuspended)
-    {
-        showItem = TRUE;
-    }
+static PPH_STRING GetProcessSearchText(
+    _In_ PPH_PROCESS_NODE ProcessNode
+    )
+{
+    PPH_PROCESS_ITEM processItem = ProcessNode->ProcessItem;
+    PPROCESS_SEARCH_CACHE cache;
+    PROCESS_SEARCH_SIGNATURE signature;
+    ULONG i;
+
+    cache = PhPluginGetObjectExtension(PluginInstance, ProcessNode, EmProcessNodeType);
+
+    memset(&signature, 0, sizeof(PROCESS_SEARCH_SIGNATURE));
+    signature.Strings[0] = processItem->ProcessName;
+    signature.Strings[1] = processItem->FileName;
+    signature.Strings[2] = processItem->CommandLine;
+    signature.Strings[3] = processItem->VersionInfo.CompanyName;
+    signature.Strings[4] = processItem->VersionInfo.FileDescription;
+    signature.Strings[5] = processItem->VersionInfo.FileVersion;
+    signature.Strings[6] = processItem->VersionInfo.ProductName;
+    signature.Strings[7] = processItem->UserName;
+    signature.Strings[8] = processItem->JobName;
+    signature.Strings[9] = processItem->VerifySignerName;
+    signature.Strings[10] = processItem->PackageFullName;
+    signature.IntegrityString = processItem->IntegrityString;
+    signature.PriorityClass = processItem->PriorityClass;
+    signature.VerifyResult = processItem->VerifyResult;
+    signature.ElevationType = processItem->ElevationType;
+    signature.Flags = processItem->Flags;
+
+    // The cache keeps references to the strings it was built from, so a changed field
+    // always has a different pointer.
+    if (cache->Text && memcmp(&cache->Signature, &signature, sizeof(PROCESS_SEARCH_SIGNATURE)) == 0)
+        return cache->Text;
+
+    for (i = 0; i < RTL_NUMBER_OF(signature.Strings); i++)
+    {
+        if (signature.Strings[i])
+            PhReferenceObject(signature.Strings[i]);
+        if (cache->Signature.Strings[i])
+            PhDereferenceObject(cache->Signature.Strings[i]);
+    }
+
+    cache->Signature = signature;
+    PhSwapReference2(&cache->Text, CreateProcessSearchText(processItem, &signature));
+
+    return cache->Text;
+}
 
-    if (WordMatchString(L"IsWow64") && processNode->ProcessItem->IsWow64)
-    {
-        showItem = TRUE;
-    }
+BOOLEAN ProcessTreeFilterCallback(
+    _In_ PPH_TREENEW_NODE Node,
+    _In_opt_ PVOID Context
+    )
+{
+    PPH_PROCESS_NODE processNode = (PPH_PROCESS_NODE)Node;
 
-    if (WordMatchString(L"IsImmersive") && processNode->ProcessItem->IsImmersive)
-    {
-        showItem = TRUE;
-    }
+    if (!SearchQuery)
+        return TRUE;
 
-    return showItem;
+    return SearchQueryMatchEx(SearchQuery, &GetProcessSearchText(processNode)->sr, TRUE);
 }
 
 BOOLEAN ServiceTreeFilterCallback(
@@ -297,43 +396,42 @@ BOOLEAN ServiceTreeFilterCallback(
     _In_opt_ PVOID Context
     )
 {
-    BOOLEAN showItem = FALSE;
     PPH_SERVICE_NODE serviceNode = (PPH_SERVICE_NODE)Node;
 
-    if (PhIsNullOrEmptyString(SearchboxText))
+    if (!SearchQuery)
         return TRUE;
 
-    if (WordMatchString(PhGetServiceTypeString(serviceNode->ServiceItem->Type)))
-        showItem = TRUE;
-
-    if (WordMatchString(PhGetServiceStateString(serviceNode->ServiceItem->State)))
-        showItem = TRUE;
-
-    if (WordMatchString(PhGetServiceStartTypeString(serviceNode->ServiceItem->StartType)))
-        showItem = TRUE;
-
-    if (WordMatchString(PhGetServiceErrorControlString(serviceNode->ServiceItem->ErrorControl)))
-        showItem = TRUE;
-
     if (serviceNode->ServiceItem->Name)
     {
-        if (WordMatchStringRef(&serviceNode->ServiceItem->Name->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&serviceNode->ServiceItem->Name->sr))
+            return TRUE;
     }
 
     if (serviceNode->ServiceItem->DisplayName)
     {
-        if (WordMatchStringRef(&serviceNode->ServiceItem->DisplayName->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&serviceNode->ServiceItem->DisplayName->sr))
+            return TRUE;
     }
 
     if (serviceNode->ServiceItem->ProcessIdString)
     {
-        if (WordMatchString(serviceNode->ServiceItem->ProcessIdString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(serviceNode->ServiceItem->ProcessIdString))
+            return TRUE;
     }
 
-    return showItem;
+    if (SearchQueryMatchString(PhGetServiceTypeString(serviceNode->ServiceItem->Type)))
+        return TRUE;
+
+    if (SearchQueryMatchString(PhGetServiceStateString(serviceNode->ServiceItem->State)))
+        return TRUE;
+
+    if (SearchQueryMatchString(PhGetServiceStartTypeString(serviceNode->ServiceItem->StartType)))
+        return TRUE;
+
+    if (SearchQueryMatchString(PhGetServiceErrorControlString(serviceNode->ServiceItem->ErrorControl)))
+        return TRUE;
+
+    return FALSE;
 }
 
 BOOLEAN NetworkTreeFilterCallback(
@@ -341,58 +439,57 @@ BOOLEAN NetworkTreeFilterCallback(
     _In_opt_ PVOID Context
     )
 {
-    BOOLEAN showItem = FALSE;
     PPH_NETWORK_NODE networkNode = (PPH_NETWORK_NODE)Node;
 
-    if (PhIsNullOrEmptyString(SearchboxText))
+    if (!SearchQuery)
         return TRUE;
 
     if (networkNode->NetworkItem->ProcessName)
     {
-        if (WordMatchStringRef(&networkNode->NetworkItem->ProcessName->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&networkNode->NetworkItem->ProcessName->sr))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->OwnerName)
     {
-        if (WordMatchStringRef(&networkNode->NetworkItem->OwnerName->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&networkNode->NetworkItem->OwnerName->sr))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->LocalAddressString)
     {
-        if (WordMatchString(networkNode->NetworkItem->LocalAddressString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(networkNode->NetworkItem->LocalAddressString))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->LocalPortString)
     {
-        if (WordMatchString(networkNode->NetworkItem->LocalPortString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(networkNode->NetworkItem->LocalPortString))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->LocalHostString)
     {
-        if (WordMatchStringRef(&networkNode->NetworkItem->LocalHostString->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&networkNode->NetworkItem->LocalHostString->sr))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->RemoteAddressString)
     {
-        if (WordMatchString(networkNode->NetworkItem->RemoteAddressString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(networkNode->NetworkItem->RemoteAddressString))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->RemotePortString)
     {
-        if (WordMatchString(networkNode->NetworkItem->RemotePortString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(networkNode->NetworkItem->RemotePortString))
+            return TRUE;
     }
 
     if (networkNode->NetworkItem->RemoteHostString)
     {
-        if (WordMatchStringRef(&networkNode->NetworkItem->RemoteHostString->sr))
-            showItem = TRUE;
+        if (SearchQueryMatchStringRef(&networkNode->NetworkItem->RemoteHostString->sr))
+            return TRUE;
     }
 
     {
@@ -400,9 +497,9 @@ BOOLEAN NetworkTreeFilterCallback(
 
         PhPrintUInt32(pidString, HandleToUlong(networkNode->NetworkItem->ProcessId));
 
-        if (WordMatchString(pidString))
-            showItem = TRUE;
+        if (SearchQueryMatchString(pidString))
+            return TRUE;
     }
 
-    return showItem;
-}
\ No newline at end of file
+    return FALSE;
+}
@@ -195,6 +195,12 @@ static LRESULT CALLBACK MainWndSubclassProc(
                     // Cache the current search text for our callback.
                     PhSwapReference2(&SearchboxText, PhGetWindowText(TextboxHandle));
 
+                    // Compile the search text once instead of splitting it for every node.
+                    if (SearchQuery)
+                        FreeSearchQuery(SearchQuery);
+
+                    SearchQuery = CreateSearchQuery(&SearchboxText->sr);
+
                     // Expand the nodes so we can search them
                     PhExpandAllProcessNodes(TRUE);
                     PhDeselectAllProcessNodes();
@@ -611,6 +617,14 @@ LOGICAL DllMain(
                 &TabPageCallbackRegistration
                 );
 
+            PhPluginSetObjectExtension(
+                PluginInstance,
+                EmProcessNodeType,
+                sizeof(PROCESS_SEARCH_CACHE),
+                ProcessNodeSearchCacheCreateCallback,
+                ProcessNodeSearchCacheDeleteCallback
+                );
+
             PhAddSettings(settings, _countof(settings));
 
             AcceleratorTable = LoadAccelerators(
@@ -67,6 +67,38 @@ typedef enum _TOOLBAR_DISPLAY_STYLE
 #define STATUS_MAXIOPROCESS 0x200
 #define STATUS_MAXIMUM 0x400
 
+typedef struct _SEARCH_QUERY_WORD
+{
+    PH_STRINGREF Text;
+    USHORT Skip[256];
+} SEARCH_QUERY_WORD, *PSEARCH_QUERY_WORD;
+
+// The compiled form of the search text. Each word is folded to upper case once and
+// has a Horspool skip table keyed on the low byte of each character.
+typedef struct _SEARCH_QUERY
+{
+    ULONG NumberOfWords;
+    SEARCH_QUERY_WORD Words[1];
+} SEARCH_QUERY, *PSEARCH_QUERY;
+
+typedef struct _PROCESS_SEARCH_SIGNATURE
+{
+    PPH_STRING Strings[11];
+    PWSTR IntegrityString;
+    ULONG PriorityClass;
+    VERIFY_RESULT VerifyResult;
+    TOKEN_ELEVATION_TYPE ElevationType;
+    ULONG Flags;
+} PROCESS_SEARCH_SIGNATURE, *PPROCESS_SEARCH_SIGNATURE;
+
+// The searchable text of a process node, folded to upper case and kept until one of
+// the captured fields changes.
+typedef struct _PROCESS_SEARCH_CACHE
+{
+    PROCESS_SEARCH_SIGNATURE Signature;
+    PPH_STRING Text;
+} PROCESS_SEARCH_CACHE, *PPROCESS_SEARCH_CACHE;
+
 extern BOOLEAN EnableToolBar;
 extern BOOLEAN EnableSearchBox;
 extern BOOLEAN EnableStatusBar;
@@ -76,6 +108,7 @@ extern HWND ToolBarHandle;
 extern HWND TextboxHandle;
 extern HACCEL AcceleratorTable;
 extern PPH_STRING SearchboxText;
+extern PSEARCH_QUERY SearchQuery;
 extern PPH_TN_FILTER_ENTRY ProcessTreeFilterEntry;
 extern PPH_TN_FILTER_ENTRY ServiceTreeFilterEntry;
 extern PPH_TN_FILTER_ENTRY NetworkTreeFilterEntry;
@@ -102,6 +135,23 @@ INT_PTR CALLBACK OptionsDlgProc(
     _In_ LPARAM lParam
     );
 
+PSEARCH_QUERY CreateSearchQuery(
+    _In_ PPH_STRINGREF Text
+    );
+VOID FreeSearchQuery(
+    _In_ PSEARCH_QUERY Query
+    );
+VOID NTAPI ProcessNodeSearchCacheCreateCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    );
+VOID NTAPI ProcessNodeSearchCacheDeleteCallback(
+    _In_ PVOID Object,
+    _In_ PH_EM_OBJECT_TYPE ObjectType,
+    _In_ PVOID Extension
+    );
+
 BOOLEAN ProcessTreeFilterCallback(
     _In_ PPH_TREENEW_NODE Node,
     _In_opt_ PVOID Context
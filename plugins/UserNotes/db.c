@@ -178,25 +178,121 @@ VOID SetDbPath(
     PhSwapReference(&ObjectDbPath, Path);
 }
 
-mxml_type_t MxmlLoadCallback(
-    _In_ mxml_node_t *node
-    )
+typedef struct _LOAD_DB_CONTEXT
 {
-    return MXML_OPAQUE;
-}
+    ULONG64 Tag;
+    PPH_STRING Name;
+    ULONG64 PriorityClass;
+    PPH_STRING Comment;
+    PPH_LIST Objects;
+} LOAD_DB_CONTEXT, *PLOAD_DB_CONTEXT;
 
-PPH_STRING GetOpaqueXmlNodeText(
-    _In_ mxml_node_t *node
+/**
+ * Frees a list of objects which are not in the database.
+ */
+static VOID FreeDbObjectList(
+    _In_ PPH_LIST List
     )
 {
-    if (node->child && node->child->type == MXML_OPAQUE && node->child->value.opaque)
+    ULONG i;
+
+    for (i = 0; i < List->Count; i++)
     {
-        return PhCreateStringFromAnsi(node->child->value.opaque);
+        PDB_OBJECT object = List->Items[i];
+
+        PhDereferenceObject(object->Name);
+        PhDereferenceObject(object->Comment);
+        PhFree(object);
     }
-    else
+
+    PhDereferenceObject(List);
+}
+
+int LoadDbCallback(
+    _In_ mxml_stream_event_t Event,
+    _In_ mxml_stream_node_t *Node,
+    _In_ PVOID Context
+    )
+{
+    PLOAD_DB_CONTEXT context = Context;
+
+    // Objects are the children of the root element:
+    // <objects><object tag="..." name="..." priorityclass="...">comment</object>...</objects>
+
+    if (Node->depth != 2)
+        return 0;
+
+    switch (Event)
     {
-        return PhReferenceEmptyString();
+    case MXML_STREAM_ELEMENT_OPEN:
+        {
+            BOOLEAN hasTag = FALSE;
+            int i;
+
+            context->PriorityClass = 0;
+
+            for (i = 0; i < Node->num_attrs; i++)
+            {
+                PH_STRINGREF value;
+
+                value.Buffer = (PWSTR)Node->attrs[i].value;
+                value.Length = Node->attrs[i].length * sizeof(WCHAR);
+
+                if (stricmp(Node->attrs[i].name, "tag") == 0)
+                    hasTag = PhStringToInteger64(&value, 10, &context->Tag);
+                else if (stricmp(Node->attrs[i].name, "name") == 0)
+                    PhSwapReference2(&context->Name, PhCreateStringEx(value.Buffer, value.Length));
+                else if (stricmp(Node->attrs[i].name, "priorityclass") == 0)
+                    PhStringToInteger64(&value, 10, &context->PriorityClass);
+            }
+
+            if (!hasTag)
+                PhSwapReference(&context->Name, NULL);
+        }
+        break;
+    case MXML_STREAM_DATA:
+        if (context->Name)
+        {
+            PH_STRINGREF text;
+
+            text.Buffer = (PWSTR)Node->text;
+            text.Length = Node->length * sizeof(WCHAR);
+
+            if (!context->Comment)
+                context->Comment = PhCreateStringEx(text.Buffer, text.Length);
+            else
+                PhSwapReference2(&context->Comment, PhConcatStringRef2(&context->Comment->sr, &text));
+        }
+        break;
+    case MXML_STREAM_ELEMENT_CLOSE:
+        if (context->Name)
+        {
+            PDB_OBJECT object;
+
+            if (!context->Comment)
+                context->Comment = PhReferenceEmptyString();
+
+            // The object is only added to the database after the whole file
+            // has been parsed. The references to the strings are transferred.
+            object = PhAllocate(sizeof(DB_OBJECT));
+            memset(object, 0, sizeof(DB_OBJECT));
+            object->Tag = (ULONG)context->Tag;
+            object->Name = context->Name;
+            object->Key = object->Name->sr;
+            object->Comment = context->Comment;
+            object->PriorityClass = (ULONG)context->PriorityClass;
+            PhAddItemList(context->Objects, object);
+
+            context->Name = NULL;
+            context->Comment = NULL;
+        }
+
+        PhSwapReference(&context->Name, NULL);
+        PhSwapReference(&context->Comment, NULL);
+        break;
     }
+
+    return 0;
 }
 
 NTSTATUS LoadDb(
@@ -206,8 +302,8 @@ NTSTATUS LoadDb(
     NTSTATUS status;
     HANDLE fileHandle;
     LARGE_INTEGER fileSize;
-    mxml_node_t *topNode;
-    mxml_node_t *currentNode;
+    LOAD_DB_CONTEXT context;
+    int result;
 
     status = PhCreateFileWin32(
         &fileHandle,
@@ -229,164 +325,71 @@ NTSTATUS LoadDb(
         return status;
     }
 
-    topNode = mxmlLoadFd(NULL, fileHandle, MxmlLoadCallback);
-    NtClose(fileHandle);
-
-    if (!topNode)
-        return STATUS_FILE_CORRUPT_ERROR;
+    memset(&context, 0, sizeof(LOAD_DB_CONTEXT));
+    context.Objects = PhCreateList(64);
 
-    if (topNode->type != MXML_ELEMENT)
-    {
-        mxmlDelete(topNode);
-        return STATUS_FILE_CORRUPT_ERROR;
-    }
+    result = mxmlStreamLoadFd(fileHandle, LoadDbCallback, &context);
 
-    LockDb();
+    NtClose(fileHandle);
 
-    currentNode = topNode->child;
+    PhSwapReference(&context.Name, NULL);
+    PhSwapReference(&context.Comment, NULL);
 
-    while (currentNode)
+    // A corrupt file must not leave a partially loaded database behind.
+    if (result == 0)
     {
-        PPH_STRING tag = NULL;
-        PPH_STRING name = NULL;
-        PPH_STRING priorityClass = NULL;
-        PPH_STRING comment = NULL;
-
-        if (currentNode->type == MXML_ELEMENT &&
-            currentNode->value.element.num_attrs >= 2)
-        {
-            ULONG i;
-
-            for (i = 0; i < (ULONG)currentNode->value.element.num_attrs; i++)
-            {
-                if (stricmp(currentNode->value.element.attrs[i].name, "tag") == 0)
-                    PhSwapReference2(&tag, PhCreateStringFromAnsi(currentNode->value.element.attrs[i].value));
-                else if (stricmp(currentNode->value.element.attrs[i].name, "name") == 0)
-                    PhSwapReference2(&name, PhCreateStringFromAnsi(currentNode->value.element.attrs[i].value));
-                else if (stricmp(currentNode->value.element.attrs[i].name, "priorityclass") == 0)
-                    PhSwapReference2(&priorityClass, PhCreateStringFromAnsi(currentNode->value.element.attrs[i].value));
-            }
-        }
+        ULONG i;
 
-        comment = GetOpaqueXmlNodeText(currentNode);
+        LockDb();
 
-        if (tag && name && comment)
+        for (i = 0; i < context.Objects->Count; i++)
         {
+            PDB_OBJECT loadedObject = context.Objects->Items[i];
             PDB_OBJECT object;
-            ULONG64 tagInteger;
-            ULONG64 priorityClassInteger = 0;
-
-            PhStringToInteger64(&tag->sr, 10, &tagInteger);
 
-            if (priorityClass)
-                PhStringToInteger64(&priorityClass->sr, 10, &priorityClassInteger);
-
-            object = CreateDbObject((ULONG)tagInteger, &name->sr, comment);
-            object->PriorityClass = (ULONG)priorityClassInteger;
+            object = CreateDbObject(loadedObject->Tag, &loadedObject->Name->sr, loadedObject->Comment);
+            object->PriorityClass = loadedObject->PriorityClass;
         }
 
-        PhSwapReference(&tag, NULL);
-        PhSwapReference(&name, NULL);
-        PhSwapReference(&priorityClass, NULL);
-        PhSwapReference(&comment, NULL);
-
-        currentNode = currentNode->next;
+        UnlockDb();
     }
 
-    UnlockDb();
+    FreeDbObjectList(context.Objects);
 
-    mxmlDelete(topNode);
+    if (result != 0)
+        return STATUS_FILE_CORRUPT_ERROR;
 
     return STATUS_SUCCESS;
 }
 
-char *MxmlSaveCallback(
-    _In_ mxml_node_t *node,
-    _In_ int position
-    )
-{
-    if (STR_IEQUAL(node->value.element.name, "object"))
-    {
-        if (position == MXML_WS_BEFORE_OPEN)
-            return "  ";
-        else if (position == MXML_WS_AFTER_CLOSE)
-            return "\r\n";
-    }
-    else if (STR_IEQUAL(node->value.element.name, "objects"))
-    {
-        if (position == MXML_WS_AFTER_OPEN)
-            return "\r\n";
-    }
-
-    return NULL;
-}
-
-mxml_node_t *CreateObjectElement(
-    _Inout_ mxml_node_t *ParentNode,
-    _In_ PPH_STRINGREF Tag,
-    _In_ PPH_STRINGREF Name,
-    _In_ PPH_STRINGREF PriorityClass,
-    _In_ PPH_STRINGREF Comment
-    )
-{
-    mxml_node_t *objectNode;
-    mxml_node_t *textNode;
-    PPH_ANSI_STRING tagAnsi;
-    PPH_ANSI_STRING nameAnsi;
-    PPH_ANSI_STRING priorityClassAnsi;
-    PPH_ANSI_STRING valueAnsi;
-
-    // Create the setting element.
-
-    objectNode = mxmlNewElement(ParentNode, "object");
-
-    tagAnsi = PhCreateAnsiStringFromUnicodeEx(Tag->Buffer, Tag->Length);
-    mxmlElementSetAttr(objectNode, "tag", tagAnsi->Buffer);
-    PhDereferenceObject(tagAnsi);
-
-    nameAnsi = PhCreateAnsiStringFromUnicodeEx(Name->Buffer, Name->Length);
-    mxmlElementSetAttr(objectNode, "name", nameAnsi->Buffer);
-    PhDereferenceObject(nameAnsi);
-
-    priorityClassAnsi = PhCreateAnsiStringFromUnicodeEx(PriorityClass->Buffer, PriorityClass->Length);
-    mxmlElementSetAttr(objectNode, "priorityclass", priorityClassAnsi->Buffer);
-    PhDereferenceObject(priorityClassAnsi);
-
-    // Set the value.
-
-    valueAnsi = PhCreateAnsiStringFromUnicodeEx(Comment->Buffer, Comment->Length);
-    textNode = mxmlNewOpaque(objectNode, valueAnsi->Buffer);
-    PhDereferenceObject(valueAnsi);
-
-    return objectNode;
-}
-
 NTSTATUS SaveDb(
     VOID
     )
 {
     NTSTATUS status;
     HANDLE fileHandle;
-    mxml_node_t *topNode;
+    mxml_stream_writer_t writer;
     ULONG enumerationKey = 0;
-    PDB_OBJECT *object;
-
-    topNode = mxmlNewElement(MXML_NO_PARENT, "objects");
+    PDB_OBJECT *objectPtr;
+    PPH_LIST objects;
+    PPH_STRING tempFileName;
+    ULONG i;
 
+    // Take a copy of the objects so the lock is not held while the file is
+    // written.
     LockDb();
 
-    while (PhEnumHashtable(ObjectDb, (PVOID *)&object, &enumerationKey))
-    {
-        PPH_STRING tagString;
-        PPH_STRING priorityClassString;
-
-        tagString = PhIntegerToString64((*object)->Tag, 10, FALSE);
-        priorityClassString = PhIntegerToString64((*object)->PriorityClass, 10, FALSE);
+    objects = PhCreateList(ObjectDb->Count);
 
-        CreateObjectElement(topNode, &tagString->sr, &(*object)->Name->sr, &priorityClassString->sr, &(*object)->Comment->sr);
+    while (PhEnumHashtable(ObjectDb, (PVOID *)&objectPtr, &enumerationKey))
+    {
+        PDB_OBJECT copy;
 
-        PhDereferenceObject(tagString);
-        PhDereferenceObject(priorityClassString);
+        copy = PhAllocate(sizeof(DB_OBJECT));
+        *copy = **objectPtr;
+        PhReferenceObject(copy->Name);
+        PhReferenceObject(copy->Comment);
+        PhAddItemList(objects, copy);
     }
 
     UnlockDb();
@@ -412,9 +415,13 @@ NTSTATUS SaveDb(
         }
     }
 
+    // Write to a temporary file first so the existing database is not lost
+    // if the write fails.
+    tempFileName = PhConcatStrings2(ObjectDbPath->Buffer, L".tmp");
+
     status = PhCreateFileWin32(
         &fileHandle,
-        ObjectDbPath->Buffer,
+        tempFileName->Buffer,
         FILE_GENERIC_WRITE,
         0,
         FILE_SHARE_READ,
@@ -423,14 +430,51 @@ NTSTATUS SaveDb(
         );
 
     if (!NT_SUCCESS(status))
+        goto CleanupExit;
+
+    mxmlStreamWriterInit(&writer, fileHandle);
+    mxmlStreamWriteElementOpen(&writer, "objects");
+    mxmlStreamWriteRaw(&writer, "\r\n");
+
+    for (i = 0; i < objects->Count; i++)
     {
-        mxmlDelete(topNode);
-        return status;
+        PDB_OBJECT object = objects->Items[i];
+        WCHAR tagString[PH_INT32_STR_LEN_1];
+        WCHAR priorityClassString[PH_INT32_STR_LEN_1];
+
+        PhPrintUInt32(tagString, object->Tag);
+        PhPrintUInt32(priorityClassString, object->PriorityClass);
+
+        mxmlStreamWriteRaw(&writer, "  ");
+        mxmlStreamWriteElementOpen(&writer, "object");
+        mxmlStreamWriteAttr(&writer, "tag", tagString, (int)wcslen(tagString));
+        mxmlStreamWriteAttr(&writer, "name", object->Name->Buffer, (int)(object->Name->Length / sizeof(WCHAR)));
+        mxmlStreamWriteAttr(&writer, "priorityclass", priorityClassString, (int)wcslen(priorityClassString));
+        mxmlStreamWriteText(&writer, object->Comment->Buffer, (int)(object->Comment->Length / sizeof(WCHAR)));
+        mxmlStreamWriteElementClose(&writer, "object");
+        mxmlStreamWriteRaw(&writer, "\r\n");
     }
 
-    mxmlSaveFd(topNode, fileHandle, MxmlSaveCallback);
-    mxmlDelete(topNode);
+    mxmlStreamWriteElementClose(&writer, "objects");
+    mxmlStreamWriteRaw(&writer, "\r\n");
+
+    if (mxmlStreamWriterClose(&writer) != 0)
+        status = STATUS_UNSUCCESSFUL;
+
     NtClose(fileHandle);
 
-    return STATUS_SUCCESS;
+    if (NT_SUCCESS(status))
+    {
+        if (!MoveFileEx(tempFileName->Buffer, ObjectDbPath->Buffer, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            status = PhGetLastWin32ErrorAsNtStatus();
+    }
+
+    if (!NT_SUCCESS(status))
+        DeleteFile(tempFileName->Buffer);
+
+CleanupExit:
+    PhDereferenceObject(tempFileName);
+    FreeDbObjectList(objects);
+
+    return status;
 }
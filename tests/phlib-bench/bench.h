@@ -0,0 +1,149 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <ph.h>
+#include <phintrnl.h>
+
+#define BENCH_MAXIMUM_THREADS 64
+
+typedef struct _BENCH_PARAMETERS
+{
+    ULONG NumberOfThreads;
+    ULONG ReadPercent;
+    ULONG CriticalSectionLength;
+    ULONG Duration; // in milliseconds
+} BENCH_PARAMETERS, *PBENCH_PARAMETERS;
+
+// Each thread keeps its own counters. Latencies are in timestamp counter ticks.
+typedef struct DECLSPEC_ALIGN(64) _BENCH_THREAD
+{
+    ULONG Index;
+    ULONG Seed;
+    ULONG64 Operations;
+    ULONG64 MaximumLatency;
+    PH_STATISTICS_HISTOGRAM Latency;
+    PVOID Context;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+typedef struct _BENCH_RESULT
+{
+    ULONG64 Operations;
+    DOUBLE Seconds;
+    DOUBLE TicksPerNanosecond;
+    DOUBLE Fairness;
+    ULONG64 MinimumThreadOperations;
+    ULONG64 MaximumThreadOperations;
+    PH_STATISTICS_HISTOGRAM Latency;
+    ULONG64 MaximumLatency;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+typedef NTSTATUS (NTAPI *PBENCH_THREAD_ROUTINE)(
+    _Inout_ PBENCH_THREAD Thread
+    );
+
+#define BENCH_MAXIMUM_VALUES 16
+
+typedef struct _BENCH_LIST
+{
+    ULONG Count;
+    ULONG Values[BENCH_MAXIMUM_VALUES];
+} BENCH_LIST, *PBENCH_LIST;
+
+extern BENCH_LIST BenchThreadCounts;
+extern BENCH_LIST BenchReadPercents;
+extern BENCH_LIST BenchCriticalSectionLengths;
+extern ULONG BenchDuration;
+
+// The parameters of the current run, and the flag that ends it.
+extern BENCH_PARAMETERS BenchParameters;
+extern volatile BOOLEAN BenchStop;
+
+VOID BenchRun(
+    _In_ PBENCH_THREAD_ROUTINE Routine,
+    _In_opt_ PVOID Context,
+    _In_ PBENCH_PARAMETERS Parameters,
+    _Out_ PBENCH_RESULT Result
+    );
+
+FORCEINLINE VOID BenchRecordLatency(
+    _Inout_ PBENCH_THREAD Thread,
+    _In_ ULONG64 Latency
+    )
+{
+    ULONG bucket;
+
+    if ((ULONG)(Latency >> 32) != 0)
+        bucket = PH_STATISTICS_HISTOGRAM_BUCKETS - 1;
+    else if (!_BitScanReverse(&bucket, (ULONG)Latency))
+        bucket = 0;
+
+    // Only this thread updates the histogram, so interlocked operations are not needed.
+    Thread->Latency.Buckets[bucket]++;
+
+    if (Thread->MaximumLatency < Latency)
+        Thread->MaximumLatency = Latency;
+}
+
+FORCEINLINE ULONG BenchRandom(
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    Thread->Seed = Thread->Seed * 1103515245 + 12345;
+
+    return Thread->Seed >> 16;
+}
+
+FORCEINLINE VOID BenchSpin(
+    _In_ ULONG Iterations
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Iterations; i++)
+        YieldProcessor();
+}
+
+// lockbench
+
+VOID BenchLocks(
+    _In_opt_ PPH_STRINGREF LockNames,
+    _In_opt_ PPH_STRINGREF SpinPolicies
+    );
+
+// microbench
+
+VOID BenchKphBatches(
+    VOID
+    );
+
+VOID BenchBTree(
+    VOID
+    );
+
+VOID BenchDevicePrefixes(
+    VOID
+    );
+
+// syncbench
+
+VOID BenchConditions(
+    VOID
+    );
+
+VOID BenchWakeEvents(
+    VOID
+    );
+
+VOID BenchEvents(
+    VOID
+    );
+
+// main
+
+VOID BenchReport(
+    _In_ PWSTR Name,
+    _In_ PBENCH_PARAMETERS Parameters,
+    _In_ PBENCH_RESULT Result
+    );
+
+#endif
@@ -0,0 +1,233 @@
+#include "bench.h"
+
+typedef enum _BENCH_LOCK_TYPE
+{
+    BenchQueuedLock,
+    BenchFastLock,
+    BenchCriticalSection,
+    BenchMaximumLock
+} BENCH_LOCK_TYPE;
+
+static PWSTR BenchLockNames[] = { L"queued", L"fast", L"cs" };
+
+typedef struct _BENCH_LOCK_CONTEXT
+{
+    BENCH_LOCK_TYPE Type;
+    PH_QUEUED_LOCK QueuedLock;
+    PH_FAST_LOCK FastLock;
+    RTL_CRITICAL_SECTION CriticalSection;
+
+    // Protected by the lock.
+    DECLSPEC_ALIGN(64) ULONG64 Value;
+    ULONG64 Checksum;
+} BENCH_LOCK_CONTEXT, *PBENCH_LOCK_CONTEXT;
+
+static BENCH_LOCK_CONTEXT BenchLockContext;
+
+// The lock type is switched on inside the loop instead of calling through function
+// pointers, so the inline fast paths of the queued lock are measured.
+static NTSTATUS NTAPI BenchLockThreadRoutine(
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    PBENCH_LOCK_CONTEXT context = Thread->Context;
+    BENCH_LOCK_TYPE type = context->Type;
+    ULONG readPercent = BenchParameters.ReadPercent;
+    ULONG criticalSectionLength = BenchParameters.CriticalSectionLength;
+    ULONG64 startTimestamp;
+    ULONG64 latency;
+    BOOLEAN shared;
+
+    while (!BenchStop)
+    {
+        shared = BenchRandom(Thread) % 100 < readPercent;
+        startTimestamp = ReadTimeStampCounter();
+
+        switch (type)
+        {
+        case BenchQueuedLock:
+            if (shared)
+                PhAcquireQueuedLockShared(&context->QueuedLock);
+            else
+                PhAcquireQueuedLockExclusive(&context->QueuedLock);
+            break;
+        case BenchFastLock:
+            if (shared)
+                PhAcquireFastLockShared(&context->FastLock);
+            else
+                PhAcquireFastLockExclusive(&context->FastLock);
+            break;
+        case BenchCriticalSection:
+            RtlEnterCriticalSection(&context->CriticalSection);
+            break;
+        }
+
+        latency = ReadTimeStampCounter() - startTimestamp;
+
+        BenchSpin(criticalSectionLength);
+
+        if (shared)
+        {
+            // Writers keep the checksum equal to the value.
+            if (context->Value != context->Checksum)
+            {
+                wprintf(L"[fail]: %s: inconsistent state in read zone!\n", BenchLockNames[type]);
+                NtTerminateProcess(NtCurrentProcess(), STATUS_UNSUCCESSFUL);
+            }
+        }
+        else
+        {
+            context->Value++;
+            context->Checksum = context->Value;
+        }
+
+        switch (type)
+        {
+        case BenchQueuedLock:
+            if (shared)
+                PhReleaseQueuedLockShared(&context->QueuedLock);
+            else
+                PhReleaseQueuedLockExclusive(&context->QueuedLock);
+            break;
+        case BenchFastLock:
+            if (shared)
+                PhReleaseFastLockShared(&context->FastLock);
+            else
+                PhReleaseFastLockExclusive(&context->FastLock);
+            break;
+        case BenchCriticalSection:
+            RtlLeaveCriticalSection(&context->CriticalSection);
+            break;
+        }
+
+        BenchRecordLatency(Thread, latency);
+        Thread->Operations++;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+typedef struct _BENCH_SPIN_POLICY
+{
+    PWSTR Name;
+    ULONG Flags;
+} BENCH_SPIN_POLICY, *PBENCH_SPIN_POLICY;
+
+// Spin policies for queued locks. Other locks ignore them.
+static BENCH_SPIN_POLICY BenchSpinPolicies[] =
+{
+    { L"fixed", 0 },
+    { L"adaptive", PH_QUEUED_LOCK_SPIN_ADAPTIVE },
+    { L"backoff", PH_QUEUED_LOCK_SPIN_ADAPTIVE | PH_QUEUED_LOCK_SPIN_BACKOFF }
+};
+
+static BOOLEAN BenchIsNameSelected(
+    _In_opt_ PPH_STRINGREF Names,
+    _In_ PWSTR Name
+    )
+{
+    PH_STRINGREF remaining;
+    PH_STRINGREF part;
+
+    if (!Names)
+        return TRUE;
+
+    remaining = *Names;
+
+    while (remaining.Length != 0)
+    {
+        PhSplitStringRefAtChar(&remaining, ',', &part, &remaining);
+
+        if (PhEqualStringRef2(&part, Name, TRUE))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Runs the read/write lock benchmarks over every combination of thread count,
+ * read percentage and critical section length.
+ *
+ * \param LockNames A comma-separated list of locks to run, or NULL to run all locks.
+ * \param SpinPolicies A comma-separated list of spin policies to run queued locks
+ * with, or NULL to run all policies.
+ */
+VOID BenchLocks(
+    _In_opt_ PPH_STRINGREF LockNames,
+    _In_opt_ PPH_STRINGREF SpinPolicies
+    )
+{
+    PBENCH_LOCK_CONTEXT context = &BenchLockContext;
+    ULONG oldSpinFlags;
+    BENCH_PARAMETERS parameters;
+    BENCH_RESULT result;
+    PPH_STRING name;
+    ULONG type;
+    ULONG policy;
+    ULONG i;
+    ULONG j;
+    ULONG k;
+
+    oldSpinFlags = PhQueuedLockSpinFlags;
+
+    for (type = 0; type < BenchMaximumLock; type++)
+    {
+        if (!BenchIsNameSelected(LockNames, BenchLockNames[type]))
+            continue;
+
+        for (policy = 0; policy < sizeof(BenchSpinPolicies) / sizeof(BENCH_SPIN_POLICY); policy++)
+        {
+            if (type == BenchQueuedLock)
+            {
+                if (!BenchIsNameSelected(SpinPolicies, BenchSpinPolicies[policy].Name))
+                    continue;
+
+                PhQueuedLockSpinFlags = BenchSpinPolicies[policy].Flags;
+                name = PhFormatString(L"%s/%s", BenchLockNames[type], BenchSpinPolicies[policy].Name);
+            }
+            else
+            {
+                if (policy != 0)
+                    break;
+
+                name = PhCreateString(BenchLockNames[type]);
+            }
+
+            for (i = 0; i < BenchThreadCounts.Count; i++)
+            {
+                for (j = 0; j < BenchReadPercents.Count; j++)
+                {
+                    // Critical sections have no shared mode, so the read percentage
+                    // makes no difference.
+                    if (type == BenchCriticalSection && j != 0)
+                        break;
+
+                    for (k = 0; k < BenchCriticalSectionLengths.Count; k++)
+                    {
+                        memset(context, 0, sizeof(BENCH_LOCK_CONTEXT));
+                        context->Type = type;
+                        PhInitializeQueuedLock(&context->QueuedLock);
+                        PhInitializeFastLock(&context->FastLock);
+                        RtlInitializeCriticalSection(&context->CriticalSection);
+
+                        parameters.NumberOfThreads = BenchThreadCounts.Values[i];
+                        parameters.ReadPercent = type != BenchCriticalSection ? BenchReadPercents.Values[j] : 0;
+                        parameters.CriticalSectionLength = BenchCriticalSectionLengths.Values[k];
+                        parameters.Duration = BenchDuration;
+
+                        BenchRun(BenchLockThreadRoutine, context, &parameters, &result);
+                        BenchReport(name->Buffer, &parameters, &result);
+
+                        PhDeleteFastLock(&context->FastLock);
+                        RtlDeleteCriticalSection(&context->CriticalSection);
+                    }
+                }
+            }
+
+            PhDereferenceObject(name);
+        }
+    }
+
+    PhQueuedLockSpinFlags = oldSpinFlags;
+}
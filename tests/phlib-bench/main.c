@@ -0,0 +1,399 @@
+#include "bench.h"
+
+BENCH_LIST BenchThreadCounts;
+BENCH_LIST BenchReadPercents = { 4, { 0, 50, 90, 100 } };
+BENCH_LIST BenchCriticalSectionLengths = { 3, { 0, 50, 500 } };
+ULONG BenchDuration = 250;
+
+BENCH_PARAMETERS BenchParameters;
+volatile BOOLEAN BenchStop;
+
+static BENCH_THREAD BenchThreads[BENCH_MAXIMUM_THREADS];
+static PBENCH_THREAD_ROUTINE BenchRoutine;
+static PH_BARRIER BenchStartBarrier;
+static BOOLEAN BenchCsv;
+static BOOLEAN BenchCsvHeaderPrinted;
+
+static VOID BenchAddToList(
+    _Inout_ PBENCH_LIST List,
+    _In_ ULONG Value
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < List->Count; i++)
+    {
+        if (List->Values[i] == Value)
+            return;
+    }
+
+    if (List->Count < BENCH_MAXIMUM_VALUES)
+        List->Values[List->Count++] = Value;
+}
+
+static BOOLEAN BenchParseList(
+    _Out_ PBENCH_LIST List,
+    _In_ PWSTR String
+    )
+{
+    PH_STRINGREF remaining;
+    PH_STRINGREF part;
+    ULONG64 value;
+
+    List->Count = 0;
+    PhInitializeStringRef(&remaining, String);
+
+    while (remaining.Length != 0)
+    {
+        PhSplitStringRefAtChar(&remaining, ',', &part, &remaining);
+
+        if (!PhStringToInteger64(&part, 10, &value))
+            return FALSE;
+
+        BenchAddToList(List, (ULONG)value);
+    }
+
+    return List->Count != 0;
+}
+
+static NTSTATUS BenchThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PBENCH_THREAD thread = Parameter;
+
+    PhWaitForBarrier(&BenchStartBarrier, FALSE);
+
+    return BenchRoutine(thread);
+}
+
+/**
+ * Runs a benchmark routine on several threads for the configured duration.
+ *
+ * \param Routine The routine to run on each thread. It must return soon after
+ * BenchStop is set.
+ * \param Context A value stored in each thread's context.
+ * \param Parameters The parameters for the run.
+ * \param Result A variable which receives the combined results of all threads.
+ */
+VOID BenchRun(
+    _In_ PBENCH_THREAD_ROUTINE Routine,
+    _In_opt_ PVOID Context,
+    _In_ PBENCH_PARAMETERS Parameters,
+    _Out_ PBENCH_RESULT Result
+    )
+{
+    HANDLE threadHandles[BENCH_MAXIMUM_THREADS];
+    ULONG numberOfThreads;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startCounter;
+    LARGE_INTEGER endCounter;
+    ULONG64 startTimestamp;
+    ULONG64 endTimestamp;
+    LARGE_INTEGER interval;
+    DOUBLE sum;
+    DOUBLE sumOfSquares;
+    ULONG i;
+    ULONG j;
+
+    numberOfThreads = min(Parameters->NumberOfThreads, BENCH_MAXIMUM_THREADS);
+    BenchParameters = *Parameters;
+    BenchParameters.NumberOfThreads = numberOfThreads;
+    BenchRoutine = Routine;
+    BenchStop = FALSE;
+    PhInitializeBarrier(&BenchStartBarrier, numberOfThreads + 1);
+
+    for (i = 0; i < numberOfThreads; i++)
+    {
+        memset(&BenchThreads[i], 0, sizeof(BENCH_THREAD));
+        BenchThreads[i].Index = i;
+        BenchThreads[i].Seed = i * 7919 + 1;
+        BenchThreads[i].Context = Context;
+        threadHandles[i] = PhCreateThread(0, BenchThreadStart, &BenchThreads[i]);
+        assert(threadHandles[i]);
+    }
+
+    PhWaitForBarrier(&BenchStartBarrier, FALSE);
+    NtQueryPerformanceCounter(&startCounter, &frequency);
+    startTimestamp = ReadTimeStampCounter();
+
+    NtDelayExecution(FALSE, PhTimeoutFromMilliseconds(&interval, BenchParameters.Duration));
+    BenchStop = TRUE;
+
+    // The timestamp counter is calibrated against the performance counter over the same
+    // interval, so latencies can be reported in nanoseconds.
+    NtQueryPerformanceCounter(&endCounter, NULL);
+    endTimestamp = ReadTimeStampCounter();
+
+    NtWaitForMultipleObjects(numberOfThreads, threadHandles, WaitAll, FALSE, NULL);
+
+    for (i = 0; i < numberOfThreads; i++)
+        NtClose(threadHandles[i]);
+
+    memset(Result, 0, sizeof(BENCH_RESULT));
+    Result->Seconds = (DOUBLE)(endCounter.QuadPart - startCounter.QuadPart) / frequency.QuadPart;
+    Result->TicksPerNanosecond = (DOUBLE)(endTimestamp - startTimestamp) / (Result->Seconds * 1e9);
+    Result->MinimumThreadOperations = MAXULONG64;
+    sum = 0;
+    sumOfSquares = 0;
+
+    for (i = 0; i < numberOfThreads; i++)
+    {
+        PBENCH_THREAD thread = &BenchThreads[i];
+
+        Result->Operations += thread->Operations;
+        Result->MinimumThreadOperations = min(Result->MinimumThreadOperations, thread->Operations);
+        Result->MaximumThreadOperations = max(Result->MaximumThreadOperations, thread->Operations);
+        Result->MaximumLatency = max(Result->MaximumLatency, thread->MaximumLatency);
+
+        for (j = 0; j < PH_STATISTICS_HISTOGRAM_BUCKETS; j++)
+            Result->Latency.Buckets[j] += thread->Latency.Buckets[j];
+
+        sum += (DOUBLE)thread->Operations;
+        sumOfSquares += (DOUBLE)thread->Operations * thread->Operations;
+    }
+
+    // Jain's fairness index: 1 when all threads complete the same number of operations,
+    // 1/n when a single thread completes all of them.
+    if (sumOfSquares != 0)
+        Result->Fairness = sum * sum / (numberOfThreads * sumOfSquares);
+    else
+        Result->Fairness = 0;
+}
+
+/**
+ * Gets an upper bound for a percentile of a latency histogram.
+ *
+ * \param Result The results of a run.
+ * \param Fraction The percentile, between 0 and 1.
+ *
+ * \return The upper bound of the bucket containing the percentile, in nanoseconds.
+ */
+static DOUBLE BenchGetPercentile(
+    _In_ PBENCH_RESULT Result,
+    _In_ DOUBLE Fraction
+    )
+{
+    ULONG64 total;
+    ULONG64 target;
+    ULONG64 count;
+    ULONG64 bound;
+    ULONG i;
+
+    total = 0;
+
+    for (i = 0; i < PH_STATISTICS_HISTOGRAM_BUCKETS; i++)
+        total += Result->Latency.Buckets[i];
+
+    if (total == 0)
+        return 0;
+
+    target = (ULONG64)(total * Fraction);
+
+    if (target == 0)
+        target = 1;
+
+    count = 0;
+    bound = Result->MaximumLatency;
+
+    for (i = 0; i < PH_STATISTICS_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        count += Result->Latency.Buckets[i];
+
+        if (count >= target)
+        {
+            bound = min(2ULL << i, Result->MaximumLatency);
+            break;
+        }
+    }
+
+    return bound / Result->TicksPerNanosecond;
+}
+
+VOID BenchReport(
+    _In_ PWSTR Name,
+    _In_ PBENCH_PARAMETERS Parameters,
+    _In_ PBENCH_RESULT Result
+    )
+{
+    DOUBLE throughput;
+
+    throughput = Result->Operations / Result->Seconds;
+
+    if (BenchCsv)
+    {
+        if (!BenchCsvHeaderPrinted)
+        {
+            wprintf(L"name,threads,read_percent,cs_length,ops_per_sec,fairness,min_thread_ops,max_thread_ops,p50_ns,p99_ns,p999_ns,max_ns\n");
+            BenchCsvHeaderPrinted = TRUE;
+        }
+
+        wprintf(
+            L"%s,%u,%u,%u,%.0f,%.4f,%I64u,%I64u,%.0f,%.0f,%.0f,%.0f\n",
+            Name,
+            Parameters->NumberOfThreads,
+            Parameters->ReadPercent,
+            Parameters->CriticalSectionLength,
+            throughput,
+            Result->Fairness,
+            Result->MinimumThreadOperations,
+            Result->MaximumThreadOperations,
+            BenchGetPercentile(Result, 0.5),
+            BenchGetPercentile(Result, 0.99),
+            BenchGetPercentile(Result, 0.999),
+            Result->MaximumLatency / Result->TicksPerNanosecond
+            );
+    }
+    else
+    {
+        wprintf(
+            L"%-16s %3u thr %3u%% rd %4u cs: %10.0f ops/s, fair %.3f (%I64u-%I64u), "
+            L"p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, max %.0f ns\n",
+            Name,
+            Parameters->NumberOfThreads,
+            Parameters->ReadPercent,
+            Parameters->CriticalSectionLength,
+            throughput,
+            Result->Fairness,
+            Result->MinimumThreadOperations,
+            Result->MaximumThreadOperations,
+            BenchGetPercentile(Result, 0.5),
+            BenchGetPercentile(Result, 0.99),
+            BenchGetPercentile(Result, 0.999),
+            Result->MaximumLatency / Result->TicksPerNanosecond
+            );
+    }
+}
+
+static VOID BenchUsage(
+    VOID
+    )
+{
+    wprintf(
+        L"phlib-bench [options]\n"
+        L"  -b locks|sync|micro|all\n"
+        L"                       benchmarks to run (default all)\n"
+        L"  -l queued,fast,cs    locks to run (default all)\n"
+        L"  -s fixed,adaptive,backoff\n"
+        L"                       queued lock spin policies (default all)\n"
+        L"  -t n[,n...]          thread counts (default 1,2,4,ncpu,2*ncpu)\n"
+        L"  -r n[,n...]          read percentages (default 0,50,90,100)\n"
+        L"  -c n[,n...]          critical section lengths (default 0,50,500)\n"
+        L"  -d ms                duration of each run (default 250)\n"
+        L"  -csv                 print results as CSV\n"
+        );
+}
+
+int __cdecl wmain(int argc, wchar_t *argv[])
+{
+    NTSTATUS status;
+    PWSTR benchmarks = L"all";
+    PH_STRINGREF lockNames;
+    BOOLEAN lockNamesSpecified = FALSE;
+    PH_STRINGREF spinPolicies;
+    BOOLEAN spinPoliciesSpecified = FALSE;
+    ULONG numberOfProcessors;
+    int i;
+
+    status = PhInitializePhLib();
+    assert(NT_SUCCESS(status));
+
+    numberOfProcessors = PhSystemBasicInformation.NumberOfProcessors;
+    BenchAddToList(&BenchThreadCounts, 1);
+    BenchAddToList(&BenchThreadCounts, 2);
+    BenchAddToList(&BenchThreadCounts, 4);
+    BenchAddToList(&BenchThreadCounts, min(numberOfProcessors, BENCH_MAXIMUM_THREADS));
+    BenchAddToList(&BenchThreadCounts, min(numberOfProcessors * 2, BENCH_MAXIMUM_THREADS));
+
+    for (i = 1; i < argc; i++)
+    {
+        PWSTR option = argv[i];
+        PWSTR value = i + 1 < argc ? argv[i + 1] : NULL;
+        BOOLEAN valid = TRUE;
+
+        if (PhEqualStringZ(option, L"-csv", TRUE))
+        {
+            BenchCsv = TRUE;
+            continue;
+        }
+
+        if (!value)
+        {
+            valid = FALSE;
+        }
+        else if (PhEqualStringZ(option, L"-b", TRUE))
+        {
+            benchmarks = value;
+        }
+        else if (PhEqualStringZ(option, L"-l", TRUE))
+        {
+            PhInitializeStringRef(&lockNames, value);
+            lockNamesSpecified = TRUE;
+        }
+        else if (PhEqualStringZ(option, L"-s", TRUE))
+        {
+            PhInitializeStringRef(&spinPolicies, value);
+            spinPoliciesSpecified = TRUE;
+        }
+        else if (PhEqualStringZ(option, L"-t", TRUE))
+        {
+            valid = BenchParseList(&BenchThreadCounts, value);
+        }
+        else if (PhEqualStringZ(option, L"-r", TRUE))
+        {
+            valid = BenchParseList(&BenchReadPercents, value);
+        }
+        else if (PhEqualStringZ(option, L"-c", TRUE))
+        {
+            valid = BenchParseList(&BenchCriticalSectionLengths, value);
+        }
+        else if (PhEqualStringZ(option, L"-d", TRUE))
+        {
+            PH_STRINGREF valueSr;
+            ULONG64 duration;
+
+            PhInitializeStringRef(&valueSr, value);
+
+            valid = PhStringToInteger64(&valueSr, 10, &duration);
+
+            if (valid)
+                BenchDuration = (ULONG)duration;
+        }
+        else
+        {
+            valid = FALSE;
+        }
+
+        if (!valid)
+        {
+            BenchUsage();
+            return 1;
+        }
+
+        i++;
+    }
+
+    if (PhEqualStringZ(benchmarks, L"locks", TRUE) || PhEqualStringZ(benchmarks, L"all", TRUE))
+    {
+        BenchLocks(
+            lockNamesSpecified ? &lockNames : NULL,
+            spinPoliciesSpecified ? &spinPolicies : NULL
+            );
+    }
+
+    if (PhEqualStringZ(benchmarks, L"sync", TRUE) || PhEqualStringZ(benchmarks, L"all", TRUE))
+    {
+        BenchConditions();
+        BenchWakeEvents();
+        BenchEvents();
+    }
+
+    if (PhEqualStringZ(benchmarks, L"micro", TRUE) || PhEqualStringZ(benchmarks, L"all", TRUE))
+    {
+        BenchKphBatches();
+        BenchBTree();
+        BenchDevicePrefixes();
+    }
+
+    return 0;
+}
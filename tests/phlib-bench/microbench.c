@@ -0,0 +1,480 @@
+#include "bench.h"
+#include <kphuser.h>
+
+static ULONG64 BenchQueryCounter(
+    VOID
+    )
+{
+    LARGE_INTEGER counter;
+
+    NtQueryPerformanceCounter(&counter, NULL);
+
+    return counter.QuadPart;
+}
+
+// KProcessHacker batches
+
+// Decodes a batch the same way as KProcessHacker, without sending it to the driver.
+static NTSTATUS NTAPI BenchDispatchBatch(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    )
+{
+    PULONG numberOfDispatchedOperations = Context;
+    ULONG numberOfOperations;
+    PKPH_BATCH_RESULT results;
+    PVOID data;
+    ULONG i;
+
+    numberOfOperations = OperationsLength / sizeof(KPH_BATCH_OPERATION);
+
+    if (OutputLength < numberOfOperations * sizeof(KPH_BATCH_RESULT))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    results = Output;
+    data = PTR_ADD_OFFSET(Output, numberOfOperations * sizeof(KPH_BATCH_RESULT));
+
+    for (i = 0; i < numberOfOperations; i++)
+    {
+        PKPH_BATCH_OPERATION operation = &Operations[i];
+
+        if (operation->DataLength < sizeof(ULONG))
+        {
+            results[i].Status = STATUS_BUFFER_TOO_SMALL;
+            results[i].ReturnLength = sizeof(ULONG);
+            continue;
+        }
+
+        *(PULONG)PTR_ADD_OFFSET(data, operation->DataOffset) =
+            (ULONG)(ULONG_PTR)operation->u.QueryInformationObject.Handle;
+        results[i].Status = STATUS_SUCCESS;
+        results[i].ReturnLength = sizeof(ULONG);
+    }
+
+    *numberOfDispatchedOperations += numberOfOperations;
+
+    return STATUS_SUCCESS;
+}
+
+// Measures the per-operation cost of the batch codec for handle queries compared to
+// sending each query as its own request.
+VOID BenchKphBatches(
+    VOID
+    )
+{
+    static ULONG counts[] = { 1, 16, 256, 1024 };
+    KPH_BATCH batch;
+    LARGE_INTEGER frequency;
+    ULONG i;
+    ULONG j;
+    ULONG k;
+
+    NtQueryPerformanceCounter(&frequency, &frequency);
+    KphInitializeBatch(&batch);
+
+    for (i = 0; i < sizeof(counts) / sizeof(ULONG); i++)
+    {
+        ULONG numberOfOperations = 0;
+        ULONG64 start;
+        ULONG64 batched;
+        ULONG64 single;
+
+        start = BenchQueryCounter();
+
+        for (k = 0; k < 100; k++)
+        {
+            KphClearBatch(&batch);
+
+            for (j = 0; j < counts[i]; j++)
+                KphAddQueryInformationObjectBatch(&batch, (HANDLE)4, (HANDLE)(ULONG_PTR)(j * 4), KphObjectBasicInformation, 0x38);
+
+            KphExecuteBatchEx(&batch, BenchDispatchBatch, &numberOfOperations);
+        }
+
+        batched = BenchQueryCounter() - start;
+        start = BenchQueryCounter();
+
+        for (k = 0; k < 100; k++)
+        {
+            for (j = 0; j < counts[i]; j++)
+            {
+                KphClearBatch(&batch);
+                KphAddQueryInformationObjectBatch(&batch, (HANDLE)4, (HANDLE)(ULONG_PTR)(j * 4), KphObjectBasicInformation, 0x38);
+                KphExecuteBatchEx(&batch, BenchDispatchBatch, &numberOfOperations);
+            }
+        }
+
+        single = BenchQueryCounter() - start;
+
+        assert(numberOfOperations == counts[i] * 200);
+
+        wprintf(
+            L"kph batch: %4u ops, %.1f ns/op batched, %.1f ns/op single (%u dispatches vs %u)\n",
+            counts[i],
+            (DOUBLE)batched * 1e9 / frequency.QuadPart / (counts[i] * 100),
+            (DOUBLE)single * 1e9 / frequency.QuadPart / (counts[i] * 100),
+            100,
+            counts[i] * 100
+            );
+    }
+
+    KphDeleteBatch(&batch);
+}
+
+// B+ trees
+
+typedef struct _BENCH_AVL_ENTRY
+{
+    PH_AVL_LINKS Links;
+    ULONG64 Key;
+} BENCH_AVL_ENTRY, *PBENCH_AVL_ENTRY;
+
+static LONG NTAPI BenchCompareKeyBTree(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return uint64cmp(*(PULONG64)Entry1, *(PULONG64)Entry2);
+}
+
+static LONG NTAPI BenchCompareKeyAvlTree(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    return uint64cmp(
+        CONTAINING_RECORD(Links1, BENCH_AVL_ENTRY, Links)->Key,
+        CONTAINING_RECORD(Links2, BENCH_AVL_ENTRY, Links)->Key
+        );
+}
+
+static ULONG BenchNextRandom(
+    _Inout_ PULONG Seed
+    )
+{
+    *Seed = *Seed * 1103515245 + 12345;
+
+    return *Seed >> 8;
+}
+
+// Compares lookups and in-order iteration of the B+ tree and the AVL tree.
+VOID BenchBTree(
+    VOID
+    )
+{
+    static ULONG counts[] = { 10000, 100000, 1000000, 10000000 };
+    LARGE_INTEGER frequency;
+    ULONG i;
+    ULONG j;
+
+    NtQueryPerformanceCounter(&frequency, &frequency);
+
+    for (i = 0; i < sizeof(counts) / sizeof(ULONG); i++)
+    {
+        PH_BTREE btree;
+        PH_BTREE_ENUM_CONTEXT enumContext;
+        PH_AVL_TREE avlTree = PH_AVL_TREE_INIT(BenchCompareKeyAvlTree);
+        PBENCH_AVL_ENTRY avlEntries;
+        PPH_AVL_LINKS links;
+        PULONG64 keys;
+        BENCH_AVL_ENTRY lookupEntry;
+        ULONG64 key;
+        ULONG64 sum;
+        ULONG64 start;
+        ULONG64 btreeLookup;
+        ULONG64 avlLookup;
+        ULONG64 btreeIterate;
+        ULONG64 avlIterate;
+        ULONG numberOfLookups;
+        ULONG seed;
+
+        keys = PhAllocate(counts[i] * sizeof(ULONG64));
+        avlEntries = PhAllocate(counts[i] * sizeof(BENCH_AVL_ENTRY));
+
+        for (j = 0; j < counts[i]; j++)
+            keys[j] = (ULONG64)j * 2;
+
+        PhInitializeBTree(&btree, sizeof(ULONG64), BenchCompareKeyBTree);
+        PhBulkLoadBTree(&btree, keys, counts[i]);
+
+        // Insert the AVL entries in random order so that nodes are not laid out in
+        // key order in memory.
+        seed = 1;
+
+        for (j = counts[i] - 1; j != 0; j--)
+        {
+            ULONG other = BenchNextRandom(&seed) % (j + 1);
+            ULONG64 temp = keys[j];
+
+            keys[j] = keys[other];
+            keys[other] = temp;
+        }
+
+        for (j = 0; j < counts[i]; j++)
+        {
+            avlEntries[j].Key = keys[j];
+            PhAddElementAvlTree(&avlTree, &avlEntries[j].Links);
+        }
+
+        numberOfLookups = 1000000;
+
+        seed = 2;
+        sum = 0;
+        start = BenchQueryCounter();
+
+        for (j = 0; j < numberOfLookups; j++)
+        {
+            key = (ULONG64)(BenchNextRandom(&seed) % counts[i]) * 2;
+            sum += *(PULONG64)PhFindEntryBTree(&btree, &key);
+        }
+
+        btreeLookup = BenchQueryCounter() - start;
+
+        seed = 2;
+        start = BenchQueryCounter();
+
+        for (j = 0; j < numberOfLookups; j++)
+        {
+            lookupEntry.Key = (ULONG64)(BenchNextRandom(&seed) % counts[i]) * 2;
+            sum -= CONTAINING_RECORD(PhFindElementAvlTree(&avlTree, &lookupEntry.Links), BENCH_AVL_ENTRY, Links)->Key;
+        }
+
+        avlLookup = BenchQueryCounter() - start;
+        assert(sum == 0);
+
+        start = BenchQueryCounter();
+        PhBeginEnumBTree(&btree, NULL, &enumContext);
+
+        for (j = 0; j < counts[i]; j++)
+            sum += *(PULONG64)PhNextEnumBTree(&enumContext);
+
+        btreeIterate = BenchQueryCounter() - start;
+        start = BenchQueryCounter();
+        links = PhMinimumElementAvlTree(&avlTree);
+
+        for (j = 0; j < counts[i]; j++)
+        {
+            sum -= CONTAINING_RECORD(links, BENCH_AVL_ENTRY, Links)->Key;
+            links = PhSuccessorElementAvlTree(links);
+        }
+
+        avlIterate = BenchQueryCounter() - start;
+        assert(sum == 0);
+
+        wprintf(
+            L"btree: %8u keys, lookup %.1f ns (avl %.1f ns), iterate %.2f ns (avl %.2f ns), height %u\n",
+            counts[i],
+            (DOUBLE)btreeLookup * 1e9 / frequency.QuadPart / numberOfLookups,
+            (DOUBLE)avlLookup * 1e9 / frequency.QuadPart / numberOfLookups,
+            (DOUBLE)btreeIterate * 1e9 / frequency.QuadPart / counts[i],
+            (DOUBLE)avlIterate * 1e9 / frequency.QuadPart / counts[i],
+            btree.Height
+            );
+
+        PhDeleteBTree(&btree);
+        PhFree(avlEntries);
+        PhFree(keys);
+    }
+}
+
+// Device prefixes
+
+static PPH_STRING BenchQuerySymbolicLinkTarget(
+    _In_ PWSTR LinkName
+    )
+{
+    HANDLE linkHandle;
+    OBJECT_ATTRIBUTES oa;
+    UNICODE_STRING linkName;
+    UNICODE_STRING target;
+    WCHAR buffer[256];
+    PPH_STRING result = NULL;
+
+    RtlInitUnicodeString(&linkName, LinkName);
+    InitializeObjectAttributes(&oa, &linkName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    if (NT_SUCCESS(NtOpenSymbolicLinkObject(&linkHandle, SYMBOLIC_LINK_QUERY, &oa)))
+    {
+        target.Buffer = buffer;
+        target.Length = 0;
+        target.MaximumLength = sizeof(buffer);
+
+        if (NT_SUCCESS(NtQuerySymbolicLinkObject(linkHandle, &target, NULL)))
+            result = PhCreateStringEx(target.Buffer, target.Length);
+
+        NtClose(linkHandle);
+    }
+
+    return result;
+}
+
+static PPH_STRING BenchLinearPrefixes[26];
+static PH_QUEUED_LOCK BenchLinearPrefixesLock = PH_QUEUED_LOCK_INIT;
+
+// The previous implementation of PhResolveDevicePrefix, which checks each drive
+// letter in turn and acquires the lock on each iteration.
+static PPH_STRING BenchLinearResolveDevicePrefix(
+    _In_ PPH_STRING Name
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 26; i++)
+    {
+        BOOLEAN isPrefix = FALSE;
+        PH_STRINGREF prefix;
+
+        PhAcquireQueuedLockShared(&BenchLinearPrefixesLock);
+
+        if (BenchLinearPrefixes[i])
+        {
+            prefix = BenchLinearPrefixes[i]->sr;
+
+            if (PhStartsWithStringRef(&Name->sr, &prefix, TRUE) &&
+                (Name->Length == prefix.Length || Name->Buffer[prefix.Length / sizeof(WCHAR)] == '\\'))
+            {
+                isPrefix = TRUE;
+            }
+        }
+
+        PhReleaseQueuedLockShared(&BenchLinearPrefixesLock);
+
+        if (isPrefix)
+        {
+            PPH_STRING newName;
+
+            newName = PhCreateStringEx(NULL, 2 * sizeof(WCHAR) + Name->Length - prefix.Length);
+            newName->Buffer[0] = (WCHAR)('A' + i);
+            newName->Buffer[1] = ':';
+            memcpy(&newName->Buffer[2], &Name->Buffer[prefix.Length / sizeof(WCHAR)], Name->Length - prefix.Length);
+
+            return newName;
+        }
+    }
+
+    return NULL;
+}
+
+// Resolves a corpus of NT paths recorded from the handle, module and process lists
+// of a typical system, and compares the time taken with the previous implementation.
+VOID BenchDevicePrefixes(
+    VOID
+    )
+{
+    static PWSTR corpus[] =
+    {
+        L"%s\\Windows\\System32\\ntdll.dll",
+        L"%s\\Windows\\System32\\kernel32.dll",
+        L"%s\\Windows\\System32\\KernelBase.dll",
+        L"%s\\Windows\\System32\\svchost.exe",
+        L"%s\\Windows\\System32\\en-US\\svchost.exe.mui",
+        L"%s\\Windows\\WinSxS\\amd64_microsoft.windows.common-controls_6595b64144ccf1df_6.0.9600.17810_none_6240b9c7ecbd0bda\\comctl32.dll",
+        L"%s\\Windows\\System32\\winevt\\Logs\\Application.evtx",
+        L"%s\\ProgramData\\Microsoft\\Windows Defender\\Support\\MPLog-07132009-221054.log",
+        L"%s\\Program Files (x86)\\Google\\Chrome\\Application\\chrome.exe",
+        L"%s\\Program Files (x86)\\Google\\Chrome\\Application\\43.0.2357.132\\chrome.dll",
+        L"%s\\Users\\user\\AppData\\Local\\Google\\Chrome\\User Data\\Default\\History",
+        L"%s\\Users\\user\\AppData\\Local\\Microsoft\\Windows\\Explorer\\thumbcache_idx.db",
+        L"%s\\$Extend\\$RmMetadata\\$TxfLog\\$TxfLog.blf",
+        L"%s\\System Volume Information\\{3808876b-c176-4e48-b7ae-04046e6cc752}",
+        L"%s",
+        L"\\Device\\Mup\\fileserver\\share\\document.docx",
+        L"\\Device\\NamedPipe\\lsass",
+        L"\\Device\\Afd\\Endpoint",
+        L"\\Device\\KsecDD",
+        L"\\Device\\ConDrv"
+    };
+    WCHAR linkName[] = L"\\??\\ :";
+    PPH_STRING device;
+    PPH_LIST names;
+    LARGE_INTEGER frequency;
+    ULONG64 start;
+    ULONG64 trieTime;
+    ULONG64 linearTime;
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < 26; i++)
+    {
+        linkName[4] = (WCHAR)('A' + i);
+        BenchLinearPrefixes[i] = BenchQuerySymbolicLinkTarget(linkName);
+    }
+
+    linkName[4] = USER_SHARED_DATA->NtSystemRoot[0];
+    device = BenchQuerySymbolicLinkTarget(linkName);
+    assert(device);
+
+    names = PhCreateList(sizeof(corpus) / sizeof(PWSTR));
+
+    for (i = 0; i < sizeof(corpus) / sizeof(PWSTR); i++)
+        PhAddItemList(names, PhFormatString(corpus[i], device->Buffer));
+
+    // Both implementations must agree on DOS device prefixes.
+    for (i = 0; i < names->Count; i++)
+    {
+        PPH_STRING resolved;
+        PPH_STRING linearResolved;
+
+        resolved = PhResolveDevicePrefix(names->Items[i]);
+        linearResolved = BenchLinearResolveDevicePrefix(names->Items[i]);
+
+        // The linear resolver doesn't handle network providers.
+        if (linearResolved)
+            assert(resolved && PhEqualString(resolved, linearResolved, FALSE));
+
+        if (resolved) PhDereferenceObject(resolved);
+        if (linearResolved) PhDereferenceObject(linearResolved);
+    }
+
+    NtQueryPerformanceCounter(&frequency, &frequency);
+
+    start = BenchQueryCounter();
+
+    for (j = 0; j < 10000; j++)
+    {
+        for (i = 0; i < names->Count; i++)
+        {
+            PPH_STRING resolved;
+
+            if (resolved = PhResolveDevicePrefix(names->Items[i]))
+                PhDereferenceObject(resolved);
+        }
+    }
+
+    trieTime = BenchQueryCounter() - start;
+    start = BenchQueryCounter();
+
+    for (j = 0; j < 10000; j++)
+    {
+        for (i = 0; i < names->Count; i++)
+        {
+            PPH_STRING resolved;
+
+            if (resolved = BenchLinearResolveDevicePrefix(names->Items[i]))
+                PhDereferenceObject(resolved);
+        }
+    }
+
+    linearTime = BenchQueryCounter() - start;
+
+    wprintf(
+        L"device prefix: %.1f ns/path trie, %.1f ns/path linear\n",
+        (DOUBLE)trieTime * 1e9 / frequency.QuadPart / (names->Count * 10000),
+        (DOUBLE)linearTime * 1e9 / frequency.QuadPart / (names->Count * 10000)
+        );
+
+    for (i = 0; i < names->Count; i++)
+        PhDereferenceObject(names->Items[i]);
+
+    PhDereferenceObject(names);
+    PhDereferenceObject(device);
+
+    for (i = 0; i < 26; i++)
+    {
+        if (BenchLinearPrefixes[i])
+            PhDereferenceObject(BenchLinearPrefixes[i]);
+    }
+}
@@ -0,0 +1,286 @@
+#include "bench.h"
+
+#define BENCH_QUEUE_SIZE 64
+#define BENCH_WAIT_TIMEOUT 10 // in milliseconds
+
+// Conditions
+
+typedef struct _BENCH_QUEUE
+{
+    PH_QUEUED_LOCK Lock;
+    PH_QUEUED_LOCK NotEmptyCondition;
+    PH_QUEUED_LOCK NotFullCondition;
+    ULONG Head;
+    ULONG Count;
+    ULONG64 Items[BENCH_QUEUE_SIZE];
+} BENCH_QUEUE, *PBENCH_QUEUE;
+
+static BENCH_QUEUE BenchQueue;
+
+// Even threads produce items and odd threads consume them. Each item holds the time at
+// which it was queued, so consumers record the latency of the hand-off.
+static NTSTATUS NTAPI BenchConditionThreadRoutine(
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    PBENCH_QUEUE queue = &BenchQueue;
+    BOOLEAN producer = Thread->Index % 2 == 0;
+    LARGE_INTEGER timeout;
+    ULONG64 timestamp;
+
+    PhTimeoutFromMilliseconds(&timeout, BENCH_WAIT_TIMEOUT);
+
+    while (!BenchStop)
+    {
+        PhAcquireQueuedLockExclusive(&queue->Lock);
+
+        if (producer)
+        {
+            while (queue->Count == BENCH_QUEUE_SIZE && !BenchStop)
+                PhWaitForCondition(&queue->NotFullCondition, &queue->Lock, &timeout);
+
+            if (BenchStop)
+            {
+                PhReleaseQueuedLockExclusive(&queue->Lock);
+                break;
+            }
+
+            queue->Items[(queue->Head + queue->Count) % BENCH_QUEUE_SIZE] = ReadTimeStampCounter();
+            queue->Count++;
+            PhReleaseQueuedLockExclusive(&queue->Lock);
+
+            PhPulseCondition(&queue->NotEmptyCondition);
+        }
+        else
+        {
+            while (queue->Count == 0 && !BenchStop)
+                PhWaitForCondition(&queue->NotEmptyCondition, &queue->Lock, &timeout);
+
+            if (BenchStop)
+            {
+                PhReleaseQueuedLockExclusive(&queue->Lock);
+                break;
+            }
+
+            timestamp = queue->Items[queue->Head];
+            queue->Head = (queue->Head + 1) % BENCH_QUEUE_SIZE;
+            queue->Count--;
+            PhReleaseQueuedLockExclusive(&queue->Lock);
+
+            PhPulseCondition(&queue->NotFullCondition);
+
+            BenchRecordLatency(Thread, ReadTimeStampCounter() - timestamp);
+        }
+
+        Thread->Operations++;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Runs a bounded producer/consumer queue built on a queued lock and two conditions.
+ */
+VOID BenchConditions(
+    VOID
+    )
+{
+    BENCH_PARAMETERS parameters;
+    BENCH_RESULT result;
+    ULONG i;
+
+    for (i = 0; i < BenchThreadCounts.Count; i++)
+    {
+        // At least one producer and one consumer are needed.
+        if (BenchThreadCounts.Values[i] < 2)
+            continue;
+
+        memset(&BenchQueue, 0, sizeof(BENCH_QUEUE));
+        PhInitializeQueuedLock(&BenchQueue.Lock);
+        PhInitializeQueuedLock(&BenchQueue.NotEmptyCondition);
+        PhInitializeQueuedLock(&BenchQueue.NotFullCondition);
+
+        parameters.NumberOfThreads = BenchThreadCounts.Values[i];
+        parameters.ReadPercent = 0;
+        parameters.CriticalSectionLength = 0;
+        parameters.Duration = BenchDuration;
+
+        BenchRun(BenchConditionThreadRoutine, NULL, &parameters, &result);
+        BenchReport(L"condition", &parameters, &result);
+    }
+}
+
+// Ping-pong
+//
+// Threads are paired, and the two threads of a pair take turns to wake each other. The
+// latency is the time from one thread signalling to the other thread waking.
+
+typedef struct DECLSPEC_ALIGN(64) _BENCH_PAIR
+{
+    volatile LONG Turn;
+    ULONG64 Timestamp;
+    PH_QUEUED_LOCK WakeEvent[2];
+    // Each side alternates between two events, so the event it waits on next can be
+    // reset before the other side is woken.
+    PH_EVENT Events[2][2];
+} BENCH_PAIR, *PBENCH_PAIR;
+
+static BENCH_PAIR BenchPairs[BENCH_MAXIMUM_THREADS / 2];
+
+static VOID BenchInitializePairs(
+    VOID
+    )
+{
+    ULONG i;
+
+    memset(BenchPairs, 0, sizeof(BenchPairs));
+
+    for (i = 0; i < BENCH_MAXIMUM_THREADS / 2; i++)
+    {
+        PhInitializeQueuedLock(&BenchPairs[i].WakeEvent[0]);
+        PhInitializeQueuedLock(&BenchPairs[i].WakeEvent[1]);
+        PhInitializeEvent(&BenchPairs[i].Events[0][0]);
+        PhInitializeEvent(&BenchPairs[i].Events[0][1]);
+        PhInitializeEvent(&BenchPairs[i].Events[1][0]);
+        PhInitializeEvent(&BenchPairs[i].Events[1][1]);
+    }
+}
+
+static VOID BenchRecordPairLatency(
+    _Inout_ PBENCH_THREAD Thread,
+    _In_ PBENCH_PAIR Pair
+    )
+{
+    // The first turn of the pair has no signaller.
+    if (Pair->Timestamp != 0)
+        BenchRecordLatency(Thread, ReadTimeStampCounter() - Pair->Timestamp);
+
+    Thread->Operations++;
+}
+
+static NTSTATUS NTAPI BenchWakeEventThreadRoutine(
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    PBENCH_PAIR pair = &BenchPairs[Thread->Index / 2];
+    LONG side = Thread->Index % 2;
+    PH_QUEUED_WAIT_BLOCK waitBlock;
+    LARGE_INTEGER timeout;
+
+    PhTimeoutFromMilliseconds(&timeout, BENCH_WAIT_TIMEOUT);
+
+    while (TRUE)
+    {
+        while (pair->Turn != side && !BenchStop)
+        {
+            PhQueueWakeEvent(&pair->WakeEvent[side], &waitBlock);
+
+            if (pair->Turn == side || BenchStop)
+            {
+                // Cancel the wait.
+                PhSetWakeEvent(&pair->WakeEvent[side], &waitBlock);
+            }
+            else
+            {
+                // Block immediately so that the wake path is measured instead of spinning.
+                PhWaitForWakeEvent(&pair->WakeEvent[side], &waitBlock, FALSE, &timeout);
+            }
+        }
+
+        if (BenchStop)
+            break;
+
+        BenchRecordPairLatency(Thread, pair);
+
+        pair->Timestamp = ReadTimeStampCounter();
+        _InterlockedExchange(&pair->Turn, !side);
+        PhSetWakeEvent(&pair->WakeEvent[!side], NULL);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI BenchEventThreadRoutine(
+    _Inout_ PBENCH_THREAD Thread
+    )
+{
+    PBENCH_PAIR pair = &BenchPairs[Thread->Index / 2];
+    ULONG side = Thread->Index % 2;
+    ULONG round;
+    LARGE_INTEGER timeout;
+
+    PhTimeoutFromMilliseconds(&timeout, BENCH_WAIT_TIMEOUT);
+
+    // In round r, this side waits on Events[side][r % 2] and then sets Events[!side][r % 2].
+    for (round = 0; ; round++)
+    {
+        while (!PhWaitForEvent(&pair->Events[side][round % 2], &timeout) && !BenchStop)
+            NOTHING;
+
+        if (BenchStop)
+            break;
+
+        BenchRecordPairLatency(Thread, pair);
+
+        // The other side finished setting this event in the previous round, and will not
+        // set it again until we set its event below.
+        PhInitializeEvent(&pair->Events[side][(round + 1) % 2]);
+
+        pair->Timestamp = ReadTimeStampCounter();
+        PhSetEvent(&pair->Events[!side][round % 2]);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID BenchPingPong(
+    _In_ PWSTR Name,
+    _In_ PBENCH_THREAD_ROUTINE Routine
+    )
+{
+    BENCH_PARAMETERS parameters;
+    BENCH_RESULT result;
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < BenchThreadCounts.Count; i++)
+    {
+        // Threads without a partner are not used.
+        if (BenchThreadCounts.Values[i] < 2)
+            continue;
+
+        BenchInitializePairs();
+
+        // The first side of each pair starts.
+        for (j = 0; j < BENCH_MAXIMUM_THREADS / 2; j++)
+            PhSetEvent(&BenchPairs[j].Events[0][0]);
+
+        parameters.NumberOfThreads = BenchThreadCounts.Values[i] & ~1;
+        parameters.ReadPercent = 0;
+        parameters.CriticalSectionLength = 0;
+        parameters.Duration = BenchDuration;
+
+        BenchRun(Routine, NULL, &parameters, &result);
+        BenchReport(Name, &parameters, &result);
+    }
+}
+
+/**
+ * Runs a ping-pong between pairs of threads using wake events.
+ */
+VOID BenchWakeEvents(
+    VOID
+    )
+{
+    BenchPingPong(L"wakeevent", BenchWakeEventThreadRoutine);
+}
+
+/**
+ * Runs a ping-pong between pairs of threads using event objects.
+ */
+VOID BenchEvents(
+    VOID
+    )
+{
+    BenchPingPong(L"event", BenchEventThreadRoutine);
+}
@@ -10,6 +10,15 @@ int __cdecl main(int argc, char *argv[])
     Test_basesup();
     Test_format();
     Test_support();
+    Test_collect();
+    Test_kph();
+    Test_native();
+    Test_unwind();
+    Test_calltree();
+    Test_stats();
+    Test_queuedlock();
+    Test_trace();
+    Test_provider();
 
     return 0;
 }
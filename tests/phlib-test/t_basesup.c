@@ -254,6 +254,109 @@ VOID Test_strint(
     assert(wcscmp(string->Buffer, L"18446744073709551493") == 0);
 }
 
+static VOID Test_intern(
+    VOID
+    )
+{
+    static PH_STRINGREF svchost = PH_STRINGREF_INIT(L"svchost.exe");
+    static PH_STRINGREF explorer = PH_STRINGREF_INIT(L"explorer.exe");
+    PH_INTERNED_STRING_STATISTICS statistics;
+    PPH_STRING string1;
+    PPH_STRING string2;
+    PPH_STRING string3;
+    PPH_STRING string4;
+
+    string1 = PhInternStringRef(&svchost);
+    string2 = PhInternStringRef(&svchost);
+    assert(string1 == string2);
+    assert(PhIsInternedString(string1));
+    assert(PhEqualStringRef(&string1->sr, &svchost, FALSE));
+    assert(string1->Buffer[string1->Length / sizeof(WCHAR)] == 0);
+    assert(PhGetInternedStringHash(string1) == PhHashBytes((PUCHAR)svchost.Buffer, svchost.Length));
+
+    // Interning is case-sensitive.
+    string3 = PhCreateString(L"SVCHOST.EXE");
+    assert(!PhIsInternedString(string3));
+    string4 = PhInternString(string3);
+    assert(string4 != string1);
+    assert(!PhEqualInternedString(string4, string1));
+    PhDereferenceObject(string3);
+
+    // Interning an interned string returns the same object.
+    string3 = PhInternString(string1);
+    assert(string3 == string1);
+    PhDereferenceObject(string3);
+
+    PhDereferenceObject(string4);
+    PhDereferenceObject(string2);
+    PhDereferenceObject(string1);
+
+    // Strings are removed when the last reference is released.
+    string1 = PhInternStringRef(&explorer);
+    PhGetInternedStringStatistics(&statistics);
+    assert(statistics.NumberOfStrings == 1 && statistics.NumberOfReferences == 1);
+    PhDereferenceObject(string1);
+    PhGetInternedStringStatistics(&statistics);
+    assert(statistics.NumberOfStrings == 0);
+}
+
+// Interns the process names and user names of a recorded process snapshot and checks
+// that memory is saved.
+static VOID Test_internsnapshot(
+    VOID
+    )
+{
+    static struct
+    {
+        PWSTR Name;
+        ULONG Count;
+    } snapshot[] =
+    {
+        { L"svchost.exe", 84 },
+        { L"chrome.exe", 212 },
+        { L"conhost.exe", 31 },
+        { L"RuntimeBroker.exe", 9 },
+        { L"explorer.exe", 1 },
+        { L"csrss.exe", 2 },
+        { L"dllhost.exe", 6 },
+        { L"NT AUTHORITY\\SYSTEM", 120 },
+        { L"NT AUTHORITY\\LOCAL SERVICE", 41 },
+        { L"NT AUTHORITY\\NETWORK SERVICE", 17 },
+        { L"CONTOSO\\user", 224 }
+    };
+    PH_INTERNED_STRING_STATISTICS statistics;
+    PPH_LIST list;
+    SIZE_T uninternedBytes;
+    ULONG i;
+    ULONG j;
+
+    list = PhCreateList(800);
+    uninternedBytes = 0;
+
+    for (i = 0; i < sizeof(snapshot) / sizeof(snapshot[0]); i++)
+    {
+        PH_STRINGREF name;
+
+        PhInitializeStringRef(&name, snapshot[i].Name);
+
+        for (j = 0; j < snapshot[i].Count; j++)
+        {
+            PhAddItemList(list, PhInternStringRef(&name));
+            uninternedBytes += FIELD_OFFSET(PH_STRING, Data) + name.Length + sizeof(WCHAR);
+        }
+    }
+
+    PhGetInternedStringStatistics(&statistics);
+    assert(statistics.NumberOfStrings == sizeof(snapshot) / sizeof(snapshot[0]));
+    assert(statistics.NumberOfReferences == list->Count);
+    assert(statistics.NumberOfBytes < uninternedBytes);
+
+    for (i = 0; i < list->Count; i++)
+        PhDereferenceObject(list->Items[i]);
+
+    PhDereferenceObject(list);
+}
+
 VOID Test_basesup(
     VOID
     )
@@ -263,4 +366,6 @@ VOID Test_basesup(
     Test_stringref();
     Test_hexstring();
     Test_strint();
+    Test_intern();
+    Test_internsnapshot();
 }
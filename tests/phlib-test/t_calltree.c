@@ -0,0 +1,209 @@
+#include "tests.h"
+
+#define SAMPLES_PER_THREAD 100000
+#define NUMBER_OF_THREADS 4
+
+typedef struct _RESOLVE_CONTEXT
+{
+    ULONG NumberOfCalls;
+    ULONG NumberOfAddresses;
+} RESOLVE_CONTEXT, *PRESOLVE_CONTEXT;
+
+static VOID AddSample(
+    _Inout_ PPH_CALL_TREE CallTree,
+    _In_ ULONG NumberOfFrames,
+    ...
+    )
+{
+    PVOID frames[16];
+    va_list argptr;
+    ULONG i;
+
+    va_start(argptr, NumberOfFrames);
+
+    for (i = 0; i < NumberOfFrames; i++)
+        frames[i] = (PVOID)va_arg(argptr, ULONG_PTR);
+
+    va_end(argptr);
+
+    PhAddSampleCallTree(CallTree, frames, NumberOfFrames);
+}
+
+// Names addresses by function, where each function is 0x100 bytes long.
+static VOID NTAPI ResolveByFunction(
+    _In_reads_(Count) PVOID *Addresses,
+    _In_ ULONG Count,
+    _Out_writes_(Count) PPH_STRING *Names,
+    _In_opt_ PVOID Context
+    )
+{
+    PRESOLVE_CONTEXT context = Context;
+    ULONG i;
+
+    context->NumberOfCalls++;
+    context->NumberOfAddresses += Count;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (i != 0)
+            assert((ULONG_PTR)Addresses[i - 1] < (ULONG_PTR)Addresses[i]);
+
+        if ((ULONG_PTR)Addresses[i] < 0x10000)
+            Names[i] = PhFormatString(L"f%Ix", (ULONG_PTR)Addresses[i] / 0x100);
+    }
+}
+
+static VOID Test_fold(
+    VOID
+    )
+{
+    PPH_CALL_TREE callTree;
+    PPH_STRING folded;
+    RESOLVE_CONTEXT context = { 0 };
+
+    callTree = PhCreateCallTree();
+
+    // Frames are innermost first.
+    AddSample(callTree, 3, 0x3000, 0x2000, 0x1000);
+    AddSample(callTree, 3, 0x3000, 0x2000, 0x1000);
+    AddSample(callTree, 2, 0x2000, 0x1000);
+    AddSample(callTree, 3, 0x3000, 0x2000, 0x1000);
+    AddSample(callTree, 2, 0x4000, 0x1000);
+    AddSample(callTree, 2, 0x2000, 0x1000);
+    AddSample(callTree, 1, 0x9000);
+
+    assert(callTree->NumberOfSamples == 7);
+    assert(callTree->Root.InclusiveCount == 7);
+    assert(callTree->NumberOfNodes == 5);
+
+    folded = PhExportFoldedCallTree(callTree, NULL, NULL);
+    assert(PhEqualString2(folded,
+        L"0x1000;0x2000 2\n"
+        L"0x1000;0x2000;0x3000 3\n"
+        L"0x1000;0x4000 1\n"
+        L"0x9000 1\n",
+        FALSE));
+    PhDereferenceObject(folded);
+
+    // Different return addresses in the same function are combined, and each
+    // address is resolved once.
+    AddSample(callTree, 3, 0x3010, 0x2000, 0x1000);
+    AddSample(callTree, 3, 0x3020, 0x2008, 0x1000);
+    AddSample(callTree, 2, 0x12345678, 0x1000);
+
+    folded = PhExportFoldedCallTree(callTree, ResolveByFunction, &context);
+    assert(PhEqualString2(folded,
+        L"f10;0x12345678 1\n"
+        L"f10;f20 2\n"
+        L"f10;f20;f30 5\n"
+        L"f10;f40 1\n"
+        L"f90 1\n",
+        FALSE));
+    assert(context.NumberOfCalls == 1 && context.NumberOfAddresses == 9);
+    PhDereferenceObject(folded);
+
+    PhDereferenceObject(callTree);
+
+    // An empty tree.
+    callTree = PhCreateCallTree();
+    folded = PhExportFoldedCallTree(callTree, ResolveByFunction, &context);
+    assert(folded->Length == 0);
+    PhDereferenceObject(folded);
+    PhDereferenceObject(callTree);
+}
+
+static ULONG NextRandom(
+    _Inout_ PULONG Seed
+    )
+{
+    *Seed = *Seed * 1103515245 + 12345;
+
+    return *Seed >> 8;
+}
+
+// Adds samples drawn from 64 * 8 distinct stacks.
+static NTSTATUS AddSamplesThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    PPH_CALL_TREE callTree = Parameter;
+    PVOID frames[8];
+    ULONG seed;
+    ULONG random;
+    ULONG i;
+    ULONG j;
+
+    seed = (ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread;
+
+    for (i = 0; i < SAMPLES_PER_THREAD; i++)
+    {
+        random = NextRandom(&seed);
+
+        for (j = 0; j < 8; j++)
+            frames[7 - j] = (PVOID)(ULONG_PTR)(0x1000 * (j + 1) + (j < 2 ? (random >> (j * 3)) % 8 : 0));
+
+        PhAddSampleCallTree(callTree, frames, (random >> 6) % 8 + 1);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID Test_concurrent(
+    VOID
+    )
+{
+    PPH_CALL_TREE callTree;
+    HANDLE threadHandles[NUMBER_OF_THREADS];
+    PPH_STRING folded;
+    PH_STRINGREF remaining;
+    PH_STRINGREF line;
+    PH_STRINGREF countString;
+    ULONG64 count;
+    ULONG64 total;
+    BOOLEAN result;
+    ULONG i;
+
+    callTree = PhCreateCallTree();
+
+    for (i = 0; i < NUMBER_OF_THREADS; i++)
+        threadHandles[i] = PhCreateThread(0, AddSamplesThreadStart, callTree);
+
+    for (i = 0; i < NUMBER_OF_THREADS; i++)
+    {
+        assert(threadHandles[i]);
+        NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+        NtClose(threadHandles[i]);
+    }
+
+    assert(callTree->NumberOfSamples == SAMPLES_PER_THREAD * NUMBER_OF_THREADS);
+    assert(callTree->Root.InclusiveCount == SAMPLES_PER_THREAD * NUMBER_OF_THREADS);
+
+    // No samples are lost.
+
+    folded = PhExportFoldedCallTree(callTree, NULL, NULL);
+    remaining = folded->sr;
+    total = 0;
+
+    while (remaining.Length != 0)
+    {
+        PhSplitStringRefAtChar(&remaining, '\n', &line, &remaining);
+        result = PhSplitStringRefAtLastChar(&line, ' ', &line, &countString);
+        assert(result);
+        result = PhStringToInteger64(&countString, 10, &count);
+        assert(result);
+        total += count;
+    }
+
+    assert(total == SAMPLES_PER_THREAD * NUMBER_OF_THREADS);
+
+    PhDereferenceObject(folded);
+    PhDereferenceObject(callTree);
+}
+
+VOID Test_calltree(
+    VOID
+    )
+{
+    Test_fold();
+    Test_concurrent();
+}
@@ -0,0 +1,289 @@
+#include "tests.h"
+
+typedef struct _AVL_ENTRY
+{
+    PH_AVL_LINKS Links;
+    ULONG64 Key;
+} AVL_ENTRY, *PAVL_ENTRY;
+
+static LONG NTAPI CompareKeyBTree(
+    _In_ PVOID Entry1,
+    _In_ PVOID Entry2
+    )
+{
+    return uint64cmp(*(PULONG64)Entry1, *(PULONG64)Entry2);
+}
+
+static LONG NTAPI CompareKeyAvlTree(
+    _In_ PPH_AVL_LINKS Links1,
+    _In_ PPH_AVL_LINKS Links2
+    )
+{
+    return uint64cmp(
+        CONTAINING_RECORD(Links1, AVL_ENTRY, Links)->Key,
+        CONTAINING_RECORD(Links2, AVL_ENTRY, Links)->Key
+        );
+}
+
+static ULONG NextRandom(
+    _Inout_ PULONG Seed
+    )
+{
+    *Seed = *Seed * 1103515245 + 12345;
+
+    return *Seed >> 8;
+}
+
+static VOID Test_btree(
+    VOID
+    )
+{
+    static ULONG sizes[] = { 8, 100 };
+    PH_BTREE tree;
+    PH_BTREE_ENUM_CONTEXT enumContext;
+    UCHAR entry[100];
+    PULONG64 key;
+    PUCHAR present;
+    PVOID result;
+    BOOLEAN added;
+    ULONG seed;
+    ULONG count;
+    ULONG i;
+    ULONG j;
+
+    present = PhAllocate(10000);
+    key = (PULONG64)entry;
+    memset(entry, 0, sizeof(entry));
+
+    for (i = 0; i < sizeof(sizes) / sizeof(ULONG); i++)
+    {
+        PhInitializeBTree(&tree, sizes[i], CompareKeyBTree);
+        memset(present, 0, 10000);
+        seed = 1;
+        count = 0;
+
+        // Random insertions and removals, so that nodes are split, merged and
+        // rebalanced with both siblings.
+        for (j = 0; j < 100000; j++)
+        {
+            *key = NextRandom(&seed) % 10000;
+
+            if (NextRandom(&seed) % 3 != 0)
+            {
+                result = PhAddEntryBTree(&tree, entry, &added);
+                assert(added == !present[*key]);
+                assert(*(PULONG64)result == *key);
+
+                if (added)
+                {
+                    present[*key] = TRUE;
+                    count++;
+                }
+            }
+            else
+            {
+                assert(PhRemoveEntryBTree(&tree, entry) == present[*key]);
+
+                if (present[*key])
+                {
+                    present[*key] = FALSE;
+                    count--;
+                }
+            }
+
+            assert(tree.Count == count);
+        }
+
+        for (j = 0; j < 10000; j++)
+        {
+            *key = j;
+            result = PhFindEntryBTree(&tree, entry);
+            assert(!!result == present[j]);
+        }
+
+        // Ordered iteration
+        PhBeginEnumBTree(&tree, NULL, &enumContext);
+        j = 0;
+
+        while (result = PhNextEnumBTree(&enumContext))
+        {
+            for (; !present[j]; j++)
+                NOTHING;
+
+            assert(*(PULONG64)result == j);
+            j++;
+            count--;
+        }
+
+        assert(count == 0);
+
+        // Range scan
+        *key = 5000;
+        PhBeginEnumBTree(&tree, entry, &enumContext);
+
+        for (j = 5000; j < 6000; j++)
+        {
+            if (present[j])
+            {
+                result = PhNextEnumBTree(&enumContext);
+                assert(*(PULONG64)result == j);
+            }
+        }
+
+        // Remove everything
+        for (j = 0; j < 10000; j++)
+        {
+            *key = j;
+            assert(PhRemoveEntryBTree(&tree, entry) == present[j]);
+        }
+
+        assert(tree.Count == 0 && tree.Root == NULL);
+        PhBeginEnumBTree(&tree, NULL, &enumContext);
+        assert(!PhNextEnumBTree(&enumContext));
+
+        PhDeleteBTree(&tree);
+    }
+
+    PhFree(present);
+}
+
+static VOID Test_btreebulkload(
+    VOID
+    )
+{
+    static ULONG counts[] = { 0, 1, 2, 125, 126, 127, 1000, 7813, 100000 };
+    PH_BTREE tree;
+    PH_BTREE_ENUM_CONTEXT enumContext;
+    PULONG64 keys;
+    ULONG64 key;
+    PVOID result;
+    BOOLEAN added;
+    ULONG i;
+    ULONG j;
+
+    keys = PhAllocate(100000 * sizeof(ULONG64));
+
+    for (i = 0; i < sizeof(counts) / sizeof(ULONG); i++)
+    {
+        for (j = 0; j < counts[i]; j++)
+            keys[j] = j * 2;
+
+        PhInitializeBTree(&tree, sizeof(ULONG64), CompareKeyBTree);
+        PhBulkLoadBTree(&tree, keys, counts[i]);
+        assert(tree.Count == counts[i]);
+
+        for (j = 0; j < counts[i] * 2; j++)
+        {
+            key = j;
+            result = PhFindEntryBTree(&tree, &key);
+            assert(!!result == (j % 2 == 0));
+        }
+
+        // The tree must remain valid after modification.
+        for (j = 0; j < counts[i]; j += 2)
+        {
+            key = j * 2;
+            assert(PhRemoveEntryBTree(&tree, &key));
+            key = j * 2 + 1;
+            PhAddEntryBTree(&tree, &key, &added);
+            assert(added);
+        }
+
+        PhBeginEnumBTree(&tree, NULL, &enumContext);
+        key = 0;
+        j = 0;
+
+        while (result = PhNextEnumBTree(&enumContext))
+        {
+            assert(j == 0 || *(PULONG64)result > key);
+            key = *(PULONG64)result;
+            j++;
+        }
+
+        assert(j == counts[i]);
+
+        PhDeleteBTree(&tree);
+    }
+
+    PhFree(keys);
+}
+
+// Checks that lookups and in-order iteration of a bulk-loaded B+ tree agree with
+// an AVL tree containing the same keys.
+static VOID Test_btreeavl(
+    VOID
+    )
+{
+    PH_BTREE btree;
+    PH_BTREE_ENUM_CONTEXT enumContext;
+    PH_AVL_TREE avlTree = PH_AVL_TREE_INIT(CompareKeyAvlTree);
+    PAVL_ENTRY avlEntries;
+    PPH_AVL_LINKS links;
+    PULONG64 keys;
+    AVL_ENTRY lookupEntry;
+    ULONG64 key;
+    PVOID result;
+    ULONG seed;
+    ULONG j;
+
+    keys = PhAllocate(10000 * sizeof(ULONG64));
+    avlEntries = PhAllocate(10000 * sizeof(AVL_ENTRY));
+
+    for (j = 0; j < 10000; j++)
+        keys[j] = (ULONG64)j * 2;
+
+    PhInitializeBTree(&btree, sizeof(ULONG64), CompareKeyBTree);
+    PhBulkLoadBTree(&btree, keys, 10000);
+
+    seed = 1;
+
+    for (j = 10000 - 1; j != 0; j--)
+    {
+        ULONG other = NextRandom(&seed) % (j + 1);
+        ULONG64 temp = keys[j];
+
+        keys[j] = keys[other];
+        keys[other] = temp;
+    }
+
+    for (j = 0; j < 10000; j++)
+    {
+        avlEntries[j].Key = keys[j];
+        PhAddElementAvlTree(&avlTree, &avlEntries[j].Links);
+    }
+
+    for (j = 0; j < 20000; j++)
+    {
+        key = j;
+        lookupEntry.Key = j;
+        result = PhFindEntryBTree(&btree, &key);
+        links = PhFindElementAvlTree(&avlTree, &lookupEntry.Links);
+        assert(!!result == !!links);
+    }
+
+    PhBeginEnumBTree(&btree, NULL, &enumContext);
+    links = PhMinimumElementAvlTree(&avlTree);
+
+    for (j = 0; j < 10000; j++)
+    {
+        result = PhNextEnumBTree(&enumContext);
+        assert(*(PULONG64)result == CONTAINING_RECORD(links, AVL_ENTRY, Links)->Key);
+        links = PhSuccessorElementAvlTree(links);
+    }
+
+    result = PhNextEnumBTree(&enumContext);
+    assert(!result && !links);
+
+    PhDeleteBTree(&btree);
+    PhFree(avlEntries);
+    PhFree(keys);
+}
+
+VOID Test_collect(
+    VOID
+    )
+{
+    Test_btree();
+    Test_btreebulkload();
+    Test_btreeavl();
+}
@@ -0,0 +1,185 @@
+#include "tests.h"
+#include <kphuser.h>
+
+typedef struct _STUB_DISPATCH_CONTEXT
+{
+    ULONG NumberOfCalls;
+    ULONG NumberOfOperations;
+} STUB_DISPATCH_CONTEXT, *PSTUB_DISPATCH_CONTEXT;
+
+// Decodes a batch the same way as KProcessHacker, and fills each output buffer
+// with a value derived from the operation.
+static NTSTATUS NTAPI StubDispatchBatch(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    )
+{
+    PSTUB_DISPATCH_CONTEXT context = Context;
+    ULONG numberOfOperations;
+    PKPH_BATCH_RESULT results;
+    PVOID data;
+    ULONG dataLength;
+    ULONG i;
+
+    if (OperationsLength == 0 || OperationsLength % sizeof(KPH_BATCH_OPERATION) != 0)
+        return STATUS_INVALID_PARAMETER_2;
+
+    numberOfOperations = OperationsLength / sizeof(KPH_BATCH_OPERATION);
+
+    if (OutputLength < numberOfOperations * sizeof(KPH_BATCH_RESULT))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    results = Output;
+    data = PTR_ADD_OFFSET(Output, numberOfOperations * sizeof(KPH_BATCH_RESULT));
+    dataLength = OutputLength - numberOfOperations * sizeof(KPH_BATCH_RESULT);
+
+    for (i = 0; i < numberOfOperations; i++)
+    {
+        PKPH_BATCH_OPERATION operation = &Operations[i];
+        ULONG value;
+
+        if (operation->DataOffset > dataLength ||
+            operation->DataLength > dataLength - operation->DataOffset ||
+            operation->DataOffset % KPH_BATCH_DATA_ALIGNMENT != 0)
+        {
+            results[i].Status = STATUS_INVALID_PARAMETER;
+            continue;
+        }
+
+        switch (operation->Type)
+        {
+        case KphBatchQueryInformationProcess:
+            value = (ULONG)(ULONG_PTR)operation->u.QueryInformationProcess.ProcessHandle + operation->u.QueryInformationProcess.ProcessInformationClass;
+            break;
+        case KphBatchQueryInformationThread:
+            value = (ULONG)(ULONG_PTR)operation->u.QueryInformationThread.ThreadHandle + operation->u.QueryInformationThread.ThreadInformationClass;
+            break;
+        case KphBatchQueryInformationObject:
+            value = (ULONG)(ULONG_PTR)operation->u.QueryInformationObject.Handle + operation->u.QueryInformationObject.ObjectInformationClass;
+            break;
+        default:
+            results[i].Status = STATUS_INVALID_INFO_CLASS;
+            continue;
+        }
+
+        if (operation->DataLength < sizeof(ULONG))
+        {
+            results[i].Status = STATUS_BUFFER_TOO_SMALL;
+            results[i].ReturnLength = sizeof(ULONG);
+            continue;
+        }
+
+        memset(PTR_ADD_OFFSET(data, operation->DataOffset), 0xcc, operation->DataLength);
+        *(PULONG)PTR_ADD_OFFSET(data, operation->DataOffset) = value;
+        results[i].Status = STATUS_SUCCESS;
+        results[i].ReturnLength = sizeof(ULONG);
+    }
+
+    if (context)
+    {
+        context->NumberOfCalls++;
+        context->NumberOfOperations += numberOfOperations;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NTAPI FailDispatchBatch(
+    _In_reads_bytes_(OperationsLength) PKPH_BATCH_OPERATION Operations,
+    _In_ ULONG OperationsLength,
+    _Out_writes_bytes_(OutputLength) PVOID Output,
+    _In_ ULONG OutputLength,
+    _In_opt_ PVOID Context
+    )
+{
+    return STATUS_INVALID_DEVICE_REQUEST;
+}
+
+static VOID Test_batchroundtrip(
+    VOID
+    )
+{
+    KPH_BATCH batch;
+    STUB_DISPATCH_CONTEXT context = { 0 };
+    ULONG indices[4];
+    PVOID buffer;
+    ULONG returnLength;
+    NTSTATUS status;
+
+    KphInitializeBatch(&batch);
+
+    indices[0] = KphAddQueryInformationProcessBatch(&batch, (HANDLE)100, KphProcessIoPriority, sizeof(ULONG));
+    indices[1] = KphAddQueryInformationThreadBatch(&batch, (HANDLE)200, KphThreadIoPriority, 13);
+    indices[2] = KphAddQueryInformationObjectBatch(&batch, (HANDLE)300, (HANDLE)400, KphObjectNameInformation, 2);
+    indices[3] = KphAddQueryInformationObjectBatch(&batch, (HANDLE)300, (HANDLE)500, KphObjectBasicInformation, 0x100);
+    assert(indices[0] == 0 && indices[1] == 1 && indices[2] == 2 && indices[3] == 3);
+
+    // Output buffers must be aligned and must not overlap.
+    assert(batch.Operations[1].DataOffset == 8);
+    assert(batch.Operations[2].DataOffset == 24);
+    assert(batch.Operations[3].DataOffset == 32);
+    assert(batch.DataLength == 32 + 0x100);
+
+    status = KphExecuteBatchEx(&batch, StubDispatchBatch, &context);
+    assert(NT_SUCCESS(status));
+    assert(context.NumberOfCalls == 1 && context.NumberOfOperations == 4);
+
+    status = KphGetResultBatch(&batch, 0, &buffer, &returnLength);
+    assert(NT_SUCCESS(status) && returnLength == sizeof(ULONG) && *(PULONG)buffer == 100 + KphProcessIoPriority);
+    status = KphGetResultBatch(&batch, 1, &buffer, &returnLength);
+    assert(NT_SUCCESS(status) && *(PULONG)buffer == 200 + KphThreadIoPriority);
+    assert(*(PUCHAR)PTR_ADD_OFFSET(buffer, 12) == 0xcc); // data written up to the reserved length
+    status = KphGetResultBatch(&batch, 2, NULL, &returnLength);
+    assert(status == STATUS_BUFFER_TOO_SMALL && returnLength == sizeof(ULONG));
+    status = KphGetResultBatch(&batch, 3, &buffer, NULL);
+    assert(NT_SUCCESS(status) && *(PULONG)buffer == 500 + KphObjectBasicInformation);
+    status = KphGetResultBatch(&batch, 4, NULL, NULL);
+    assert(status == STATUS_INVALID_PARAMETER_2);
+
+    // Reuse the batch.
+    KphClearBatch(&batch);
+    assert(KphAddQueryInformationObjectBatch(&batch, (HANDLE)1, (HANDLE)2, KphObjectTypeInformation, 4) == 0);
+    status = KphExecuteBatchEx(&batch, StubDispatchBatch, &context);
+    assert(NT_SUCCESS(status) && context.NumberOfCalls == 2);
+    status = KphGetResultBatch(&batch, 0, &buffer, NULL);
+    assert(NT_SUCCESS(status) && *(PULONG)buffer == 2 + KphObjectTypeInformation);
+
+    // A failed request fails every operation.
+    status = KphExecuteBatchEx(&batch, FailDispatchBatch, NULL);
+    assert(status == STATUS_INVALID_DEVICE_REQUEST);
+    assert(KphGetResultBatch(&batch, 0, NULL, NULL) == STATUS_INVALID_DEVICE_REQUEST);
+
+    KphDeleteBatch(&batch);
+}
+
+static VOID Test_batchlimits(
+    VOID
+    )
+{
+    KPH_BATCH batch;
+    ULONG i;
+
+    KphInitializeBatch(&batch);
+
+    for (i = 0; i < KPH_BATCH_MAXIMUM_OPERATIONS; i++)
+        assert(KphAddQueryInformationProcessBatch(&batch, (HANDLE)(ULONG_PTR)i, KphProcessIoPriority, sizeof(ULONG)) == i);
+
+    assert(KphAddQueryInformationProcessBatch(&batch, NULL, KphProcessIoPriority, sizeof(ULONG)) == -1);
+
+    KphClearBatch(&batch);
+    assert(KphAddQueryInformationObjectBatch(&batch, NULL, NULL, KphObjectNameInformation, MAXULONG) == -1);
+    assert(batch.Count == 0);
+
+    KphDeleteBatch(&batch);
+}
+
+VOID Test_kph(
+    VOID
+    )
+{
+    Test_batchroundtrip();
+    Test_batchlimits();
+}
@@ -0,0 +1,245 @@
+#include "tests.h"
+
+static PPH_STRING QuerySymbolicLinkTarget(
+    _In_ PWSTR LinkName
+    )
+{
+    HANDLE linkHandle;
+    OBJECT_ATTRIBUTES oa;
+    UNICODE_STRING linkName;
+    UNICODE_STRING target;
+    WCHAR buffer[256];
+    PPH_STRING result = NULL;
+
+    RtlInitUnicodeString(&linkName, LinkName);
+    InitializeObjectAttributes(&oa, &linkName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    if (NT_SUCCESS(NtOpenSymbolicLinkObject(&linkHandle, SYMBOLIC_LINK_QUERY, &oa)))
+    {
+        target.Buffer = buffer;
+        target.Length = 0;
+        target.MaximumLength = sizeof(buffer);
+
+        if (NT_SUCCESS(NtQuerySymbolicLinkObject(linkHandle, &target, NULL)))
+            result = PhCreateStringEx(target.Buffer, target.Length);
+
+        NtClose(linkHandle);
+    }
+
+    return result;
+}
+
+static VOID AssertFileName(
+    _In_ PPH_STRING Name,
+    _In_ PPH_STRING Expected
+    )
+{
+    PPH_STRING fileName;
+
+    fileName = PhGetFileName(Name);
+    assert(PhEqualString(fileName, Expected, TRUE));
+    PhDereferenceObject(fileName);
+}
+
+static VOID Test_devicePrefix(
+    VOID
+    )
+{
+    static PH_STRINGREF ntdllPart = PH_STRINGREF_INIT(L"\\System32\\ntdll.dll");
+
+    WCHAR linkName[] = L"\\??\\ :";
+    PPH_STRING device;
+    PPH_STRING name;
+    PPH_STRING expected;
+    PPH_STRING resolved;
+    PH_STRINGREF systemRoot;
+
+    linkName[4] = USER_SHARED_DATA->NtSystemRoot[0];
+    device = QuerySymbolicLinkTarget(linkName);
+    assert(device);
+
+    // \Device\HarddiskVolumeX\Windows -> C:\Windows
+    name = PhConcatStrings2(device->Buffer, L"\\Windows");
+    expected = PhFormatString(L"%c:\\Windows", linkName[4]);
+    resolved = PhResolveDevicePrefix(name);
+    assert(resolved && PhEqualString(resolved, expected, TRUE));
+    PhDereferenceObject(resolved);
+    AssertFileName(name, expected);
+    PhDereferenceObject(expected);
+    PhDereferenceObject(name);
+
+    // The prefix must be followed by a backslash or the end of the name.
+    resolved = PhResolveDevicePrefix(device);
+    assert(resolved && resolved->Length == 2 * sizeof(WCHAR));
+    PhDereferenceObject(resolved);
+    name = PhConcatStrings2(device->Buffer, L"0\\Windows");
+    assert(!PhResolveDevicePrefix(name));
+    PhDereferenceObject(name);
+
+    // Case-insensitive.
+    name = PhConcatStrings2(device->Buffer, L"\\x");
+    PhUpperString(name);
+    resolved = PhResolveDevicePrefix(name);
+    assert(resolved && resolved->Buffer[1] == ':');
+    PhDereferenceObject(resolved);
+    PhDereferenceObject(name);
+
+    PhDereferenceObject(device);
+
+    // File name rules.
+    name = PhCreateString(L"\\??\\C:\\Test\\a.txt");
+    expected = PhCreateString(L"C:\\Test\\a.txt");
+    assert(!PhResolveDevicePrefix(name));
+    AssertFileName(name, expected);
+    PhDereferenceObject(expected);
+    PhDereferenceObject(name);
+
+    PhGetSystemRoot(&systemRoot);
+    name = PhCreateString(L"\\systemroot\\System32\\ntdll.dll");
+    expected = PhConcatStringRef2(&systemRoot, &ntdllPart);
+    AssertFileName(name, expected);
+    PhDereferenceObject(expected);
+    PhDereferenceObject(name);
+
+    name = PhCreateString(L"\\Device\\Mup\\server\\share\\a.txt");
+    expected = PhCreateString(L"\\server\\share\\a.txt");
+    AssertFileName(name, expected);
+    PhDereferenceObject(expected);
+    PhDereferenceObject(name);
+
+    // Don't resolve if the name is the network provider prefix.
+    name = PhCreateString(L"\\Device\\Mup");
+    assert(!PhResolveDevicePrefix(name));
+    PhDereferenceObject(name);
+
+    // Names which don't match anything are returned unchanged.
+    name = PhCreateString(L"\\Device\\NoSuchDevice\\a.txt");
+    resolved = PhGetFileName(name);
+    assert(resolved == name);
+    PhDereferenceObject(resolved);
+    PhDereferenceObject(name);
+}
+
+static VOID Test_processSnapshot(
+    VOID
+    )
+{
+    PPH_PROCESS_SNAPSHOT snapshot1;
+    PPH_PROCESS_SNAPSHOT snapshot2;
+    PPH_PROCESS_SNAPSHOT snapshot3;
+    PSYSTEM_PROCESS_INFORMATION process;
+
+    assert(NT_SUCCESS(PhCreateProcessSnapshot(&snapshot1)));
+    process = PhFindProcessInformation(snapshot1->Processes, NtCurrentTeb()->ClientId.UniqueProcess);
+    assert(process);
+
+    // Make the snapshot ten seconds old so the test does not depend on timing.
+    snapshot1->QueryTime.QuadPart -= 10 * PH_TICKS_PER_SEC;
+
+    // A snapshot is not shared until it is published.
+    PhPublishProcessSnapshot(snapshot1);
+    snapshot2 = PhReferenceProcessSnapshot();
+    assert(snapshot2 == snapshot1);
+    PhDereferenceObject(snapshot2);
+
+    assert(NT_SUCCESS(PhGetProcessSnapshot(60000, &snapshot2)));
+    assert(snapshot2 == snapshot1);
+    PhDereferenceObject(snapshot2);
+
+    // A stale snapshot is replaced.
+    assert(NT_SUCCESS(PhGetProcessSnapshot(1000, &snapshot2)));
+    assert(snapshot2 != snapshot1);
+    snapshot3 = PhReferenceProcessSnapshot();
+    assert(snapshot3 == snapshot2);
+    PhDereferenceObject(snapshot3);
+
+    // An older snapshot never replaces a newer one.
+    PhPublishProcessSnapshot(snapshot1);
+    snapshot3 = PhReferenceProcessSnapshot();
+    assert(snapshot3 == snapshot2);
+    PhDereferenceObject(snapshot3);
+
+    PhDereferenceObject(snapshot2);
+    PhDereferenceObject(snapshot1);
+}
+
+typedef struct _USER_FRAME_CONTEXT
+{
+    PVOID ImageBase;
+    PVOID ImageEnd;
+    BOOLEAN Found;
+} USER_FRAME_CONTEXT, *PUSER_FRAME_CONTEXT;
+
+static volatile LONG SpinThreadState; // 1 while spinning, 2 to stop
+
+static NTSTATUS SpinThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    _InterlockedExchange(&SpinThreadState, 1);
+
+    while (SpinThreadState == 1)
+        YieldProcessor();
+
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN NTAPI FindUserFrameCallback(
+    _In_ PPH_THREAD_STACK_FRAME StackFrame,
+    _In_opt_ PVOID Context
+    )
+{
+    PUSER_FRAME_CONTEXT context = Context;
+
+    if (StackFrame->PcAddress >= context->ImageBase && StackFrame->PcAddress < context->ImageEnd)
+        context->Found = TRUE;
+
+    return !context->Found;
+}
+
+// The profiler walks stacks with these flags. Including the kernel stack must not
+// lose the user stack.
+static VOID Test_walkThreadStack(
+    VOID
+    )
+{
+    USER_FRAME_CONTEXT context;
+    HANDLE threadHandle;
+
+    context.ImageBase = NtCurrentPeb()->ImageBaseAddress;
+    context.ImageEnd = PTR_ADD_OFFSET(context.ImageBase, RtlImageNtHeader(context.ImageBase)->OptionalHeader.SizeOfImage);
+    context.Found = FALSE;
+
+    SpinThreadState = 0;
+    threadHandle = PhCreateThread(0, SpinThreadStart, NULL);
+    assert(threadHandle);
+
+    while (SpinThreadState != 1)
+        YieldProcessor();
+
+    // The status is not checked because the WOW64 part of the walk fails for native
+    // threads.
+    PhWalkThreadStackEx(
+        threadHandle,
+        NtCurrentProcess(),
+        NULL,
+        PH_WALK_I386_STACK | PH_WALK_AMD64_STACK | PH_WALK_KERNEL_STACK,
+        FindUserFrameCallback,
+        &context,
+        NULL
+        );
+    assert(context.Found);
+
+    _InterlockedExchange(&SpinThreadState, 2);
+    NtWaitForSingleObject(threadHandle, FALSE, NULL);
+    NtClose(threadHandle);
+}
+
+VOID Test_native(
+    VOID
+    )
+{
+    Test_devicePrefix();
+    Test_processSnapshot();
+    Test_walkThreadStack();
+}
@@ -0,0 +1,164 @@
+#include "tests.h"
+
+// The provider threads in these tests are driven by a simulated clock which advances by one
+// interval on every tick, so the results do not depend on how late the real ticks are.
+#define TICK_INTERVAL 10
+
+static ULONG64 SimulatedTime;
+
+static ULONG64 NTAPI SimulatedClock(
+    VOID
+    )
+{
+    SimulatedTime += TICK_INTERVAL;
+
+    return SimulatedTime;
+}
+
+static VOID NTAPI CheapProviderUpdate(
+    _In_ PVOID Object
+    )
+{
+    NOTHING;
+}
+
+static VOID NTAPI ExpensiveProviderUpdate(
+    _In_ PVOID Object
+    )
+{
+    LARGE_INTEGER timeout;
+
+    NtDelayExecution(FALSE, PhTimeoutFromMilliseconds(&timeout, 10));
+}
+
+static VOID InitializeProviderThread(
+    _Out_ PPH_PROVIDER_THREAD ProviderThread
+    )
+{
+    SimulatedTime = 1000;
+    PhInitializeProviderThread(ProviderThread, TICK_INTERVAL);
+    PhSetClockProviderThread(ProviderThread, SimulatedClock);
+}
+
+static VOID WaitForRunId(
+    _In_ PPH_PROVIDER_REGISTRATION Registration,
+    _In_ ULONG RunId
+    )
+{
+    LARGE_INTEGER timeout;
+
+    while (*(volatile ULONG *)&Registration->RunId < RunId)
+        NtDelayExecution(FALSE, PhTimeoutFromMilliseconds(&timeout, 1));
+}
+
+static VOID Test_interval(
+    VOID
+    )
+{
+    PH_PROVIDER_THREAD providerThread;
+    PH_PROVIDER_REGISTRATION fastRegistration;
+    PH_PROVIDER_REGISTRATION slowRegistration;
+
+    InitializeProviderThread(&providerThread);
+    PhRegisterProvider(&providerThread, CheapProviderUpdate, NULL, &fastRegistration);
+    PhSetEnabledProvider(&fastRegistration, TRUE);
+    PhRegisterProvider(&providerThread, CheapProviderUpdate, NULL, &slowRegistration);
+    PhSetScheduleProvider(&slowRegistration, TICK_INTERVAL * 4, 0, 0);
+    PhSetEnabledProvider(&slowRegistration, TRUE);
+
+    PhStartProviderThread(&providerThread);
+    WaitForRunId(&slowRegistration, 5);
+    PhStopProviderThread(&providerThread);
+
+    // The slow provider runs on the first tick and then on every fourth tick.
+    assert(fastRegistration.RunId >= (slowRegistration.RunId - 1) * 4 + 1);
+    assert(fastRegistration.RunId <= slowRegistration.RunId * 4);
+    assert(fastRegistration.SkippedRuns == 0 && slowRegistration.SkippedRuns == 0);
+    assert(fastRegistration.LateRuns == 0 && slowRegistration.LateRuns == 0);
+
+    PhUnregisterProvider(&fastRegistration);
+    PhUnregisterProvider(&slowRegistration);
+    PhDeleteProviderThread(&providerThread);
+}
+
+static VOID Test_reenable(
+    VOID
+    )
+{
+    PH_PROVIDER_THREAD providerThread;
+    PH_PROVIDER_REGISTRATION tickRegistration;
+    PH_PROVIDER_REGISTRATION registration;
+    ULONG runId;
+
+    InitializeProviderThread(&providerThread);
+    PhRegisterProvider(&providerThread, CheapProviderUpdate, NULL, &tickRegistration);
+    PhSetEnabledProvider(&tickRegistration, TRUE);
+    PhRegisterProvider(&providerThread, CheapProviderUpdate, NULL, &registration);
+    PhSetScheduleProvider(&registration, TICK_INTERVAL * 4, 0, 0);
+    PhSetEnabledProvider(&registration, TRUE);
+
+    PhStartProviderThread(&providerThread);
+    WaitForRunId(&registration, 2);
+
+    // The time during which the provider is disabled must not make its next run late.
+    PhSetEnabledProvider(&registration, FALSE);
+    WaitForRunId(&tickRegistration, tickRegistration.RunId + 20);
+    runId = registration.RunId;
+    PhSetEnabledProvider(&registration, TRUE);
+    WaitForRunId(&registration, runId + 2);
+
+    PhStopProviderThread(&providerThread);
+
+    assert(registration.LateRuns == 0);
+
+    PhUnregisterProvider(&tickRegistration);
+    PhUnregisterProvider(&registration);
+    PhDeleteProviderThread(&providerThread);
+}
+
+static VOID Test_budget(
+    VOID
+    )
+{
+    PH_PROVIDER_THREAD providerThread;
+    PH_PROVIDER_REGISTRATION registrations[2];
+    ULONG i;
+
+    // Only one of the providers fits in each tick, so they should take turns.
+    InitializeProviderThread(&providerThread);
+    PhSetBudgetProviderThread(&providerThread, 5000);
+
+    for (i = 0; i < 2; i++)
+    {
+        PhRegisterProvider(&providerThread, ExpensiveProviderUpdate, NULL, &registrations[i]);
+        PhSetScheduleProvider(&registrations[i], 0, 1000, 0);
+        PhSetEnabledProvider(&registrations[i], TRUE);
+    }
+
+    PhStartProviderThread(&providerThread);
+    WaitForRunId(&registrations[0], 4);
+    WaitForRunId(&registrations[1], 4);
+    PhStopProviderThread(&providerThread);
+
+    assert(registrations[0].RunId <= registrations[1].RunId + 1);
+    assert(registrations[1].RunId <= registrations[0].RunId + 1);
+
+    for (i = 0; i < 2; i++)
+    {
+        assert(registrations[i].SkippedRuns != 0);
+        assert(registrations[i].LateRuns == 0);
+        assert(registrations[i].Cost >= 5000);
+        PhUnregisterProvider(&registrations[i]);
+    }
+
+    PhDeleteProviderThread(&providerThread);
+}
+
+VOID Test_provider(
+    VOID
+    )
+{
+    Test_interval();
+    Test_reenable();
+    Test_budget();
+}
@@ -0,0 +1,161 @@
+#include "tests.h"
+
+#define ACQUIRES_PER_THREAD 100000
+#define NUMBER_OF_THREADS 4
+
+static PH_QUEUED_LOCK TestLock = PH_QUEUED_LOCK_INIT;
+static ULONG TestCounter;
+
+static NTSTATUS ContendThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < ACQUIRES_PER_THREAD; i++)
+    {
+        if (i % 4 != 0)
+        {
+            PhAcquireQueuedLockExclusive(&TestLock);
+            TestCounter++;
+            PhReleaseQueuedLockExclusive(&TestLock);
+        }
+        else
+        {
+            PhAcquireQueuedLockShared(&TestLock);
+            PhReleaseQueuedLockShared(&TestLock);
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static VOID Test_profile(
+    VOID
+    )
+{
+    static PH_QUEUED_LOCK unregisteredLock = PH_QUEUED_LOCK_INIT;
+    HANDLE threadHandles[NUMBER_OF_THREADS];
+    PH_QUEUED_LOCK_PROFILE profiles[4];
+    PPH_QUEUED_LOCK_PROFILE profile;
+    ULONG numberOfProfiles;
+    ULONG acquires;
+    ULONG i;
+
+    assert(PhRegisterQueuedLockProfile(&TestLock, L"TestLock"));
+    PhResetQueuedLockProfiles();
+    PhQueuedLockProfilingEnabled = TRUE;
+
+    for (i = 0; i < NUMBER_OF_THREADS; i++)
+        threadHandles[i] = PhCreateThread(0, ContendThreadStart, NULL);
+
+    for (i = 0; i < NUMBER_OF_THREADS; i++)
+    {
+        assert(threadHandles[i]);
+        NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+        NtClose(threadHandles[i]);
+    }
+
+    // Locks that are not registered still work.
+    PhAcquireQueuedLockExclusive(&unregisteredLock);
+    PhReleaseQueuedLockExclusive(&unregisteredLock);
+
+    PhQueuedLockProfilingEnabled = FALSE;
+
+    assert(TestCounter == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4 * 3);
+    assert(TestLock.Value == 0);
+    assert(unregisteredLock.Value == 0);
+
+    numberOfProfiles = PhQueryQueuedLockProfiles(profiles, 4);
+    profile = NULL;
+
+    for (i = 0; i < numberOfProfiles; i++)
+    {
+        if (profiles[i].Lock == &TestLock)
+            profile = &profiles[i];
+    }
+
+    assert(profile);
+    assert(PhEqualStringZ(profile->Name, L"TestLock", FALSE));
+    assert(profile->ExclusiveAcquireCount == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4 * 3);
+    assert(profile->SharedAcquireCount == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4);
+    assert(profile->OwnerTimestamp == 0);
+
+    // The two call sites in ContendThreadStart are counted separately.
+    acquires = 0;
+
+    for (i = 0; i < PH_QUEUED_LOCK_PROFILE_CALL_SITES; i++)
+    {
+        if (profile->CallSites[i].Address)
+        {
+            assert(
+                profile->CallSites[i].AcquireCount == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4 * 3 ||
+                profile->CallSites[i].AcquireCount == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4
+                );
+            acquires += profile->CallSites[i].AcquireCount;
+        }
+    }
+
+    assert(acquires == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS);
+
+    // Statistics can be reset while a lock is held.
+    PhQueuedLockProfilingEnabled = TRUE;
+    PhAcquireQueuedLockExclusive(&TestLock);
+    PhResetQueuedLockProfiles();
+    PhReleaseQueuedLockExclusive(&TestLock);
+    PhQueuedLockProfilingEnabled = FALSE;
+
+    PhResetQueuedLockProfiles();
+    numberOfProfiles = PhQueryQueuedLockProfiles(profiles, 4);
+
+    for (i = 0; i < numberOfProfiles; i++)
+        assert(profiles[i].ExclusiveAcquireCount == 0 && profiles[i].CallSites[0].AcquireCount == 0);
+}
+
+static VOID Test_spin(
+    VOID
+    )
+{
+    static ULONG spinFlags[] =
+    {
+        0,
+        PH_QUEUED_LOCK_SPIN_ADAPTIVE,
+        PH_QUEUED_LOCK_SPIN_ADAPTIVE | PH_QUEUED_LOCK_SPIN_BACKOFF
+    };
+    ULONG oldSpinFlags;
+    HANDLE threadHandles[NUMBER_OF_THREADS];
+    ULONG i;
+    ULONG j;
+
+    oldSpinFlags = PhQueuedLockSpinFlags;
+
+    // Every spin policy must preserve mutual exclusion.
+    for (i = 0; i < sizeof(spinFlags) / sizeof(ULONG); i++)
+    {
+        PhQueuedLockSpinFlags = spinFlags[i];
+        TestCounter = 0;
+
+        for (j = 0; j < NUMBER_OF_THREADS; j++)
+            threadHandles[j] = PhCreateThread(0, ContendThreadStart, NULL);
+
+        for (j = 0; j < NUMBER_OF_THREADS; j++)
+        {
+            assert(threadHandles[j]);
+            NtWaitForSingleObject(threadHandles[j], FALSE, NULL);
+            NtClose(threadHandles[j]);
+        }
+
+        assert(TestCounter == ACQUIRES_PER_THREAD * NUMBER_OF_THREADS / 4 * 3);
+        assert(TestLock.Value == 0);
+    }
+
+    PhQueuedLockSpinFlags = oldSpinFlags;
+}
+
+VOID Test_queuedlock(
+    VOID
+    )
+{
+    Test_profile();
+    Test_spin();
+}
@@ -0,0 +1,86 @@
+#include "tests.h"
+#include <phintrnl.h>
+
+static VOID Test_histogram(
+    VOID
+    )
+{
+    PH_STATISTICS_HISTOGRAM histogram;
+
+    memset(&histogram, 0, sizeof(PH_STATISTICS_HISTOGRAM));
+
+    PhAddLibStatisticsHistogram(&histogram, 0);
+    PhAddLibStatisticsHistogram(&histogram, 1);
+    PhAddLibStatisticsHistogram(&histogram, 2);
+    PhAddLibStatisticsHistogram(&histogram, 3);
+    PhAddLibStatisticsHistogram(&histogram, 1000);
+    PhAddLibStatisticsHistogram(&histogram, 0x80000000);
+    PhAddLibStatisticsHistogram(&histogram, 0x123456789);
+
+    assert(histogram.Buckets[0] == 2);
+    assert(histogram.Buckets[1] == 2);
+    assert(histogram.Buckets[9] == 1);
+    assert(histogram.Buckets[PH_STATISTICS_HISTOGRAM_BUCKETS - 1] == 2);
+}
+
+static NTSTATUS DummyWorkItem(
+    _In_ PVOID Parameter
+    )
+{
+    NtSetEvent(Parameter, NULL);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID Test_query(
+    VOID
+    )
+{
+    PHLIB_STATISTICS_BLOCK before;
+    PHLIB_STATISTICS_BLOCK after;
+    PH_WORK_QUEUE workQueue;
+    HANDLE eventHandle;
+    ULONG runs;
+    ULONG i;
+    PPH_STRING text;
+
+    PhQueryLibStatistics(&before);
+
+    NtCreateEvent(&eventHandle, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE);
+    PhInitializeWorkQueue(&workQueue, 0, 1, 1000);
+
+    for (i = 0; i < 10; i++)
+    {
+        PhQueueItemWorkQueue(&workQueue, DummyWorkItem, eventHandle);
+        NtWaitForSingleObject(eventHandle, FALSE, NULL);
+    }
+
+    PhDeleteWorkQueue(&workQueue);
+    NtClose(eventHandle);
+
+    PhQueryLibStatistics(&after);
+
+    // Updates made on every processor are counted.
+    assert(after.WqWorkItemsQueued - before.WqWorkItemsQueued >= 10);
+    assert(after.WqWorkQueueThreadsCreated - before.WqWorkQueueThreadsCreated >= 1);
+
+    runs = 0;
+
+    for (i = 0; i < PH_STATISTICS_HISTOGRAM_BUCKETS; i++)
+        runs += after.WqWorkItemRunTime.Buckets[i] - before.WqWorkItemRunTime.Buckets[i];
+
+    assert(runs >= 10);
+
+    text = PhFormatLibStatistics();
+    assert(PhFindStringInString(text, 0, L"\"WqWorkItemsQueued\": ") != -1);
+    assert(PhFindStringInString(text, 0, L"\"WqWorkItemRunTime\": [") != -1);
+    PhDereferenceObject(text);
+}
+
+VOID Test_stats(
+    VOID
+    )
+{
+    Test_histogram();
+    Test_query();
+}
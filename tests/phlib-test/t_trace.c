@@ -0,0 +1,85 @@
+#include "tests.h"
+
+typedef struct _RESOLVE_CONTEXT
+{
+    ULONG NumberOfCalls;
+} RESOLVE_CONTEXT, *PRESOLVE_CONTEXT;
+
+static PPH_STRING NTAPI ResolveCallback(
+    _In_ PVOID Address,
+    _In_opt_ PVOID Context
+    )
+{
+    PRESOLVE_CONTEXT context = Context;
+
+    context->NumberOfCalls++;
+
+    return PhFormatString(L"func%Iu", (ULONG_PTR)Address);
+}
+
+static ULONG CountOccurrences(
+    _In_ PPH_STRING String,
+    _In_ PWSTR SubString
+    )
+{
+    ULONG count = 0;
+    PWSTR position = String->Buffer;
+
+    while (position = wcsstr(position, SubString))
+    {
+        count++;
+        position++;
+    }
+
+    return count;
+}
+
+VOID Test_trace(
+    VOID
+    )
+{
+    RESOLVE_CONTEXT context;
+    PPH_STRING text;
+    ULONG64 startTime;
+    ULONG i;
+
+    // Spans are not recorded while tracing is disabled.
+    assert(PhBeginTraceSpan() == 0);
+
+    PhStartTrace();
+
+    startTime = PhBeginTraceSpan();
+    assert(startTime != 0);
+    PhEndTraceSpan(L"test", L"Span \"quoted\"", startTime);
+
+    for (i = 0; i < 10; i++)
+        PhRecordTraceSpan(L"test", NULL, (PVOID)(ULONG_PTR)(i % 2 + 1), PhBeginTraceSpan());
+
+    PhStopTrace();
+    PhEndTraceSpan(L"test", L"Dropped", ReadTimeStampCounter());
+
+    context.NumberOfCalls = 0;
+    text = PhExportTrace(ResolveCallback, &context);
+
+    // Each distinct address is resolved once.
+    assert(context.NumberOfCalls == 2);
+    assert(CountOccurrences(text, L"\"ph\":\"X\"") == 11);
+    assert(CountOccurrences(text, L"\"name\":\"Span \\\"quoted\\\"\"") == 1);
+    assert(CountOccurrences(text, L"\"name\":\"func1\"") == 5);
+    assert(CountOccurrences(text, L"\"name\":\"func2\"") == 5);
+    assert(CountOccurrences(text, L"Dropped") == 0);
+    PhDereferenceObject(text);
+
+    // Restarting the trace discards old spans, and the buffer keeps only the newest spans.
+    PhStartTrace();
+
+    for (i = 0; i < PH_TRACE_BUFFER_SIZE + 100; i++)
+        PhEndTraceSpan(L"test", L"Wrapped", PhBeginTraceSpan());
+
+    PhStopTrace();
+
+    text = PhExportTrace(NULL, NULL);
+    assert(CountOccurrences(text, L"\"ph\":\"X\"") == PH_TRACE_BUFFER_SIZE);
+    assert(CountOccurrences(text, L"Wrapped") == PH_TRACE_BUFFER_SIZE);
+    PhDereferenceObject(text);
+}
@@ -0,0 +1,465 @@
+#include "tests.h"
+
+// The fixtures below are an x64 image (headers, exception directory, unwind
+// information and code) and a recorded stack, both served to the unwinder through
+// a read callback.
+
+#define IMAGE_BASE 0x10000000
+#define IMAGE_SIZE 0x3000
+#define STACK_BASE 0x200000
+#define STACK_SIZE 0x4000
+
+#define FUNCTION_BASIC 0x2000 // push rbx; sub rsp, 20h
+#define FUNCTION_FRAME 0x2100 // push rbp; sub rsp, 1000h; lea rbp, [rsp+20h]; mov [rsp+18h], rsi
+#define FUNCTION_CHAINED_PARENT 0x2200 // push rdi; sub rsp, 28h
+#define FUNCTION_CHAINED 0x2240 // mov [rsp+20h], rsi
+#define FUNCTION_INDIRECT 0x2260 // shares the entry of FUNCTION_BASIC
+#define FUNCTION_MACHINE_FRAME 0x2280 // interrupt frame with an error code
+#define FUNCTION_LEAF 0x2300 // no function table entry
+
+typedef struct _FIXTURE_REGION
+{
+    ULONG64 Address;
+    SIZE_T Size;
+    PUCHAR Buffer;
+} FIXTURE_REGION, *PFIXTURE_REGION;
+
+typedef struct _FIXTURE_PROCESS
+{
+    ULONG NumberOfRegions;
+    FIXTURE_REGION Regions[2];
+    LONG NumberOfReads;
+} FIXTURE_PROCESS, *PFIXTURE_PROCESS;
+
+static UCHAR Image[IMAGE_SIZE];
+static UCHAR Stack[STACK_SIZE];
+static FIXTURE_PROCESS Process;
+
+static NTSTATUS NTAPI FixtureReadVirtualMemory(
+    _In_ HANDLE ProcessHandle,
+    _In_ PVOID BaseAddress,
+    _Out_writes_bytes_(BufferSize) PVOID Buffer,
+    _In_ SIZE_T BufferSize,
+    _Out_opt_ PSIZE_T NumberOfBytesRead
+    )
+{
+    PFIXTURE_PROCESS process = (PFIXTURE_PROCESS)ProcessHandle;
+    ULONG64 address = (ULONG64)BaseAddress;
+    SIZE_T size;
+    ULONG i;
+
+    _InterlockedIncrement(&process->NumberOfReads);
+
+    if (NumberOfBytesRead)
+        *NumberOfBytesRead = 0;
+
+    for (i = 0; i < process->NumberOfRegions; i++)
+    {
+        PFIXTURE_REGION region = &process->Regions[i];
+
+        if (address >= region->Address && address < region->Address + region->Size)
+        {
+            size = (SIZE_T)min(BufferSize, region->Address + region->Size - address);
+            memcpy(Buffer, region->Buffer + (address - region->Address), size);
+
+            if (NumberOfBytesRead)
+                *NumberOfBytesRead = size;
+
+            return size == BufferSize ? STATUS_SUCCESS : STATUS_PARTIAL_COPY;
+        }
+    }
+
+    return STATUS_ACCESS_VIOLATION;
+}
+
+static VOID PutBytes(
+    _In_ ULONG Rva,
+    _In_reads_bytes_(Length) PVOID Bytes,
+    _In_ ULONG Length
+    )
+{
+    memcpy(&Image[Rva], Bytes, Length);
+}
+
+static VOID PutFunction(
+    _In_ ULONG Index,
+    _In_ ULONG BeginAddress,
+    _In_ ULONG EndAddress,
+    _In_ ULONG UnwindData
+    )
+{
+    ULONG entry[3];
+
+    entry[0] = BeginAddress;
+    entry[1] = EndAddress;
+    entry[2] = UnwindData;
+    PutBytes(0x1000 + Index * sizeof(entry), entry, sizeof(entry));
+}
+
+static VOID BuildFixtures(
+    VOID
+    )
+{
+    static UCHAR basicInfo[] = { 0x01, 5, 2, 0x00, 5, 0x32, 1, 0x30 };
+    static UCHAR frameInfo[] = { 0x01, 18, 6, 0x25, 18, 0x64, 3, 0x00, 13, 0x03, 8, 0x01, 0x00, 0x02, 1, 0x50 };
+    static UCHAR chainedParentInfo[] = { 0x01, 5, 2, 0x00, 5, 0x42, 1, 0x70 };
+    static UCHAR chainedInfo[] = { 0x21, 0, 2, 0x00, 0, 0x64, 4, 0x00 };
+    static UCHAR machineFrameInfo[] = { 0x01, 0, 1, 0x00, 0, 0x1a, 0, 0 };
+    static UCHAR basicProlog[] = { 0x53, 0x48, 0x83, 0xec, 0x20 };
+    static UCHAR basicEpilog[] = { 0x48, 0x83, 0xc4, 0x20, 0x5b, 0xc3 };
+    static UCHAR chainedParentEpilog[] = { 0x48, 0x83, 0xc4, 0x28, 0x5f, 0xe9, 0xc0, 0xfd, 0xff, 0xff };
+    PIMAGE_DOS_HEADER dosHeader;
+    PIMAGE_NT_HEADERS64 ntHeaders;
+    ULONG chainedFunction[3];
+
+    memset(Image, 0, sizeof(Image));
+
+    dosHeader = (PIMAGE_DOS_HEADER)Image;
+    dosHeader->e_magic = IMAGE_DOS_SIGNATURE;
+    dosHeader->e_lfanew = 0x80;
+
+    ntHeaders = (PIMAGE_NT_HEADERS64)&Image[0x80];
+    ntHeaders->Signature = IMAGE_NT_SIGNATURE;
+    ntHeaders->FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+    ntHeaders->FileHeader.NumberOfSections = 0;
+    ntHeaders->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    ntHeaders->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    ntHeaders->OptionalHeader.ImageBase = IMAGE_BASE;
+    ntHeaders->OptionalHeader.SizeOfImage = IMAGE_SIZE;
+    ntHeaders->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION].VirtualAddress = 0x1000;
+    ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION].Size = 6 * 12;
+
+    PutFunction(0, FUNCTION_BASIC, FUNCTION_BASIC + 0x40, 0x1400);
+    PutFunction(1, FUNCTION_FRAME, FUNCTION_FRAME + 0x80, 0x1410);
+    PutFunction(2, FUNCTION_CHAINED_PARENT, FUNCTION_CHAINED_PARENT + 0x40, 0x1430);
+    PutFunction(3, FUNCTION_CHAINED, FUNCTION_CHAINED + 0x20, 0x1440);
+    PutFunction(4, FUNCTION_INDIRECT, FUNCTION_INDIRECT + 0x10, 0x1000 | 1);
+    PutFunction(5, FUNCTION_MACHINE_FRAME, FUNCTION_MACHINE_FRAME + 0x10, 0x1460);
+
+    PutBytes(0x1400, basicInfo, sizeof(basicInfo));
+    PutBytes(0x1410, frameInfo, sizeof(frameInfo));
+    PutBytes(0x1430, chainedParentInfo, sizeof(chainedParentInfo));
+    PutBytes(0x1440, chainedInfo, sizeof(chainedInfo));
+    chainedFunction[0] = FUNCTION_CHAINED_PARENT;
+    chainedFunction[1] = FUNCTION_CHAINED_PARENT + 0x40;
+    chainedFunction[2] = 0x1430;
+    PutBytes(0x1448, chainedFunction, sizeof(chainedFunction));
+    PutBytes(0x1460, machineFrameInfo, sizeof(machineFrameInfo));
+
+    memset(&Image[0x2000], 0x90, 0x400);
+    PutBytes(FUNCTION_BASIC, basicProlog, sizeof(basicProlog));
+    PutBytes(FUNCTION_BASIC + 0x3a, basicEpilog, sizeof(basicEpilog));
+    // The epilog of the parent ends with a tail call to FUNCTION_BASIC.
+    PutBytes(FUNCTION_CHAINED_PARENT + 0x36, chainedParentEpilog, sizeof(chainedParentEpilog));
+
+    memset(Stack, 0xcc, sizeof(Stack));
+
+    Process.NumberOfRegions = 2;
+    Process.Regions[0].Address = IMAGE_BASE;
+    Process.Regions[0].Size = IMAGE_SIZE;
+    Process.Regions[0].Buffer = Image;
+    Process.Regions[1].Address = STACK_BASE;
+    Process.Regions[1].Size = STACK_SIZE;
+    Process.Regions[1].Buffer = Stack;
+}
+
+static VOID PutStack(
+    _In_ ULONG64 Address,
+    _In_ ULONG64 Value
+    )
+{
+    *(PULONG64)&Stack[Address - STACK_BASE] = Value;
+}
+
+static PPH_UNWIND_CACHE CreateFixtureCache(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+
+    cache = PhCreateUnwindCache((HANDLE)&Process, FixtureReadVirtualMemory);
+    assert(cache);
+    assert(NT_SUCCESS(PhAddModuleUnwindCache(cache, IMAGE_BASE)));
+
+    return cache;
+}
+
+static NTSTATUS UnwindOnce(
+    _In_ PPH_UNWIND_CACHE Cache,
+    _In_ ULONG64 Rip,
+    _In_ ULONG64 Rsp,
+    _In_ ULONG64 Rbp,
+    _Out_ PPH_UNWIND_CONTEXT Result
+    )
+{
+    NTSTATUS status;
+    PH_UNWIND_CONTEXT context;
+    PH_UNWIND_STATE state;
+
+    memset(&context, 0, sizeof(PH_UNWIND_CONTEXT));
+    context.Rip = Rip;
+    context.Registers[PH_UNWIND_RSP] = Rsp;
+    context.Registers[PH_UNWIND_RBP] = Rbp;
+
+    PhInitializeUnwindState(&state, Cache, &context);
+    status = PhUnwindFrame(&state);
+    *Result = state.Context;
+    PhDeleteUnwindState(&state);
+
+    return status;
+}
+
+static VOID Test_prolog(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+    PH_UNWIND_CONTEXT result;
+    ULONG64 rsp = STACK_BASE + 0x100;
+
+    BuildFixtures();
+    cache = CreateFixtureCache();
+
+    PutStack(rsp + 0x20, 0x1111);
+    PutStack(rsp + 0x28, IMAGE_BASE + 0x5555);
+
+    // In the body, the whole prolog is reversed.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC + 0x10, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x5555);
+    assert(result.Registers[PH_UNWIND_RSP] == rsp + 0x30);
+    assert(result.Registers[3] == 0x1111); // rbx
+
+    // The same entry through an indirect function table entry.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_INDIRECT + 4, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x5555 && result.Registers[3] == 0x1111);
+
+    // After "push rbx" but before "sub rsp, 20h".
+    PutStack(rsp, 0x2222);
+    PutStack(rsp + 8, IMAGE_BASE + 0x6666);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC + 1, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x6666);
+    assert(result.Registers[PH_UNWIND_RSP] == rsp + 0x10);
+    assert(result.Registers[3] == 0x2222);
+
+    // At the first instruction.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC, rsp, 0, &result)));
+    assert(result.Rip == 0x2222 && result.Registers[PH_UNWIND_RSP] == rsp + 8 && result.Registers[3] == 0);
+
+    PhDereferenceObject(cache);
+}
+
+static VOID Test_framepointer(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+    PH_UNWIND_CONTEXT result;
+    ULONG64 frame = STACK_BASE + 0x1800; // the stack pointer after the prolog
+
+    BuildFixtures();
+    cache = CreateFixtureCache();
+
+    PutStack(frame + 0x18, 0x3333); // rsi
+    PutStack(frame + 0x1000, 0x4444); // rbp
+    PutStack(frame + 0x1008, IMAGE_BASE + 0x7777);
+
+    // The stack pointer has moved (e.g. by _alloca), so only the frame pointer can be
+    // used to find the saved registers.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_FRAME + 0x40, frame - 0x300, frame + 0x20, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x7777);
+    assert(result.Registers[PH_UNWIND_RSP] == frame + 0x1010);
+    assert(result.Registers[PH_UNWIND_RBP] == 0x4444);
+    assert(result.Registers[6] == 0x3333); // rsi
+
+    // After "lea rbp, [rsp+20h]" but before rsi is saved.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_FRAME + 13, frame, frame + 0x20, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x7777 && result.Registers[PH_UNWIND_RBP] == 0x4444);
+    assert(result.Registers[6] == 0);
+
+    // Before the frame pointer is set, the stack pointer is used.
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_FRAME + 8, frame, 0x9999, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x7777 && result.Registers[PH_UNWIND_RSP] == frame + 0x1010);
+    assert(result.Registers[PH_UNWIND_RBP] == 0x4444);
+
+    PhDereferenceObject(cache);
+}
+
+static VOID Test_epilog(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+    PH_UNWIND_CONTEXT result;
+    ULONG64 rsp = STACK_BASE + 0x100;
+
+    BuildFixtures();
+    cache = CreateFixtureCache();
+
+    PutStack(rsp + 0x20, 0x1111);
+    PutStack(rsp + 0x28, IMAGE_BASE + 0x5555);
+
+    // At "add rsp, 20h".
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC + 0x3a, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x5555 && result.Registers[PH_UNWIND_RSP] == rsp + 0x30);
+    assert(result.Registers[3] == 0x1111);
+
+    // At "pop rbx" and at "ret".
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC + 0x3e, rsp + 0x20, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x5555 && result.Registers[3] == 0x1111);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_BASIC + 0x3f, rsp + 0x28, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x5555 && result.Registers[PH_UNWIND_RSP] == rsp + 0x30);
+
+    // An epilog that ends with a tail call.
+    PutStack(rsp + 0x28, 0x5151);
+    PutStack(rsp + 0x30, IMAGE_BASE + 0x6161);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_CHAINED_PARENT + 0x36, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x6161 && result.Registers[PH_UNWIND_RSP] == rsp + 0x38);
+    assert(result.Registers[7] == 0x5151); // rdi
+
+    PhDereferenceObject(cache);
+}
+
+static VOID Test_special(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+    PH_UNWIND_CONTEXT result;
+    ULONG64 rsp = STACK_BASE + 0x100;
+
+    BuildFixtures();
+    cache = CreateFixtureCache();
+
+    // Chained unwind information.
+    PutStack(rsp + 0x20, 0x1212); // rsi
+    PutStack(rsp + 0x28, 0x1313); // rdi
+    PutStack(rsp + 0x30, IMAGE_BASE + 0x1414);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_CHAINED + 8, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x1414 && result.Registers[PH_UNWIND_RSP] == rsp + 0x38);
+    assert(result.Registers[6] == 0x1212 && result.Registers[7] == 0x1313);
+
+    // A machine frame with an error code.
+    PutStack(rsp + 8, IMAGE_BASE + 0x1515);
+    PutStack(rsp + 0x20, STACK_BASE + 0x2000);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_MACHINE_FRAME, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x1515 && result.Registers[PH_UNWIND_RSP] == STACK_BASE + 0x2000);
+
+    // A leaf function.
+    PutStack(rsp, IMAGE_BASE + 0x1616);
+    assert(NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_LEAF, rsp, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + 0x1616 && result.Registers[PH_UNWIND_RSP] == rsp + 8);
+
+    // An address outside any module, and a stack that cannot be read.
+    assert(UnwindOnce(cache, 0x50000000, rsp, 0, &result) == STATUS_NOT_FOUND);
+    assert(result.Rip == 0x50000000 && result.Registers[PH_UNWIND_RSP] == rsp);
+    assert(!NT_SUCCESS(UnwindOnce(cache, IMAGE_BASE + FUNCTION_LEAF, 0x10, 0, &result)));
+    assert(result.Rip == IMAGE_BASE + FUNCTION_LEAF);
+
+    PhDereferenceObject(cache);
+}
+
+// FUNCTION_BASIC, called from FUNCTION_CHAINED, called from FUNCTION_LEAF, called
+// from the thread start.
+static VOID BuildWalkFixture(
+    VOID
+    )
+{
+    ULONG64 rsp = STACK_BASE + 0x3f00;
+
+    PutStack(rsp + 0x20, 0x1111);
+    PutStack(rsp + 0x28, IMAGE_BASE + FUNCTION_CHAINED + 8);
+    rsp += 0x30;
+    PutStack(rsp + 0x20, 0x1212);
+    PutStack(rsp + 0x28, 0x1313);
+    PutStack(rsp + 0x30, IMAGE_BASE + FUNCTION_LEAF);
+    rsp += 0x38;
+    PutStack(rsp, 0);
+}
+
+static ULONG WalkFixture(
+    _In_ PPH_UNWIND_CACHE Cache
+    )
+{
+    static ULONG64 expectedRip[] = { IMAGE_BASE + FUNCTION_BASIC + 0x10, IMAGE_BASE + FUNCTION_CHAINED + 8, IMAGE_BASE + FUNCTION_LEAF, 0 };
+    PH_UNWIND_CONTEXT context;
+    PH_UNWIND_STATE state;
+    ULONG frames;
+
+    memset(&context, 0, sizeof(PH_UNWIND_CONTEXT));
+    context.Rip = expectedRip[0];
+    context.Registers[PH_UNWIND_RSP] = STACK_BASE + 0x3f00;
+
+    PhInitializeUnwindState(&state, Cache, &context);
+
+    for (frames = 0; state.Context.Rip != 0; frames++)
+    {
+        assert(state.Context.Rip == expectedRip[frames]);
+        assert(NT_SUCCESS(PhUnwindFrame(&state)));
+    }
+
+    assert(state.Context.Registers[3] == 0x1111);
+    assert(state.Context.Registers[6] == 0x1212 && state.Context.Registers[7] == 0x1313);
+    assert(state.Context.Registers[PH_UNWIND_RSP] == STACK_BASE + 0x3f00 + 0x70);
+
+    PhDeleteUnwindState(&state);
+
+    return frames;
+}
+
+static NTSTATUS WalkFixtureThreadStart(
+    _In_ PVOID Parameter
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < 1000; i++)
+        assert(WalkFixture(Parameter) == 3);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID Test_walk(
+    VOID
+    )
+{
+    PPH_UNWIND_CACHE cache;
+    HANDLE threadHandles[4];
+    LONG numberOfReads;
+    ULONG i;
+
+    BuildFixtures();
+    BuildWalkFixture();
+
+    // Once the unwind information is cached, a walk reads the stack in one piece, plus
+    // the code of the first frame to check for an epilog.
+    cache = CreateFixtureCache();
+    assert(WalkFixture(cache) == 3);
+    numberOfReads = Process.NumberOfReads;
+    assert(WalkFixture(cache) == 3);
+    assert(Process.NumberOfReads - numberOfReads == 2);
+
+    // Walk from several threads at once using the same cache.
+    for (i = 0; i < sizeof(threadHandles) / sizeof(HANDLE); i++)
+        threadHandles[i] = PhCreateThread(0, WalkFixtureThreadStart, cache);
+
+    for (i = 0; i < sizeof(threadHandles) / sizeof(HANDLE); i++)
+    {
+        assert(threadHandles[i]);
+        NtWaitForSingleObject(threadHandles[i], FALSE, NULL);
+        NtClose(threadHandles[i]);
+    }
+
+    PhDereferenceObject(cache);
+}
+
+VOID Test_unwind(
+    VOID
+    )
+{
+    Test_prolog();
+    Test_framepointer();
+    Test_epilog();
+    Test_special();
+    Test_walk();
+}
@@ -15,4 +15,40 @@ VOID Test_support(
     VOID
     );
 
+VOID Test_collect(
+    VOID
+    );
+
+VOID Test_kph(
+    VOID
+    );
+
+VOID Test_native(
+    VOID
+    );
+
+VOID Test_unwind(
+    VOID
+    );
+
+VOID Test_calltree(
+    VOID
+    );
+
+VOID Test_stats(
+    VOID
+    );
+
+VOID Test_queuedlock(
+    VOID
+    );
+
+VOID Test_trace(
+    VOID
+    );
+
+VOID Test_provider(
+    VOID
+    );
+
 #endif